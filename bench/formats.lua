@@ -0,0 +1,95 @@
+--
+-- formats.lua -- pixel access on formats packing several pixels per byte
+--
+-- Usage: lua formats.lua SDL.so
+--
+
+local sdlpath = ...
+
+if not sdlpath then
+	io.stderr:write("usage: formats.lua SDL.so\n")
+	os.exit(1)
+end
+
+package.preload["SDL"] = assert(package.loadlib(sdlpath, "luaopen_SDL"))
+
+local SDL = require "SDL"
+
+local width, height = 13, 5
+local failures = 0
+
+local function fail(fmt, ...)
+	io.stderr:write(string.format(fmt, ...), "\n")
+	failures = failures + 1
+end
+
+-- SDL reports one byte per pixel for those, bytes can not address them
+local subbyte = {
+	Index1LSB = 1,
+	Index1MSB = 1,
+	Index4LSB = 4,
+	Index4MSB = 4
+}
+
+local function calls(s)
+	return {
+		getRawPixel = function () return s:getRawPixel(width - 1, height - 1) end,
+		getPixels = function () return s:getPixels() end,
+		setPixels = function () return s:setPixels(nil, string.rep("\255", width * height)) end,
+		mapPixels = function () return s:mapPixels(function () return 1 end) end,
+		mapPixelsRGBA = function () return s:mapPixelsRGBA(function () end) end,
+		getView = function () return s:getView() end
+	}
+end
+
+for name, depth in pairs(subbyte) do
+	local s = assert(SDL.createRGBSurfaceWithFormat(width, height, depth, SDL.pixelFormat[name]))
+
+	for method, f in pairs(calls(s)) do
+		local ok, err = pcall(f)
+
+		if ok then
+			fail("%s: %s accepted a sub-byte surface", name, method)
+		elseif not tostring(err):find("8 bits per pixel", 1, true) then
+			fail("%s: %s: unexpected error: %s", name, method, tostring(err))
+		end
+	end
+
+	-- Surface:diff returns the error instead of raising it
+	local other = assert(SDL.createRGBSurfaceWithFormat(width, height, depth, SDL.pixelFormat[name]))
+	local rects, err = s:diff(other)
+
+	if rects ~= nil then
+		fail("%s: diff accepted a sub-byte surface", name)
+	elseif not tostring(err):find("8 bits per pixel", 1, true) then
+		fail("%s: diff: unexpected error: %s", name, tostring(err))
+	end
+end
+
+-- A byte per pixel still works
+local s = assert(SDL.createRGBSurfaceWithFormat(width, height, 8, SDL.pixelFormat.Index8))
+
+for method, f in pairs(calls(s)) do
+	local ok, err = pcall(f)
+
+	if not ok or err == nil then
+		fail("Index8: %s failed: %s", method, tostring(err))
+	end
+end
+
+if #s:getPixels() ~= width * height then
+	fail("Index8: getPixels returned %d bytes", #s:getPixels())
+end
+
+local other = assert(SDL.createRGBSurfaceWithFormat(width, height, 8, SDL.pixelFormat.Index8))
+local rects, changed = other:diff(s)
+
+if rects == nil or changed ~= width * height then
+	fail("Index8: diff found %s changed pixels", tostring(changed))
+end
+
+print(string.format("sub-byte formats: %d failures", failures))
+
+if failures > 0 then
+	os.exit(1)
+end
@@ -0,0 +1,334 @@
+--
+-- net.lua -- loopback benchmarks for SDL.net
+--
+-- Usage: lua net.lua SDL.so net.so [output.json]
+--
+-- Everything runs in one thread over 127.0.0.1, the results are printed as
+-- JSON and also written to output.json if given.
+--
+
+local sdlpath, netpath, output = ...
+
+if not sdlpath or not netpath then
+	io.stderr:write("usage: net.lua SDL.so net.so [output.json]\n")
+	os.exit(1)
+end
+
+package.preload["SDL"] = assert(package.loadlib(sdlpath, "luaopen_SDL"))
+package.preload["SDL.net"] = assert(package.loadlib(netpath, "luaopen_SDL_net"))
+
+local SDL	= require "SDL"
+local net	= require "SDL.net"
+
+assert(net.init())
+
+local frequency = SDL.getPerformanceFrequency()
+
+local function now()
+	return SDL.getPerformanceCounter() / frequency
+end
+
+local function percentile(samples, p)
+	table.sort(samples)
+
+	local index = math.max(1, math.ceil(#samples * p))
+
+	return samples[index]
+end
+
+-- Minimal JSON encoder, enough for numbers, strings and tables.
+local function encode(value, indent)
+	indent = indent or ""
+
+	local t = type(value)
+
+	if t == "number" then
+		return string.format("%.6g", value)
+	elseif t == "string" then
+		return string.format("%q", value)
+	elseif t == "boolean" then
+		return tostring(value)
+	elseif t ~= "table" then
+		return "null"
+	end
+
+	local inner = indent .. "  "
+	local parts = { }
+
+	if #value > 0 then
+		for _, v in ipairs(value) do
+			parts[#parts + 1] = inner .. encode(v, inner)
+		end
+
+		return "[\n" .. table.concat(parts, ",\n") .. "\n" .. indent .. "]"
+	end
+
+	local keys = { }
+
+	for k in pairs(value) do
+		keys[#keys + 1] = k
+	end
+
+	table.sort(keys)
+
+	for _, k in ipairs(keys) do
+		parts[#parts + 1] = inner .. string.format("%q", k) .. ": " .. encode(value[k], inner)
+	end
+
+	return "{\n" .. table.concat(parts, ",\n") .. "\n" .. indent .. "}"
+end
+
+-- Open a listening socket on the first port available and connect to it.
+local function tcpPair()
+	for port = 47000, 47100 do
+		local server = net.openTcp(net.resolveHost(nil, port))
+
+		if server then
+			local client = assert(net.openTcp(net.resolveHost("127.0.0.1", port)))
+			local peer = assert(server:accept())
+
+			return server, client, peer
+		end
+	end
+
+	error("no port available")
+end
+
+local function udpAddress(s)
+	local addr = assert(s:getPeerAddress(-1))
+
+	addr.host = net.resolveHost("127.0.0.1", 0).host
+
+	return addr
+end
+
+-- TCP bulk transfer, raw recv() against framed recvMessage().
+local function benchTcpBulk(total, chunk)
+	local server, client, peer = tcpPair()
+	local data = string.rep("x", chunk)
+	local results = { }
+
+	-- Raw, the reader concatenates like protocol code would
+	local start = now()
+	local received = 0
+
+	while received < total do
+		assert(client:send(data) == chunk)
+
+		local parts, got = { }, 0
+
+		while got < chunk do
+			local s, n = peer:recv(chunk - got)
+
+			assert(s, n)
+			parts[#parts + 1] = s
+			got = got + n
+		end
+
+		received = received + #table.concat(parts)
+	end
+
+	results.raw = total / (now() - start) / (1024 * 1024)
+
+	-- Framed
+	start = now()
+	received = 0
+
+	while received < total do
+		assert(client:sendMessage(data))
+		received = received + #assert(peer:recvMessage())
+	end
+
+	results.framed = total / (now() - start) / (1024 * 1024)
+	results.bytes = total
+	results.chunk = chunk
+
+	client:close()
+	peer:close()
+	server:close()
+
+	return results
+end
+
+-- TCP request / response round trips with small framed messages.
+local function benchTcpLatency(count, size)
+	local server, client, peer = tcpPair()
+	local data = string.rep("r", size)
+	local samples = { }
+
+	for i = 1, count do
+		local start = now()
+
+		assert(client:sendMessage(data))
+		assert(peer:sendMessage(assert(peer:recvMessage())))
+		assert(client:recvMessage())
+
+		samples[i] = (now() - start) * 1e6
+	end
+
+	client:close()
+	peer:close()
+	server:close()
+
+	return {
+		count	= count,
+		size	= size,
+		p50_us	= percentile(samples, 0.50),
+		p99_us	= percentile(samples, 0.99)
+	}
+end
+
+-- UDP packets per second, one send/recv per packet against batches.
+local function benchUdp(size, count, batch)
+	local sender = assert(net.openUdp(0))
+	local receiver = assert(net.openUdp(0))
+	local addr = udpAddress(receiver)
+	local data = string.rep("u", size)
+	local payloads, addresses = { }, { }
+	local outgoing = { }
+	local result = { size = size }
+
+	for i = 1, batch do
+		outgoing[i] = data
+	end
+
+	local function drain(expected, many)
+		local got, deadline = 0, now() + 1
+
+		while got < expected and now() < deadline do
+			if many then
+				local n = receiver:recvMany(batch, payloads, addresses, size)
+
+				got = got + n
+			else
+				local s = receiver:recv(size)
+
+				if s then
+					got = got + 1
+				end
+			end
+		end
+
+		return got
+	end
+
+	-- Single packets
+	local start, received = now(), 0
+
+	for _ = 1, count / batch do
+		for _ = 1, batch do
+			sender:send(data, addr)
+		end
+
+		received = received + drain(batch, false)
+	end
+
+	result.single_pps = received / (now() - start)
+
+	-- Batches
+	start, received = now(), 0
+
+	for _ = 1, count / batch do
+		sender:sendMany(outgoing, addr)
+		received = received + drain(batch, true)
+	end
+
+	result.batched_pps = received / (now() - start)
+
+	sender:close()
+	receiver:close()
+
+	return result
+end
+
+-- Cost of checkSockets() then ready() on every socket, against the poller.
+local function benchSets(count, rounds)
+	local sockets = { }
+	local set = net.set(count)
+	local result = { sockets = count }
+	local poller = net.createPoller()
+
+	for i = 1, count do
+		sockets[i] = assert(net.openUdp(0))
+		set:add(sockets[i])
+
+		if poller then
+			poller:add(sockets[i])
+		end
+	end
+
+	-- One socket always has a pending datagram
+	local target = sockets[count]
+	local sender = assert(net.openUdp(0))
+
+	sender:send("p", udpAddress(target))
+	SDL.delay(10)
+
+	local start = now()
+
+	for _ = 1, rounds do
+		set:checkSockets(0)
+
+		for i = 1, count do
+			sockets[i]:ready()
+		end
+	end
+
+	result.checkSockets_us = (now() - start) / rounds * 1e6
+
+	if poller then
+		local ready = { }
+
+		start = now()
+
+		for _ = 1, rounds do
+			poller:wait(0, ready)
+		end
+
+		result.poller_us = (now() - start) / rounds * 1e6
+	end
+
+	for i = 1, count do
+		sockets[i]:close()
+	end
+
+	sender:close()
+
+	return result
+end
+
+local results = {
+	tcp_bulk	= { },
+	tcp_latency	= { },
+	udp		= { },
+	sets		= { }
+}
+
+for _, chunk in ipairs { 1024, 16384, 65536 } do
+	table.insert(results.tcp_bulk, benchTcpBulk(64 * 1024 * 1024, chunk))
+end
+
+for _, size in ipairs { 16, 256, 4096 } do
+	table.insert(results.tcp_latency, benchTcpLatency(10000, size))
+end
+
+for _, size in ipairs { 32, 256, 1024 } do
+	table.insert(results.udp, benchUdp(size, 64 * 1024, 64))
+end
+
+for _, count in ipairs { 16, 64, 256, 512 } do
+	table.insert(results.sets, benchSets(count, 1000))
+end
+
+net.quit()
+
+local json = encode(results)
+
+print(json)
+
+if output then
+	local file = assert(io.open(output, "w"))
+
+	file:write(json, "\n")
+	file:close()
+end
@@ -0,0 +1,104 @@
+--
+-- pack.lua -- SDL.pack against a plain Lua serializer
+--
+-- Usage: lua pack.lua SDL.so [output.json]
+--
+
+local sdlpath, output = ...
+
+if not sdlpath then
+	io.stderr:write("usage: pack.lua SDL.so [output.json]\n")
+	os.exit(1)
+end
+
+package.preload["SDL"] = assert(package.loadlib(sdlpath, "luaopen_SDL"))
+
+local SDL = require "SDL"
+
+local frequency = SDL.getPerformanceFrequency()
+
+local function now()
+	return SDL.getPerformanceCounter() / frequency
+end
+
+-- The kind of serializer games write by hand, table.concat of fields
+local function serialize(value, out)
+	local t = type(value)
+
+	if t == "table" then
+		out[#out + 1] = "{"
+
+		for k, v in pairs(value) do
+			out[#out + 1] = "["
+			serialize(k, out)
+			out[#out + 1] = "]="
+			serialize(v, out)
+			out[#out + 1] = ","
+		end
+
+		out[#out + 1] = "}"
+	elseif t == "string" then
+		out[#out + 1] = string.format("%q", value)
+	else
+		out[#out + 1] = tostring(value)
+	end
+
+	return out
+end
+
+-- A world snapshot, the usual network payload
+local snapshot = { tick = 1234, entities = { } }
+
+for i = 1, 200 do
+	snapshot.entities[i] = {
+		id	= i,
+		kind	= (i % 3 == 0) and "enemy" or "prop",
+		x	= i * 1.5,
+		y	= i * -0.25,
+		health	= 100 - i % 100,
+		alive	= true
+	}
+end
+
+local function measure(count, f)
+	local start = now()
+
+	for _ = 1, count do
+		f()
+	end
+
+	return (now() - start) / count * 1e6
+end
+
+local packed = assert(SDL.pack(snapshot))
+local lua = table.concat(serialize(snapshot, { }))
+
+local results = {
+	pack_us		= measure(2000, function () SDL.pack(snapshot) end),
+	unpack_us	= measure(2000, function () SDL.unpack(packed) end),
+	lua_us		= measure(2000, function () table.concat(serialize(snapshot, { })) end),
+	pack_bytes	= #packed,
+	lua_bytes	= #lua
+}
+
+results.speedup = results.lua_us / results.pack_us
+
+local json = string.format([[
+{
+  "lua_bytes": %d,
+  "lua_us": %.3f,
+  "pack_bytes": %d,
+  "pack_us": %.3f,
+  "speedup": %.2f,
+  "unpack_us": %.3f
+}]], results.lua_bytes, results.lua_us, results.pack_bytes,
+    results.pack_us, results.speedup, results.unpack_us)
+
+print(json)
+
+if output then
+	local file = assert(io.open(output, "w"))
+
+	file:write(json, "\n")
+	file:close()
+end
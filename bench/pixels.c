@@ -0,0 +1,405 @@
+/*
+ * pixels.c -- check the vector kernels against the scalar ones
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Plain main, SDL is only used for the CPU checks */
+#define SDL_MAIN_HANDLED
+
+/*
+ * The backend selection is static, include the kernels to force every
+ * backend the compiler and the CPU support in turn. The scalar backend is
+ * the reference.
+ */
+#include "common/pixels.c"
+
+/* Long enough for several vector iterations and every tail length */
+#define MAXLEN		1100
+
+/* Resampled images, in pixels */
+#define MAXSIZE		48
+
+typedef void (*Kernel)(Uint32 *, size_t, const void *);
+
+static const struct {
+	const char	*name;
+	enum backend	 backend;
+} backends[] = {
+#if defined(PIXELS_SSE2)
+	{ "SSE2",	BackendSSE2	},
+#endif
+#if defined(PIXELS_AVX2)
+	{ "AVX2",	BackendAVX2	},
+#endif
+#if defined(PIXELS_NEON)
+	{ "NEON",	BackendNEON	},
+#endif
+	{ NULL,		BackendScalar	}
+};
+
+static const size_t lengths[] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17,
+	23, 24, 25, 31, 32, 33, 63, 64, 65, 255, 256, 257, 1021, 1024, 1031
+};
+
+static Uint32 seed = 0x9e3779b9U;
+static int checks;
+static int failures;
+
+/*
+ * xorshift32, the sequence is the same on every run.
+ */
+static Uint32
+random32(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+/*
+ * Random pixels with the extreme byte values mixed in, they are the ones
+ * where rounding and saturation go wrong.
+ */
+static void
+randomPixels(Uint32 *p, size_t n)
+{
+	static const Uint32 extremes[] = {
+		0x00000000U, 0xffffffffU, 0xff000000U, 0x000000ffU,
+		0x00ff00ffU, 0xff00ff00U, 0x80808080U, 0x7f7f7f7fU
+	};
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		if (random32() % 5 == 0)
+			p[i] = extremes[random32() % SDL_arraysize(extremes)];
+		else
+			p[i] = random32();
+	}
+}
+
+static int
+available(enum backend b)
+{
+	switch (b) {
+#if defined(PIXELS_SSE2)
+	case BackendSSE2:
+		return SDL_HasSSE2();
+#endif
+#if defined(PIXELS_AVX2)
+	case BackendAVX2:
+		return SDL_HasAVX2();
+#endif
+#if defined(PIXELS_NEON)
+	case BackendNEON:
+		return SDL_HasNEON();
+#endif
+	default:
+		return 0;
+	}
+}
+
+static void
+fail(const char *kernel, int b, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "%s (%s): ", kernel, backends[b].name);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+
+	++ failures;
+}
+
+/* --------------------------------------------------------
+ * In place kernels
+ * -------------------------------------------------------- */
+
+static void
+kernelMultiply(Uint32 *p, size_t n, const void *arg)
+{
+	pixelsMultiply(p, n, *(const Uint32 *)arg);
+}
+
+static void
+kernelPremultiply(Uint32 *p, size_t n, const void *arg)
+{
+	pixelsPremultiply(p, n, arg);
+}
+
+static void
+kernelGrayscale(Uint32 *p, size_t n, const void *arg)
+{
+	pixelsGrayscale(p, n, arg);
+}
+
+static void
+kernelSwizzle(Uint32 *p, size_t n, const void *arg)
+{
+	pixelsSwizzle(p, n, arg);
+}
+
+static void
+checkKernel(const char *kernel, Kernel k, const void *arg, const Uint32 *src, size_t n)
+{
+	static Uint32 expected[MAXLEN], got[MAXLEN];
+	size_t i;
+	int b;
+
+	memcpy(expected, src, n * sizeof (Uint32));
+	selected = BackendScalar;
+	k(expected, n, arg);
+
+	for (b = 0; backends[b].name != NULL; ++b) {
+		if (!available(backends[b].backend))
+			continue;
+
+		memcpy(got, src, n * sizeof (Uint32));
+		selected = backends[b].backend;
+		k(got, n, arg);
+		++ checks;
+
+		for (i = 0; i < n; ++i) {
+			if (got[i] != expected[i]) {
+				fail(kernel, b, "length %u, pixel %u: %08x instead of %08x",
+				    (unsigned)n, (unsigned)i, got[i], expected[i]);
+				break;
+			}
+		}
+	}
+}
+
+static void
+checkDiff(const Uint32 *a, size_t n, Uint32 mask)
+{
+	static Uint32 other[MAXLEN];
+	size_t i, expected, got;
+	int b;
+
+	/* About a quarter of the pixels change, some outside of the mask */
+	for (i = 0; i < n; ++i) {
+		other[i] = a[i];
+
+		if (random32() % 4 == 0)
+			other[i] ^= 1U << (random32() % 32);
+	}
+
+	selected = BackendScalar;
+	expected = pixelsDiff(a, other, n, mask);
+
+	for (b = 0; backends[b].name != NULL; ++b) {
+		if (!available(backends[b].backend))
+			continue;
+
+		selected = backends[b].backend;
+		got = pixelsDiff(a, other, n, mask);
+		++ checks;
+
+		if (got != expected)
+			fail("diff", b, "length %u, mask %08x: %u instead of %u",
+			    (unsigned)n, mask, (unsigned)got, (unsigned)expected);
+	}
+}
+
+/* --------------------------------------------------------
+ * Resampling
+ * -------------------------------------------------------- */
+
+/*
+ * The destination rows are padded, the padding must be left alone.
+ */
+static void
+checkResize(int sw, int sh, int dw, int dh, PixelFilter filter)
+{
+	static Uint32 src[MAXSIZE * (MAXSIZE + 3)];
+	static Uint32 expected[MAXSIZE * (MAXSIZE + 3)], got[MAXSIZE * (MAXSIZE + 3)];
+	int spitch = (sw + 3) * 4, dpitch = (dw + 3) * 4, b, i;
+
+	randomPixels(src, (size_t)sh * (sw + 3));
+
+	memset(expected, 0xa5, sizeof (expected));
+	selected = BackendScalar;
+	if (pixelsResize(src, sw, sh, spitch, expected, dw, dh, dpitch, filter) < 0) {
+		fprintf(stderr, "resize: %s\n", SDL_GetError());
+		++ failures;
+		return;
+	}
+
+	for (b = 0; backends[b].name != NULL; ++b) {
+		if (!available(backends[b].backend))
+			continue;
+
+		memset(got, 0xa5, sizeof (got));
+		selected = backends[b].backend;
+		pixelsResize(src, sw, sh, spitch, got, dw, dh, dpitch, filter);
+		++ checks;
+
+		for (i = 0; i < dh * (dw + 3); ++i) {
+			if (got[i] != expected[i]) {
+				fail("resize", b, "%dx%d to %dx%d, filter %d, pixel %d",
+				    sw, sh, dw, dh, filter, i);
+				break;
+			}
+		}
+	}
+}
+
+static void
+checkHalve(int sw, int sh)
+{
+	static Uint32 src[MAXSIZE * (MAXSIZE + 3)];
+	static Uint32 expected[MAXSIZE * (MAXSIZE + 3)], got[MAXSIZE * (MAXSIZE + 3)];
+	int dw = (sw > 1) ? sw / 2 : 1, dh = (sh > 1) ? sh / 2 : 1;
+	int spitch = (sw + 3) * 4, dpitch = (dw + 3) * 4, b, i;
+
+	randomPixels(src, (size_t)sh * (sw + 3));
+
+	memset(expected, 0xa5, sizeof (expected));
+	selected = BackendScalar;
+	pixelsHalve(src, sw, sh, spitch, expected, dpitch);
+
+	for (b = 0; backends[b].name != NULL; ++b) {
+		if (!available(backends[b].backend))
+			continue;
+
+		memset(got, 0xa5, sizeof (got));
+		selected = backends[b].backend;
+		pixelsHalve(src, sw, sh, spitch, got, dpitch);
+		++ checks;
+
+		for (i = 0; i < dh * (dw + 3); ++i) {
+			if (got[i] != expected[i]) {
+				fail("halve", b, "%dx%d, pixel %d", sw, sh, i);
+				break;
+			}
+		}
+	}
+}
+
+/* --------------------------------------------------------
+ * Main
+ * -------------------------------------------------------- */
+
+/*
+ * Every order of the four bytes, with and without alpha.
+ */
+static int
+nextLayout(PixelLayout *layout, int index)
+{
+	int shifts[4] = { 0, 8, 16, 24 }, order = index / 2, i, j, tmp;
+
+	if (index >= 48)
+		return 0;
+
+	/* Pick the permutation number order, one position at a time */
+	for (i = 0; i < 4; ++i) {
+		int f = 1;
+
+		for (j = 1; j < 4 - i; ++j)
+			f *= j;
+
+		j = i + order / f;
+		order %= f;
+
+		tmp = shifts[j];
+		memmove(&shifts[i + 1], &shifts[i], (j - i) * sizeof (int));
+		shifts[i] = tmp;
+	}
+
+	layout->r = shifts[0];
+	layout->g = shifts[1];
+	layout->b = shifts[2];
+	layout->a = shifts[3];
+	layout->hasalpha = index % 2;
+
+	return 1;
+}
+
+int
+main(void)
+{
+	static Uint32 src[MAXLEN];
+	static const PixelFilter filters[] = {
+		PixelFilterBox, PixelFilterBilinear, PixelFilterLanczos
+	};
+	PixelLayout layout;
+	Uint32 factor;
+	size_t l;
+	int index, from[4], b, f, i;
+
+	printf("pixels: reference scalar, checking");
+	for (b = 0; backends[b].name != NULL; ++b)
+		if (available(backends[b].backend))
+			printf(" %s", backends[b].name);
+	printf("\n");
+
+	for (index = 0; nextLayout(&layout, index); ++index) {
+		from[0] = layout.r;
+		from[1] = layout.g;
+		from[2] = layout.b;
+		from[3] = layout.a;
+
+		for (l = 0; l < SDL_arraysize(lengths); ++l) {
+			randomPixels(src, lengths[l]);
+			factor = random32();
+
+			checkKernel("multiply", kernelMultiply, &factor, src, lengths[l]);
+			checkKernel("grayscale", kernelGrayscale, &layout, src, lengths[l]);
+			checkKernel("swizzle", kernelSwizzle, from, src, lengths[l]);
+
+			if (layout.hasalpha)
+				checkKernel("premultiply", kernelPremultiply, &layout, src, lengths[l]);
+
+			checkDiff(src, lengths[l], 0xffffffffU);
+			checkDiff(src, lengths[l], colorMask(&layout));
+		}
+	}
+
+	/* Swizzles which duplicate bytes */
+	for (i = 0; i < 64; ++i) {
+		for (b = 0; b < 4; ++b)
+			from[b] = (random32() % 4) * 8;
+
+		randomPixels(src, 1031);
+		checkKernel("swizzle", kernelSwizzle, from, src, 1031);
+	}
+
+	for (f = 0; f < (int)SDL_arraysize(filters); ++f)
+		for (i = 0; i < 200; ++i)
+			checkResize(1 + random32() % MAXSIZE, 1 + random32() % MAXSIZE,
+			    1 + random32() % MAXSIZE, 1 + random32() % MAXSIZE,
+			    filters[f]);
+
+	for (i = 0; i < 200; ++i) {
+		int sw = (random32() % 8 == 0) ? 1 : 2 * (1 + random32() % (MAXSIZE / 2));
+		int sh = (random32() % 8 == 0) ? 1 : 2 * (1 + random32() % (MAXSIZE / 2));
+
+		checkHalve(sw, sh);
+	}
+
+	printf("pixels: %d checks, %d failures\n", checks, failures);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+--
+-- surface.lua -- banded blits and conversions against the single threaded ones
+--
+-- Usage: lua surface.lua SDL.so [output.json] [size]
+--
+
+local sdlpath, output, size = ...
+
+if not sdlpath then
+	io.stderr:write("usage: surface.lua SDL.so [output.json] [size]\n")
+	os.exit(1)
+end
+
+package.preload["SDL"] = assert(package.loadlib(sdlpath, "luaopen_SDL"))
+
+local SDL = require "SDL"
+
+local frequency = SDL.getPerformanceFrequency()
+local size = tonumber(size) or 4096
+local threads = SDL.getCPUCount()
+
+local function now()
+	return SDL.getPerformanceCounter() / frequency
+end
+
+local function measure(count, f)
+	local start = now()
+
+	for _ = 1, count do
+		f()
+	end
+
+	return (now() - start) / count * 1e3
+end
+
+-- A noisy atlas with alpha so the blend path is taken
+local atlas = assert(SDL.createRGBSurface(size, size))
+
+atlas:mapPixels(function (x, y)
+	return (x * 2654435761 + y * 40503) % 0x100000000
+end)
+atlas:setBlendMode(SDL.blendMode.Blend)
+
+local function canvas()
+	local s = assert(SDL.createRGBSurface(size, size))
+
+	s:fillRect(nil, 0x80204060)
+
+	return s
+end
+
+local results = { size = size, threads = threads }
+
+-- Alpha blended blit
+local a, b = canvas(), canvas()
+
+assert(atlas:blit(a))
+assert(atlas:blitParallel(b))
+results.blit_equal = a:getPixels() == b:getPixels()
+results.blit_ms = measure(5, function () atlas:blit(a) end)
+results.blit_parallel_ms = measure(5, function () atlas:blitParallel(b, nil, nil, threads) end)
+results.blit_speedup = results.blit_ms / results.blit_parallel_ms
+
+-- Conversion to a swapped byte order
+local format = SDL.pixelFormat.BGRA8888
+local c = assert(atlas:convertFormat(format))
+local d = assert(atlas:convertFormatParallel(format, threads))
+
+results.convert_equal = c:getPixels() == d:getPixels()
+results.convert_ms = measure(5, function () atlas:convertFormat(format) end)
+results.convert_parallel_ms = measure(5, function () atlas:convertFormatParallel(format, threads) end)
+results.convert_speedup = results.convert_ms / results.convert_parallel_ms
+
+local json = string.format([[
+{
+  "blit_equal": %s,
+  "blit_ms": %.3f,
+  "blit_parallel_ms": %.3f,
+  "blit_speedup": %.2f,
+  "convert_equal": %s,
+  "convert_ms": %.3f,
+  "convert_parallel_ms": %.3f,
+  "convert_speedup": %.2f,
+  "size": %d,
+  "threads": %d
+}]], tostring(results.blit_equal), results.blit_ms, results.blit_parallel_ms,
+    results.blit_speedup, tostring(results.convert_equal), results.convert_ms,
+    results.convert_parallel_ms, results.convert_speedup, results.size,
+    results.threads)
+
+print(json)
+
+if output then
+	local file = assert(io.open(output, "w"))
+
+	file:write(json, "\n")
+	file:close()
+end
+
+if not results.blit_equal or not results.convert_equal then
+	io.stderr:write("parallel results differ from the single threaded ones\n")
+	os.exit(1)
+end
@@ -0,0 +1,387 @@
+/*
+ * blit.c -- blits and conversions split in bands over a worker pool
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "blit.h"
+
+/*
+ * Smaller bands cost more in scheduling than they save.
+ */
+#define BLIT_MINROWS	32
+
+#define BLIT_ERRLEN	128
+
+typedef struct batch {
+	SDL_mutex	*mutex;
+	SDL_cond	*cond;
+	int		 pending;
+} Batch;
+
+/*
+ * One band of rows. SDL keeps the blit state in the source surface so
+ * every band blits from its own surface sharing the source pixels.
+ */
+typedef struct band {
+	Batch		*batch;
+
+	/* Blits */
+	SDL_Surface	*src;
+	SDL_Surface	*dst;
+	SDL_Rect	 srcrect;
+	SDL_Rect	 dstrect;
+
+	/* Conversions */
+	int		 width;
+	int		 height;
+	Uint32		 srcformat;
+	const void	*srcpixels;
+	int		 srcpitch;
+	Uint32		 dstformat;
+	void		*dstpixels;
+	int		 dstpitch;
+
+	int		 failed;
+	char		 error[BLIT_ERRLEN];
+} Band;
+
+static void
+bandDone(Band *band, int ret)
+{
+	if (ret < 0) {
+		band->failed = 1;
+		SDL_strlcpy(band->error, SDL_GetError(), sizeof (band->error));
+	}
+
+	/* Signaled with the lock held, the batch is gone right after */
+	SDL_LockMutex(band->batch->mutex);
+	-- band->batch->pending;
+	SDL_CondSignal(band->batch->cond);
+	SDL_UnlockMutex(band->batch->mutex);
+}
+
+static void
+bandBlit(Band *band)
+{
+	bandDone(band, SDL_LowerBlit(band->src, &band->srcrect, band->dst, &band->dstrect));
+}
+
+static void
+bandConvert(Band *band)
+{
+	bandDone(band, SDL_ConvertPixels(band->width, band->height,
+	    band->srcformat, band->srcpixels, band->srcpitch,
+	    band->dstformat, band->dstpixels, band->dstpitch));
+}
+
+/*
+ * Run every band and wait for them, the bands that can not be queued run
+ * in the calling thread.
+ */
+static int
+batchRun(WorkerPool *pool, Band *bands, int count, WorkerFunc run)
+{
+	Batch batch;
+	int i;
+
+	if ((batch.mutex = SDL_CreateMutex()) == NULL)
+		return -1;
+	if ((batch.cond = SDL_CreateCond()) == NULL) {
+		SDL_DestroyMutex(batch.mutex);
+		return -1;
+	}
+
+	batch.pending = count;
+
+	for (i = 0; i < count; ++i) {
+		bands[i].batch = &batch;
+
+		if (workerPush(pool, run, &bands[i]) < 0)
+			run(&bands[i]);
+	}
+
+	SDL_LockMutex(batch.mutex);
+	while (batch.pending > 0)
+		SDL_CondWait(batch.cond, batch.mutex);
+	SDL_UnlockMutex(batch.mutex);
+
+	SDL_DestroyCond(batch.cond);
+	SDL_DestroyMutex(batch.mutex);
+
+	for (i = 0; i < count; ++i)
+		if (bands[i].failed)
+			return SDL_SetError("%s", bands[i].error);
+
+	return 0;
+}
+
+/*
+ * Split rows in at most count bands of BLIT_MINROWS rows or more, the
+ * first ones get the remainder.
+ */
+static int
+bandCount(int rows, int count)
+{
+	if (count > rows / BLIT_MINROWS)
+		count = rows / BLIT_MINROWS;
+
+	return (count < 1) ? 1 : count;
+}
+
+static int
+bandRows(int rows, int count, int index)
+{
+	return rows / count + (index < rows % count);
+}
+
+/* --------------------------------------------------------
+ * Blits
+ * -------------------------------------------------------- */
+
+/*
+ * Check if the blit can be split in bands, palettes, color keys and color
+ * modulation are left to SDL.
+ */
+static int
+blitSplittable(SDL_Surface *src, SDL_Surface *dst)
+{
+	Uint32 key;
+	Uint8 r, g, b, a;
+
+	if (src == dst || SDL_MUSTLOCK(src) || SDL_MUSTLOCK(dst))
+		return 0;
+	if (src->format->palette != NULL || dst->format->palette != NULL)
+		return 0;
+	if (SDL_GetColorKey(src, &key) == 0)
+		return 0;
+
+	SDL_GetSurfaceColorMod(src, &r, &g, &b);
+	SDL_GetSurfaceAlphaMod(src, &a);
+
+	return r == 255 && g == 255 && b == 255 && a == 255;
+}
+
+/*
+ * A surface over the source pixels with the same blend mode, the only
+ * setting blitSplittable() lets through.
+ */
+static SDL_Surface *
+blitAlias(SDL_Surface *src)
+{
+	SDL_PixelFormat *fmt = src->format;
+	SDL_Surface *alias;
+	SDL_BlendMode mode;
+
+	alias = SDL_CreateRGBSurfaceFrom(src->pixels, src->w, src->h,
+	    fmt->BitsPerPixel, src->pitch, fmt->Rmask, fmt->Gmask, fmt->Bmask,
+	    fmt->Amask);
+
+	if (alias == NULL)
+		return NULL;
+
+	SDL_GetSurfaceBlendMode(src, &mode);
+	SDL_SetSurfaceBlendMode(alias, mode);
+
+	return alias;
+}
+
+int
+blitParallel(WorkerPool *pool,
+	     int count,
+	     SDL_Surface *src,
+	     const SDL_Rect *srcrect,
+	     SDL_Surface *dst,
+	     SDL_Rect *dstrect)
+{
+	SDL_Rect sr, dr, empty = { 0, 0, 0, 0 }, emptydst;
+	const SDL_Rect *clip = &dst->clip_rect;
+	Band *bands;
+	int srcx, srcy, w, h, d, i, y, ret = 0;
+
+	if (dstrect == NULL || !blitSplittable(src, dst))
+		return SDL_UpperBlit(src, srcrect, dst, dstrect);
+	if (src->locked || dst->locked)
+		return SDL_SetError("Surfaces must not be locked during blit");
+
+	dr = *dstrect;
+
+	/* Same clipping as SDL_UpperBlit */
+	if (srcrect != NULL) {
+		srcx = srcrect->x;
+		w = srcrect->w;
+		if (srcx < 0) {
+			w += srcx;
+			dr.x -= srcx;
+			srcx = 0;
+		}
+		if (w > src->w - srcx)
+			w = src->w - srcx;
+
+		srcy = srcrect->y;
+		h = srcrect->h;
+		if (srcy < 0) {
+			h += srcy;
+			dr.y -= srcy;
+			srcy = 0;
+		}
+		if (h > src->h - srcy)
+			h = src->h - srcy;
+	} else {
+		srcx = srcy = 0;
+		w = src->w;
+		h = src->h;
+	}
+
+	if ((d = clip->x - dr.x) > 0) {
+		w -= d;
+		dr.x += d;
+		srcx += d;
+	}
+	if ((d = dr.x + w - clip->x - clip->w) > 0)
+		w -= d;
+	if ((d = clip->y - dr.y) > 0) {
+		h -= d;
+		dr.y += d;
+		srcy += d;
+	}
+	if ((d = dr.y + h - clip->y - clip->h) > 0)
+		h -= d;
+
+	/* Nothing to split, SDL does it all */
+	if (w <= 0 || (count = bandCount(h, count)) == 1)
+		return SDL_UpperBlit(src, srcrect, dst, dstrect);
+
+	dr.w = w;
+	dr.h = h;
+	sr.x = srcx;
+	sr.y = srcy;
+	sr.w = w;
+	sr.h = h;
+
+	if ((bands = calloc(count, sizeof (Band))) == NULL)
+		return SDL_OutOfMemory();
+
+	for (i = 0, y = 0; i < count; ++i) {
+		if ((bands[i].src = blitAlias(src)) == NULL) {
+			ret = -1;
+			goto out;
+		}
+
+		/* Map the blit here, SDL links the map into the destination */
+		emptydst = empty;
+		if (SDL_LowerBlit(bands[i].src, &empty, dst, &emptydst) < 0) {
+			ret = -1;
+			goto out;
+		}
+
+		bands[i].dst = dst;
+		bands[i].srcrect = sr;
+		bands[i].srcrect.y = sr.y + y;
+		bands[i].srcrect.h = bandRows(h, count, i);
+		bands[i].dstrect = dr;
+		bands[i].dstrect.y = dr.y + y;
+		bands[i].dstrect.h = bands[i].srcrect.h;
+		y += bands[i].srcrect.h;
+	}
+
+	if ((ret = batchRun(pool, bands, count, (WorkerFunc)bandBlit)) == 0)
+		*dstrect = dr;
+
+out:
+	for (i = 0; i < count; ++i)
+		if (bands[i].src != NULL)
+			SDL_FreeSurface(bands[i].src);
+
+	free(bands);
+
+	return ret;
+}
+
+/* --------------------------------------------------------
+ * Conversions
+ * -------------------------------------------------------- */
+
+/*
+ * Check if SDL_ConvertPixels gives the same pixels as SDL_ConvertSurface.
+ */
+static int
+convertSplittable(SDL_Surface *src, Uint32 format)
+{
+	Uint32 key;
+	Uint8 r, g, b, a;
+
+	if (SDL_MUSTLOCK(src) || src->format->palette != NULL)
+		return 0;
+	if (SDL_ISPIXELFORMAT_INDEXED(format) || SDL_ISPIXELFORMAT_FOURCC(format))
+		return 0;
+	if (SDL_GetColorKey(src, &key) == 0)
+		return 0;
+
+	SDL_GetSurfaceColorMod(src, &r, &g, &b);
+	SDL_GetSurfaceAlphaMod(src, &a);
+
+	return r == 255 && g == 255 && b == 255 && a == 255;
+}
+
+SDL_Surface *
+convertParallel(WorkerPool *pool, int count, SDL_Surface *src, Uint32 format)
+{
+	SDL_Surface *dst;
+	Uint32 rmask, gmask, bmask, amask;
+	Band *bands;
+	int bpp, i, y;
+
+	count = bandCount(src->h, count);
+
+	if (count == 1 || !convertSplittable(src, format))
+		return SDL_ConvertSurfaceFormat(src, format, 0);
+	if (!SDL_PixelFormatEnumToMasks(format, &bpp, &rmask, &gmask, &bmask, &amask))
+		return NULL;
+	if ((dst = SDL_CreateRGBSurface(0, src->w, src->h, bpp, rmask, gmask, bmask, amask)) == NULL)
+		return NULL;
+	if ((bands = calloc(count, sizeof (Band))) == NULL) {
+		SDL_FreeSurface(dst);
+		SDL_OutOfMemory();
+		return NULL;
+	}
+
+	for (i = 0, y = 0; i < count; ++i) {
+		bands[i].width = src->w;
+		bands[i].height = bandRows(src->h, count, i);
+		bands[i].srcformat = src->format->format;
+		bands[i].srcpixels = (const Uint8 *)src->pixels + y * src->pitch;
+		bands[i].srcpitch = src->pitch;
+		bands[i].dstformat = dst->format->format;
+		bands[i].dstpixels = (Uint8 *)dst->pixels + y * dst->pitch;
+		bands[i].dstpitch = dst->pitch;
+		y += bands[i].height;
+	}
+
+	if (batchRun(pool, bands, count, (WorkerFunc)bandConvert) < 0) {
+		SDL_FreeSurface(dst);
+		dst = NULL;
+	} else if (src->format->Amask && dst->format->Amask) {
+		/* Like SDL_ConvertSurface */
+		SDL_SetSurfaceBlendMode(dst, SDL_BLENDMODE_BLEND);
+	}
+
+	free(bands);
+
+	return dst;
+}
@@ -0,0 +1,65 @@
+/*
+ * blit.h -- blits and conversions split in bands over a worker pool
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _BLIT_H_
+#define _BLIT_H_
+
+#include <common/worker.h>
+
+/**
+ * Name of the shared pool in the registry, see workerShared().
+ */
+#define BLIT_POOL	"__SDL_surface_workers"
+
+/**
+ * Like SDL_UpperBlit with the destination rows split in bands blitted at
+ * the same time. The result is the same as SDL_UpperBlit, which is used
+ * directly when the surfaces can not be split (RLE, same surface, small,
+ * palettes, color keys and color modulation).
+ *
+ * @param pool the pool
+ * @param bands the maximum number of bands
+ * @param src the source
+ * @param srcrect the source rectangle or NULL
+ * @param dst the destination
+ * @param dstrect the destination position, updated to the final rectangle
+ * @return 0 on success or -1 with the SDL error set
+ */
+int
+blitParallel(WorkerPool *pool,
+	     int bands,
+	     SDL_Surface *src,
+	     const SDL_Rect *srcrect,
+	     SDL_Surface *dst,
+	     SDL_Rect *dstrect);
+
+/**
+ * Like SDL_ConvertSurfaceFormat with the rows converted in bands at the
+ * same time. Palettes, color keys and color modulation fall back to
+ * SDL_ConvertSurfaceFormat.
+ *
+ * @param pool the pool
+ * @param bands the maximum number of bands
+ * @param src the source
+ * @param format the new pixel format
+ * @return the new surface or NULL with the SDL error set
+ */
+SDL_Surface *
+convertParallel(WorkerPool *pool, int bands, SDL_Surface *src, Uint32 format);
+
+#endif /* !_BLIT_H_ */
@@ -0,0 +1,422 @@
+/*
+ * buffer.c -- resizable native byte buffers
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "pack.h"
+
+Buffer *
+bufferTest(lua_State *L, int index)
+{
+	CommonUserdata *udata = luaL_testudata(L, index, BufferName);
+
+	return (udata != NULL) ? udata->data : NULL;
+}
+
+static int
+bufferResize(Buffer *b, size_t size)
+{
+	unsigned char *tmp;
+
+	if (size <= b->size)
+		return 0;
+	if (b->pins > 0)
+		return SDL_SetError("buffer is pinned");
+	if ((tmp = realloc(b->data, size)) == NULL)
+		return SDL_OutOfMemory();
+
+	b->data = tmp;
+	b->size = size;
+
+	return 0;
+}
+
+int
+bufferReserve(Buffer *b, size_t length)
+{
+	size_t size;
+
+	if (b->length + length <= b->size)
+		return 0;
+
+	size = (b->size < 64) ? 64 : b->size;
+	while (size < b->length + length)
+		size *= 2;
+
+	return bufferResize(b, size);
+}
+
+const char *
+bufferCheckData(lua_State *L, int index, int offarg, size_t *length)
+{
+	Buffer *b = bufferTest(L, index);
+	const char *data;
+	size_t total;
+	lua_Integer offset, count;
+
+	if (b != NULL) {
+		data = (const char *)b->data;
+		total = b->length;
+	} else
+		data = luaL_checklstring(L, index, &total);
+
+	offset = luaL_optinteger(L, offarg, 0);
+
+	if (offset < 0 || (size_t)offset > total)
+		luaL_argerror(L, offarg, "offset out of range");
+
+	count = luaL_optinteger(L, offarg + 1, total - offset);
+
+	if (count < 0 || (size_t)count > total - offset)
+		luaL_argerror(L, offarg + 1, "length out of range");
+
+	*length = (size_t)count;
+
+	return data + offset;
+}
+
+void
+bufferPin(Buffer *b)
+{
+	++ b->pins;
+}
+
+void
+bufferUnpin(Buffer *b)
+{
+	if (b->pins > 0)
+		-- b->pins;
+}
+
+/* --------------------------------------------------------
+ * Buffer functions
+ * -------------------------------------------------------- */
+
+/*
+ * SDL.createBuffer(size)
+ *
+ * Arguments:
+ *	size (optional) the initial capacity in bytes
+ *
+ * Returns:
+ *	The buffer or nil
+ *	The error message
+ */
+static int
+l_buffer_create(lua_State *L)
+{
+	lua_Integer size = luaL_optinteger(L, 1, 0);
+	Buffer *b;
+
+	if (size < 0)
+		return luaL_argerror(L, 1, "must be positive");
+	if ((b = calloc(1, sizeof (Buffer))) == NULL)
+		return commonPushErrno(L, 1);
+
+	if (size > 0 && bufferResize(b, size) < 0) {
+		free(b);
+		return commonPushSDLError(L, 1);
+	}
+
+	return commonPush(L, "p", BufferName, b);
+}
+
+const luaL_Reg BufferFunctions[] = {
+	{ "createBuffer",	l_buffer_create		},
+	{ NULL,			NULL			}
+};
+
+/* --------------------------------------------------------
+ * Buffer object
+ * -------------------------------------------------------- */
+
+/*
+ * Buffer:write(data, offset, length)
+ *
+ * Arguments:
+ *	data the string or buffer to append
+ *	offset (optional) the first byte of data, from 0
+ *	length (optional) the number of bytes
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_buffer_write(lua_State *L)
+{
+	Buffer *b = commonGetAs(L, 1, BufferName, Buffer *);
+	const char *data;
+	size_t length, offset = 0;
+	int self;
+
+	data = bufferCheckData(L, 2, 3, &length);
+
+	/* The source may be the buffer itself which can move */
+	if ((self = bufferTest(L, 2) == b))
+		offset = (const unsigned char *)data - b->data;
+	if (bufferReserve(b, length) < 0)
+		return commonPushSDLError(L, 1);
+	if (self)
+		data = (const char *)b->data + offset;
+
+	memmove(b->data + b->length, data, length);
+	b->length += length;
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * Buffer:writeValue(value)
+ *
+ * Arguments:
+ *	value the value to append, packed like SDL.pack does
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_buffer_writeValue(lua_State *L)
+{
+	Buffer *b = commonGetAs(L, 1, BufferName, Buffer *);
+	PackBuffer pb;
+	int ret;
+
+	luaL_checkany(L, 2);
+
+	if (b->pins > 0)
+		return commonPush(L, "ns", "buffer is pinned");
+
+	packInit(&pb, b->data, b->size, b->length);
+	ret = packValue(L, 2, &pb);
+
+	b->data = pb.data;
+	b->size = pb.size;
+
+	if (ret < 0)
+		return commonPushSDLError(L, 1);
+
+	b->length = pb.length;
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * Buffer:read(offset, length)
+ *
+ * Arguments:
+ *	offset (optional) the first byte, from 0
+ *	length (optional) the number of bytes
+ *
+ * Returns:
+ *	The bytes as a string
+ */
+static int
+l_buffer_read(lua_State *L)
+{
+	size_t length;
+	const char *data;
+
+	commonGetUserdata(L, 1, BufferName);
+	data = bufferCheckData(L, 1, 2, &length);
+	lua_pushlstring(L, data, length);
+
+	return 1;
+}
+
+/*
+ * Buffer:readValue(offset, length)
+ *
+ * Arguments:
+ *	offset (optional) the first byte, from 0
+ *	length (optional) the number of bytes
+ *
+ * Returns:
+ *	The value or nil
+ *	The error message
+ */
+static int
+l_buffer_readValue(lua_State *L)
+{
+	size_t length;
+	const char *data;
+
+	commonGetUserdata(L, 1, BufferName);
+	data = bufferCheckData(L, 1, 2, &length);
+
+	if (unpackValue(L, data, length) < 0)
+		return commonPushSDLError(L, 1);
+
+	return 1;
+}
+
+/*
+ * Buffer:resize(length)
+ *
+ * Set the number of bytes used, new bytes are zeroed.
+ *
+ * Arguments:
+ *	length the new length
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_buffer_resize(lua_State *L)
+{
+	Buffer *b = commonGetAs(L, 1, BufferName, Buffer *);
+	lua_Integer length = luaL_checkinteger(L, 2);
+
+	if (length < 0)
+		return luaL_argerror(L, 2, "must be positive");
+
+	if ((size_t)length > b->length) {
+		if (bufferReserve(b, length - b->length) < 0)
+			return commonPushSDLError(L, 1);
+
+		memset(b->data + b->length, 0, length - b->length);
+	}
+
+	b->length = length;
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * Buffer:reserve(length)
+ *
+ * Arguments:
+ *	length the number of bytes to make room for after the used ones
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_buffer_reserve(lua_State *L)
+{
+	Buffer *b = commonGetAs(L, 1, BufferName, Buffer *);
+	lua_Integer length = luaL_checkinteger(L, 2);
+
+	if (length < 0)
+		return luaL_argerror(L, 2, "must be positive");
+	if (bufferReserve(b, length) < 0)
+		return commonPushSDLError(L, 1);
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * Buffer:clear()
+ */
+static int
+l_buffer_clear(lua_State *L)
+{
+	commonGetAs(L, 1, BufferName, Buffer *)->length = 0;
+
+	return 0;
+}
+
+/*
+ * Buffer:length()
+ *
+ * Returns:
+ *	The number of bytes used
+ */
+static int
+l_buffer_length(lua_State *L)
+{
+	lua_pushinteger(L, commonGetAs(L, 1, BufferName, Buffer *)->length);
+
+	return 1;
+}
+
+/*
+ * Buffer:capacity()
+ *
+ * Returns:
+ *	The number of bytes allocated
+ */
+static int
+l_buffer_capacity(lua_State *L)
+{
+	lua_pushinteger(L, commonGetAs(L, 1, BufferName, Buffer *)->size);
+
+	return 1;
+}
+
+/*
+ * Buffer:__gc()
+ */
+static int
+l_buffer_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, BufferName);
+	Buffer *b = udata->data;
+
+	if (udata->mustdelete) {
+		free(b->data);
+		free(b);
+		udata->mustdelete = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Buffer:__tostring()
+ */
+static int
+l_buffer_tostring(lua_State *L)
+{
+	Buffer *b = commonGetAs(L, 1, BufferName, Buffer *);
+
+	lua_pushfstring(L, "buffer %d/%d bytes", (int)b->length, (int)b->size);
+
+	return 1;
+}
+
+static const luaL_Reg methods[] = {
+	{ "write",		l_buffer_write		},
+	{ "writeValue",		l_buffer_writeValue	},
+	{ "read",		l_buffer_read		},
+	{ "readValue",		l_buffer_readValue	},
+	{ "resize",		l_buffer_resize		},
+	{ "reserve",		l_buffer_reserve	},
+	{ "clear",		l_buffer_clear		},
+	{ "length",		l_buffer_length		},
+	{ "capacity",		l_buffer_capacity	},
+	{ NULL,			NULL			}
+};
+
+static const luaL_Reg metamethods[] = {
+	{ "__gc",		l_buffer_gc		},
+	{ "__len",		l_buffer_length		},
+	{ "__tostring",		l_buffer_tostring	},
+	{ NULL,			NULL			}
+};
+
+const CommonObject BufferObject = {
+	"Buffer",
+	methods,
+	metamethods
+};
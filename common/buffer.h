@@ -0,0 +1,96 @@
+/*
+ * buffer.h -- resizable native byte buffers
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _BUFFER_H_
+#define _BUFFER_H_
+
+#include <stddef.h>
+
+#include "common.h"
+
+#define BufferName	BufferObject.name
+
+/**
+ * @struct Buffer
+ * @brief bytes that can be filled and sent without Lua strings
+ *
+ * While pinned, the data pointer is borrowed by native code and the
+ * buffer cannot be reallocated.
+ */
+typedef struct buffer {
+	unsigned char	*data;		/*! the bytes */
+	size_t		 length;	/*! bytes used */
+	size_t		 size;		/*! bytes allocated */
+	int		 pins;		/*! number of borrowers */
+} Buffer;
+
+/**
+ * Get the buffer at the given index.
+ *
+ * @param L the Lua state
+ * @param index the value index
+ * @return the buffer or NULL if the value is not a buffer
+ */
+Buffer *
+bufferTest(lua_State *L, int index);
+
+/**
+ * Make room for length more bytes after the used ones.
+ *
+ * @param b the buffer
+ * @param length the number of bytes
+ * @return 0 on success or -1 on failure (SDL error set)
+ */
+int
+bufferReserve(Buffer *b, size_t length);
+
+/**
+ * Get the bytes of a string or a buffer argument, optionally sliced by
+ * an offset and a length at the arguments offarg and offarg + 1. Raises
+ * an error if the argument is invalid.
+ *
+ * @param L the Lua state
+ * @param index the string or buffer index
+ * @param offarg the offset argument index
+ * @param length the slice length
+ * @return the slice
+ */
+const char *
+bufferCheckData(lua_State *L, int index, int offarg, size_t *length);
+
+/**
+ * Prevent reallocation while native code borrows the data.
+ *
+ * @param b the buffer
+ */
+void
+bufferPin(Buffer *b);
+
+/**
+ * Release a previous bufferPin().
+ *
+ * @param b the buffer
+ */
+void
+bufferUnpin(Buffer *b);
+
+extern const CommonObject BufferObject;
+
+extern const luaL_Reg BufferFunctions[];
+
+#endif /* !_BUFFER_H_ */
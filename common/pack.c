@@ -0,0 +1,641 @@
+/*
+ * pack.c -- compact binary serialization of Lua values
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pack.h"
+
+/*
+ * Wire format, after the version byte every value starts with a tag:
+ *
+ *	0x00		nil, also ends the key / value pairs of a table
+ *	0x01, 0x02	false, true
+ *	0x03		integer, zigzag varint
+ *	0x04		number, IEEE 754 double little endian
+ *	0x05		string, varint length then the bytes
+ *	0x06		key string, like 0x05 and assigned the next key number
+ *	0x07		key reference, varint key number
+ *	0x08		table, varint array length, the array values then the
+ *			key / value pairs terminated by 0x00
+ *	0x80 - 0xff	integer 0 to 127
+ */
+#define PACK_NIL	0x00
+#define PACK_FALSE	0x01
+#define PACK_TRUE	0x02
+#define PACK_INT	0x03
+#define PACK_DOUBLE	0x04
+#define PACK_STRING	0x05
+#define PACK_KEY	0x06
+#define PACK_KEYREF	0x07
+#define PACK_TABLE	0x08
+#define PACK_SMALL	0x80
+
+#define PACK_DEPTH	128		/* maximum table nesting */
+#define PACK_KEYS	4096		/* maximum number of interned keys */
+#define PACK_KEYLEN	64		/* longer keys are not interned */
+
+typedef struct {
+	PackBuffer	*b;
+	int		 keys;		/* index of the key -> number table */
+	int		 nkeys;
+} Packer;
+
+typedef struct {
+	const unsigned char	*p;
+	const unsigned char	*end;
+	int			 keys;	/* index of the number -> key table */
+	int			 nkeys;
+} Unpacker;
+
+/* --------------------------------------------------------
+ * Encoding
+ * -------------------------------------------------------- */
+
+static int
+packReserve(PackBuffer *b, size_t length)
+{
+	unsigned char *tmp;
+	size_t size;
+
+	if (b->length + length <= b->size)
+		return 0;
+
+	size = (b->size < 256) ? 256 : b->size;
+	while (size < b->length + length)
+		size *= 2;
+
+	if ((tmp = realloc(b->data, size)) == NULL)
+		return SDL_OutOfMemory();
+
+	b->data = tmp;
+	b->size = size;
+
+	return 0;
+}
+
+static int
+packByte(PackBuffer *b, int byte)
+{
+	if (packReserve(b, 1) < 0)
+		return -1;
+
+	b->data[b->length++] = byte;
+
+	return 0;
+}
+
+static int
+packVarint(PackBuffer *b, Uint64 value)
+{
+	if (packReserve(b, 10) < 0)
+		return -1;
+
+	while (value >= 0x80) {
+		b->data[b->length++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+
+	b->data[b->length++] = (unsigned char)value;
+
+	return 0;
+}
+
+static int
+packBytes(PackBuffer *b, int tag, const char *data, size_t length)
+{
+	if (packByte(b, tag) < 0 || packVarint(b, length) < 0)
+		return -1;
+	if (packReserve(b, length) < 0)
+		return -1;
+
+	memcpy(b->data + b->length, data, length);
+	b->length += length;
+
+	return 0;
+}
+
+/*
+ * Check if the number at the index is an integer that survives the round
+ * trip, Lua 5.3 keeps the subtype so floats stay floats.
+ */
+static int
+packIsInteger(lua_State *L, int index, Sint64 *value)
+{
+#if LUA_VERSION_NUM >= 503
+	if (!lua_isinteger(L, index))
+		return 0;
+
+	*value = lua_tointeger(L, index);
+
+	return 1;
+#else
+	lua_Number n = lua_tonumber(L, index);
+
+	if (n < -9007199254740992.0 || n > 9007199254740992.0 || floor(n) != n)
+		return 0;
+
+	*value = (Sint64)n;
+
+	return 1;
+#endif
+}
+
+static int
+packNumber(PackBuffer *b, lua_State *L, int index)
+{
+	Sint64 integer;
+	double number;
+	Uint64 bits;
+
+	if (packIsInteger(L, index, &integer)) {
+		if (integer >= 0 && integer < 0x80)
+			return packByte(b, PACK_SMALL | (int)integer);
+		if (packByte(b, PACK_INT) < 0)
+			return -1;
+
+		return packVarint(b, ((Uint64)integer << 1) ^ (Uint64)(integer >> 63));
+	}
+
+	number = lua_tonumber(L, index);
+	memcpy(&bits, &number, sizeof (bits));
+	bits = SDL_SwapLE64(bits);
+
+	if (packByte(b, PACK_DOUBLE) < 0 || packReserve(b, 8) < 0)
+		return -1;
+
+	memcpy(b->data + b->length, &bits, 8);
+	b->length += 8;
+
+	return 0;
+}
+
+/*
+ * Table keys are sent once, then referenced by their number which is
+ * usually a single byte.
+ */
+static int
+packKey(Packer *p, lua_State *L, int index)
+{
+	const char *str;
+	size_t length;
+	int tag = PACK_STRING;
+
+	str = lua_tolstring(L, index, &length);
+
+	if (length > PACK_KEYLEN)
+		return packBytes(p->b, PACK_STRING, str, length);
+
+	lua_pushvalue(L, index);
+	lua_rawget(L, p->keys);
+
+	if (lua_type(L, -1) == LUA_TNUMBER) {
+		int number = (int)lua_tointeger(L, -1);
+
+		lua_pop(L, 1);
+
+		if (packByte(p->b, PACK_KEYREF) < 0)
+			return -1;
+
+		return packVarint(p->b, number);
+	}
+
+	lua_pop(L, 1);
+
+	if (p->nkeys < PACK_KEYS) {
+		lua_pushvalue(L, index);
+		lua_pushinteger(L, ++ p->nkeys);
+		lua_rawset(L, p->keys);
+		tag = PACK_KEY;
+	}
+
+	return packBytes(p->b, tag, str, length);
+}
+
+static int
+packLua(Packer *p, lua_State *L, int index, int depth);
+
+/*
+ * The array part is everything from 1 up to the first nil, the remaining
+ * pairs are sent as they are.
+ */
+static int
+packTable(Packer *p, lua_State *L, int index, int depth)
+{
+	Sint64 key;
+	int i, n, ret;
+
+	if (depth >= PACK_DEPTH) {
+		SDL_SetError("table nested too deeply or recursive");
+		return -1;
+	}
+	if (!lua_checkstack(L, 4)) {
+		SDL_SetError("stack overflow");
+		return -1;
+	}
+
+	for (n = 0; ; ++n) {
+		lua_rawgeti(L, index, n + 1);
+		ret = lua_isnil(L, -1);
+		lua_pop(L, 1);
+
+		if (ret)
+			break;
+	}
+
+	if (packByte(p->b, PACK_TABLE) < 0 || packVarint(p->b, n) < 0)
+		return -1;
+
+	for (i = 1; i <= n; ++i) {
+		lua_rawgeti(L, index, i);
+		ret = packLua(p, L, lua_gettop(L), depth + 1);
+		lua_pop(L, 1);
+
+		if (ret < 0)
+			return -1;
+	}
+
+	lua_pushnil(L);
+	while (lua_next(L, index)) {
+		int k = lua_gettop(L) - 1;
+
+		if (lua_type(L, k) == LUA_TNUMBER && packIsInteger(L, k, &key) &&
+		    key >= 1 && key <= n) {
+			lua_pop(L, 1);
+			continue;
+		}
+
+		if (lua_type(L, k) == LUA_TSTRING)
+			ret = packKey(p, L, k);
+		else
+			ret = packLua(p, L, k, depth + 1);
+
+		if (ret == 0)
+			ret = packLua(p, L, k + 1, depth + 1);
+		if (ret < 0) {
+			lua_pop(L, 2);
+			return -1;
+		}
+
+		lua_pop(L, 1);
+	}
+
+	return packByte(p->b, PACK_NIL);
+}
+
+static int
+packLua(Packer *p, lua_State *L, int index, int depth)
+{
+	switch (lua_type(L, index)) {
+	case LUA_TNIL:
+		return packByte(p->b, PACK_NIL);
+	case LUA_TBOOLEAN:
+		return packByte(p->b, lua_toboolean(L, index) ? PACK_TRUE : PACK_FALSE);
+	case LUA_TNUMBER:
+		return packNumber(p->b, L, index);
+	case LUA_TSTRING:
+	{
+		const char *str;
+		size_t length;
+
+		str = lua_tolstring(L, index, &length);
+
+		return packBytes(p->b, PACK_STRING, str, length);
+	}
+	case LUA_TTABLE:
+		return packTable(p, L, index, depth);
+	default:
+		break;
+	}
+
+	SDL_SetError("cannot pack a %s value", luaL_typename(L, index));
+
+	return -1;
+}
+
+void
+packInit(PackBuffer *b, void *data, size_t size, size_t head)
+{
+	b->data = data;
+	b->size = size;
+	b->head = head;
+	b->length = head;
+}
+
+int
+packValue(lua_State *L, int index, PackBuffer *b)
+{
+	Packer p;
+	int ret;
+
+	if (index < 0 && index > LUA_REGISTRYINDEX)
+		index = lua_gettop(L) + index + 1;
+
+	lua_newtable(L);
+
+	p.b = b;
+	p.keys = lua_gettop(L);
+	p.nkeys = 0;
+
+	/* The head is allocated even if nothing follows */
+	if ((ret = packReserve(b, 0)) == 0 && (ret = packByte(b, PACK_VERSION)) == 0)
+		ret = packLua(&p, L, index, 0);
+
+	lua_pop(L, 1);
+
+	return ret;
+}
+
+/* --------------------------------------------------------
+ * Decoding
+ * -------------------------------------------------------- */
+
+static int
+unpackError(const char *reason)
+{
+	SDL_SetError("invalid packed data: %s", reason);
+
+	return -1;
+}
+
+static int
+unpackVarint(Unpacker *u, Uint64 *value)
+{
+	int shift;
+
+	*value = 0;
+
+	for (shift = 0; shift < 64; shift += 7) {
+		if (u->p == u->end)
+			return unpackError("truncated");
+
+		*value |= (Uint64)(*u->p & 0x7f) << shift;
+
+		if ((*u->p++ & 0x80) == 0)
+			return 0;
+	}
+
+	return unpackError("varint too long");
+}
+
+static int
+unpackLength(Unpacker *u, size_t *length)
+{
+	Uint64 value;
+
+	if (unpackVarint(u, &value) < 0)
+		return -1;
+	if (value > (Uint64)(u->end - u->p))
+		return unpackError("truncated");
+
+	*length = (size_t)value;
+
+	return 0;
+}
+
+static int
+unpackLua(Unpacker *u, lua_State *L, int depth);
+
+static int
+unpackTable(Unpacker *u, lua_State *L, int depth)
+{
+	size_t n, i;
+
+	if (depth >= PACK_DEPTH)
+		return unpackError("table nested too deeply");
+	if (!lua_checkstack(L, 4))
+		return unpackError("stack overflow");
+
+	/* Every value takes at least one byte */
+	if (unpackLength(u, &n) < 0)
+		return -1;
+
+	lua_createtable(L, (int)n, 0);
+
+	for (i = 1; i <= n; ++i) {
+		if (unpackLua(u, L, depth + 1) < 0)
+			return -1;
+
+		lua_rawseti(L, -2, (int)i);
+	}
+
+	for (;;) {
+		if (u->p == u->end)
+			return unpackError("truncated");
+		if (*u->p == PACK_NIL) {
+			++ u->p;
+			break;
+		}
+
+		if (unpackLua(u, L, depth + 1) < 0)
+			return -1;
+		if (lua_type(L, -1) == LUA_TNUMBER && lua_tonumber(L, -1) != lua_tonumber(L, -1))
+			return unpackError("NaN key");
+		if (unpackLua(u, L, depth + 1) < 0)
+			return -1;
+		if (lua_isnil(L, -1))
+			return unpackError("nil value");
+
+		lua_rawset(L, -3);
+	}
+
+	return 0;
+}
+
+static int
+unpackLua(Unpacker *u, lua_State *L, int depth)
+{
+	Uint64 value;
+	size_t length;
+	int tag;
+
+	if (u->p == u->end)
+		return unpackError("truncated");
+
+	tag = *u->p++;
+
+	if (tag & PACK_SMALL) {
+		lua_pushinteger(L, tag & 0x7f);
+		return 0;
+	}
+
+	switch (tag) {
+	case PACK_NIL:
+		lua_pushnil(L);
+		break;
+	case PACK_FALSE:
+	case PACK_TRUE:
+		lua_pushboolean(L, tag == PACK_TRUE);
+		break;
+	case PACK_INT:
+	{
+		Sint64 integer;
+
+		if (unpackVarint(u, &value) < 0)
+			return -1;
+
+		integer = (Sint64)((value >> 1) ^ (~(value & 1) + 1));
+#if LUA_VERSION_NUM >= 503
+		lua_pushinteger(L, (lua_Integer)integer);
+#else
+		lua_pushnumber(L, (lua_Number)integer);
+#endif
+	}
+		break;
+	case PACK_DOUBLE:
+	{
+		double number;
+
+		if (u->end - u->p < 8)
+			return unpackError("truncated");
+
+		memcpy(&value, u->p, 8);
+		value = SDL_SwapLE64(value);
+		memcpy(&number, &value, sizeof (number));
+		u->p += 8;
+
+		lua_pushnumber(L, number);
+	}
+		break;
+	case PACK_STRING:
+	case PACK_KEY:
+		if (unpackLength(u, &length) < 0)
+			return -1;
+
+		lua_pushlstring(L, (const char *)u->p, length);
+		u->p += length;
+
+		if (tag == PACK_KEY) {
+			if (u->nkeys >= PACK_KEYS)
+				return unpackError("too many keys");
+
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, u->keys, ++ u->nkeys);
+		}
+		break;
+	case PACK_KEYREF:
+		if (unpackVarint(u, &value) < 0)
+			return -1;
+		if (value < 1 || value > (Uint64)u->nkeys)
+			return unpackError("unknown key");
+
+		lua_rawgeti(L, u->keys, (int)value);
+		break;
+	case PACK_TABLE:
+		return unpackTable(u, L, depth);
+	default:
+		return unpackError("unknown tag");
+	}
+
+	return 0;
+}
+
+int
+unpackValue(lua_State *L, const void *data, size_t length)
+{
+	Unpacker u;
+	int top = lua_gettop(L);
+
+	u.p = data;
+	u.end = u.p + length;
+
+	if (length == 0 || *u.p++ != PACK_VERSION) {
+		SDL_SetError("unsupported packed data version");
+		return -1;
+	}
+
+	lua_newtable(L);
+	u.keys = lua_gettop(L);
+	u.nkeys = 0;
+
+	if (unpackLua(&u, L, 0) < 0) {
+		lua_settop(L, top);
+		return -1;
+	}
+
+	if (u.p != u.end) {
+		lua_settop(L, top);
+		return unpackError("trailing bytes");
+	}
+
+	lua_remove(L, u.keys);
+
+	return 0;
+}
+
+/* --------------------------------------------------------
+ * Pack functions
+ * -------------------------------------------------------- */
+
+/*
+ * SDL.pack(value)
+ *
+ * Arguments:
+ *	value the value to serialize
+ *
+ * Returns:
+ *	The packed string or nil
+ *	The error message
+ */
+static int
+l_pack(lua_State *L)
+{
+	PackBuffer b;
+
+	luaL_checkany(L, 1);
+	packInit(&b, NULL, 0, 0);
+
+	if (packValue(L, 1, &b) < 0) {
+		free(b.data);
+		return commonPushSDLError(L, 1);
+	}
+
+	lua_pushlstring(L, (const char *)b.data, b.length);
+	free(b.data);
+
+	return 1;
+}
+
+/*
+ * SDL.unpack(data)
+ *
+ * Arguments:
+ *	data the string returned by SDL.pack
+ *
+ * Returns:
+ *	The value or nil
+ *	The error message
+ */
+static int
+l_unpack(lua_State *L)
+{
+	size_t length;
+	const char *data = luaL_checklstring(L, 1, &length);
+
+	if (unpackValue(L, data, length) < 0)
+		return commonPushSDLError(L, 1);
+
+	return 1;
+}
+
+const luaL_Reg PackFunctions[] = {
+	{ "pack",		l_pack			},
+	{ "unpack",		l_unpack		},
+	{ NULL,			NULL			}
+};
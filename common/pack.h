@@ -0,0 +1,81 @@
+/*
+ * pack.h -- compact binary serialization of Lua values
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _PACK_H_
+#define _PACK_H_
+
+#include <stddef.h>
+
+#include "common.h"
+
+/*
+ * Version byte written first in every packed value.
+ */
+#define PACK_VERSION	1
+
+/**
+ * @struct PackBuffer
+ * @brief growable output of packValue()
+ *
+ * The first head bytes are left free so that callers can write a frame
+ * header in place without copying the payload.
+ */
+typedef struct pack_buffer {
+	unsigned char	*data;		/*! the bytes, owned by the caller */
+	size_t		 length;	/*! bytes used including head */
+	size_t		 size;		/*! bytes allocated */
+	size_t		 head;		/*! bytes reserved at the beginning */
+} PackBuffer;
+
+/**
+ * Initialize a buffer, an existing allocation may be given to reuse it.
+ *
+ * @param b the buffer
+ * @param data the previous allocation or NULL
+ * @param size its size
+ * @param head the number of bytes to reserve
+ */
+void
+packInit(PackBuffer *b, void *data, size_t size, size_t head);
+
+/**
+ * Serialize the Lua value at the given index, nil, booleans, numbers,
+ * strings and tables of these are supported.
+ *
+ * @param L the Lua state
+ * @param index the value index
+ * @param b the buffer, appended to
+ * @return 0 on success or -1 on failure (SDL error set)
+ */
+int
+packValue(lua_State *L, int index, PackBuffer *b);
+
+/**
+ * Decode a value written by packValue() and push it on the stack.
+ *
+ * @param L the Lua state
+ * @param data the bytes
+ * @param length the number of bytes
+ * @return 0 on success or -1 on failure with nothing pushed (SDL error set)
+ */
+int
+unpackValue(lua_State *L, const void *data, size_t length);
+
+extern const luaL_Reg PackFunctions[];
+
+#endif /* !_PACK_H_ */
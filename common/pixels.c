@@ -0,0 +1,1223 @@
+/*
+ * pixels.c -- in place kernels over 32-bit pixels
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "pixels.h"
+
+/*
+ * Vector paths are compiled when the compiler can emit them and chosen at
+ * runtime from the SDL CPU checks. Every kernel gives the same result as
+ * its scalar version, which also handles the remaining pixels.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define PIXELS_SSE2
+#  include <emmintrin.h>
+#endif
+
+#if defined(PIXELS_SSE2) && defined(__GNUC__) && SDL_VERSION_ATLEAST(2, 0, 4)
+#  define PIXELS_AVX2
+#  define AVX2 __attribute__((target("avx2")))
+#  include <immintrin.h>
+#endif
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && SDL_VERSION_ATLEAST(2, 0, 6)
+#  define PIXELS_NEON
+#  include <arm_neon.h>
+#endif
+
+enum backend {
+	BackendScalar,
+	BackendSSE2,
+	BackendAVX2,
+	BackendNEON
+};
+
+/*
+ * Chosen on first use, bench/pixels.c sets it to check every backend
+ * against the scalar one.
+ */
+static int selected = -1;
+
+static enum backend
+backend(void)
+{
+	enum backend b = BackendScalar;
+
+	if (selected >= 0)
+		return selected;
+
+#if defined(PIXELS_SSE2)
+	if (SDL_HasSSE2())
+		b = BackendSSE2;
+#endif
+#if defined(PIXELS_AVX2)
+	if (SDL_HasAVX2())
+		b = BackendAVX2;
+#endif
+#if defined(PIXELS_NEON)
+	if (SDL_HasNEON())
+		b = BackendNEON;
+#endif
+
+	return selected = b;
+}
+
+static Uint32
+colorMask(const PixelLayout *layout)
+{
+	return 0xffU << layout->r | 0xffU << layout->g | 0xffU << layout->b;
+}
+
+/* --------------------------------------------------------
+ * Scalar kernels
+ * -------------------------------------------------------- */
+
+/*
+ * x * y / 255 rounded, exact for all bytes.
+ */
+static Uint32
+mul8(Uint32 x, Uint32 y)
+{
+	Uint32 t = x * y + 128;
+
+	return (t + (t >> 8)) >> 8;
+}
+
+static void
+multiplyScalar(Uint32 *p, size_t n, Uint32 factor)
+{
+	Uint32 v;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		v = p[i];
+		p[i] = mul8(v & 0xff, factor & 0xff) |
+		    mul8(v >> 8 & 0xff, factor >> 8 & 0xff) << 8 |
+		    mul8(v >> 16 & 0xff, factor >> 16 & 0xff) << 16 |
+		    mul8(v >> 24, factor >> 24) << 24;
+	}
+}
+
+static void
+premultiplyScalar(Uint32 *p, size_t n, const PixelLayout *layout)
+{
+	Uint32 amask = 0xffU << layout->a;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		Uint32 a = p[i] >> layout->a & 0xff;
+
+		multiplyScalar(&p[i], 1, (a * 0x01010101U) | amask);
+	}
+}
+
+static void
+grayscaleScalar(Uint32 *p, size_t n, const PixelLayout *layout)
+{
+	Uint32 keep = ~colorMask(layout), v, y;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		v = p[i];
+		y = ((v >> layout->r & 0xff) * 77 + (v >> layout->g & 0xff) * 150 +
+		    (v >> layout->b & 0xff) * 29) >> 8;
+		p[i] = (v & keep) | y << layout->r | y << layout->g | y << layout->b;
+	}
+}
+
+static void
+swizzleScalar(Uint32 *p, size_t n, const int from[4])
+{
+	Uint32 v;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		v = p[i];
+		p[i] = (v >> from[0] & 0xff) | (v >> from[1] & 0xff) << 8 |
+		    (v >> from[2] & 0xff) << 16 | (v >> from[3] & 0xff) << 24;
+	}
+}
+
+/* --------------------------------------------------------
+ * SSE2 kernels, 4 pixels at once
+ * -------------------------------------------------------- */
+
+#if defined(PIXELS_SSE2)
+
+static __m128i
+mul8SSE2(__m128i v, __m128i f)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i half = _mm_set1_epi16(128);
+	__m128i lo, hi;
+
+	lo = _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), _mm_unpacklo_epi8(f, zero));
+	hi = _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), _mm_unpackhi_epi8(f, zero));
+	lo = _mm_add_epi16(lo, half);
+	hi = _mm_add_epi16(hi, half);
+	lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+	hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+	return _mm_packus_epi16(lo, hi);
+}
+
+static size_t
+multiplySSE2(Uint32 *p, size_t n, Uint32 factor)
+{
+	const __m128i f = _mm_set1_epi32(factor);
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i *q = (__m128i *)&p[i];
+
+		_mm_storeu_si128(q, mul8SSE2(_mm_loadu_si128(q), f));
+	}
+
+	return i;
+}
+
+static size_t
+premultiplySSE2(Uint32 *p, size_t n, const PixelLayout *layout)
+{
+	const __m128i byte = _mm_set1_epi32(0xff);
+	const __m128i amask = _mm_set1_epi32(0xffU << layout->a);
+	const __m128i ashift = _mm_cvtsi32_si128(layout->a);
+	__m128i v, a;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i *q = (__m128i *)&p[i];
+
+		v = _mm_loadu_si128(q);
+		a = _mm_and_si128(_mm_srl_epi32(v, ashift), byte);
+		a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+		a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+		_mm_storeu_si128(q, mul8SSE2(v, _mm_or_si128(a, amask)));
+	}
+
+	return i;
+}
+
+static size_t
+grayscaleSSE2(Uint32 *p, size_t n, const PixelLayout *layout)
+{
+	const __m128i byte = _mm_set1_epi32(0xff);
+	const __m128i keep = _mm_set1_epi32(~colorMask(layout));
+	const __m128i rs = _mm_cvtsi32_si128(layout->r);
+	const __m128i gs = _mm_cvtsi32_si128(layout->g);
+	const __m128i bs = _mm_cvtsi32_si128(layout->b);
+	__m128i v, y;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i *q = (__m128i *)&p[i];
+
+		v = _mm_loadu_si128(q);
+
+		/* Products fit in the low 16 bits of every 32-bit lane */
+		y = _mm_mullo_epi16(_mm_and_si128(_mm_srl_epi32(v, rs), byte), _mm_set1_epi32(77));
+		y = _mm_add_epi32(y, _mm_mullo_epi16(_mm_and_si128(_mm_srl_epi32(v, gs), byte), _mm_set1_epi32(150)));
+		y = _mm_add_epi32(y, _mm_mullo_epi16(_mm_and_si128(_mm_srl_epi32(v, bs), byte), _mm_set1_epi32(29)));
+		y = _mm_srli_epi32(y, 8);
+
+		v = _mm_and_si128(v, keep);
+		v = _mm_or_si128(v, _mm_sll_epi32(y, rs));
+		v = _mm_or_si128(v, _mm_sll_epi32(y, gs));
+		v = _mm_or_si128(v, _mm_sll_epi32(y, bs));
+		_mm_storeu_si128(q, v);
+	}
+
+	return i;
+}
+
+static size_t
+swizzleSSE2(Uint32 *p, size_t n, const int from[4])
+{
+	const __m128i byte = _mm_set1_epi32(0xff);
+	const __m128i s0 = _mm_cvtsi32_si128(from[0]);
+	const __m128i s1 = _mm_cvtsi32_si128(from[1]);
+	const __m128i s2 = _mm_cvtsi32_si128(from[2]);
+	const __m128i s3 = _mm_cvtsi32_si128(from[3]);
+	__m128i v, out;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i *q = (__m128i *)&p[i];
+
+		v = _mm_loadu_si128(q);
+		out = _mm_and_si128(_mm_srl_epi32(v, s0), byte);
+		out = _mm_or_si128(out, _mm_slli_epi32(_mm_and_si128(_mm_srl_epi32(v, s1), byte), 8));
+		out = _mm_or_si128(out, _mm_slli_epi32(_mm_and_si128(_mm_srl_epi32(v, s2), byte), 16));
+		out = _mm_or_si128(out, _mm_slli_epi32(_mm_srl_epi32(v, s3), 24));
+		_mm_storeu_si128(q, out);
+	}
+
+	return i;
+}
+
+#endif /* !PIXELS_SSE2 */
+
+/* --------------------------------------------------------
+ * AVX2 kernels, 8 pixels at once
+ * -------------------------------------------------------- */
+
+#if defined(PIXELS_AVX2)
+
+AVX2 static __m256i
+mul8AVX2(__m256i v, __m256i f)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i half = _mm256_set1_epi16(128);
+	__m256i lo, hi;
+
+	/* Unpacking and packing both work within 128-bit lanes */
+	lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero), _mm256_unpacklo_epi8(f, zero));
+	hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero), _mm256_unpackhi_epi8(f, zero));
+	lo = _mm256_add_epi16(lo, half);
+	hi = _mm256_add_epi16(hi, half);
+	lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+	hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+
+	return _mm256_packus_epi16(lo, hi);
+}
+
+AVX2 static size_t
+multiplyAVX2(Uint32 *p, size_t n, Uint32 factor)
+{
+	const __m256i f = _mm256_set1_epi32(factor);
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i *q = (__m256i *)&p[i];
+
+		_mm256_storeu_si256(q, mul8AVX2(_mm256_loadu_si256(q), f));
+	}
+
+	return i;
+}
+
+AVX2 static size_t
+premultiplyAVX2(Uint32 *p, size_t n, const PixelLayout *layout)
+{
+	const __m256i byte = _mm256_set1_epi32(0xff);
+	const __m256i amask = _mm256_set1_epi32(0xffU << layout->a);
+	const __m128i ashift = _mm_cvtsi32_si128(layout->a);
+	__m256i v, a;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i *q = (__m256i *)&p[i];
+
+		v = _mm256_loadu_si256(q);
+		a = _mm256_and_si256(_mm256_srl_epi32(v, ashift), byte);
+		a = _mm256_or_si256(a, _mm256_slli_epi32(a, 8));
+		a = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+		_mm256_storeu_si256(q, mul8AVX2(v, _mm256_or_si256(a, amask)));
+	}
+
+	return i;
+}
+
+AVX2 static size_t
+grayscaleAVX2(Uint32 *p, size_t n, const PixelLayout *layout)
+{
+	const __m256i byte = _mm256_set1_epi32(0xff);
+	const __m256i keep = _mm256_set1_epi32(~colorMask(layout));
+	const __m128i rs = _mm_cvtsi32_si128(layout->r);
+	const __m128i gs = _mm_cvtsi32_si128(layout->g);
+	const __m128i bs = _mm_cvtsi32_si128(layout->b);
+	__m256i v, y;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i *q = (__m256i *)&p[i];
+
+		v = _mm256_loadu_si256(q);
+		y = _mm256_mullo_epi16(_mm256_and_si256(_mm256_srl_epi32(v, rs), byte), _mm256_set1_epi32(77));
+		y = _mm256_add_epi32(y, _mm256_mullo_epi16(_mm256_and_si256(_mm256_srl_epi32(v, gs), byte), _mm256_set1_epi32(150)));
+		y = _mm256_add_epi32(y, _mm256_mullo_epi16(_mm256_and_si256(_mm256_srl_epi32(v, bs), byte), _mm256_set1_epi32(29)));
+		y = _mm256_srli_epi32(y, 8);
+
+		v = _mm256_and_si256(v, keep);
+		v = _mm256_or_si256(v, _mm256_sll_epi32(y, rs));
+		v = _mm256_or_si256(v, _mm256_sll_epi32(y, gs));
+		v = _mm256_or_si256(v, _mm256_sll_epi32(y, bs));
+		_mm256_storeu_si256(q, v);
+	}
+
+	return i;
+}
+
+AVX2 static size_t
+swizzleAVX2(Uint32 *p, size_t n, const int from[4])
+{
+	const __m256i byte = _mm256_set1_epi32(0xff);
+	const __m128i s0 = _mm_cvtsi32_si128(from[0]);
+	const __m128i s1 = _mm_cvtsi32_si128(from[1]);
+	const __m128i s2 = _mm_cvtsi32_si128(from[2]);
+	const __m128i s3 = _mm_cvtsi32_si128(from[3]);
+	__m256i v, out;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i *q = (__m256i *)&p[i];
+
+		v = _mm256_loadu_si256(q);
+		out = _mm256_and_si256(_mm256_srl_epi32(v, s0), byte);
+		out = _mm256_or_si256(out, _mm256_slli_epi32(_mm256_and_si256(_mm256_srl_epi32(v, s1), byte), 8));
+		out = _mm256_or_si256(out, _mm256_slli_epi32(_mm256_and_si256(_mm256_srl_epi32(v, s2), byte), 16));
+		out = _mm256_or_si256(out, _mm256_slli_epi32(_mm256_srl_epi32(v, s3), 24));
+		_mm256_storeu_si256(q, out);
+	}
+
+	return i;
+}
+
+#endif /* !PIXELS_AVX2 */
+
+/* --------------------------------------------------------
+ * NEON kernels, 4 pixels at once
+ * -------------------------------------------------------- */
+
+#if defined(PIXELS_NEON)
+
+static uint8x16_t
+mul8NEON(uint8x16_t v, uint8x16_t f)
+{
+	uint16x8_t lo = vmull_u8(vget_low_u8(v), vget_low_u8(f));
+	uint16x8_t hi = vmull_u8(vget_high_u8(v), vget_high_u8(f));
+
+	/* (t + ((t + 128) >> 8) + 128) >> 8 like mul8 */
+	return vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)),
+	    vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+}
+
+static size_t
+multiplyNEON(Uint32 *p, size_t n, Uint32 factor)
+{
+	const uint8x16_t f = vreinterpretq_u8_u32(vdupq_n_u32(factor));
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		uint8x16_t v = vreinterpretq_u8_u32(vld1q_u32(&p[i]));
+
+		vst1q_u32(&p[i], vreinterpretq_u32_u8(mul8NEON(v, f)));
+	}
+
+	return i;
+}
+
+static size_t
+premultiplyNEON(Uint32 *p, size_t n, const PixelLayout *layout)
+{
+	const uint32x4_t amask = vdupq_n_u32(0xffU << layout->a);
+	const int32x4_t ashift = vdupq_n_s32(-layout->a);
+	const uint32x4_t byte = vdupq_n_u32(0xff);
+	uint32x4_t v, a;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = vld1q_u32(&p[i]);
+		a = vandq_u32(vshlq_u32(v, ashift), byte);
+		a = vorrq_u32(vmulq_n_u32(a, 0x01010101U), amask);
+		vst1q_u32(&p[i], vreinterpretq_u32_u8(mul8NEON(
+		    vreinterpretq_u8_u32(v), vreinterpretq_u8_u32(a))));
+	}
+
+	return i;
+}
+
+static size_t
+grayscaleNEON(Uint32 *p, size_t n, const PixelLayout *layout)
+{
+	const uint32x4_t byte = vdupq_n_u32(0xff);
+	const uint32x4_t keep = vdupq_n_u32(~colorMask(layout));
+	const int32x4_t rs = vdupq_n_s32(layout->r);
+	const int32x4_t gs = vdupq_n_s32(layout->g);
+	const int32x4_t bs = vdupq_n_s32(layout->b);
+	uint32x4_t v, y;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = vld1q_u32(&p[i]);
+		y = vmulq_n_u32(vandq_u32(vshlq_u32(v, vnegq_s32(rs)), byte), 77);
+		y = vmlaq_n_u32(y, vandq_u32(vshlq_u32(v, vnegq_s32(gs)), byte), 150);
+		y = vmlaq_n_u32(y, vandq_u32(vshlq_u32(v, vnegq_s32(bs)), byte), 29);
+		y = vshrq_n_u32(y, 8);
+
+		v = vandq_u32(v, keep);
+		v = vorrq_u32(v, vshlq_u32(y, rs));
+		v = vorrq_u32(v, vshlq_u32(y, gs));
+		v = vorrq_u32(v, vshlq_u32(y, bs));
+		vst1q_u32(&p[i], v);
+	}
+
+	return i;
+}
+
+static size_t
+swizzleNEON(Uint32 *p, size_t n, const int from[4])
+{
+	const uint32x4_t byte = vdupq_n_u32(0xff);
+	uint32x4_t v, out;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = vld1q_u32(&p[i]);
+		out = vandq_u32(vshlq_u32(v, vdupq_n_s32(-from[0])), byte);
+		out = vorrq_u32(out, vshlq_n_u32(vandq_u32(vshlq_u32(v, vdupq_n_s32(-from[1])), byte), 8));
+		out = vorrq_u32(out, vshlq_n_u32(vandq_u32(vshlq_u32(v, vdupq_n_s32(-from[2])), byte), 16));
+		out = vorrq_u32(out, vshlq_n_u32(vshlq_u32(v, vdupq_n_s32(-from[3])), 24));
+		vst1q_u32(&p[i], out);
+	}
+
+	return i;
+}
+
+#endif /* !PIXELS_NEON */
+
+/* --------------------------------------------------------
+ * Dispatch
+ * -------------------------------------------------------- */
+
+int
+pixelsLayout(const SDL_PixelFormat *format, PixelLayout *layout)
+{
+	Uint32 used;
+
+	if (format->BytesPerPixel != 4 || format->Rloss || format->Gloss ||
+	    format->Bloss || (format->Amask && format->Aloss))
+		return SDL_SetError("surface must be 32-bit with 8-bit channels");
+
+	layout->r = format->Rshift;
+	layout->g = format->Gshift;
+	layout->b = format->Bshift;
+	layout->hasalpha = format->Amask != 0;
+
+	if (layout->hasalpha)
+		layout->a = format->Ashift;
+	else {
+		/* The padding byte is the one left */
+		used = format->Rmask | format->Gmask | format->Bmask;
+
+		for (layout->a = 0; layout->a < 24; layout->a += 8)
+			if (!(used & 0xffU << layout->a))
+				break;
+	}
+
+	return 0;
+}
+
+void
+pixelsMultiply(Uint32 *pixels, size_t count, Uint32 factor)
+{
+	size_t done = 0;
+
+	switch (backend()) {
+#if defined(PIXELS_AVX2)
+	case BackendAVX2:
+		done = multiplyAVX2(pixels, count, factor);
+		break;
+#endif
+#if defined(PIXELS_SSE2)
+	case BackendSSE2:
+		done = multiplySSE2(pixels, count, factor);
+		break;
+#endif
+#if defined(PIXELS_NEON)
+	case BackendNEON:
+		done = multiplyNEON(pixels, count, factor);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	multiplyScalar(pixels + done, count - done, factor);
+}
+
+void
+pixelsPremultiply(Uint32 *pixels, size_t count, const PixelLayout *layout)
+{
+	size_t done = 0;
+
+	switch (backend()) {
+#if defined(PIXELS_AVX2)
+	case BackendAVX2:
+		done = premultiplyAVX2(pixels, count, layout);
+		break;
+#endif
+#if defined(PIXELS_SSE2)
+	case BackendSSE2:
+		done = premultiplySSE2(pixels, count, layout);
+		break;
+#endif
+#if defined(PIXELS_NEON)
+	case BackendNEON:
+		done = premultiplyNEON(pixels, count, layout);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	premultiplyScalar(pixels + done, count - done, layout);
+}
+
+void
+pixelsGrayscale(Uint32 *pixels, size_t count, const PixelLayout *layout)
+{
+	size_t done = 0;
+
+	switch (backend()) {
+#if defined(PIXELS_AVX2)
+	case BackendAVX2:
+		done = grayscaleAVX2(pixels, count, layout);
+		break;
+#endif
+#if defined(PIXELS_SSE2)
+	case BackendSSE2:
+		done = grayscaleSSE2(pixels, count, layout);
+		break;
+#endif
+#if defined(PIXELS_NEON)
+	case BackendNEON:
+		done = grayscaleNEON(pixels, count, layout);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	grayscaleScalar(pixels + done, count - done, layout);
+}
+
+void
+pixelsSwizzle(Uint32 *pixels, size_t count, const int from[4])
+{
+	size_t done = 0;
+
+	switch (backend()) {
+#if defined(PIXELS_AVX2)
+	case BackendAVX2:
+		done = swizzleAVX2(pixels, count, from);
+		break;
+#endif
+#if defined(PIXELS_SSE2)
+	case BackendSSE2:
+		done = swizzleSSE2(pixels, count, from);
+		break;
+#endif
+#if defined(PIXELS_NEON)
+	case BackendNEON:
+		done = swizzleNEON(pixels, count, from);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	swizzleScalar(pixels + done, count - done, from);
+}
+
+/*
+ * Table lookups and map searches do not vectorize without gathers, they
+ * stay scalar on every backend.
+ */
+void
+pixelsLookup(Uint32 *pixels, size_t count, const PixelLayout *layout, const Uint8 table[256])
+{
+	Uint32 keep = ~colorMask(layout), v;
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		v = pixels[i];
+		pixels[i] = (v & keep) |
+		    (Uint32)table[v >> layout->r & 0xff] << layout->r |
+		    (Uint32)table[v >> layout->g & 0xff] << layout->g |
+		    (Uint32)table[v >> layout->b & 0xff] << layout->b;
+	}
+}
+
+void
+pixelsRemap(Uint32 *pixels, size_t count, const Uint32 *map, size_t length)
+{
+	Uint32 last = 0, lastto = 0, v;
+	int haslast = 0;
+	size_t i, lo, hi, mid;
+
+	for (i = 0; i < count; ++i) {
+		v = pixels[i];
+
+		/* Runs of the same color are common */
+		if (haslast && v == last) {
+			pixels[i] = lastto;
+			continue;
+		}
+
+		for (lo = 0, hi = length; lo < hi; ) {
+			mid = lo + (hi - lo) / 2;
+
+			if (map[mid * 2] < v)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		last = v;
+		lastto = (lo < length && map[lo * 2] == v) ? map[lo * 2 + 1] : v;
+		haslast = 1;
+		pixels[i] = lastto;
+	}
+}
+
+/* --------------------------------------------------------
+ * Resampling
+ * -------------------------------------------------------- */
+
+/*
+ * Weights are 2.14 fixed point, every byte is summed in 32 bits and the
+ * result clamped to 0-255. The vector paths do the same integer operations
+ * so the results match the scalar ones.
+ */
+#define RESIZE_BITS	14
+#define RESIZE_ONE	(1 << RESIZE_BITS)
+#define RESIZE_HALF	(1 << (RESIZE_BITS - 1))
+
+#define RESIZE_PI	3.14159265358979323846
+
+/*
+ * Source span and weights of every destination pixel of one axis.
+ */
+typedef struct taps {
+	int		*start;		/*! first source pixel */
+	int		*count;		/*! number of source pixels */
+	Sint16		*weights;	/*! stride pixels per destination pixel */
+	int		 stride;	/*! maximum number of source pixels */
+} Taps;
+
+static double
+filterSupport(PixelFilter filter)
+{
+	switch (filter) {
+	case PixelFilterBilinear:
+		return 1.0;
+	case PixelFilterLanczos:
+		return 3.0;
+	default:
+		break;
+	}
+
+	return 0.5;
+}
+
+static double
+filterSinc(double x)
+{
+	if (x == 0.0)
+		return 1.0;
+
+	x *= RESIZE_PI;
+
+	return SDL_sin(x) / x;
+}
+
+static double
+filterValue(PixelFilter filter, double x)
+{
+	switch (filter) {
+	case PixelFilterBilinear:
+		if (x < 0.0)
+			x = -x;
+		return (x < 1.0) ? 1.0 - x : 0.0;
+	case PixelFilterLanczos:
+		if (x <= -3.0 || x >= 3.0)
+			return 0.0;
+		return filterSinc(x) * filterSinc(x / 3.0);
+	default:
+		break;
+	}
+
+	return (x > -0.5 && x <= 0.5) ? 1.0 : 0.0;
+}
+
+static void
+tapsFree(Taps *taps)
+{
+	free(taps->start);
+	free(taps->count);
+	free(taps->weights);
+}
+
+/*
+ * The filter is widened by the scale when downscaling so it covers every
+ * source pixel, weights are normalized so they sum to RESIZE_ONE.
+ */
+static int
+tapsInit(Taps *taps, int in, int out, PixelFilter filter)
+{
+	double scale = (double)in / out, fscale, support, center, total;
+	double *w;
+	Sint16 *iw;
+	int i, j, min, max, sum, top;
+
+	fscale = (scale > 1.0) ? scale : 1.0;
+	support = filterSupport(filter) * fscale;
+
+	taps->stride = (int)SDL_ceil(support) * 2 + 1;
+	taps->start = malloc(sizeof (int) * out);
+	taps->count = malloc(sizeof (int) * out);
+	taps->weights = calloc((size_t)out * taps->stride, sizeof (Sint16));
+	w = malloc(sizeof (double) * taps->stride);
+
+	if (taps->start == NULL || taps->count == NULL || taps->weights == NULL || w == NULL) {
+		tapsFree(taps);
+		free(w);
+		return SDL_OutOfMemory();
+	}
+
+	for (i = 0; i < out; ++i) {
+		center = (i + 0.5) * scale;
+
+		if ((min = (int)(center - support + 0.5)) < 0)
+			min = 0;
+		if ((max = (int)(center + support + 0.5)) > in)
+			max = in;
+		if (max - min > taps->stride)
+			max = min + taps->stride;
+
+		total = 0.0;
+		for (j = 0; j < max - min; ++j) {
+			w[j] = filterValue(filter, (j + min - center + 0.5) / fscale);
+			total += w[j];
+		}
+
+		/* Tiny spans at the borders may only see zero weights */
+		if (total == 0.0) {
+			min = (int)center;
+			max = min + 1;
+			w[0] = total = 1.0;
+		}
+
+		iw = &taps->weights[(size_t)i * taps->stride];
+		sum = top = 0;
+
+		for (j = 0; j < max - min; ++j) {
+			iw[j] = (Sint16)SDL_floor(w[j] / total * RESIZE_ONE + 0.5);
+			sum += iw[j];
+
+			if (iw[j] > iw[top])
+				top = j;
+		}
+
+		/* Rounding leftovers go to the heaviest pixel */
+		iw[top] += RESIZE_ONE - sum;
+
+		taps->start[i] = min;
+		taps->count[i] = max - min;
+	}
+
+	free(w);
+
+	return 0;
+}
+
+static Uint8
+resizeClamp(int sum)
+{
+	sum >>= RESIZE_BITS;
+
+	return (sum < 0) ? 0 : (sum > 255) ? 255 : sum;
+}
+
+static void
+resizeRowScalar(const Uint32 *src, Uint32 *dst, int x, int w, const Taps *taps)
+{
+	const Uint8 *p;
+	const Sint16 *iw;
+	Uint8 *out;
+	int sum[4], c, j;
+
+	for (; x < w; ++x) {
+		p = (const Uint8 *)&src[taps->start[x]];
+		iw = &taps->weights[(size_t)x * taps->stride];
+		out = (Uint8 *)&dst[x];
+
+		sum[0] = sum[1] = sum[2] = sum[3] = RESIZE_HALF;
+
+		for (j = 0; j < taps->count[x]; ++j, p += 4)
+			for (c = 0; c < 4; ++c)
+				sum[c] += p[c] * iw[j];
+
+		for (c = 0; c < 4; ++c)
+			out[c] = resizeClamp(sum[c]);
+	}
+}
+
+/*
+ * Rows of the span are rows + start * pitch, weights in iw.
+ */
+static void
+resizeColumnScalar(const Uint8 *rows, size_t pitch, int n, const Sint16 *iw, Uint32 *dst, int x, int w)
+{
+	const Uint8 *p;
+	Uint8 *out;
+	int sum, j;
+
+	for (x *= 4, w *= 4; x < w; ++x) {
+		p = rows + x;
+		out = (Uint8 *)dst + x;
+		sum = RESIZE_HALF;
+
+		for (j = 0; j < n; ++j, p += pitch)
+			sum += *p * iw[j];
+
+		*out = resizeClamp(sum);
+	}
+}
+
+#if defined(PIXELS_SSE2)
+
+/*
+ * Bytes are widened to 32 bits with zero high halves, _mm_madd_epi16 with
+ * the weight in the low halves gives the signed products.
+ */
+static int
+resizeRowSSE2(const Uint32 *src, Uint32 *dst, int w, const Taps *taps)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const Sint16 *iw;
+	__m128i acc, p, wv;
+	int x, j, start;
+
+	for (x = 0; x < w; ++x) {
+		iw = &taps->weights[(size_t)x * taps->stride];
+		start = taps->start[x];
+		acc = _mm_set1_epi32(RESIZE_HALF);
+
+		for (j = 0; j < taps->count[x]; ++j) {
+			p = _mm_cvtsi32_si128((int)src[start + j]);
+			p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(p, zero), zero);
+			wv = _mm_set1_epi32((Uint16)iw[j]);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(p, wv));
+		}
+
+		acc = _mm_srai_epi32(acc, RESIZE_BITS);
+		acc = _mm_packs_epi32(acc, acc);
+		dst[x] = (Uint32)_mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+	}
+
+	return w;
+}
+
+static int
+resizeColumnSSE2(const Uint8 *rows, size_t pitch, int n, const Sint16 *iw, Uint32 *dst, int w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i half = _mm_set1_epi32(RESIZE_HALF);
+	__m128i a0, a1, a2, a3, v, lo, hi, wv;
+	int x, j;
+
+	for (x = 0; x + 4 <= w; x += 4) {
+		a0 = a1 = a2 = a3 = half;
+
+		for (j = 0; j < n; ++j) {
+			v = _mm_loadu_si128((const __m128i *)(rows + j * pitch + x * 4));
+			wv = _mm_set1_epi32((Uint16)iw[j]);
+			lo = _mm_unpacklo_epi8(v, zero);
+			hi = _mm_unpackhi_epi8(v, zero);
+			a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_unpacklo_epi16(lo, zero), wv));
+			a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_unpackhi_epi16(lo, zero), wv));
+			a2 = _mm_add_epi32(a2, _mm_madd_epi16(_mm_unpacklo_epi16(hi, zero), wv));
+			a3 = _mm_add_epi32(a3, _mm_madd_epi16(_mm_unpackhi_epi16(hi, zero), wv));
+		}
+
+		lo = _mm_packs_epi32(_mm_srai_epi32(a0, RESIZE_BITS), _mm_srai_epi32(a1, RESIZE_BITS));
+		hi = _mm_packs_epi32(_mm_srai_epi32(a2, RESIZE_BITS), _mm_srai_epi32(a3, RESIZE_BITS));
+		_mm_storeu_si128((__m128i *)&dst[x], _mm_packus_epi16(lo, hi));
+	}
+
+	return x;
+}
+
+#endif /* !PIXELS_SSE2 */
+
+/*
+ * Two passes, rows are resampled horizontally into a temporary image and
+ * its columns vertically into the destination.
+ */
+int
+pixelsResize(const Uint32 *src, int sw, int sh, int spitch,
+	     Uint32 *dst, int dw, int dh, int dpitch,
+	     PixelFilter filter)
+{
+	Taps htaps, vtaps;
+	Uint32 *tmp;
+	const Uint8 *rows;
+	const Sint16 *iw;
+	int x, y;
+#if defined(PIXELS_SSE2)
+	int vector = backend() == BackendSSE2 || backend() == BackendAVX2;
+#endif
+
+	if (tapsInit(&htaps, sw, dw, filter) < 0)
+		return -1;
+	if (tapsInit(&vtaps, sh, dh, filter) < 0) {
+		tapsFree(&htaps);
+		return -1;
+	}
+	if ((tmp = malloc(sizeof (Uint32) * dw * sh)) == NULL) {
+		tapsFree(&htaps);
+		tapsFree(&vtaps);
+		return SDL_OutOfMemory();
+	}
+
+	for (y = 0; y < sh; ++y) {
+		const Uint32 *in = (const Uint32 *)((const Uint8 *)src + (size_t)y * spitch);
+
+		x = 0;
+#if defined(PIXELS_SSE2)
+		if (vector)
+			x = resizeRowSSE2(in, tmp + (size_t)y * dw, dw, &htaps);
+#endif
+		resizeRowScalar(in, tmp + (size_t)y * dw, x, dw, &htaps);
+	}
+
+	for (y = 0; y < dh; ++y) {
+		Uint32 *out = (Uint32 *)((Uint8 *)dst + (size_t)y * dpitch);
+
+		rows = (const Uint8 *)(tmp + (size_t)vtaps.start[y] * dw);
+		iw = &vtaps.weights[(size_t)y * vtaps.stride];
+		x = 0;
+#if defined(PIXELS_SSE2)
+		if (vector)
+			x = resizeColumnSSE2(rows, dw * 4, vtaps.count[y], iw, out, dw);
+#endif
+		resizeColumnScalar(rows, dw * 4, vtaps.count[y], iw, out, x, dw);
+	}
+
+	free(tmp);
+	tapsFree(&htaps);
+	tapsFree(&vtaps);
+
+	return 0;
+}
+
+/*
+ * A height of 1 reads the same row twice, so the sum is always over two
+ * rows and step columns.
+ */
+static void
+halveScalar(const Uint8 *r0, const Uint8 *r1, Uint8 *out, int x, int w, int step)
+{
+	const Uint8 *a, *b;
+	int c, sum;
+
+	for (; x < w; ++x) {
+		a = r0 + x * step * 4;
+		b = r1 + x * step * 4;
+
+		for (c = 0; c < 4; ++c) {
+			sum = a[c] + b[c];
+
+			if (step == 2)
+				sum += a[c + 4] + b[c + 4];
+
+			*out++ = (Uint8)((sum + step) >> step);
+		}
+	}
+}
+
+#if defined(PIXELS_SSE2)
+
+/*
+ * 2 destination pixels from 4 pixels of both rows.
+ */
+static int
+halveSSE2(const Uint8 *r0, const Uint8 *r1, Uint8 *out, int w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	__m128i a, b, lo, hi;
+	int x;
+
+	for (x = 0; x + 2 <= w; x += 2) {
+		a = _mm_loadu_si128((const __m128i *)(r0 + x * 8));
+		b = _mm_loadu_si128((const __m128i *)(r1 + x * 8));
+		lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+		hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+		lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+		hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+		lo = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+		_mm_storel_epi64((__m128i *)(out + x * 4), _mm_packus_epi16(lo, zero));
+	}
+
+	return x;
+}
+
+#endif /* !PIXELS_SSE2 */
+
+void
+pixelsHalve(const Uint32 *src, int sw, int sh, int spitch, Uint32 *dst, int dpitch)
+{
+	const Uint8 *r0, *r1;
+	Uint8 *out;
+	int dw = (sw > 1) ? sw / 2 : 1, dh = (sh > 1) ? sh / 2 : 1, x, y;
+
+	for (y = 0; y < dh; ++y) {
+		r0 = (const Uint8 *)src + (size_t)y * (sh > 1 ? 2 : 1) * spitch;
+		r1 = (sh > 1) ? r0 + spitch : r0;
+		out = (Uint8 *)dst + (size_t)y * dpitch;
+		x = 0;
+
+#if defined(PIXELS_SSE2)
+		if (sw > 1 && (backend() == BackendSSE2 || backend() == BackendAVX2))
+			x = halveSSE2(r0, r1, out, dw);
+#endif
+		halveScalar(r0, r1, out + x * 4, x, dw, sw > 1 ? 2 : 1);
+	}
+}
+
+/* --------------------------------------------------------
+ * Comparison
+ * -------------------------------------------------------- */
+
+static size_t
+diffScalar(const Uint32 *a, const Uint32 *b, size_t n, Uint32 mask)
+{
+	size_t i, changed = 0;
+
+	for (i = 0; i < n; ++i)
+		changed += ((a[i] ^ b[i]) & mask) != 0;
+
+	return changed;
+}
+
+/*
+ * The vector paths count the equal pixels, every lane subtracts its all
+ * ones comparison result. They return the number of pixels done and add
+ * the different ones to changed.
+ */
+#if defined(PIXELS_SSE2)
+
+static size_t
+diffSSE2(const Uint32 *a, const Uint32 *b, size_t n, Uint32 mask, size_t *changed)
+{
+	const __m128i m = _mm_set1_epi32((int)mask);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i same = zero, x;
+	Uint32 lanes[4];
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&a[i]),
+		    _mm_loadu_si128((const __m128i *)&b[i]));
+		x = _mm_cmpeq_epi32(_mm_and_si128(x, m), zero);
+		same = _mm_sub_epi32(same, x);
+	}
+
+	_mm_storeu_si128((__m128i *)lanes, same);
+	*changed += i - (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+
+	return i;
+}
+
+#endif /* !PIXELS_SSE2 */
+
+#if defined(PIXELS_AVX2)
+
+AVX2 static size_t
+diffAVX2(const Uint32 *a, const Uint32 *b, size_t n, Uint32 mask, size_t *changed)
+{
+	const __m256i m = _mm256_set1_epi32((int)mask);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i same = zero, x;
+	Uint32 lanes[8];
+	size_t i, j, equal = 0;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&a[i]),
+		    _mm256_loadu_si256((const __m256i *)&b[i]));
+		x = _mm256_cmpeq_epi32(_mm256_and_si256(x, m), zero);
+		same = _mm256_sub_epi32(same, x);
+	}
+
+	_mm256_storeu_si256((__m256i *)lanes, same);
+
+	for (j = 0; j < 8; ++j)
+		equal += lanes[j];
+
+	*changed += i - equal;
+
+	return i;
+}
+
+#endif /* !PIXELS_AVX2 */
+
+#if defined(PIXELS_NEON)
+
+static size_t
+diffNEON(const Uint32 *a, const Uint32 *b, size_t n, Uint32 mask, size_t *changed)
+{
+	const uint32x4_t m = vdupq_n_u32(mask);
+	const uint32x4_t zero = vdupq_n_u32(0);
+	uint32x4_t same = zero, x;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		x = veorq_u32(vld1q_u32(&a[i]), vld1q_u32(&b[i]));
+		x = vceqq_u32(vandq_u32(x, m), zero);
+		same = vsubq_u32(same, x);
+	}
+
+	*changed += i - (vgetq_lane_u32(same, 0) + vgetq_lane_u32(same, 1) +
+	    vgetq_lane_u32(same, 2) + vgetq_lane_u32(same, 3));
+
+	return i;
+}
+
+#endif /* !PIXELS_NEON */
+
+size_t
+pixelsDiff(const Uint32 *a, const Uint32 *b, size_t count, Uint32 mask)
+{
+	size_t done = 0, changed = 0;
+
+	switch (backend()) {
+#if defined(PIXELS_AVX2)
+	case BackendAVX2:
+		done = diffAVX2(a, b, count, mask, &changed);
+		break;
+#endif
+#if defined(PIXELS_SSE2)
+	case BackendSSE2:
+		done = diffSSE2(a, b, count, mask, &changed);
+		break;
+#endif
+#if defined(PIXELS_NEON)
+	case BackendNEON:
+		done = diffNEON(a, b, count, mask, &changed);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	return changed + diffScalar(a + done, b + done, count - done, mask);
+}
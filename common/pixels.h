@@ -0,0 +1,171 @@
+/*
+ * pixels.h -- in place kernels over 32-bit pixels
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _PIXELS_H_
+#define _PIXELS_H_
+
+#include <stddef.h>
+
+#include <SDL.h>
+
+/**
+ * @struct PixelLayout
+ * @brief position of the 8-bit channels in a 32-bit pixel
+ *
+ * Formats without alpha still have a padding byte, its shift is stored in
+ * a and hasalpha is 0.
+ */
+typedef struct pixel_layout {
+	int		 r;		/*! red shift */
+	int		 g;		/*! green shift */
+	int		 b;		/*! blue shift */
+	int		 a;		/*! alpha or padding shift */
+	int		 hasalpha;	/*! the format has alpha */
+} PixelLayout;
+
+/**
+ * @enum PixelFilter
+ * @brief resampling filters of pixelsResize
+ */
+typedef enum pixel_filter {
+	PixelFilterBox,			/*! area average */
+	PixelFilterBilinear,		/*! triangle */
+	PixelFilterLanczos		/*! windowed sinc, 3 lobes */
+} PixelFilter;
+
+/**
+ * Get the layout of a pixel format.
+ *
+ * @param format the format
+ * @param layout the result
+ * @return 0 on success or -1 if the format is not 8-bit per channel
+ * 32-bit, with the SDL error set
+ */
+int
+pixelsLayout(const SDL_PixelFormat *format, PixelLayout *layout);
+
+/**
+ * Multiply every byte by the matching byte of factor, divided by 255.
+ *
+ * @param pixels the pixels
+ * @param count the number of pixels
+ * @param factor the factor
+ */
+void
+pixelsMultiply(Uint32 *pixels, size_t count, Uint32 factor);
+
+/**
+ * Multiply the color channels by the alpha channel.
+ *
+ * @param pixels the pixels
+ * @param count the number of pixels
+ * @param layout the layout, it must have alpha
+ */
+void
+pixelsPremultiply(Uint32 *pixels, size_t count, const PixelLayout *layout);
+
+/**
+ * Replace the color channels by the luma, (77 r + 150 g + 29 b) / 256.
+ *
+ * @param pixels the pixels
+ * @param count the number of pixels
+ * @param layout the layout
+ */
+void
+pixelsGrayscale(Uint32 *pixels, size_t count, const PixelLayout *layout);
+
+/**
+ * Move bytes around, byte i of the result is byte from[i] of the pixel.
+ *
+ * @param pixels the pixels
+ * @param count the number of pixels
+ * @param from the source shift of the bytes at shift 0, 8, 16 and 24
+ */
+void
+pixelsSwizzle(Uint32 *pixels, size_t count, const int from[4]);
+
+/**
+ * Pass the color channels through a table, alpha is kept.
+ *
+ * @param pixels the pixels
+ * @param count the number of pixels
+ * @param layout the layout
+ * @param table the new value of every channel value
+ */
+void
+pixelsLookup(Uint32 *pixels, size_t count, const PixelLayout *layout, const Uint8 table[256]);
+
+/**
+ * Replace pixel values found in a map.
+ *
+ * @param pixels the pixels
+ * @param count the number of pixels
+ * @param map pairs of old and new values sorted by old value
+ * @param length the number of pairs
+ */
+void
+pixelsRemap(Uint32 *pixels, size_t count, const Uint32 *map, size_t length);
+
+/**
+ * Resample 32-bit pixels, every byte is filtered on its own so the
+ * channel layout does not matter. Filters widen when downscaling so every
+ * source pixel contributes.
+ *
+ * @param src the source pixels
+ * @param sw the source width
+ * @param sh the source height
+ * @param spitch the source pitch in bytes
+ * @param dst the destination pixels
+ * @param dw the destination width
+ * @param dh the destination height
+ * @param dpitch the destination pitch in bytes
+ * @param filter the filter
+ * @return 0 on success or -1 with the SDL error set
+ */
+int
+pixelsResize(const Uint32 *src, int sw, int sh, int spitch,
+	     Uint32 *dst, int dw, int dh, int dpitch,
+	     PixelFilter filter);
+
+/**
+ * Halve 32-bit pixels, every byte is the rounded average of its 2x2 block.
+ * Both sizes must be even or 1, a size of 1 is kept.
+ *
+ * @param src the source pixels
+ * @param sw the source width
+ * @param sh the source height
+ * @param spitch the source pitch in bytes
+ * @param dst the destination pixels
+ * @param dpitch the destination pitch in bytes
+ */
+void
+pixelsHalve(const Uint32 *src, int sw, int sh, int spitch, Uint32 *dst, int dpitch);
+
+/**
+ * Count the pixels that differ in the bits of mask.
+ *
+ * @param a the first pixels
+ * @param b the second pixels
+ * @param count the number of pixels
+ * @param mask the bits to compare
+ * @return the number of different pixels
+ */
+size_t
+pixelsDiff(const Uint32 *a, const Uint32 *b, size_t count, Uint32 mask);
+
+#endif /* !_PIXELS_H_ */
@@ -0,0 +1,191 @@
+/*
+ * qoi.c -- QOI image encoder
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "qoi.h"
+
+#define QOI_OP_INDEX	0x00
+#define QOI_OP_DIFF	0x40
+#define QOI_OP_LUMA	0x80
+#define QOI_OP_RUN	0xc0
+#define QOI_OP_RGB	0xfe
+#define QOI_OP_RGBA	0xff
+
+#define QOI_HEADER	14
+#define QOI_END		8
+#define QOI_MAXRUN	62
+
+/*
+ * Pixels are compared as r << 24 | g << 16 | b << 8 | a.
+ */
+#define QOI_HASH(r, g, b, a)	(((r) * 3 + (g) * 5 + (b) * 7 + (a) * 11) % 64)
+
+static Uint8 *
+put32(Uint8 *p, Uint32 v)
+{
+	*p++ = v >> 24;
+	*p++ = v >> 16;
+	*p++ = v >> 8;
+	*p++ = v;
+
+	return p;
+}
+
+/*
+ * Difference wrapped to -128..127 like the reference encoder.
+ */
+static int
+qoiDelta(int now, int before)
+{
+	return ((now - before + 128) & 0xff) - 128;
+}
+
+Uint8 *
+qoiEncode(const void *pixels, int w, int h, int pitch, const PixelLayout *layout, size_t *length)
+{
+	Uint32 index[64] = { 0 }, prev = 0xff, px, v;
+	const Uint32 *row;
+	Uint8 *data, *p;
+	int channels = (layout->hasalpha) ? 4 : 3;
+	int x, y, r, g, b, a, pr = 0, pg = 0, pb = 0, pa = 255, run = 0;
+	int vr, vg, vb, hash;
+
+	/* Worst case is one RGBA operation per pixel */
+	data = malloc((size_t)w * h * (channels + 1) + QOI_HEADER + QOI_END);
+
+	if (data == NULL) {
+		SDL_OutOfMemory();
+		return NULL;
+	}
+
+	p = data;
+	*p++ = 'q';
+	*p++ = 'o';
+	*p++ = 'i';
+	*p++ = 'f';
+	p = put32(p, w);
+	p = put32(p, h);
+	*p++ = channels;
+	*p++ = 0;			/* sRGB with linear alpha */
+
+	for (y = 0; y < h; ++y) {
+		row = (const Uint32 *)((const Uint8 *)pixels + (size_t)y * pitch);
+
+		for (x = 0; x < w; ++x) {
+			v = row[x];
+			r = v >> layout->r & 0xff;
+			g = v >> layout->g & 0xff;
+			b = v >> layout->b & 0xff;
+			a = (layout->hasalpha) ? (v >> layout->a & 0xff) : 255;
+			px = (Uint32)r << 24 | (Uint32)g << 16 | (Uint32)b << 8 | (Uint32)a;
+
+			if (px == prev) {
+				if (++run == QOI_MAXRUN || (y == h - 1 && x == w - 1)) {
+					*p++ = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+
+				continue;
+			}
+
+			if (run > 0) {
+				*p++ = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+
+			hash = QOI_HASH(r, g, b, a);
+
+			if (index[hash] == px)
+				*p++ = QOI_OP_INDEX | hash;
+			else {
+				index[hash] = px;
+
+				if (a == pa) {
+					vr = qoiDelta(r, pr);
+					vg = qoiDelta(g, pg);
+					vb = qoiDelta(b, pb);
+
+					if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1)
+						*p++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+					else if (vr - vg >= -8 && vr - vg <= 7 && vg >= -32 && vg <= 31 &&
+					    vb - vg >= -8 && vb - vg <= 7) {
+						*p++ = QOI_OP_LUMA | (vg + 32);
+						*p++ = (vr - vg + 8) << 4 | (vb - vg + 8);
+					} else {
+						*p++ = QOI_OP_RGB;
+						*p++ = r;
+						*p++ = g;
+						*p++ = b;
+					}
+				} else {
+					*p++ = QOI_OP_RGBA;
+					*p++ = r;
+					*p++ = g;
+					*p++ = b;
+					*p++ = a;
+				}
+			}
+
+			prev = px;
+			pr = r;
+			pg = g;
+			pb = b;
+			pa = a;
+		}
+	}
+
+	for (x = 0; x < QOI_END - 1; ++x)
+		*p++ = 0;
+
+	*p++ = 1;
+	*length = p - data;
+
+	return data;
+}
+
+Uint8 *
+qoiEncodeSurface(SDL_Surface *surface, size_t *length)
+{
+	SDL_Surface *conv;
+	PixelLayout layout;
+	Uint8 *data;
+
+	if (pixelsLayout(surface->format, &layout) == 0) {
+		if (SDL_LockSurface(surface) < 0)
+			return NULL;
+
+		data = qoiEncode(surface->pixels, surface->w, surface->h,
+		    surface->pitch, &layout, length);
+		SDL_UnlockSurface(surface);
+
+		return data;
+	}
+
+	if ((conv = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0)) == NULL)
+		return NULL;
+
+	/* Converted formats without alpha get an opaque one */
+	pixelsLayout(conv->format, &layout);
+	layout.hasalpha = surface->format->Amask != 0;
+
+	data = qoiEncode(conv->pixels, conv->w, conv->h, conv->pitch, &layout, length);
+	SDL_FreeSurface(conv);
+
+	return data;
+}
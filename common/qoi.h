@@ -0,0 +1,55 @@
+/*
+ * qoi.h -- QOI image encoder
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _QOI_H_
+#define _QOI_H_
+
+#include <stddef.h>
+
+#include <SDL.h>
+
+#include "pixels.h"
+
+/**
+ * Encode 32-bit pixels to the QOI format, formats without alpha are
+ * written with 3 channels. It touches no Lua state so any thread can call
+ * it.
+ *
+ * @param pixels the pixels
+ * @param w the width
+ * @param h the height
+ * @param pitch the pitch in bytes
+ * @param layout the layout of the pixels
+ * @param length the encoded length
+ * @return the encoded data to free or NULL with the SDL error set
+ */
+Uint8 *
+qoiEncode(const void *pixels, int w, int h, int pitch, const PixelLayout *layout, size_t *length);
+
+/**
+ * Encode a surface to the QOI format, formats other than 32-bit with 8-bit
+ * channels are converted first.
+ *
+ * @param surface the surface
+ * @param length the encoded length
+ * @return the encoded data to free or NULL with the SDL error set
+ */
+Uint8 *
+qoiEncodeSurface(SDL_Surface *surface, size_t *length);
+
+#endif /* !_QOI_H_ */
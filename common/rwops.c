@@ -16,8 +16,11 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "pack.h"
 #include "rwops.h"
 
 /* --------------------------------------------------------
@@ -374,6 +377,88 @@ l_rw_read(lua_State *L)
 	return nret;
 }
 
+/*
+ * Read the payload of a value. When the stream size is unknown the buffer
+ * grows with what has been read so that a bogus length can not make us
+ * allocate up to 4 GiB upfront.
+ */
+static void *
+readValueData(SDL_RWops *ops, size_t length, int bounded, const char **error)
+{
+	unsigned char *ptr = NULL, *grown;
+	size_t nread = 0, capacity = bounded ? length : 0;
+
+	do {
+		if (nread == capacity) {
+			capacity = capacity < 4096 ? 4096 : capacity * 2;
+			capacity = capacity > length ? length : capacity;
+		}
+
+		/* One more byte so that an empty value still gets a buffer */
+		if ((grown = realloc(ptr, capacity + 1)) == NULL) {
+			*error = strerror(errno);
+			free(ptr);
+			return NULL;
+		}
+
+		ptr = grown;
+
+		if (capacity > nread &&
+		    SDL_RWread(ops, ptr + nread, capacity - nread, 1) != 1) {
+			*error = "truncated value";
+			free(ptr);
+			return NULL;
+		}
+
+		nread = capacity;
+	} while (nread < length);
+
+	return ptr;
+}
+
+/*
+ * RWOps:readValue()
+ *
+ * Returns:
+ *	The value written by RWOps:writeValue or nil
+ *	The error message
+ */
+static int
+l_rw_readValue(lua_State *L)
+{
+	SDL_RWops *ops	= commonGetAs(L, 1, RWOpsName, SDL_RWops *);
+	unsigned char header[4];
+	size_t length;
+	Sint64 size, offset;
+	const char *error;
+	void *ptr;
+	int bounded, nret;
+
+	if (SDL_RWread(ops, header, sizeof (header), 1) != 1)
+		return commonPush(L, "ns", "no value to read");
+
+	length = (size_t)header[0] | (size_t)header[1] << 8 |
+	    (size_t)header[2] << 16 | (size_t)header[3] << 24;
+
+	/* The length is untrusted, never allocate more than what remains */
+	bounded = (size = SDL_RWsize(ops)) >= 0 &&
+	    (offset = SDL_RWtell(ops)) >= 0 && offset <= size;
+
+	if (bounded && (Uint64)length > (Uint64)(size - offset))
+		return commonPush(L, "ns", "truncated value");
+
+	if ((ptr = readValueData(ops, length, bounded, &error)) == NULL)
+		nret = commonPush(L, "ns", error);
+	else if (unpackValue(L, ptr, length) < 0)
+		nret = commonPushSDLError(L, 1);
+	else
+		nret = 1;
+
+	free(ptr);
+
+	return nret;
+}
+
 /*
  * RWOps:readByte(size, mode)
  *
@@ -463,6 +548,56 @@ l_rw_write(lua_State *L)
 	return nret;
 }
 
+/*
+ * RWOps:writeValue(value)
+ *
+ * The value is packed like SDL.pack does and preceded by its length as
+ * a 32 bits little endian integer.
+ *
+ * Arguments:
+ *	value the value to write
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_rw_writeValue(lua_State *L)
+{
+	SDL_RWops *ops	= commonGetAs(L, 1, RWOpsName, SDL_RWops *);
+	PackBuffer b;
+	size_t length;
+	int nret;
+
+	luaL_checkany(L, 2);
+	packInit(&b, NULL, 0, 4);
+
+	if (packValue(L, 2, &b) < 0) {
+		free(b.data);
+		return commonPushSDLError(L, 1);
+	}
+
+	/* The prefix is 32 bits, readValue could not find the end */
+	if ((length = b.length - b.head) > SDL_MAX_UINT32) {
+		free(b.data);
+		return commonPush(L, "ns", "value larger than 4 GiB");
+	}
+
+	b.data[0] = length & 0xff;
+	b.data[1] = (length >> 8) & 0xff;
+	b.data[2] = (length >> 16) & 0xff;
+	b.data[3] = (length >> 24) & 0xff;
+
+	if (SDL_RWwrite(ops, b.data, b.length, 1) != 1)
+		nret = commonPushSDLError(L, 1);
+	else
+		nret = commonPush(L, "b", 1);
+
+	free(b.data);
+
+	return nret;
+}
+
 /*
  * RWOps:writeByte(byte, size, mode)
  *
@@ -547,10 +682,12 @@ static const luaL_Reg methods[] = {
 	{ "close", 		l_rw_close		},
 	{ "read",		l_rw_read		},
 	{ "readByte",		l_rw_readByte		},
+	{ "readValue",		l_rw_readValue		},
 	{ "seek",		l_rw_seek		},
 	{ "tell",		l_rw_tell		},
 	{ "write",		l_rw_write		},
 	{ "writeByte",		l_rw_writeByte		},
+	{ "writeValue",		l_rw_writeValue		},
 	{ NULL,			NULL			}
 };
 
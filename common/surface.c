@@ -21,10 +21,33 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "array.h"
+#include "blit.h"
+#include "buffer.h"
+#include "pixels.h"
+#include "qoi.h"
 #include "rwops.h"
 #include "surface.h"
 #include "video.h"
 
+/*
+ * A region of a locked surface, surface is NULL once released.
+ */
+typedef struct view {
+	SDL_Surface	*surface;
+	SDL_Rect	 rect;
+	int		 readonly;	/* the surface is read-only */
+} View;
+
+/*
+ * Idle surfaces kept for reuse, at most limit of them.
+ */
+typedef struct pool {
+	SDL_Surface	**idle;
+	int		 count;
+	int		 limit;
+} Pool;
+
 /* --------------------------------------------------------
  * Surface functions
  * -------------------------------------------------------- */
@@ -82,7 +105,157 @@ static int l_surface_createRGB(lua_State *L)
 	return commonPush(L, "p", SurfaceName, s);
 }
 
-#if 0
+/*
+ * Get the pixels at index for a surface of height rows of pitch bytes,
+ * the string or buffer is borrowed without copy.
+ */
+static void *
+surfaceCheckPixels(lua_State *L, int index, int width, int height, int depth, int pitch)
+{
+	Buffer *b = bufferTest(L, index);
+	size_t length, needed;
+	void *pixels;
+
+	if (b != NULL) {
+		pixels = b->data;
+		length = b->length;
+	} else
+		pixels = (void *)luaL_checklstring(L, index, &length);
+
+	luaL_argcheck(L, width > 0 && height > 0, 2, "invalid size");
+	luaL_argcheck(L, pitch >= width * ((depth + 7) / 8), 5, "pitch too small");
+
+	needed = (size_t)pitch * (height - 1) + (size_t)width * ((depth + 7) / 8);
+
+	if (length < needed)
+		luaL_argerror(L, index, "not enough pixel data");
+
+	return pixels;
+}
+
+/*
+ * Keys of the fields read back from the surface user value. With Lua 5.1
+ * the user value of a plain surface is the globals table, light userdata
+ * keys can not be found there.
+ */
+static const char KeyPixels;
+static const char KeyPool;
+static const char KeyReadOnly;
+
+/*
+ * Get the table stored with the surface at index, nil if none.
+ */
+static void
+surfaceGetUservalue(lua_State *L, int index)
+{
+#if LUA_VERSION_NUM >= 502
+	lua_getuservalue(L, index);
+#else
+	lua_getfenv(L, index);
+#endif
+	if (lua_type(L, -1) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_pushnil(L);
+	}
+}
+
+/*
+ * Push the user value field of the surface at index or nil.
+ */
+static void
+surfaceGetField(lua_State *L, int index, const char *key)
+{
+	surfaceGetUservalue(L, index);
+
+	if (lua_type(L, -1) == LUA_TTABLE) {
+		lua_pushlightuserdata(L, (void *)key);
+		lua_rawget(L, -2);
+		lua_remove(L, -2);
+	}
+}
+
+/*
+ * Set the user value field of the surface at index to the value at the
+ * top of the stack, which is popped.
+ */
+static void
+surfaceSetField(lua_State *L, int index, const char *key)
+{
+	if (index < 0)
+		index = lua_gettop(L) + index + 1;
+
+	surfaceGetUservalue(L, index);
+	lua_pushlightuserdata(L, (void *)key);
+	lua_pushvalue(L, -3);
+	lua_rawset(L, -3);
+	lua_pop(L, 2);
+}
+
+static int
+surfaceIsReadOnly(lua_State *L, int index)
+{
+	int readonly;
+
+	surfaceGetField(L, index, &KeyReadOnly);
+	readonly = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+
+	return readonly;
+}
+
+/*
+ * Get the surface at index for a method changing its pixels.
+ */
+static SDL_Surface *
+surfaceCheckWritable(lua_State *L, int index)
+{
+	SDL_Surface *surf = commonGetAs(L, index, SurfaceName, SDL_Surface *);
+
+	if (surfaceIsReadOnly(L, index))
+		luaL_argerror(L, index, "surface is read-only");
+
+	return surf;
+}
+
+void
+surfaceSetReadOnly(lua_State *L, int index)
+{
+	lua_pushboolean(L, 1);
+	surfaceSetField(L, index < 0 ? index - 1 : index, &KeyReadOnly);
+}
+
+/*
+ * Push the surface using the pixels at index, they are kept alive as the
+ * surface user value and buffers are pinned. Strings are immutable so the
+ * surface is read-only.
+ */
+static int
+surfacePushBorrowed(lua_State *L, int index, SDL_Surface *s)
+{
+	Buffer *b;
+
+	if (s == NULL)
+		return commonPushSDLError(L, 1);
+	if ((b = bufferTest(L, index)) != NULL)
+		bufferPin(b);
+
+	commonPush(L, "p", SurfaceName, s);
+
+	lua_createtable(L, 0, 2);
+#if LUA_VERSION_NUM >= 502
+	lua_setuservalue(L, -2);
+#else
+	lua_setfenv(L, -2);
+#endif
+
+	lua_pushvalue(L, index);
+	surfaceSetField(L, -2, &KeyPixels);
+
+	if (b == NULL)
+		surfaceSetReadOnly(L, -1);
+
+	return 1;
+}
 
 /*
  * SDL.createRGBSurfaceFrom(pixels,
@@ -95,7 +268,11 @@ static int l_surface_createRGB(lua_State *L)
  * 			    bmask,
  * 			    amask)
  *
- * Create a surface object and return it.
+ * Create a surface over existing pixels and return it. A buffer is pinned
+ * while the surface lives, a surface over a string is read-only.
+ *
+ * Params:
+ *	pixels the string or buffer
  *
  * Returns:
  *	The surface or nil
@@ -103,30 +280,47 @@ static int l_surface_createRGB(lua_State *L)
  */
 static int l_surface_createRGBFrom(lua_State *L)
 {
-	char *pixels	= strdup(luaL_checkstring(L, 1));
 	int width	= luaL_checkinteger(L, 2);
 	int height	= luaL_checkinteger(L, 3);
 	int depth	= luaL_checkinteger(L, 4);
 	int pitch	= luaL_checkinteger(L, 5);
-	int rmask	= luaL_checkinteger(L, 6);
-	int gmask	= luaL_checkinteger(L, 7);
-	int bmask	= luaL_checkinteger(L, 8);
-	int amask	= luaL_checkinteger(L, 9);
-
-	/*
-	 * TODO: we need to store the pixels into the metatable and free
-	 * them after the surface.
-	 */
-
-	SDL_Surface *s = SDL_CreateRGBSurfaceFrom(pixels, width, height, depth,
-	    pitch, rmask, gmask, bmask, amask);
+	Uint32 rmask	= luaL_checkinteger(L, 6);
+	Uint32 gmask	= luaL_checkinteger(L, 7);
+	Uint32 bmask	= luaL_checkinteger(L, 8);
+	Uint32 amask	= luaL_checkinteger(L, 9);
+	void *pixels	= surfaceCheckPixels(L, 1, width, height, depth, pitch);
+
+	return surfacePushBorrowed(L, 1, SDL_CreateRGBSurfaceFrom(pixels,
+	    width, height, depth, pitch, rmask, gmask, bmask, amask));
+}
 
-	if (s == NULL)
-		return commonPushSDLError(L, 1);
+#if SDL_VERSION_ATLEAST(2, 0, 5)
+/*
+ * SDL.createRGBSurfaceFromWithFormat(pixels,
+ *				      width,
+ *				      height,
+ *				      depth,
+ *				      pitch,
+ *				      format = SDL.pixelFormat.RGBA32)
+ *
+ * Like SDL.createRGBSurfaceFrom with a pixel format instead of masks.
+ *
+ * Returns:
+ *	The surface or nil
+ *	The error message
+ */
+static int l_surface_createRGBFromWithFormat(lua_State *L)
+{
+	int width	= luaL_checkinteger(L, 2);
+	int height	= luaL_checkinteger(L, 3);
+	int depth	= luaL_checkinteger(L, 4);
+	int pitch	= luaL_checkinteger(L, 5);
+	int format	= luaL_optinteger(L, 6, SDL_PIXELFORMAT_RGBA32);
+	void *pixels	= surfaceCheckPixels(L, 1, width, height, depth, pitch);
 
-	return commonPush(L, "p", SurfaceName, s);
+	return surfacePushBorrowed(L, 1, SDL_CreateRGBSurfaceWithFormatFrom(pixels,
+	    width, height, depth, pitch, format));
 }
-
 #endif
 
 #if SDL_VERSION_ATLEAST(2, 0, 5)
@@ -207,6 +401,37 @@ static int l_surface_loadBMP_RW(lua_State *L)
 	return commonPush(L, "p", SurfaceName, s);
 }
 
+/*
+ * SDL.createSurfacePool(limit = 16)
+ *
+ * Create a pool of surfaces for reuse, see SurfacePool:acquire.
+ *
+ * Params:
+ *	limit the maximum number of idle surfaces kept
+ *
+ * Returns:
+ *	The pool or nil
+ *	The error message
+ */
+static int l_surface_createPool(lua_State *L)
+{
+	int limit = luaL_optinteger(L, 1, 16);
+	Pool *pool;
+
+	luaL_argcheck(L, limit >= 0, 1, "limit must not be negative");
+
+	if ((pool = calloc(1, sizeof (Pool))) == NULL)
+		return commonPushErrno(L, 1);
+	if (limit > 0 && (pool->idle = calloc(limit, sizeof (SDL_Surface *))) == NULL) {
+		free(pool);
+		return commonPushErrno(L, 1);
+	}
+
+	pool->limit = limit;
+
+	return commonPush(L, "p", SurfacePoolName, pool);
+}
+
 const luaL_Reg SurfaceFunctions[] = {
 	{ "createRGBSurface",			l_surface_createRGB		},
 #if SDL_VERSION_ATLEAST(2, 0, 5)
@@ -214,13 +439,12 @@ const luaL_Reg SurfaceFunctions[] = {
 #endif
 	{ "loadBMP",				l_surface_loadBMP		},
 	{ "loadBMP_RW",				l_surface_loadBMP_RW		},
-#if 0
 	{ "createRGBSurfaceFrom",		l_surface_createRGBFrom		},
 #if SDL_VERSION_ATLEAST(2, 0, 5)
 	{ "createRGBSurfaceFromWithFormat",
 		l_surface_createRGBFromWithFormat				},
 #endif
-#endif
+	{ "createSurfacePool",			l_surface_createPool		},
 	{ NULL,				NULL			}
 };
 
@@ -235,7 +459,7 @@ surfaceBlit(lua_State *L, int scaled, int lower)
 	typedef int (*LowerBlitFunc)(SDL_Surface *, SDL_Rect *, SDL_Surface *, SDL_Rect *);
 
 	SDL_Surface *src = commonGetAs(L, 1, SurfaceName, SDL_Surface *);
-	SDL_Surface *dst = commonGetAs(L, 2, SurfaceName, SDL_Surface *);
+	SDL_Surface *dst = surfaceCheckWritable(L, 2);
 	SDL_Rect srcrect, dstrect;
 	SDL_Rect *srcptr = &srcrect, *dstptr = &dstrect;
 
@@ -268,6 +492,192 @@ surfaceBlit(lua_State *L, int scaled, int lower)
 	return 2;
 }
 
+/*
+ * Read a raw pixel value of bpp bytes.
+ */
+static Uint32
+surfacePixelRead(const Uint8 *p, int bpp)
+{
+	switch (bpp) {
+	case 1:
+		return *p;
+	case 2:
+		return *(const Uint16 *)p;
+	case 3:
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+		return p[0] << 16 | p[1] << 8 | p[2];
+#else
+		return p[0] | p[1] << 8 | p[2] << 16;
+#endif
+	default:
+		return *(const Uint32 *)p;
+	}
+}
+
+/*
+ * Write a raw pixel value of bpp bytes.
+ */
+static void
+surfacePixelWrite(Uint8 *p, int bpp, Uint32 value)
+{
+	switch (bpp) {
+	case 1:
+		*p = value;
+		break;
+	case 2:
+		*(Uint16 *)p = value;
+		break;
+	case 3:
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+		p[0] = (value >> 16) & 0xff;
+		p[1] = (value >> 8) & 0xff;
+		p[2] = value & 0xff;
+#else
+		p[0] = value & 0xff;
+		p[1] = (value >> 8) & 0xff;
+		p[2] = (value >> 16) & 0xff;
+#endif
+		break;
+	default:
+		*(Uint32 *)p = value;
+		break;
+	}
+}
+
+/*
+ * Pixels are only addressed by bytes, SDL reports one byte per pixel for
+ * the formats packing several pixels in a byte too.
+ */
+static void
+surfaceCheckBytePixels(lua_State *L, int index, const SDL_Surface *surf)
+{
+	if (surf->format->BitsPerPixel < 8)
+		luaL_argerror(L, index, "surfaces with less than 8 bits per pixel are not supported");
+}
+
+static Uint8 *
+surfacePixelAt(SDL_Surface *surf, int x, int y)
+{
+	return (Uint8 *)surf->pixels + y * surf->pitch + x * surf->format->BytesPerPixel;
+}
+
+/*
+ * Get an optional rectangle that must lie within the surface, nil is the
+ * whole surface.
+ */
+static void
+surfaceCheckRect(lua_State *L, int index, SDL_Surface *surf, SDL_Rect *rect)
+{
+	if (lua_isnoneornil(L, index)) {
+		rect->x = rect->y = 0;
+		rect->w = surf->w;
+		rect->h = surf->h;
+		return;
+	}
+
+	videoGetRect(L, index, rect);
+
+	if (rect->x < 0 || rect->y < 0 || rect->w < 0 || rect->h < 0 ||
+	    rect->x > surf->w - rect->w || rect->y > surf->h - rect->h)
+		luaL_argerror(L, index, "rectangle out of bounds");
+}
+
+/*
+ * Call the function at the top of the stack with nargs arguments. The
+ * surface is unlocked before raising any error.
+ */
+static void
+surfaceCall(lua_State *L, SDL_Surface *surf, int nargs, int nresults)
+{
+	if (lua_pcall(L, nargs, nresults, 0) != 0) {
+		SDL_UnlockSurface(surf);
+		lua_error(L);
+	}
+}
+
+typedef void (*SurfaceKernel)(Uint32 *, size_t, const void *);
+
+/*
+ * Run a kernel over the rows of a region of a 32-bit surface.
+ */
+static int
+surfaceApply(lua_State *L, SDL_Surface *surf, const SDL_Rect *rect, SurfaceKernel kernel, const void *data)
+{
+	int y;
+
+	if (SDL_LockSurface(surf) < 0)
+		return commonPushSDLError(L, 1);
+
+	/* Whole rows without padding are a single span */
+	if (rect->x == 0 && rect->w == surf->w && surf->pitch == surf->w * 4)
+		kernel((Uint32 *)surfacePixelAt(surf, 0, rect->y), (size_t)rect->w * rect->h, data);
+	else
+		for (y = rect->y; y < rect->y + rect->h; ++y)
+			kernel((Uint32 *)surfacePixelAt(surf, rect->x, y), rect->w, data);
+
+	SDL_UnlockSurface(surf);
+
+	return commonPush(L, "b", 1);
+}
+
+static void
+kernelMultiply(Uint32 *p, size_t n, const void *data)
+{
+	pixelsMultiply(p, n, *(const Uint32 *)data);
+}
+
+static void
+kernelPremultiply(Uint32 *p, size_t n, const void *data)
+{
+	pixelsPremultiply(p, n, data);
+}
+
+static void
+kernelGrayscale(Uint32 *p, size_t n, const void *data)
+{
+	pixelsGrayscale(p, n, data);
+}
+
+static void
+kernelSwizzle(Uint32 *p, size_t n, const void *data)
+{
+	pixelsSwizzle(p, n, data);
+}
+
+typedef struct lookup {
+	PixelLayout	 layout;
+	Uint8		 table[256];
+} Lookup;
+
+static void
+kernelLookup(Uint32 *p, size_t n, const void *data)
+{
+	const Lookup *lookup = data;
+
+	pixelsLookup(p, n, &lookup->layout, lookup->table);
+}
+
+typedef struct remap {
+	Uint32		*map;
+	size_t		 length;
+} Remap;
+
+static void
+kernelRemap(Uint32 *p, size_t n, const void *data)
+{
+	const Remap *remap = data;
+
+	pixelsRemap(p, n, remap->map, remap->length);
+}
+
+static int
+remapCompare(const void *a, const void *b)
+{
+	Uint32 x = *(const Uint32 *)a, y = *(const Uint32 *)b;
+
+	return (x > y) - (x < y);
+}
+
 /* --------------------------------------------------------
  * Surface methods
  * -------------------------------------------------------- */
@@ -290,6 +700,52 @@ l_surface_blit(lua_State *L)
 	return surfaceBlit(L, 0, 0);
 }
 
+/*
+ * Surface:blitParallel(surface, srcrect, dstrect, threads)
+ *
+ * Like Surface:blit with the rows split in bands blitted at the same time,
+ * the result is the same.
+ *
+ * Params:
+ *	surface the destination surface
+ *	srcrect the source clip rectangle (nil for all)
+ *	dstrect the destination rectangle
+ *	threads (optional) the number of bands, default the CPU count
+ *
+ * Returns:
+ *	True on success or false
+ *	The error message
+ */
+static int
+l_surface_blitParallel(lua_State *L)
+{
+	SDL_Surface *src = commonGetAs(L, 1, SurfaceName, SDL_Surface *);
+	SDL_Surface *dst = surfaceCheckWritable(L, 2);
+	int threads = luaL_optinteger(L, 5, SDL_GetCPUCount());
+	SDL_Rect srcrect, dstrect;
+	WorkerPool *pool;
+
+	if (lua_type(L, 3) == LUA_TTABLE)
+		videoGetRect(L, 3, &srcrect);
+	else
+		SDL_GetClipRect(src, &srcrect);
+
+	if (lua_type(L, 4) == LUA_TTABLE)
+		videoGetRect(L, 4, &dstrect);
+	else
+		SDL_GetClipRect(dst, &dstrect);
+
+	if ((pool = workerShared(L, BLIT_POOL, 0)) == NULL)
+		return commonPushSDLError(L, 2);
+	if (blitParallel(pool, threads, src, &srcrect, dst, &dstrect) < 0)
+		return commonPushSDLError(L, 2);
+
+	lua_pushboolean(L, 1);
+	videoPushRect(L, &dstrect);
+
+	return 2;
+}
+
 /*
  * Surface:blitScaled(surface, srcrect, dstrect)
  *
@@ -341,6 +797,37 @@ l_surface_convertFormat(lua_State *L)
 	return commonPush(L, "p", SurfaceName, ret);
 }
 
+/*
+ * Surface:convertFormatParallel(format, threads)
+ *
+ * Like Surface:convertFormat with the rows split in bands converted at
+ * the same time, the result is the same.
+ *
+ * Params:
+ *	format the pixel format
+ *	threads (optional) the number of bands, default the CPU count
+ *
+ * Returns:
+ *	The surface or nil
+ *	The error message
+ */
+static int
+l_surface_convertFormatParallel(lua_State *L)
+{
+	SDL_Surface *surf	= commonGetAs(L, 1, SurfaceName, SDL_Surface *);
+	int format		= luaL_checkinteger(L, 2);
+	int threads		= luaL_optinteger(L, 3, SDL_GetCPUCount());
+	WorkerPool *pool;
+	SDL_Surface *ret;
+
+	if ((pool = workerShared(L, BLIT_POOL, 0)) == NULL)
+		return commonPushSDLError(L, 1);
+	if ((ret = convertParallel(pool, threads, surf, format)) == NULL)
+		return commonPushSDLError(L, 1);
+
+	return commonPush(L, "p", SurfaceName, ret);
+}
+
 /*
  * Surface:fillRect(rect = nil, color = black)
  *
@@ -355,7 +842,7 @@ l_surface_convertFormat(lua_State *L)
 static int
 l_surface_fillRect(lua_State *L)
 {
-	SDL_Surface *surf = commonGetAs(L, 1, SurfaceName, SDL_Surface *);
+	SDL_Surface *surf = surfaceCheckWritable(L, 1);
 	SDL_Rect rect, *rectptr = NULL;
 	Uint32 color = 0;
 
@@ -390,7 +877,7 @@ l_surface_fillRect(lua_State *L)
 static int
 l_surface_fillRects(lua_State *L)
 {
-	SDL_Surface *surf	= commonGetAs(L, 1, SurfaceName, SDL_Surface *);
+	SDL_Surface *surf	= surfaceCheckWritable(L, 1);
 	SDL_Color c		= videoGetColorRGB(L, 3);
 	Uint32 color		= SDL_MapRGBA(surf->format, c.r, c.g, c.b, c.a);
 	Array rects;
@@ -666,6 +1153,74 @@ l_surface_saveBMP_RW(lua_State *L)
 	return commonPush(L, "b", 1);
 }
 
+/*
+ * Write the surface in the QOI format, a lossless format much faster to
+ * encode than PNG and much smaller than BMP.
+ */
+static int
+surfaceSaveQOI(lua_State *L, SDL_Surface *surf, SDL_RWops *ops)
+{
+	Uint8 *data;
+	size_t length;
+	int ret = 0;
+
+	if ((data = qoiEncodeSurface(surf, &length)) == NULL)
+		return commonPushSDLError(L, 1);
+
+	if (SDL_RWwrite(ops, data, 1, length) != length)
+		ret = commonPushSDLError(L, 1);
+
+	free(data);
+
+	return (ret != 0) ? ret : commonPush(L, "b", 1);
+}
+
+/*
+ * Surface:saveQOI(path)
+ *
+ * Params:
+ *	path the path
+ *
+ * Returns:
+ *	True on success or false
+ *	The error message
+ */
+static int
+l_surface_saveQOI(lua_State *L)
+{
+	SDL_Surface *surf	= commonGetAs(L, 1, SurfaceName, SDL_Surface *);
+	const char *path	= luaL_checkstring(L, 2);
+	SDL_RWops *ops;
+	int ret;
+
+	if ((ops = SDL_RWFromFile(path, "wb")) == NULL)
+		return commonPushSDLError(L, 1);
+
+	ret = surfaceSaveQOI(L, surf, ops);
+	SDL_RWclose(ops);
+
+	return ret;
+}
+
+/*
+ * Surface:saveQOI_RW(ops)
+ *
+ * Params:
+ *	ops the rwops
+ *
+ * Returns:
+ *	True on success or false
+ *	The error message
+ */
+static int
+l_surface_saveQOI_RW(lua_State *L)
+{
+	SDL_Surface *surf	= commonGetAs(L, 1, SurfaceName, SDL_Surface *);
+	SDL_RWops *ops		= commonGetAs(L, 2, RWOpsName, SDL_RWops *);
+
+	return surfaceSaveQOI(L, surf, ops);
+}
+
 /*
  * Surface:setClipRect(rect)
  *
@@ -846,6 +1401,113 @@ l_surface_unlock(lua_State *L)
 	return 0;
 }
 
+/*
+ * Free an owned surface now, borrowed buffers can move again.
+ */
+static void
+surfaceFree(lua_State *L, int index, CommonUserdata *udata)
+{
+	Buffer *b;
+
+	SDL_FreeSurface(udata->data);
+	udata->mustdelete = 0;
+
+	surfaceGetField(L, index, &KeyPixels);
+
+	if ((b = bufferTest(L, -1)) != NULL)
+		bufferUnpin(b);
+
+	lua_pop(L, 1);
+}
+
+/*
+ * Put back the settings of a new surface, the pixels are kept.
+ */
+static void
+surfaceReset(SDL_Surface *surf)
+{
+	SDL_SetSurfaceRLE(surf, 0);
+	SDL_SetColorKey(surf, SDL_FALSE, 0);
+	SDL_SetSurfaceColorMod(surf, 255, 255, 255);
+	SDL_SetSurfaceAlphaMod(surf, 255);
+	SDL_SetSurfaceBlendMode(surf, (surf->format->Amask) ?
+	    SDL_BLENDMODE_BLEND : SDL_BLENDMODE_NONE);
+	SDL_SetClipRect(surf, NULL);
+}
+
+/*
+ * Give the surface at index to the pool or free it when the pool is full,
+ * NULL or the surface can not be reused. The object loses its metatable so
+ * any later use raises an error instead of touching a recycled surface.
+ */
+static int
+surfaceRelease(lua_State *L, Pool *pool, int index)
+{
+	CommonUserdata *udata = commonGetUserdata(L, index, SurfaceName);
+	SDL_Surface *surf = udata->data;
+
+	if (!udata->mustdelete)
+		return commonPush(L, "ns", "surface is not owned");
+	if (surf->locked)
+		return commonPush(L, "ns", "surface is locked");
+
+	/* Pixels of others (buffers, caches) are only lent to the surface */
+	if (pool != NULL && pool->count < pool->limit && !SDL_MUSTLOCK(surf) &&
+	    surf->format->palette == NULL && !(surf->flags & SDL_PREALLOC)) {
+		surfaceReset(surf);
+		pool->idle[pool->count++] = surf;
+		udata->mustdelete = 0;
+	} else
+		surfaceFree(L, index, udata);
+
+	udata->data = NULL;
+	lua_pushnil(L);
+	lua_setmetatable(L, index);
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * Get the pool at index or NULL.
+ */
+static Pool *
+surfaceTestPool(lua_State *L, int index)
+{
+	CommonUserdata *udata = lua_touserdata(L, index);
+	int same = 0;
+
+	if (udata != NULL && lua_getmetatable(L, index)) {
+		luaL_getmetatable(L, SurfacePoolName);
+		same = lua_rawequal(L, -1, -2);
+		lua_pop(L, 2);
+	}
+
+	return (same) ? udata->data : NULL;
+}
+
+/*
+ * Surface:release()
+ *
+ * Give the surface back to the pool it was acquired from, other surfaces
+ * are freed now. The surface can not be used anymore.
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_surface_release(lua_State *L)
+{
+	Pool *pool = NULL;
+
+	commonGetUserdata(L, 1, SurfaceName);
+	surfaceGetField(L, 1, &KeyPool);
+	pool = surfaceTestPool(L, -1);
+	lua_pop(L, 1);
+
+	return surfaceRelease(L, pool, 1);
+}
+
 /*
  * Surface:__gc()
  */
@@ -855,13 +1517,11 @@ l_surface_gc(lua_State *L)
 	CommonUserdata *udata = commonGetUserdata(L, 1, SurfaceName);
 
 	if (udata->mustdelete)
-		SDL_FreeSurface(udata->data);
+		surfaceFree(L, 1, udata);
 
 	return 0;
 }
 
-
-
 /*
  * Surface:getSize()
  *
@@ -890,60 +1550,1320 @@ l_surface_getRawPixel(lua_State *L)
 	SDL_Surface *surf = commonGetAs(L, 1, SurfaceName, SDL_Surface *);
 	int x = luaL_checkinteger(L, 2);
 	int y = luaL_checkinteger(L, 3);
-	int size = surf->format->BytesPerPixel;
-	char *ptr = (char *)surf->pixels + y * surf->pitch + x * size;
-	lua_pushlstring(L, ptr, size);
+
+	surfaceCheckBytePixels(L, 1, surf);
+	luaL_argcheck(L, x >= 0 && x < surf->w, 2, "out of bounds");
+	luaL_argcheck(L, y >= 0 && y < surf->h, 3, "out of bounds");
+
+	if (SDL_LockSurface(surf) < 0)
+		return commonPushSDLError(L, 1);
+
+	lua_pushlstring(L, (const char *)surfacePixelAt(surf, x, y),
+	    surf->format->BytesPerPixel);
+	SDL_UnlockSurface(surf);
+
 	return 1;
 }
 
-static const luaL_Reg methods[] = {
-	{ "blit",		l_surface_blit			},
-	{ "blitScaled",		l_surface_blitScaled		},
-	{ "convert",		l_surface_convert		},
-	{ "convertFormat",	l_surface_convertFormat		},
-	{ "fillRect",		l_surface_fillRect		},
-	{ "fillRects",		l_surface_fillRects		},
-	{ "mapRGB", 		l_surface_mapRGB		},
-	{ "mapRGBA",		l_surface_mapRGBA		},
-	{ "getClipRect",	l_surface_getClipRect,		},
-	{ "getColorKey",	l_surface_getColorKey		},
-	{ "getAlphaMod",	l_surface_getAlphaMod		},
-	{ "getBlendMode",	l_surface_getBlendMode		},
-	{ "getColorMod",	l_surface_getColorMod		},
-	{ "getSize",		l_surface_getSize		},
-	{ "getRawPixel",        l_surface_getRawPixel		},
-	{ "lock",		l_surface_lock			},
-	{ "lowerBlit",		l_surface_lowerBlit		},
-	{ "lowerBlitScaled",	l_surface_lowerBlitScaled	},
-	{ "mustLock",		l_surface_mustLock		},
-	{ "saveBMP",		l_surface_saveBMP		},
-	{ "saveBMP_RW",		l_surface_saveBMP_RW		},
-	{ "setClipRect",	l_surface_setClipRect		},
-	{ "setColorKey",	l_surface_setColorKey		},
-	{ "setAlphaMod",	l_surface_setAlphaMod		},
-	{ "setBlendMode",	l_surface_setBlendMode		},
-	{ "setColorMod",	l_surface_setColorMod		},
-	{ "setPalette",		l_surface_setPalette		},
-	{ "setRLE",		l_surface_setRLE		},
-	{ "unlock",		l_surface_unlock		},
-	{ NULL,			NULL				}
-};
+/*
+ * Surface:getPixels(rect, buffer)
+ *
+ * Rows are copied one after the other without padding.
+ *
+ * Params:
+ *	rect (optional) the region, default the whole surface
+ *	buffer (optional) a buffer to append to instead of a new string
+ *
+ * Returns:
+ *	The raw pixels as a string or the buffer, or nil
+ *	The error message
+ */
+static int
+l_surface_getPixels(lua_State *L)
+{
+	SDL_Surface *surf = commonGetAs(L, 1, SurfaceName, SDL_Surface *);
+	Buffer *b = NULL;
+	SDL_Rect rect;
+	size_t rowsize;
+	luaL_Buffer lb;
+	int y;
 
-static const luaL_Reg metamethods[] = {
-	{ "__gc",		l_surface_gc			},
-	{ NULL,			NULL				}
-};
+	surfaceCheckBytePixels(L, 1, surf);
+	surfaceCheckRect(L, 2, surf, &rect);
+	rowsize = (size_t)rect.w * surf->format->BytesPerPixel;
 
-const CommonEnum BlendMode[] = {
-	{ "None",		SDL_BLENDMODE_NONE		},
-	{ "Blend",		SDL_BLENDMODE_BLEND		},
-	{ "Add",		SDL_BLENDMODE_ADD		},
-	{ "Mod",		SDL_BLENDMODE_MOD		},
-	{ NULL,			-1				}
-};
+	if (!lua_isnoneornil(L, 3)) {
+		b = commonGetAs(L, 3, BufferName, Buffer *);
 
-const CommonObject Surface = {
-	"Surface",
-	methods,
-	metamethods
+		if (bufferReserve(b, rowsize * rect.h) < 0)
+			return commonPushSDLError(L, 1);
+	}
+
+	if (SDL_LockSurface(surf) < 0)
+		return commonPushSDLError(L, 1);
+
+	if (b != NULL) {
+		for (y = 0; y < rect.h; ++y) {
+			memcpy(b->data + b->length, surfacePixelAt(surf, rect.x, rect.y + y), rowsize);
+			b->length += rowsize;
+		}
+	} else if (rect.x == 0 && rect.w == surf->w && (size_t)surf->pitch == rowsize) {
+		/* Contiguous rows are pushed at once */
+		lua_pushlstring(L, (const char *)surfacePixelAt(surf, 0, rect.y), rowsize * rect.h);
+	} else {
+		luaL_buffinit(L, &lb);
+
+		for (y = 0; y < rect.h; ++y)
+			luaL_addlstring(&lb, (const char *)surfacePixelAt(surf, rect.x, rect.y + y), rowsize);
+
+		luaL_pushresult(&lb);
+	}
+
+	SDL_UnlockSurface(surf);
+
+	if (b != NULL)
+		lua_pushvalue(L, 3);
+
+	return 1;
+}
+
+/*
+ * Surface:setPixels(rect, data, offset, length)
+ *
+ * Params:
+ *	rect the region or nil for the whole surface
+ *	data the raw pixels as a string or buffer, rows without padding
+ *	offset (optional) the first byte of data, from 0
+ *	length (optional) the number of bytes
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_surface_setPixels(lua_State *L)
+{
+	SDL_Surface *surf = surfaceCheckWritable(L, 1);
+	SDL_Rect rect;
+	const char *data;
+	size_t length, rowsize;
+	int y;
+
+	surfaceCheckBytePixels(L, 1, surf);
+	surfaceCheckRect(L, 2, surf, &rect);
+	data = bufferCheckData(L, 3, 4, &length);
+	rowsize = (size_t)rect.w * surf->format->BytesPerPixel;
+
+	if (length < rowsize * rect.h)
+		return commonPush(L, "ns", "not enough pixel data");
+	if (SDL_LockSurface(surf) < 0)
+		return commonPushSDLError(L, 1);
+
+	for (y = 0; y < rect.h; ++y)
+		memcpy(surfacePixelAt(surf, rect.x, rect.y + y), data + y * rowsize, rowsize);
+
+	SDL_UnlockSurface(surf);
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * Surface:mapPixels(func, rect)
+ *
+ * The function is called as func(x, y, pixel) for every pixel of the
+ * region, if it returns a number the pixel is replaced by it.
+ *
+ * Params:
+ *	func the function
+ *	rect (optional) the region, default the whole surface
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_surface_mapPixels(lua_State *L)
+{
+	SDL_Surface *surf = surfaceCheckWritable(L, 1);
+	int bpp = surf->format->BytesPerPixel;
+	SDL_Rect rect;
+	Uint8 *p;
+	int x, y;
+
+	surfaceCheckBytePixels(L, 1, surf);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	surfaceCheckRect(L, 3, surf, &rect);
+
+	if (SDL_LockSurface(surf) < 0)
+		return commonPushSDLError(L, 1);
+
+	for (y = rect.y; y < rect.y + rect.h; ++y) {
+		for (x = rect.x; x < rect.x + rect.w; ++x) {
+			p = surfacePixelAt(surf, x, y);
+
+			lua_pushvalue(L, 2);
+			lua_pushinteger(L, x);
+			lua_pushinteger(L, y);
+			lua_pushinteger(L, surfacePixelRead(p, bpp));
+			surfaceCall(L, surf, 3, 1);
+
+			if (lua_type(L, -1) == LUA_TNUMBER)
+				surfacePixelWrite(p, bpp, (Uint32)lua_tointeger(L, -1));
+
+			lua_pop(L, 1);
+		}
+	}
+
+	SDL_UnlockSurface(surf);
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * Surface:mapPixelsRGBA(func, rect)
+ *
+ * Like mapPixels but the function is called as func(x, y, r, g, b, a) and
+ * may return the new r, g, b, a components.
+ *
+ * Params:
+ *	func the function
+ *	rect (optional) the region, default the whole surface
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_surface_mapPixelsRGBA(lua_State *L)
+{
+	SDL_Surface *surf = surfaceCheckWritable(L, 1);
+	int bpp = surf->format->BytesPerPixel;
+	SDL_Rect rect;
+	Uint8 *p, r, g, b, a;
+	int x, y;
+
+	surfaceCheckBytePixels(L, 1, surf);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	surfaceCheckRect(L, 3, surf, &rect);
+
+	if (SDL_LockSurface(surf) < 0)
+		return commonPushSDLError(L, 1);
+
+	for (y = rect.y; y < rect.y + rect.h; ++y) {
+		for (x = rect.x; x < rect.x + rect.w; ++x) {
+			p = surfacePixelAt(surf, x, y);
+			SDL_GetRGBA(surfacePixelRead(p, bpp), surf->format, &r, &g, &b, &a);
+
+			lua_pushvalue(L, 2);
+			lua_pushinteger(L, x);
+			lua_pushinteger(L, y);
+			lua_pushinteger(L, r);
+			lua_pushinteger(L, g);
+			lua_pushinteger(L, b);
+			lua_pushinteger(L, a);
+			surfaceCall(L, surf, 6, 4);
+
+			if (lua_type(L, -4) == LUA_TNUMBER) {
+				r = lua_tointeger(L, -4);
+				if (lua_type(L, -3) == LUA_TNUMBER)
+					g = lua_tointeger(L, -3);
+				if (lua_type(L, -2) == LUA_TNUMBER)
+					b = lua_tointeger(L, -2);
+				if (lua_type(L, -1) == LUA_TNUMBER)
+					a = lua_tointeger(L, -1);
+				surfacePixelWrite(p, bpp, SDL_MapRGBA(surf->format, r, g, b, a));
+			}
+
+			lua_pop(L, 4);
+		}
+	}
+
+	SDL_UnlockSurface(surf);
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * Surface:getView(rect)
+ *
+ * The surface stays locked until the view is released so it can not be
+ * blitted meanwhile.
+ *
+ * Params:
+ *	rect (optional) the region, default the whole surface
+ *
+ * Returns:
+ *	The pixel view or nil
+ *	The error message
+ */
+static int
+l_surface_getView(lua_State *L)
+{
+	SDL_Surface *surf = commonGetAs(L, 1, SurfaceName, SDL_Surface *);
+	SDL_Rect rect;
+	View *view;
+
+	/* Raises, check before allocating */
+	surfaceCheckBytePixels(L, 1, surf);
+	surfaceCheckRect(L, 2, surf, &rect);
+
+	if ((view = calloc(1, sizeof (View))) == NULL)
+		return commonPushErrno(L, 1);
+
+	view->rect = rect;
+
+	if (SDL_LockSurface(surf) < 0) {
+		free(view);
+		return commonPushSDLError(L, 1);
+	}
+
+	view->surface = surf;
+	view->readonly = surfaceIsReadOnly(L, 1);
+	commonPush(L, "p", PixelViewName, view);
+
+	/* Keep the surface alive with the view */
+	lua_createtable(L, 0, 1);
+	lua_pushvalue(L, 1);
+	lua_setfield(L, -2, "surface");
+#if LUA_VERSION_NUM >= 502
+	lua_setuservalue(L, -2);
+#else
+	lua_setfenv(L, -2);
+#endif
+
+	return 1;
+}
+
+/*
+ * Surface:premultiply(rect)
+ *
+ * Multiply the color channels by alpha, the surface must be 32-bit.
+ *
+ * Params:
+ *	rect (optional) the region, default the whole surface
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_surface_premultiply(lua_State *L)
+{
+	SDL_Surface *surf = surfaceCheckWritable(L, 1);
+	PixelLayout layout;
+	SDL_Rect rect;
+
+	surfaceCheckRect(L, 2, surf, &rect);
+
+	if (pixelsLayout(surf->format, &layout) < 0)
+		return commonPushSDLError(L, 1);
+	if (!layout.hasalpha)
+		return commonPush(L, "ns", "surface has no alpha");
+
+	return surfaceApply(L, surf, &rect, kernelPremultiply, &layout);
+}
+
+/*
+ * Surface:tint(color, rect)
+ *
+ * Multiply every channel by the color, the surface must be 32-bit.
+ *
+ * Params:
+ *	color the color table or hexadecimal value
+ *	rect (optional) the region, default the whole surface
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_surface_tint(lua_State *L)
+{
+	SDL_Surface *surf = surfaceCheckWritable(L, 1);
+	SDL_Color c = videoGetColorRGB(L, 2);
+	PixelLayout layout;
+	SDL_Rect rect;
+	Uint32 factor;
+
+	surfaceCheckRect(L, 3, surf, &rect);
+
+	if (pixelsLayout(surf->format, &layout) < 0)
+		return commonPushSDLError(L, 1);
+
+	factor = (Uint32)c.r << layout.r | (Uint32)c.g << layout.g |
+	    (Uint32)c.b << layout.b;
+	factor |= (Uint32)(layout.hasalpha ? c.a : 0xff) << layout.a;
+
+	return surfaceApply(L, surf, &rect, kernelMultiply, &factor);
+}
+
+/*
+ * Surface:grayscale(rect)
+ *
+ * Replace the color channels by the luma, the surface must be 32-bit.
+ *
+ * Params:
+ *	rect (optional) the region, default the whole surface
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_surface_grayscale(lua_State *L)
+{
+	SDL_Surface *surf = surfaceCheckWritable(L, 1);
+	PixelLayout layout;
+	SDL_Rect rect;
+
+	surfaceCheckRect(L, 2, surf, &rect);
+
+	if (pixelsLayout(surf->format, &layout) < 0)
+		return commonPushSDLError(L, 1);
+
+	return surfaceApply(L, surf, &rect, kernelGrayscale, &layout);
+}
+
+/*
+ * Surface:gamma(gamma, rect)
+ *
+ * Raise the color channels to the power 1 / gamma, the surface must be
+ * 32-bit.
+ *
+ * Params:
+ *	gamma the gamma, greater than 0
+ *	rect (optional) the region, default the whole surface
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_surface_gamma(lua_State *L)
+{
+	SDL_Surface *surf = surfaceCheckWritable(L, 1);
+	double gamma = luaL_checknumber(L, 2);
+	Lookup lookup;
+	SDL_Rect rect;
+	int i;
+
+	luaL_argcheck(L, gamma > 0, 2, "must be positive");
+	surfaceCheckRect(L, 3, surf, &rect);
+
+	if (pixelsLayout(surf->format, &lookup.layout) < 0)
+		return commonPushSDLError(L, 1);
+
+	for (i = 0; i < 256; ++i)
+		lookup.table[i] = (Uint8)(SDL_pow(i / 255.0, 1.0 / gamma) * 255.0 + 0.5);
+
+	return surfaceApply(L, surf, &rect, kernelLookup, &lookup);
+}
+
+/*
+ * Surface:swizzle(order, rect)
+ *
+ * Reorder the channels, the surface must be 32-bit. The order tells for
+ * the red, green, blue and alpha channels where to take their value, for
+ * instance "bgra" swaps red and blue.
+ *
+ * Params:
+ *	order four letters among r, g, b and a
+ *	rect (optional) the region, default the whole surface
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_surface_swizzle(lua_State *L)
+{
+	SDL_Surface *surf = surfaceCheckWritable(L, 1);
+	const char *order = luaL_checkstring(L, 2);
+	PixelLayout layout;
+	static const char channels[] = "rgba";
+	SDL_Rect rect;
+	int shifts[4], from[4], i;
+
+	luaL_argcheck(L, strlen(order) == 4, 2, "must have four letters");
+	surfaceCheckRect(L, 3, surf, &rect);
+
+	if (pixelsLayout(surf->format, &layout) < 0)
+		return commonPushSDLError(L, 1);
+
+	shifts[0] = layout.r;
+	shifts[1] = layout.g;
+	shifts[2] = layout.b;
+	shifts[3] = layout.a;
+
+	for (i = 0; i < 4; ++i) {
+		const char *c = strchr(channels, order[i]);
+
+		if (c == NULL || *c == '\0')
+			return luaL_argerror(L, 2, "invalid channel");
+
+		from[shifts[i] / 8] = shifts[c - channels];
+	}
+
+	return surfaceApply(L, surf, &rect, kernelSwizzle, from);
+}
+
+/*
+ * Surface:remap(map, rect)
+ *
+ * Replace raw pixel values, the surface must be 32-bit.
+ *
+ * Params:
+ *	map a table of old value to new value, see Surface:mapRGBA
+ *	rect (optional) the region, default the whole surface
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_surface_remap(lua_State *L)
+{
+	SDL_Surface *surf = surfaceCheckWritable(L, 1);
+	PixelLayout layout;
+	SDL_Rect rect;
+	Remap remap;
+	size_t size = 0;
+	int ret;
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+	surfaceCheckRect(L, 3, surf, &rect);
+
+	if (pixelsLayout(surf->format, &layout) < 0)
+		return commonPushSDLError(L, 1);
+
+	lua_pushnil(L);
+	while (lua_next(L, 2)) {
+		++ size;
+		lua_pop(L, 1);
+	}
+
+	if ((remap.map = malloc(sizeof (Uint32) * 2 * (size + 1))) == NULL)
+		return commonPushErrno(L, 1);
+
+	remap.length = 0;
+	lua_pushnil(L);
+	while (lua_next(L, 2)) {
+		if (lua_type(L, -2) == LUA_TNUMBER && lua_type(L, -1) == LUA_TNUMBER) {
+			remap.map[remap.length * 2] = (Uint32)lua_tointeger(L, -2);
+			remap.map[remap.length * 2 + 1] = (Uint32)lua_tointeger(L, -1);
+			++ remap.length;
+		}
+
+		lua_pop(L, 1);
+	}
+
+	qsort(remap.map, remap.length, sizeof (Uint32) * 2, remapCompare);
+	ret = surfaceApply(L, surf, &rect, kernelRemap, &remap);
+	free(remap.map);
+
+	return ret;
+}
+
+/*
+ * A new surface of the same masks filled by pixelsHalve or pixelsResize,
+ * the source must be 32-bit with 8-bit channels.
+ */
+static SDL_Surface *
+surfaceResample(SDL_Surface *surf, int w, int h, PixelFilter filter, int halve)
+{
+	SDL_PixelFormat *fmt = surf->format;
+	SDL_Surface *ret;
+	int status = 0;
+
+	ret = SDL_CreateRGBSurface(0, w, h, 32, fmt->Rmask, fmt->Gmask,
+	    fmt->Bmask, fmt->Amask);
+
+	if (ret == NULL)
+		return NULL;
+	if (SDL_LockSurface(surf) < 0) {
+		SDL_FreeSurface(ret);
+		return NULL;
+	}
+
+	if (halve)
+		pixelsHalve(surf->pixels, surf->w, surf->h, surf->pitch,
+		    ret->pixels, ret->pitch);
+	else
+		status = pixelsResize(surf->pixels, surf->w, surf->h, surf->pitch,
+		    ret->pixels, w, h, ret->pitch, filter);
+
+	SDL_UnlockSurface(surf);
+
+	if (status < 0) {
+		SDL_FreeSurface(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
+/*
+ * Surface:resize(w, h, filter)
+ *
+ * Resample into a new surface of the same format, the surface must be
+ * 32-bit. Filters do not know about alpha, premultiply first to avoid
+ * fringes around transparent pixels.
+ *
+ * Params:
+ *	w the new width
+ *	h the new height
+ *	filter (optional) one of SDL.resizeFilter, default Bilinear
+ *
+ * Returns:
+ *	The new surface or nil
+ *	The error message
+ */
+static int
+l_surface_resize(lua_State *L)
+{
+	SDL_Surface *surf	= commonGetAs(L, 1, SurfaceName, SDL_Surface *);
+	int w			= luaL_checkinteger(L, 2);
+	int h			= luaL_checkinteger(L, 3);
+	int filter		= luaL_optinteger(L, 4, PixelFilterBilinear);
+	PixelLayout layout;
+	SDL_Surface *ret;
+
+	luaL_argcheck(L, w > 0, 2, "width must be positive");
+	luaL_argcheck(L, h > 0, 3, "height must be positive");
+	luaL_argcheck(L, filter >= PixelFilterBox && filter <= PixelFilterLanczos,
+	    4, "invalid filter");
+
+	if (pixelsLayout(surf->format, &layout) < 0)
+		return commonPushSDLError(L, 1);
+	if ((ret = surfaceResample(surf, w, h, filter, 0)) == NULL)
+		return commonPushSDLError(L, 1);
+
+	return commonPush(L, "p", SurfaceName, ret);
+}
+
+/*
+ * Surface:generateMipmaps()
+ *
+ * Build every level below the surface, each one half the size of the
+ * previous one down to 1x1. Every pixel is the average of a 2x2 block of
+ * the previous level, odd sizes use the box filter. The surface must be
+ * 32-bit.
+ *
+ * Returns:
+ *	The table of surfaces, largest first, or nil
+ *	The error message
+ */
+static int
+l_surface_generateMipmaps(lua_State *L)
+{
+	SDL_Surface *surf = commonGetAs(L, 1, SurfaceName, SDL_Surface *);
+	SDL_Surface *level;
+	PixelLayout layout;
+	int w, h, n = 0;
+
+	if (pixelsLayout(surf->format, &layout) < 0)
+		return commonPushSDLError(L, 1);
+
+	lua_newtable(L);
+
+	while (surf->w > 1 || surf->h > 1) {
+		w = (surf->w > 1) ? surf->w / 2 : 1;
+		h = (surf->h > 1) ? surf->h / 2 : 1;
+
+		level = surfaceResample(surf, w, h, PixelFilterBox,
+		    (surf->w == 1 || surf->w % 2 == 0) &&
+		    (surf->h == 1 || surf->h % 2 == 0));
+
+		/* Levels already in the table are collected */
+		if (level == NULL)
+			return commonPushSDLError(L, 1);
+
+		commonPush(L, "p", SurfaceName, level);
+		lua_rawseti(L, -2, ++n);
+		surf = level;
+	}
+
+	return 1;
+}
+
+/*
+ * Count the different pixels of one row span, only the bits of the masks
+ * are compared so padding bytes do not count.
+ */
+static size_t
+surfaceDiffSpan(const Uint8 *a, const Uint8 *b, int count, int bpp, Uint32 mask)
+{
+	size_t changed = 0;
+	int i;
+
+	if (bpp == 4)
+		return pixelsDiff((const Uint32 *)a, (const Uint32 *)b, count, mask);
+
+	for (i = 0; i < count; ++i, a += bpp, b += bpp)
+		changed += ((surfacePixelRead(a, bpp) ^ surfacePixelRead(b, bpp)) & mask) != 0;
+
+	return changed;
+}
+
+/*
+ * Add a run of dirty tiles, it extends a rectangle of the previous tile
+ * row with the same columns if any.
+ */
+static int
+surfaceDiffAdd(Array *rects, const SDL_Rect *run)
+{
+	SDL_Rect *r;
+	int i;
+
+	for (i = 0; i < rects->length; ++i) {
+		r = arrayGet(rects, i);
+
+		if (r->x == run->x && r->w == run->w && r->y + r->h == run->y) {
+			r->h += run->h;
+			return 0;
+		}
+	}
+
+	return arrayAppend(rects, run);
+}
+
+/*
+ * Surface:diff(other, tileSize = 32)
+ *
+ * Compare with a surface of the same size and format, of at least 8 bits
+ * per pixel. The surfaces are cut in tiles, the changed ones are merged in
+ * rectangles that can be given to Window:updateSurfaceRects.
+ *
+ * Params:
+ *	other the other surface
+ *	tileSize (optional) the tile width and height
+ *
+ * Returns:
+ *	The table of rectangles or nil
+ *	The number of different pixels or the error message
+ */
+static int
+l_surface_diff(lua_State *L)
+{
+	SDL_Surface *a		= commonGetAs(L, 1, SurfaceName, SDL_Surface *);
+	SDL_Surface *b		= commonGetAs(L, 2, SurfaceName, SDL_Surface *);
+	int tile		= luaL_optinteger(L, 3, 32);
+	SDL_PixelFormat *fmt	= a->format;
+	const Uint8 *pa, *pb;
+	SDL_Rect run, *r;
+	Array rects;
+	Uint8 *dirty;
+	Uint32 mask;
+	size_t changed = 0, n;
+	int bpp, cols, rows, x, y, tx, ty, i;
+
+	luaL_argcheck(L, tile > 0, 3, "tile size must be positive");
+
+	if (a->w != b->w || a->h != b->h || fmt->format != b->format->format)
+		return commonPush(L, "ns", "surfaces differ in size or format");
+
+	/* Pixels are compared whole bytes at a time, SDL says 1 for sub-byte */
+	if (fmt->BitsPerPixel < 8)
+		return commonPush(L, "ns", "surfaces with less than 8 bits per pixel are not supported");
+
+	bpp = fmt->BytesPerPixel;
+
+	mask = fmt->Rmask | fmt->Gmask | fmt->Bmask | fmt->Amask;
+
+	/* Palettes and other formats without masks compare every bit */
+	if (mask == 0)
+		mask = 0xffffffffU >> (32 - fmt->BitsPerPixel);
+
+	cols = (a->w + tile - 1) / tile;
+	rows = (a->h + tile - 1) / tile;
+
+	if ((dirty = calloc((size_t)cols * rows + 1, 1)) == NULL)
+		return commonPushErrno(L, 1);
+	if (arrayInit(&rects, sizeof (SDL_Rect), 32) < 0) {
+		free(dirty);
+		return commonPushErrno(L, 1);
+	}
+	if (SDL_LockSurface(a) < 0) {
+		free(dirty);
+		arrayFree(&rects);
+		return commonPushSDLError(L, 1);
+	}
+	if (SDL_LockSurface(b) < 0) {
+		SDL_UnlockSurface(a);
+		free(dirty);
+		arrayFree(&rects);
+		return commonPushSDLError(L, 1);
+	}
+
+	for (y = 0; y < a->h; ++y) {
+		pa = (const Uint8 *)a->pixels + (size_t)y * a->pitch;
+		pb = (const Uint8 *)b->pixels + (size_t)y * b->pitch;
+
+		for (tx = 0, x = 0; tx < cols; ++tx, x += tile) {
+			n = surfaceDiffSpan(pa + x * bpp, pb + x * bpp,
+			    (a->w - x < tile) ? a->w - x : tile, bpp, mask);
+
+			if (n > 0) {
+				dirty[(y / tile) * cols + tx] = 1;
+				changed += n;
+			}
+		}
+	}
+
+	SDL_UnlockSurface(b);
+	SDL_UnlockSurface(a);
+
+	/* Runs of dirty tiles per tile row, merged with the row above */
+	for (ty = 0; ty < rows; ++ty) {
+		for (tx = 0; tx < cols; ) {
+			if (!dirty[ty * cols + tx]) {
+				++ tx;
+				continue;
+			}
+
+			for (i = tx; i < cols && dirty[ty * cols + i]; ++i)
+				continue;
+
+			run.x = tx * tile;
+			run.y = ty * tile;
+			run.w = ((i * tile < a->w) ? i * tile : a->w) - run.x;
+			run.h = ((run.y + tile < a->h) ? run.y + tile : a->h) - run.y;
+
+			if (surfaceDiffAdd(&rects, &run) < 0) {
+				free(dirty);
+				arrayFree(&rects);
+				return commonPushErrno(L, 1);
+			}
+
+			tx = i;
+		}
+	}
+
+	lua_createtable(L, rects.length, 0);
+
+	ARRAY_FOREACH(&rects, r, i) {
+		videoPushRect(L, r);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	lua_pushinteger(L, (lua_Integer)changed);
+
+	free(dirty);
+	arrayFree(&rects);
+
+	return 2;
+}
+
+static const luaL_Reg methods[] = {
+	{ "blit",		l_surface_blit			},
+	{ "blitParallel",	l_surface_blitParallel		},
+	{ "blitScaled",		l_surface_blitScaled		},
+	{ "convert",		l_surface_convert		},
+	{ "convertFormat",	l_surface_convertFormat		},
+	{ "convertFormatParallel",
+		l_surface_convertFormatParallel				},
+	{ "diff",		l_surface_diff			},
+	{ "fillRect",		l_surface_fillRect		},
+	{ "fillRects",		l_surface_fillRects		},
+	{ "mapRGB", 		l_surface_mapRGB		},
+	{ "mapRGBA",		l_surface_mapRGBA		},
+	{ "mapPixels",		l_surface_mapPixels		},
+	{ "mapPixelsRGBA",	l_surface_mapPixelsRGBA		},
+	{ "getClipRect",	l_surface_getClipRect,		},
+	{ "getColorKey",	l_surface_getColorKey		},
+	{ "getAlphaMod",	l_surface_getAlphaMod		},
+	{ "getBlendMode",	l_surface_getBlendMode		},
+	{ "getColorMod",	l_surface_getColorMod		},
+	{ "getSize",		l_surface_getSize		},
+	{ "getRawPixel",	l_surface_getRawPixel		},
+	{ "getPixels",		l_surface_getPixels		},
+	{ "getView",		l_surface_getView		},
+	{ "generateMipmaps",	l_surface_generateMipmaps	},
+	{ "gamma",		l_surface_gamma			},
+	{ "grayscale",		l_surface_grayscale		},
+	{ "lock",		l_surface_lock			},
+	{ "lowerBlit",		l_surface_lowerBlit		},
+	{ "lowerBlitScaled",	l_surface_lowerBlitScaled	},
+	{ "mustLock",		l_surface_mustLock		},
+	{ "premultiply",	l_surface_premultiply		},
+	{ "release",		l_surface_release		},
+	{ "remap",		l_surface_remap			},
+	{ "resize",		l_surface_resize		},
+	{ "saveBMP",		l_surface_saveBMP		},
+	{ "saveBMP_RW",		l_surface_saveBMP_RW		},
+	{ "saveQOI",		l_surface_saveQOI		},
+	{ "saveQOI_RW",		l_surface_saveQOI_RW		},
+	{ "setClipRect",	l_surface_setClipRect		},
+	{ "setColorKey",	l_surface_setColorKey		},
+	{ "setAlphaMod",	l_surface_setAlphaMod		},
+	{ "setBlendMode",	l_surface_setBlendMode		},
+	{ "setColorMod",	l_surface_setColorMod		},
+	{ "setPalette",		l_surface_setPalette		},
+	{ "setPixels",		l_surface_setPixels		},
+	{ "setRLE",		l_surface_setRLE		},
+	{ "swizzle",		l_surface_swizzle		},
+	{ "tint",		l_surface_tint			},
+	{ "unlock",		l_surface_unlock		},
+	{ NULL,			NULL				}
+};
+
+static const luaL_Reg metamethods[] = {
+	{ "__gc",		l_surface_gc			},
+	{ NULL,			NULL				}
+};
+
+const CommonEnum BlendMode[] = {
+	{ "None",		SDL_BLENDMODE_NONE		},
+	{ "Blend",		SDL_BLENDMODE_BLEND		},
+	{ "Add",		SDL_BLENDMODE_ADD		},
+	{ "Mod",		SDL_BLENDMODE_MOD		},
+	{ NULL,			-1				}
+};
+
+const CommonEnum ResizeFilter[] = {
+	{ "Box",		PixelFilterBox			},
+	{ "Bilinear",		PixelFilterBilinear		},
+	{ "Lanczos",		PixelFilterLanczos		},
+	{ NULL,			-1				}
+};
+
+const CommonObject Surface = {
+	"Surface",
+	methods,
+	metamethods
+};
+
+/* --------------------------------------------------------
+ * PixelView object
+ * -------------------------------------------------------- */
+
+static View *
+viewGet(lua_State *L, int index)
+{
+	View *view = commonGetAs(L, index, PixelViewName, View *);
+
+	if (view->surface == NULL)
+		luaL_error(L, "pixel view released");
+
+	return view;
+}
+
+static View *
+viewGetWritable(lua_State *L, int index)
+{
+	View *view = viewGet(L, index);
+
+	if (view->readonly)
+		luaL_error(L, "pixel view of a read-only surface");
+
+	return view;
+}
+
+/*
+ * Get the pixel at the coordinates at index and index + 1, relative to the
+ * view region.
+ */
+static Uint8 *
+viewPixel(lua_State *L, View *view, int index)
+{
+	int x = luaL_checkinteger(L, index);
+	int y = luaL_checkinteger(L, index + 1);
+
+	luaL_argcheck(L, x >= 0 && x < view->rect.w, index, "out of bounds");
+	luaL_argcheck(L, y >= 0 && y < view->rect.h, index + 1, "out of bounds");
+
+	return surfacePixelAt(view->surface, view->rect.x + x, view->rect.y + y);
+}
+
+/*
+ * Get the pixel at the 1-based row major position at index.
+ */
+static Uint8 *
+viewPixelIndex(lua_State *L, View *view, int index)
+{
+	lua_Integer i = luaL_checkinteger(L, index);
+
+	if (i < 1 || i > (lua_Integer)view->rect.w * view->rect.h)
+		luaL_argerror(L, index, "out of bounds");
+
+	i -= 1;
+
+	return surfacePixelAt(view->surface,
+	    view->rect.x + (int)(i % view->rect.w), view->rect.y + (int)(i / view->rect.w));
+}
+
+/*
+ * PixelView:get(x, y)
+ *
+ * Params:
+ *	x the column, from 0
+ *	y the row, from 0
+ *
+ * Returns:
+ *	The raw pixel value
+ */
+static int
+l_view_get(lua_State *L)
+{
+	View *view = viewGet(L, 1);
+
+	lua_pushinteger(L, surfacePixelRead(viewPixel(L, view, 2),
+	    view->surface->format->BytesPerPixel));
+
+	return 1;
+}
+
+/*
+ * PixelView:set(x, y, value)
+ *
+ * Params:
+ *	x the column, from 0
+ *	y the row, from 0
+ *	value the raw pixel value, see Surface:mapRGBA
+ */
+static int
+l_view_set(lua_State *L)
+{
+	View *view = viewGetWritable(L, 1);
+	Uint8 *p = viewPixel(L, view, 2);
+
+	surfacePixelWrite(p, view->surface->format->BytesPerPixel,
+	    (Uint32)luaL_checkinteger(L, 4));
+
+	return 0;
+}
+
+/*
+ * PixelView:getRGBA(x, y)
+ *
+ * Params:
+ *	x the column, from 0
+ *	y the row, from 0
+ *
+ * Returns:
+ *	The red, green, blue and alpha components
+ */
+static int
+l_view_getRGBA(lua_State *L)
+{
+	View *view = viewGet(L, 1);
+	SDL_PixelFormat *fmt = view->surface->format;
+	Uint8 r, g, b, a;
+
+	SDL_GetRGBA(surfacePixelRead(viewPixel(L, view, 2), fmt->BytesPerPixel),
+	    fmt, &r, &g, &b, &a);
+
+	return commonPush(L, "iiii", r, g, b, a);
+}
+
+/*
+ * PixelView:setRGBA(x, y, color)
+ *
+ * Params:
+ *	x the column, from 0
+ *	y the row, from 0
+ *	color the color table or hexadecimal value
+ */
+static int
+l_view_setRGBA(lua_State *L)
+{
+	View *view = viewGetWritable(L, 1);
+	SDL_PixelFormat *fmt = view->surface->format;
+	Uint8 *p = viewPixel(L, view, 2);
+	SDL_Color c = videoGetColorRGB(L, 4);
+
+	surfacePixelWrite(p, fmt->BytesPerPixel, SDL_MapRGBA(fmt, c.r, c.g, c.b, c.a));
+
+	return 0;
+}
+
+/*
+ * PixelView:getSize()
+ *
+ * Returns:
+ *	The width
+ *	The height
+ */
+static int
+l_view_getSize(lua_State *L)
+{
+	View *view = viewGet(L, 1);
+
+	return commonPush(L, "ii", view->rect.w, view->rect.h);
+}
+
+/*
+ * PixelView:release()
+ *
+ * Unlock the surface, the view can not be used anymore.
+ */
+static int
+l_view_release(lua_State *L)
+{
+	View *view = commonGetAs(L, 1, PixelViewName, View *);
+
+	if (view->surface != NULL) {
+		SDL_UnlockSurface(view->surface);
+		view->surface = NULL;
+	}
+
+	return 0;
+}
+
+static const luaL_Reg viewMethods[] = {
+	{ "get",		l_view_get			},
+	{ "set",		l_view_set			},
+	{ "getRGBA",		l_view_getRGBA			},
+	{ "setRGBA",		l_view_setRGBA			},
+	{ "getSize",		l_view_getSize			},
+	{ "release",		l_view_release			},
+	{ NULL,			NULL				}
+};
+
+/*
+ * PixelView:__index(key)
+ *
+ * Numbers are 1-based row major pixel positions, strings are methods.
+ */
+static int
+l_view_index(lua_State *L)
+{
+	View *view;
+	const char *name;
+	int i;
+
+	if (lua_type(L, 2) == LUA_TNUMBER) {
+		view = viewGet(L, 1);
+		lua_pushinteger(L, surfacePixelRead(viewPixelIndex(L, view, 2),
+		    view->surface->format->BytesPerPixel));
+
+		return 1;
+	}
+
+	if ((name = lua_tostring(L, 2)) != NULL)
+		for (i = 0; viewMethods[i].name != NULL; ++i)
+			if (strcmp(viewMethods[i].name, name) == 0) {
+				lua_pushcfunction(L, viewMethods[i].func);
+				return 1;
+			}
+
+	lua_pushnil(L);
+
+	return 1;
+}
+
+/*
+ * PixelView:__newindex(index, value)
+ */
+static int
+l_view_newindex(lua_State *L)
+{
+	View *view = viewGetWritable(L, 1);
+	Uint8 *p = viewPixelIndex(L, view, 2);
+
+	surfacePixelWrite(p, view->surface->format->BytesPerPixel,
+	    (Uint32)luaL_checkinteger(L, 3));
+
+	return 0;
+}
+
+/*
+ * PixelView:__len()
+ */
+static int
+l_view_len(lua_State *L)
+{
+	View *view = commonGetAs(L, 1, PixelViewName, View *);
+
+	lua_pushinteger(L, (lua_Integer)view->rect.w * view->rect.h);
+
+	return 1;
+}
+
+/*
+ * PixelView:__gc()
+ */
+static int
+l_view_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, PixelViewName);
+
+	if (udata->mustdelete) {
+		l_view_release(L);
+		free(udata->data);
+		udata->mustdelete = 0;
+	}
+
+	return 0;
+}
+
+static const luaL_Reg viewMetamethods[] = {
+	{ "__index",		l_view_index			},
+	{ "__newindex",		l_view_newindex			},
+	{ "__len",		l_view_len			},
+	{ "__gc",		l_view_gc			},
+	{ NULL,			NULL				}
+};
+
+const CommonObject PixelView = {
+	"PixelView",
+	NULL,
+	viewMetamethods
+};
+
+/* --------------------------------------------------------
+ * SurfacePool object
+ * -------------------------------------------------------- */
+
+/*
+ * SurfacePool:acquire(width, height, format = ARGB8888)
+ *
+ * Take an idle surface of the same size and format or create a new one.
+ * Reused surfaces keep their old pixels, their other settings are the
+ * ones of a new surface.
+ *
+ * Params:
+ *	width the width
+ *	height the height
+ *	format (optional) the pixel format
+ *
+ * Returns:
+ *	The surface or nil
+ *	The error message
+ */
+static int
+l_pool_acquire(lua_State *L)
+{
+	Pool *pool		= commonGetAs(L, 1, SurfacePoolName, Pool *);
+	int width		= luaL_checkinteger(L, 2);
+	int height		= luaL_checkinteger(L, 3);
+	Uint32 format		= luaL_optinteger(L, 4, SDL_PIXELFORMAT_ARGB8888);
+	SDL_Surface *surf = NULL;
+	Uint32 rmask, gmask, bmask, amask;
+	int bpp, i;
+
+	/* Most recently released first, their pixels are likely cached */
+	for (i = pool->count - 1; i >= 0; --i) {
+		if (pool->idle[i]->w == width && pool->idle[i]->h == height &&
+		    pool->idle[i]->format->format == format) {
+			surf = pool->idle[i];
+			pool->idle[i] = pool->idle[--pool->count];
+			break;
+		}
+	}
+
+	if (surf == NULL) {
+		if (!SDL_PixelFormatEnumToMasks(format, &bpp, &rmask, &gmask, &bmask, &amask))
+			return commonPushSDLError(L, 1);
+
+		surf = SDL_CreateRGBSurface(0, width, height, bpp, rmask, gmask, bmask, amask);
+		if (surf == NULL)
+			return commonPushSDLError(L, 1);
+	}
+
+	commonPush(L, "p", SurfaceName, surf);
+
+	/* Surface:release() finds the pool here */
+	lua_createtable(L, 0, 1);
+#if LUA_VERSION_NUM >= 502
+	lua_setuservalue(L, -2);
+#else
+	lua_setfenv(L, -2);
+#endif
+
+	lua_pushvalue(L, 1);
+	surfaceSetField(L, -2, &KeyPool);
+
+	return 1;
+}
+
+/*
+ * SurfacePool:release(surface)
+ *
+ * Keep the surface for a later acquire, any owned surface is accepted. It
+ * is freed when the pool is full or the surface can not be reused (RLE,
+ * palette, borrowed pixels). The surface can not be used anymore.
+ *
+ * Params:
+ *	surface the surface
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_pool_release(lua_State *L)
+{
+	Pool *pool = commonGetAs(L, 1, SurfacePoolName, Pool *);
+
+	return surfaceRelease(L, pool, 2);
+}
+
+/*
+ * SurfacePool:clear()
+ *
+ * Free every idle surface.
+ */
+static int
+l_pool_clear(lua_State *L)
+{
+	Pool *pool = commonGetAs(L, 1, SurfacePoolName, Pool *);
+
+	while (pool->count > 0)
+		SDL_FreeSurface(pool->idle[--pool->count]);
+
+	return 0;
+}
+
+/*
+ * SurfacePool:getCount()
+ *
+ * Returns:
+ *	The number of idle surfaces
+ *	The limit
+ */
+static int
+l_pool_getCount(lua_State *L)
+{
+	Pool *pool = commonGetAs(L, 1, SurfacePoolName, Pool *);
+
+	return commonPush(L, "ii", pool->count, pool->limit);
+}
+
+/*
+ * SurfacePool:__gc()
+ */
+static int
+l_pool_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, SurfacePoolName);
+	Pool *pool = udata->data;
+
+	if (udata->mustdelete) {
+		l_pool_clear(L);
+		free(pool->idle);
+		free(pool);
+		udata->mustdelete = 0;
+	}
+
+	return 0;
+}
+
+static const luaL_Reg poolMethods[] = {
+	{ "acquire",		l_pool_acquire			},
+	{ "release",		l_pool_release			},
+	{ "clear",		l_pool_clear			},
+	{ "getCount",		l_pool_getCount			},
+	{ NULL,			NULL				}
+};
+
+static const luaL_Reg poolMetamethods[] = {
+	{ "__gc",		l_pool_gc			},
+	{ NULL,			NULL				}
+};
+
+const CommonObject SurfacePool = {
+	"SurfacePool",
+	poolMethods,
+	poolMetamethods
 };
@@ -22,11 +22,29 @@
 #include <common/common.h>
 
 #define SurfaceName	Surface.name
+#define PixelViewName	PixelView.name
+#define SurfacePoolName	SurfacePool.name
 
 extern const luaL_Reg SurfaceFunctions[];
 
 extern const CommonEnum BlendMode[];
 
+extern const CommonEnum ResizeFilter[];
+
 extern const CommonObject Surface;
 
+extern const CommonObject PixelView;
+
+extern const CommonObject SurfacePool;
+
+/**
+ * Make the surface at index read-only, the methods changing its pixels
+ * raise an error. Its user value must be a table.
+ *
+ * @param L the Lua state
+ * @param index the surface index
+ */
+void
+surfaceSetReadOnly(lua_State *L, int index);
+
 #endif /* !_SURFACE_H_ */
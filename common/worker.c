@@ -0,0 +1,198 @@
+/*
+ * worker.c -- pool of background threads for native jobs
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "worker.h"
+
+/*
+ * Metatable of the pools created by workerShared().
+ */
+#define WORKER_POOL	"WorkerPool"
+
+static int
+workerMain(WorkerPool *pool)
+{
+	WorkerJob *job;
+
+	for (;;) {
+		SDL_LockMutex(pool->mutex);
+		while (STAILQ_EMPTY(&pool->jobs) && !pool->stopping)
+			SDL_CondWait(pool->cond, pool->mutex);
+
+		/* Remaining jobs are always run before leaving */
+		if (STAILQ_EMPTY(&pool->jobs)) {
+			SDL_UnlockMutex(pool->mutex);
+			break;
+		}
+
+		job = STAILQ_FIRST(&pool->jobs);
+		STAILQ_REMOVE_HEAD(&pool->jobs, link);
+		++ pool->running;
+		SDL_UnlockMutex(pool->mutex);
+
+		job->run(job->data);
+		free(job);
+
+		SDL_LockMutex(pool->mutex);
+		-- pool->running;
+		SDL_UnlockMutex(pool->mutex);
+		SDL_CondBroadcast(pool->idle);
+	}
+
+	return 0;
+}
+
+int
+workerInit(WorkerPool *pool, int nthreads, const char *name)
+{
+	int i;
+
+	memset(pool, 0, sizeof (WorkerPool));
+	STAILQ_INIT(&pool->jobs);
+
+	if (nthreads <= 0)
+		nthreads = SDL_GetCPUCount();
+	if (nthreads <= 0)
+		nthreads = 1;
+
+	if ((pool->mutex = SDL_CreateMutex()) == NULL)
+		goto fail;
+	if ((pool->cond = SDL_CreateCond()) == NULL)
+		goto fail;
+	if ((pool->idle = SDL_CreateCond()) == NULL)
+		goto fail;
+	if ((pool->threads = calloc(nthreads, sizeof (SDL_Thread *))) == NULL) {
+		SDL_SetError("%s", strerror(errno));
+		goto fail;
+	}
+
+	for (i = 0; i < nthreads; ++i) {
+		pool->threads[i] = SDL_CreateThread((SDL_ThreadFunction)workerMain,
+		    name, pool);
+
+		if (pool->threads[i] == NULL)
+			goto fail;
+
+		++ pool->nthreads;
+	}
+
+	return 0;
+
+fail:
+	workerFree(pool);
+
+	return -1;
+}
+
+int
+workerPush(WorkerPool *pool, WorkerFunc run, void *data)
+{
+	WorkerJob *job;
+
+	if ((job = malloc(sizeof (WorkerJob))) == NULL) {
+		SDL_SetError("%s", strerror(errno));
+		return -1;
+	}
+
+	job->run = run;
+	job->data = data;
+
+	SDL_LockMutex(pool->mutex);
+	STAILQ_INSERT_TAIL(&pool->jobs, job, link);
+	SDL_UnlockMutex(pool->mutex);
+	SDL_CondSignal(pool->cond);
+
+	return 0;
+}
+
+void
+workerWait(WorkerPool *pool)
+{
+	SDL_LockMutex(pool->mutex);
+	while (!STAILQ_EMPTY(&pool->jobs) || pool->running > 0)
+		SDL_CondWait(pool->idle, pool->mutex);
+	SDL_UnlockMutex(pool->mutex);
+}
+
+void
+workerFree(WorkerPool *pool)
+{
+	int i;
+
+	if (pool->mutex != NULL) {
+		SDL_LockMutex(pool->mutex);
+		pool->stopping = 1;
+		SDL_UnlockMutex(pool->mutex);
+		SDL_CondBroadcast(pool->cond);
+	}
+
+	for (i = 0; i < pool->nthreads; ++i)
+		SDL_WaitThread(pool->threads[i], NULL);
+
+	if (pool->idle)
+		SDL_DestroyCond(pool->idle);
+	if (pool->cond)
+		SDL_DestroyCond(pool->cond);
+	if (pool->mutex)
+		SDL_DestroyMutex(pool->mutex);
+
+	free(pool->threads);
+	memset(pool, 0, sizeof (WorkerPool));
+}
+
+static int
+l_worker_gc(lua_State *L)
+{
+	workerFree(luaL_checkudata(L, 1, WORKER_POOL));
+
+	return 0;
+}
+
+WorkerPool *
+workerShared(lua_State *L, const char *name, int nthreads)
+{
+	WorkerPool *pool;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, name);
+	pool = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+
+	if (pool != NULL)
+		return pool;
+
+	pool = lua_newuserdata(L, sizeof (WorkerPool));
+
+	if (workerInit(pool, nthreads, name) < 0) {
+		lua_pop(L, 1);
+		return NULL;
+	}
+
+	/* The finalizer is only set once the threads are running */
+	if (luaL_newmetatable(L, WORKER_POOL)) {
+		lua_pushcfunction(L, l_worker_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+
+	lua_setmetatable(L, -2);
+	lua_setfield(L, LUA_REGISTRYINDEX, name);
+
+	return pool;
+}
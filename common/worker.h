@@ -0,0 +1,110 @@
+/*
+ * worker.h -- pool of background threads for native jobs
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WORKER_H_
+#define _WORKER_H_
+
+#include <sys/queue.h>
+
+#include <common/common.h>
+
+/**
+ * A job function, it is called from one of the pool threads and must never
+ * touch a lua_State.
+ */
+typedef void (*WorkerFunc)(void *);
+
+typedef struct worker_job {
+	WorkerFunc		 run;		/*! the function to call */
+	void			*data;		/*! its argument */
+
+	STAILQ_ENTRY(worker_job) link;
+} WorkerJob;
+
+typedef STAILQ_HEAD(worker_jobs, worker_job) WorkerJobs;
+
+/**
+ * @struct WorkerPool
+ * @brief a fixed set of SDL threads consuming a FIFO of jobs
+ *
+ * Results must be handed back to the Lua state by the caller, usually with
+ * a mutex protected queue that the Lua side polls.
+ */
+typedef struct worker_pool {
+	SDL_mutex		*mutex;		/*! protects everything below */
+	SDL_cond		*cond;		/*! signaled when a job is queued */
+	SDL_cond		*idle;		/*! signaled when a job is done */
+	WorkerJobs		 jobs;		/*! pending jobs */
+	SDL_Thread		**threads;	/*! the threads */
+	int			 nthreads;	/*! number of threads */
+	int			 running;	/*! jobs being executed */
+	int			 stopping;	/*! set by workerFree() */
+} WorkerPool;
+
+/**
+ * Start the pool threads.
+ *
+ * @param pool the pool
+ * @param nthreads the number of threads, <= 0 for the number of CPUs
+ * @param name the thread names
+ * @return 0 on success or -1 on failure (SDL error set)
+ */
+int
+workerInit(WorkerPool *pool, int nthreads, const char *name);
+
+/**
+ * Queue a job, it will be run by the first thread available.
+ *
+ * @param pool the pool
+ * @param run the function
+ * @param data the function argument
+ * @return 0 on success or -1 on failure (SDL error set)
+ */
+int
+workerPush(WorkerPool *pool, WorkerFunc run, void *data);
+
+/**
+ * Block until the queue is empty and no job is running.
+ *
+ * @param pool the pool
+ */
+void
+workerWait(WorkerPool *pool);
+
+/**
+ * Run the remaining jobs, stop and join the threads.
+ *
+ * @param pool the pool
+ */
+void
+workerFree(WorkerPool *pool);
+
+/**
+ * Get a pool owned by the Lua state, it is stored in the registry under the
+ * given name and created on first use. The pool is stopped when the state
+ * is closed.
+ *
+ * @param L the Lua state
+ * @param name the registry field
+ * @param nthreads the number of threads for creation, <= 0 for CPU count
+ * @return the pool or NULL on failure (SDL error set)
+ */
+WorkerPool *
+workerShared(lua_State *L, const char *name, int nthreads);
+
+#endif /* !_WORKER_H_ */
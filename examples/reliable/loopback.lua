@@ -0,0 +1,66 @@
+--
+-- loopback.lua -- reliable channels over a lossy loopback
+--
+
+local SDL	= require "SDL"
+local net	= require "SDL.net"
+
+-- Init
+net.init()
+
+local function localAddress(s)
+	local addr = s:getPeerAddress(-1)
+
+	addr.host = net.resolveHost("127.0.0.1", 0).host
+
+	return addr
+end
+
+-- Two endpoints talking to each other, 20% of the packets are lost and
+-- every packet takes 30 to 50 ms
+local simulation = { loss = 0.2, latency = 30, jitter = 20, seed = 42 }
+
+local a = net.openUdp(0)
+local b = net.openUdp(0)
+local ra = net.createReliable(a, simulation)
+local rb = net.createReliable(b, simulation)
+local addrb = localAddress(b)
+
+-- 100 small ordered messages and one fragmented message
+for i = 1, 100 do
+	ra:send(addrb, "message " .. i, net.lane.Ordered)
+end
+
+ra:send(addrb, string.rep("x", 20000), net.lane.Reliable)
+
+local expected, received, big = 1, 0, false
+
+while received < 100 or not big do
+	ra:update()
+	rb:update()
+
+	while true do
+		local data, from, lane = rb:receive()
+
+		if not data then
+			break
+		end
+
+		if lane == net.lane.Ordered then
+			assert(data == "message " .. expected, "out of order")
+			expected = expected + 1
+			received = received + 1
+		else
+			big = #data == 20000
+		end
+	end
+
+	SDL.delay(5)
+end
+
+local stats = ra:stats(addrb)
+
+print(string.format("all received, rtt %.1f ms, %d packets sent, %d resent",
+    stats.rtt, stats.sent, stats.resent))
+
+net.quit()
@@ -0,0 +1,56 @@
+--
+-- resolve.lua -- resolve host names without blocking
+--
+
+local SDL	= require "SDL"
+local net	= require "SDL.net"
+
+-- Init
+SDL.init { SDL.flags.Events }
+net.init()
+
+local function show(name, addr, err)
+	if not addr then
+		print(string.format("%s: %s", name, err))
+	else
+		print(string.format("%s: %08x port %d", name, addr.host, addr.port))
+	end
+end
+
+-- localhost comes from /etc/hosts, no network is needed
+local names = { "localhost", "localhost", "no.such.host.invalid" }
+local done = SDL.registerEvents(1)
+local pending = { }
+
+for _, name in ipairs(names) do
+	local r = net.resolveHostAsync(name, 80, done)
+
+	-- The second localhost is answered by the cache
+	if r:isDone() then
+		show(name .. " (cached)", r:get())
+	else
+		pending[name] = r
+	end
+end
+
+-- The main loop keeps running while the lookups are in progress
+while next(pending) do
+	for e in SDL.pollEvent() do
+		if e.type == done then
+			for name, r in pairs(pending) do
+				if r:isDone() then
+					show(name, r:get())
+					pending[name] = nil
+				end
+			end
+		end
+	end
+
+	SDL.delay(10)
+end
+
+-- Resolved names are now cached for the blocking call too
+show("localhost (blocking)", net.resolveHost("localhost", 80))
+
+net.quit()
+SDL.quit()
@@ -4,4 +4,9 @@
 #define	VERSION_BINDING_MAJOR	2
 #define	VERSION_BINDING_MINOR	1
 
+/* Portability checks */
+#if defined(__linux__)
+#  define HAVE_SYS_EPOLL_H
+#endif
+
 #endif /* !_CONFIG_H_ */
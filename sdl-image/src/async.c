@@ -0,0 +1,417 @@
+/*
+ * async.c -- images decoded in background threads
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL_image.h>
+
+#include <common/surface.h>
+#include <common/table.h>
+#include <common/worker.h>
+
+#include "async.h"
+
+/*
+ * Decoding is CPU bound, the pool has one thread per CPU.
+ */
+#define LOAD_POOL		"__SDL_image_decoders"
+#define LOAD_ERRLEN		128
+
+/*
+ * Objects of the core module, found by name in the registry.
+ */
+#define LOAD_RENDERER		"Renderer"
+#define LOAD_TEXTURE		"Texture"
+
+enum status {
+	StatusPending,
+	StatusDone,
+	StatusFailed
+};
+
+typedef struct load {
+	SDL_mutex	*mutex;
+	SDL_cond	*cond;
+	SDL_atomic_t	 ref;			/* the handle and the job */
+
+	char		*path;
+	Uint32		 format;		/* converted to, 0 for none */
+	Uint32		 event;			/* pushed when done, 0 for none */
+
+	/* Protected by mutex */
+	enum status	 status;
+	SDL_Surface	*surface;		/* until given to Lua */
+	char		 error[LOAD_ERRLEN];
+} Load;
+
+/* --------------------------------------------------------
+ * Background decoding
+ * -------------------------------------------------------- */
+
+static void
+loadRelease(Load *load)
+{
+	if (!SDL_AtomicDecRef(&load->ref))
+		return;
+
+	if (load->surface)
+		SDL_FreeSurface(load->surface);
+	if (load->cond)
+		SDL_DestroyCond(load->cond);
+	if (load->mutex)
+		SDL_DestroyMutex(load->mutex);
+
+	free(load->path);
+	free(load);
+}
+
+static void
+loadRun(Load *load)
+{
+	SDL_Surface *surf, *conv;
+	Uint32 event = load->event;
+
+	if ((surf = IMG_Load(load->path)) != NULL && load->format != 0) {
+		conv = SDL_ConvertSurfaceFormat(surf, load->format, 0);
+		SDL_FreeSurface(surf);
+		surf = conv;
+	}
+
+	SDL_LockMutex(load->mutex);
+
+	if (surf != NULL) {
+		load->status = StatusDone;
+		load->surface = surf;
+	} else {
+		load->status = StatusFailed;
+		SDL_strlcpy(load->error, SDL_GetError(), sizeof (load->error));
+	}
+
+	SDL_UnlockMutex(load->mutex);
+	SDL_CondBroadcast(load->cond);
+	loadRelease(load);
+
+	if (event != 0) {
+		SDL_Event ev;
+
+		SDL_zero(ev);
+		ev.type = event;
+		ev.user.timestamp = SDL_GetTicks();
+		SDL_PushEvent(&ev);
+	}
+}
+
+/*
+ * Queue one path, the handle is pushed with a uservalue table keeping the
+ * renderer at rdindex, 0 for none.
+ */
+static int
+loadStart(lua_State *L, WorkerPool *pool, const char *path, Uint32 format, Uint32 event, int rdindex)
+{
+	Load *load;
+
+	if ((load = calloc(1, sizeof (Load))) == NULL)
+		return commonPushErrno(L, 1);
+
+	SDL_AtomicSet(&load->ref, 1);
+	load->format = format;
+	load->event = event;
+
+	if ((load->path = malloc(strlen(path) + 1)) == NULL) {
+		loadRelease(load);
+		return commonPushErrno(L, 1);
+	}
+
+	strcpy(load->path, path);
+
+	if ((load->mutex = SDL_CreateMutex()) == NULL ||
+	    (load->cond = SDL_CreateCond()) == NULL)
+		goto fail;
+
+	SDL_AtomicIncRef(&load->ref);
+
+	if (workerPush(pool, (WorkerFunc)loadRun, load) < 0) {
+		SDL_AtomicSet(&load->ref, 1);
+		goto fail;
+	}
+
+	commonPush(L, "p", ImageLoadName, load);
+
+	lua_createtable(L, 0, 3);
+	if (rdindex != 0) {
+		lua_pushvalue(L, rdindex);
+		lua_setfield(L, -2, "renderer");
+	}
+#if LUA_VERSION_NUM >= 502
+	lua_setuservalue(L, -2);
+#else
+	lua_setfenv(L, -2);
+#endif
+
+	return 1;
+
+fail:
+	commonPushSDLError(L, 1);
+	loadRelease(load);
+
+	return 2;
+}
+
+/*
+ * Push the surface and the texture if a renderer was given, both are
+ * created once and kept in the uservalue.
+ */
+static int
+loadPush(lua_State *L, int index)
+{
+	Load *load = commonGetAs(L, index, ImageLoadName, Load *);
+	SDL_Renderer *rd;
+	SDL_Surface *surf;
+	SDL_Texture *tex;
+	enum status status;
+	char error[LOAD_ERRLEN];
+
+	SDL_LockMutex(load->mutex);
+	status = load->status;
+	surf = load->surface;
+	load->surface = NULL;
+	memcpy(error, load->error, sizeof (error));
+	SDL_UnlockMutex(load->mutex);
+
+	if (status == StatusPending)
+		return commonPush(L, "ns", "load pending");
+	if (status == StatusFailed)
+		return commonPush(L, "ns", error);
+
+#if LUA_VERSION_NUM >= 502
+	lua_getuservalue(L, index);
+#else
+	lua_getfenv(L, index);
+#endif
+
+	/* First get, the surface now belongs to Lua */
+	if (surf != NULL) {
+		commonPush(L, "p", SurfaceName, surf);
+		lua_setfield(L, -2, "surface");
+	}
+
+	lua_getfield(L, -1, "surface");
+	lua_getfield(L, -2, "texture");
+
+	if (lua_isnil(L, -1) && tableIsType(L, -3, "renderer", LUA_TUSERDATA)) {
+		lua_pop(L, 1);
+
+		rd = tableGetUserdata(L, -2, "renderer", LOAD_RENDERER)->data;
+		surf = commonGetAs(L, -1, SurfaceName, SDL_Surface *);
+
+		if ((tex = SDL_CreateTextureFromSurface(rd, surf)) == NULL)
+			return commonPushSDLError(L, 1);
+
+		commonPush(L, "p", LOAD_TEXTURE, tex);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -4, "texture");
+	}
+
+	return 2;
+}
+
+/* --------------------------------------------------------
+ * Async functions
+ * -------------------------------------------------------- */
+
+/*
+ * Image.loadAsync(paths, options)
+ *
+ * Decode images in background threads, one per CPU. Options are:
+ *
+ *	renderer a renderer, the textures are created by ImageLoad:get()
+ *	format a pixel format the surfaces are converted to
+ *	event a type from SDL.registerEvents pushed when each image is done
+ *
+ * Like Image.load, the formats are initialized by Image.init() first, the
+ * loaders must not initialize their library from several threads.
+ *
+ * Arguments:
+ *	paths a path or a sequence of paths
+ *	options (optional) the options table
+ *
+ * Returns:
+ *	The load or a sequence of loads, in the same order, or nil
+ *	The error message
+ */
+static int
+l_image_loadAsync(lua_State *L)
+{
+	Uint32 format = 0, event = 0;
+	WorkerPool *pool;
+	int rdindex = 0, i, ret;
+
+	if (lua_type(L, 1) != LUA_TSTRING)
+		luaL_checktype(L, 1, LUA_TTABLE);
+
+	if (lua_type(L, 2) == LUA_TTABLE) {
+		format = tableGetInt(L, 2, "format");
+		event = tableGetInt(L, 2, "event");
+
+		if (tableIsType(L, 2, "renderer", LUA_TUSERDATA)) {
+			tableGetUserdata(L, 2, "renderer", LOAD_RENDERER);
+			lua_getfield(L, 2, "renderer");
+			rdindex = lua_gettop(L);
+		}
+	}
+
+	if ((pool = workerShared(L, LOAD_POOL, 0)) == NULL)
+		return commonPushSDLError(L, 1);
+
+	if (lua_type(L, 1) == LUA_TSTRING)
+		return loadStart(L, pool, lua_tostring(L, 1), format, event, rdindex);
+
+	lua_createtable(L, 0, 0);
+
+	for (i = 1; lua_rawgeti(L, 1, i), !lua_isnil(L, -1); ++i) {
+		if (lua_type(L, -1) != LUA_TSTRING)
+			return luaL_error(L, "path %d is not a string", i);
+
+		ret = loadStart(L, pool, lua_tostring(L, -1), format, event, rdindex);
+
+		/* Loads already queued finish and are collected */
+		if (ret != 1)
+			return ret;
+
+		lua_rawseti(L, -3, i);
+		lua_pop(L, 1);
+	}
+
+	/* The nil which ended the sequence */
+	lua_pop(L, 1);
+
+	return 1;
+}
+
+const luaL_Reg AsyncFunctions[] = {
+	{ "loadAsync",			l_image_loadAsync		},
+	{ NULL,				NULL				}
+};
+
+/* --------------------------------------------------------
+ * ImageLoad object
+ * -------------------------------------------------------- */
+
+/*
+ * ImageLoad:isDone()
+ *
+ * Returns:
+ *	True if decoding has finished, successfully or not
+ */
+static int
+l_load_isDone(lua_State *L)
+{
+	Load *load = commonGetAs(L, 1, ImageLoadName, Load *);
+	int done;
+
+	SDL_LockMutex(load->mutex);
+	done = load->status != StatusPending;
+	SDL_UnlockMutex(load->mutex);
+
+	return commonPush(L, "b", done);
+}
+
+/*
+ * ImageLoad:get()
+ *
+ * Returns:
+ *	The surface or nil, "load pending" if not done
+ *	The texture if a renderer was given, or the error message
+ */
+static int
+l_load_get(lua_State *L)
+{
+	return loadPush(L, 1);
+}
+
+/*
+ * ImageLoad:wait(timeout)
+ *
+ * Arguments:
+ *	timeout (optional) the maximum time in ms, default forever
+ *
+ * Returns:
+ *	Like ImageLoad:get()
+ */
+static int
+l_load_wait(lua_State *L)
+{
+	Load *load = commonGetAs(L, 1, ImageLoadName, Load *);
+	lua_Integer timeout = luaL_optinteger(L, 2, -1);
+	Uint32 deadline = SDL_GetTicks() + (Uint32)timeout;
+	Uint32 now;
+
+	SDL_LockMutex(load->mutex);
+
+	while (load->status == StatusPending) {
+		if (timeout < 0) {
+			SDL_CondWait(load->cond, load->mutex);
+			continue;
+		}
+
+		if (SDL_TICKS_PASSED(now = SDL_GetTicks(), deadline))
+			break;
+
+		SDL_CondWaitTimeout(load->cond, load->mutex, deadline - now);
+	}
+
+	SDL_UnlockMutex(load->mutex);
+
+	return loadPush(L, 1);
+}
+
+/*
+ * ImageLoad:__gc()
+ */
+static int
+l_load_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, ImageLoadName);
+
+	/* A running decode keeps its own reference */
+	if (udata->mustdelete) {
+		loadRelease(udata->data);
+		udata->mustdelete = 0;
+	}
+
+	return 0;
+}
+
+static const luaL_Reg methods[] = {
+	{ "isDone",			l_load_isDone			},
+	{ "get",			l_load_get			},
+	{ "wait",			l_load_wait			},
+	{ NULL,				NULL				}
+};
+
+static const luaL_Reg metamethods[] = {
+	{ "__gc",			l_load_gc			},
+	{ NULL,				NULL				}
+};
+
+const CommonObject ImageLoadObject = {
+	"ImageLoad",
+	methods,
+	metamethods
+};
@@ -0,0 +1,504 @@
+/*
+ * cache.c -- decoded images shared by every state
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/queue.h>
+
+#include <SDL_image.h>
+
+#include <common/surface.h>
+#include <common/table.h>
+
+#include "cache.h"
+
+#if defined(_WIN32)
+#  define CACHE_PATHLEN		_MAX_PATH
+#elif defined(PATH_MAX)
+#  define CACHE_PATHLEN		PATH_MAX
+#else
+#  define CACHE_PATHLEN		4096
+#endif
+
+#define CACHE_BUDGET		(128 * 1024 * 1024)	/* default in bytes */
+
+/*
+ * One decoded file. Lua surfaces only borrow the pixels, every one of them
+ * holds a reference through an ImageCacheRef kept in its uservalue.
+ */
+typedef struct cache_entry {
+	char		*path;			/* canonical */
+	time_t		 mtime;
+	Uint32		 format;		/* requested, 0 for as decoded */
+	SDL_Surface	*surface;
+	size_t		 size;			/* bytes of pixels */
+	int		 refs;			/* surfaces given to Lua */
+	int		 stale;			/* not found anymore */
+
+	TAILQ_ENTRY(cache_entry) link;
+} CacheEntry;
+
+typedef TAILQ_HEAD(cache_entries, cache_entry) CacheEntries;
+
+/*
+ * The cache is shared by every state of the process, decoding is done
+ * outside of the lock. Entries are in LRU order, the most recent first.
+ */
+static SDL_mutex	*cacheMutex;
+static CacheEntries	 cacheEntries = TAILQ_HEAD_INITIALIZER(cacheEntries);
+static size_t		 cacheBudget = CACHE_BUDGET;
+static size_t		 cacheBytes;
+static int		 cacheCount;
+static Uint32		 cacheHits;
+static Uint32		 cacheMisses;
+static Uint32		 cacheEvictions;
+
+static int
+cacheLock(void)
+{
+	static SDL_SpinLock lock;
+
+	SDL_AtomicLock(&lock);
+
+	if (cacheMutex == NULL)
+		cacheMutex = SDL_CreateMutex();
+
+	SDL_AtomicUnlock(&lock);
+
+	if (cacheMutex == NULL)
+		return -1;
+
+	return SDL_LockMutex(cacheMutex);
+}
+
+static void
+cacheUnlock(void)
+{
+	SDL_UnlockMutex(cacheMutex);
+}
+
+/* --------------------------------------------------------
+ * Entries, called with the lock held
+ * -------------------------------------------------------- */
+
+static void
+entryFree(CacheEntry *e)
+{
+	SDL_FreeSurface(e->surface);
+	free(e->path);
+	free(e);
+}
+
+/*
+ * Take the entry out of the lookups, it is freed now if unused or by the
+ * last reference.
+ */
+static void
+entryDrop(CacheEntry *e)
+{
+	TAILQ_REMOVE(&cacheEntries, e, link);
+	cacheBytes -= e->size;
+	cacheCount --;
+
+	if (e->refs == 0)
+		entryFree(e);
+	else
+		e->stale = 1;
+}
+
+static CacheEntry *
+entryFind(const char *path, time_t mtime, Uint32 format)
+{
+	CacheEntry *e;
+
+	TAILQ_FOREACH(e, &cacheEntries, link)
+		if (e->mtime == mtime && e->format == format && strcmp(e->path, path) == 0)
+			return e;
+
+	return NULL;
+}
+
+/*
+ * Evict unused entries from the least recently used until the budget is
+ * met, entries in use are never evicted.
+ */
+static void
+entryTrim(void)
+{
+	CacheEntry *e, *prev;
+
+	for (e = TAILQ_LAST(&cacheEntries, cache_entries); e != NULL && cacheBytes > cacheBudget; e = prev) {
+		prev = TAILQ_PREV(e, cache_entries, link);
+
+		if (e->refs == 0) {
+			entryDrop(e);
+			cacheEvictions ++;
+		}
+	}
+}
+
+/* --------------------------------------------------------
+ * Loading
+ * -------------------------------------------------------- */
+
+/*
+ * Get the canonical path and modification time of the file.
+ */
+static int
+cacheStat(const char *path, char *canonical, time_t *mtime)
+{
+#if defined(_WIN32)
+	struct _stat st;
+
+	if (_fullpath(canonical, path, CACHE_PATHLEN) == NULL || _stat(canonical, &st) < 0)
+		return -1;
+#else
+	struct stat st;
+
+	if (realpath(path, canonical) == NULL || stat(canonical, &st) < 0)
+		return -1;
+#endif
+
+	*mtime = st.st_mtime;
+
+	return 0;
+}
+
+/*
+ * Decode without the lock, an entry added meanwhile by another state is
+ * used instead.
+ */
+static CacheEntry *
+cacheLoad(const char *path, time_t mtime, Uint32 format)
+{
+	SDL_Surface *surf, *conv;
+	CacheEntry *e, *old, *next;
+
+	if ((surf = IMG_Load(path)) == NULL)
+		return NULL;
+
+	if (format != 0) {
+		conv = SDL_ConvertSurfaceFormat(surf, format, 0);
+		SDL_FreeSurface(surf);
+
+		if ((surf = conv) == NULL)
+			return NULL;
+	}
+
+	if ((e = calloc(1, sizeof (CacheEntry))) == NULL ||
+	    (e->path = malloc(strlen(path) + 1)) == NULL) {
+		free(e);
+		SDL_FreeSurface(surf);
+		SDL_OutOfMemory();
+		return NULL;
+	}
+
+	strcpy(e->path, path);
+	e->mtime = mtime;
+	e->format = format;
+	e->surface = surf;
+	e->size = (size_t)surf->pitch * surf->h;
+
+	if (cacheLock() < 0) {
+		entryFree(e);
+		return NULL;
+	}
+
+	if ((old = entryFind(path, mtime, format)) != NULL) {
+		entryFree(e);
+		e = old;
+	} else {
+		/* Older versions of the file are not needed anymore */
+		for (old = TAILQ_FIRST(&cacheEntries); old != NULL; old = next) {
+			next = TAILQ_NEXT(old, link);
+
+			if (old->format == format && strcmp(old->path, path) == 0)
+				entryDrop(old);
+		}
+
+		TAILQ_INSERT_HEAD(&cacheEntries, e, link);
+		cacheBytes += e->size;
+		cacheCount ++;
+	}
+
+	e->refs ++;
+	entryTrim();
+	cacheUnlock();
+
+	return e;
+}
+
+/*
+ * Release a reference, the entry may now be evicted.
+ */
+static void
+cacheRelease(CacheEntry *e)
+{
+	if (cacheLock() < 0)
+		return;
+
+	if (-- e->refs == 0) {
+		if (e->stale)
+			entryFree(e);
+		else
+			entryTrim();
+	}
+
+	cacheUnlock();
+}
+
+/*
+ * Push a surface over the entry pixels, it keeps the reference taken by
+ * the caller.
+ */
+static int
+cachePush(lua_State *L, CacheEntry *e)
+{
+	SDL_Surface *src = e->surface, *surf;
+	SDL_PixelFormat *fmt = src->format;
+	SDL_BlendMode mode;
+	Uint32 key;
+
+	surf = SDL_CreateRGBSurfaceFrom(src->pixels, src->w, src->h,
+	    fmt->BitsPerPixel, src->pitch, fmt->Rmask, fmt->Gmask, fmt->Bmask,
+	    fmt->Amask);
+
+	if (surf == NULL) {
+		cacheRelease(e);
+		return commonPushSDLError(L, 1);
+	}
+
+	/* Palettes are copied, their reference count is not thread safe */
+	if (fmt->palette != NULL)
+		SDL_SetPaletteColors(surf->format->palette, fmt->palette->colors,
+		    0, fmt->palette->ncolors);
+	if (SDL_GetColorKey(src, &key) == 0)
+		SDL_SetColorKey(surf, SDL_TRUE, key);
+
+	SDL_GetSurfaceBlendMode(src, &mode);
+	SDL_SetSurfaceBlendMode(surf, mode);
+
+	commonPush(L, "p", SurfaceName, surf);
+
+	lua_createtable(L, 0, 1);
+	commonPush(L, "p", ImageCacheRefName, e);
+	lua_setfield(L, -2, "cache");
+#if LUA_VERSION_NUM >= 502
+	lua_setuservalue(L, -2);
+#else
+	lua_setfenv(L, -2);
+#endif
+
+	/* Every state shares the pixels */
+	surfaceSetReadOnly(L, -1);
+
+	return 1;
+}
+
+/* --------------------------------------------------------
+ * Cache functions
+ * -------------------------------------------------------- */
+
+/*
+ * Image.loadCached(path, format)
+ *
+ * Like Image.load but the decoded pixels are shared by every state of the
+ * process, keyed by the canonical path, the modification time and the
+ * format. The surfaces borrow the cached pixels so they are read-only,
+ * convert or blit them to get a private copy.
+ *
+ * Arguments:
+ *	path the path to the image
+ *	format (optional) the pixel format to convert to
+ *
+ * Returns:
+ *	The surface or nil on failure
+ *	The error message
+ */
+static int
+l_image_loadCached(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	Uint32 format = luaL_optinteger(L, 2, 0);
+	char canonical[CACHE_PATHLEN];
+	CacheEntry *e;
+	time_t mtime;
+
+	if (cacheStat(path, canonical, &mtime) < 0)
+		return commonPushErrno(L, 1);
+	if (cacheLock() < 0)
+		return commonPushSDLError(L, 1);
+
+	if ((e = entryFind(canonical, mtime, format)) != NULL) {
+		TAILQ_REMOVE(&cacheEntries, e, link);
+		TAILQ_INSERT_HEAD(&cacheEntries, e, link);
+		e->refs ++;
+		cacheHits ++;
+	} else
+		cacheMisses ++;
+
+	cacheUnlock();
+
+	if (e == NULL && (e = cacheLoad(canonical, mtime, format)) == NULL)
+		return commonPushSDLError(L, 1);
+
+	return cachePush(L, e);
+}
+
+/*
+ * Image.setCacheBudget(bytes)
+ *
+ * Set the memory kept by the cache, unused images are evicted from the
+ * least recently used until it fits.
+ *
+ * Arguments:
+ *	bytes the budget
+ */
+static int
+l_image_setCacheBudget(lua_State *L)
+{
+	lua_Number bytes = luaL_checknumber(L, 1);
+
+	if (bytes < 0)
+		return luaL_argerror(L, 1, "must be positive");
+	if (cacheLock() < 0)
+		return luaL_error(L, "%s", SDL_GetError());
+
+	cacheBudget = (size_t)bytes;
+	entryTrim();
+	cacheUnlock();
+
+	return 0;
+}
+
+/*
+ * Image.getCacheStats()
+ *
+ * Returns:
+ *	A table with hits, misses, evictions, entries, bytes and budget
+ */
+static int
+l_image_getCacheStats(lua_State *L)
+{
+	if (cacheLock() < 0)
+		return commonPushSDLError(L, 1);
+
+	lua_createtable(L, 0, 6);
+	lua_pushnumber(L, cacheHits);
+	lua_setfield(L, -2, "hits");
+	lua_pushnumber(L, cacheMisses);
+	lua_setfield(L, -2, "misses");
+	lua_pushnumber(L, cacheEvictions);
+	lua_setfield(L, -2, "evictions");
+	lua_pushnumber(L, cacheCount);
+	lua_setfield(L, -2, "entries");
+	lua_pushnumber(L, (lua_Number)cacheBytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushnumber(L, (lua_Number)cacheBudget);
+	lua_setfield(L, -2, "budget");
+
+	cacheUnlock();
+
+	return 1;
+}
+
+/*
+ * Image.invalidateCache(path)
+ *
+ * Forget the images of a file, for every format, or all of them. Surfaces
+ * already loaded stay valid, the next loads decode the file again.
+ *
+ * Arguments:
+ *	path (optional) the path, default every image
+ *
+ * Returns:
+ *	The number of images forgotten
+ */
+static int
+l_image_invalidateCache(lua_State *L)
+{
+	const char *path = luaL_optstring(L, 1, NULL);
+	char canonical[CACHE_PATHLEN];
+	CacheEntry *e, *next;
+	time_t mtime;
+	int count = 0;
+
+	/* Deleted files can still be invalidated by their given path */
+	if (path != NULL && cacheStat(path, canonical, &mtime) == 0)
+		path = canonical;
+	if (cacheLock() < 0)
+		return luaL_error(L, "%s", SDL_GetError());
+
+	for (e = TAILQ_FIRST(&cacheEntries); e != NULL; e = next) {
+		next = TAILQ_NEXT(e, link);
+
+		if (path == NULL || strcmp(e->path, path) == 0) {
+			entryDrop(e);
+			count ++;
+		}
+	}
+
+	cacheUnlock();
+
+	return commonPush(L, "i", count);
+}
+
+const luaL_Reg CacheFunctions[] = {
+	{ "loadCached",			l_image_loadCached		},
+	{ "setCacheBudget",		l_image_setCacheBudget		},
+	{ "getCacheStats",		l_image_getCacheStats		},
+	{ "invalidateCache",		l_image_invalidateCache		},
+	{ NULL,				NULL				}
+};
+
+/* --------------------------------------------------------
+ * ImageCacheRef object
+ * -------------------------------------------------------- */
+
+/*
+ * ImageCacheRef:__gc()
+ */
+static int
+l_ref_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, ImageCacheRefName);
+
+	if (udata->mustdelete) {
+		cacheRelease(udata->data);
+		udata->mustdelete = 0;
+	}
+
+	return 0;
+}
+
+static const luaL_Reg refMetamethods[] = {
+	{ "__gc",			l_ref_gc			},
+	{ NULL,				NULL				}
+};
+
+const CommonObject ImageCacheRef = {
+	"ImageCacheRef",
+	NULL,
+	refMetamethods
+};
@@ -24,6 +24,9 @@
 #include <common/rwops.h>
 #include <common/surface.h>
 
+#include "async.h"
+#include "cache.h"
+
 typedef SDL_Surface *	(*LoadFunction)(SDL_RWops *);
 typedef int		(*TypeFunction)(SDL_RWops *);
 
@@ -201,9 +204,17 @@ luaopen_SDL_image(lua_State *L)
 {
 	/* New SDL.image library */
 	commonNewLibrary(L, ImageFunctions);
+	commonBindLibrary(L, AsyncFunctions);
+	commonBindLibrary(L, CacheFunctions);
 
 	/* Flags for IMG_Init() */
 	commonBindEnum(L, -1, "flags", ImageFlags);
 
+	/* ImageLoad */
+	commonBindObject(L, &ImageLoadObject);
+
+	/* References of cached images */
+	commonBindObject(L, &ImageCacheRef);
+
 	return 1;
 }
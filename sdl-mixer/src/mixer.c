@@ -17,11 +17,209 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
 #include <common/common.h>
 #include <common/rwops.h>
+#include <common/table.h>
+#include <common/worker.h>
 
 #include <SDL_mixer.h>
 
+/* ---------------------------------------------------------
+ * Voice allocation
+ * --------------------------------------------------------- */
+
+/*
+ * Registry field of the weak table chunk -> ticks of the last play.
+ */
+#define VOICE_COOLDOWNS	"__SDL_mixer_cooldowns"
+
+/*
+ * What Chunk:play() knows about each channel. SDL_mixer has no getter for
+ * channel tags so mixer.groupChannel(s) keep a copy here.
+ */
+typedef struct voice {
+	Mix_Chunk		*chunk;		/* chunk started by Chunk:play() */
+	int			 priority;	/* its priority */
+	Uint32			 start;		/* ticks when started */
+	int			 group;		/* channel tag */
+} Voice;
+
+/*
+ * The channels belong to the process, the voices are shared by every state
+ * and only accessed with the lock held.
+ */
+static SDL_mutex	*voiceMutex;
+static Voice		*voices;
+static int		 nvoices;
+
+static int
+voiceLock(void)
+{
+	static SDL_SpinLock lock;
+
+	SDL_AtomicLock(&lock);
+
+	if (voiceMutex == NULL)
+		voiceMutex = SDL_CreateMutex();
+
+	SDL_AtomicUnlock(&lock);
+
+	if (voiceMutex == NULL)
+		return -1;
+
+	return SDL_LockMutex(voiceMutex);
+}
+
+static void
+voiceUnlock(void)
+{
+	SDL_UnlockMutex(voiceMutex);
+}
+
+/*
+ * Make sure there is one voice per allocated channel.
+ */
+static int
+voiceReserve(int count)
+{
+	Voice *tmp;
+	int i;
+
+	if (count <= nvoices)
+		return 0;
+	if ((tmp = realloc(voices, sizeof (Voice) * count)) == NULL)
+		return -1;
+
+	for (i = nvoices; i < count; ++i) {
+		memset(&tmp[i], 0, sizeof (Voice));
+		tmp[i].group = -1;
+	}
+
+	voices = tmp;
+	nvoices = count;
+
+	return 0;
+}
+
+/*
+ * Forget the voices of the channels past count, called when SDL_mixer
+ * deallocates them. Those which come back later start untagged and idle.
+ * This and the functions below are called with the lock held.
+ */
+static void
+voiceTruncate(int count)
+{
+	if (count >= 0 && count < nvoices)
+		nvoices = count;
+}
+
+static void
+voiceSetGroup(int from, int to, int tag)
+{
+	int i;
+
+	if (from < 0 || voiceReserve(to + 1) < 0)
+		return;
+
+	for (i = from; i <= to; ++i)
+		voices[i].group = tag;
+}
+
+/*
+ * Tells if the channel is still playing what Chunk:play() started on it,
+ * the voice is reset as soon as it is not.
+ */
+static int
+voiceIsOwned(int channel)
+{
+	if (voices[channel].chunk != NULL &&
+	    Mix_GetChunk(channel) == voices[channel].chunk)
+		return 1;
+
+	voices[channel].chunk = NULL;
+	voices[channel].priority = 0;
+	voices[channel].start = 0;
+
+	return 0;
+}
+
+/*
+ * Find the channel to use: a free one in the group, otherwise the voice
+ * with the lowest priority then the oldest one, if its priority is not
+ * greater than the requested one. Channels used by other functions are
+ * never stopped.
+ */
+static int
+voiceFind(int count, int group, int priority)
+{
+	int i, victim = -1;
+
+	for (i = 0; i < count; ++i) {
+		if (group >= 0 && voices[i].group != group)
+			continue;
+		if (!Mix_Playing(i))
+			return i;
+		if (!voiceIsOwned(i))
+			continue;
+
+		if (victim < 0 ||
+		    voices[i].priority < voices[victim].priority ||
+		    (voices[i].priority == voices[victim].priority &&
+		     (Sint32)(voices[i].start - voices[victim].start) < 0))
+			victim = i;
+	}
+
+	if (victim >= 0 && voices[victim].priority > priority)
+		return -1;
+
+	return victim;
+}
+
+/*
+ * Find the oldest instance of a chunk in the group if there are already max
+ * playing there.
+ */
+static int
+voiceFindInstance(int count, int group, Mix_Chunk *chunk, int max, int priority)
+{
+	int i, n = 0, oldest = -1;
+
+	for (i = 0; i < count; ++i) {
+		if (group >= 0 && voices[i].group != group)
+			continue;
+		if (!Mix_Playing(i) || !voiceIsOwned(i) || voices[i].chunk != chunk)
+			continue;
+
+		++ n;
+
+		if (oldest < 0 || (Sint32)(voices[i].start - voices[oldest].start) < 0)
+			oldest = i;
+	}
+
+	if (n < max)
+		return -2;
+	if (voices[oldest].priority > priority)
+		return -1;
+
+	return oldest;
+}
+
 /* ---------------------------------------------------------
  * Mix_Chunk object
  * --------------------------------------------------------- */
@@ -102,6 +300,114 @@ l_chunk_fadeInChannel(lua_State *L)
 	return commonPush(L, "b", 1);
 }
 
+/*
+ * Chunk:play(params)
+ *
+ * Play the chunk on a channel chosen automatically. When every channel of
+ * the group is busy, the voice with the lowest priority is stopped, the
+ * oldest one if several have the same priority. Channels not started by
+ * Chunk:play() are never stopped.
+ *
+ * Arguments:
+ *	params (optional) a table with the optional fields:
+ *	    priority the priority, default: 0
+ *	    group the channel tag to use, default: -1 (all)
+ *	    maxInstances the maximum of this chunk playing at once in the
+ *		group, the oldest instance is replaced, default: 0 (unlimited)
+ *	    cooldownMs the minimum delay between two plays, default: 0
+ *	    loops the number of loops, default: 0
+ *	    ticks the milliseconds limit, default: -1
+ *
+ * Returns:
+ *	The channel or nil on failure
+ *	The error message
+ */
+static int
+l_chunk_play(lua_State *L)
+{
+	Mix_Chunk *c	= commonGetAs(L, 1, MixChunk, Mix_Chunk *);
+	int priority	= 0;
+	int group	= -1;
+	int max		= 0;
+	int cooldown	= 0;
+	int loops	= 0;
+	int ticks	= -1;
+	Uint32 now	= SDL_GetTicks();
+	int count, channel;
+
+	if (lua_type(L, 2) == LUA_TTABLE) {
+		priority = tableGetInt(L, 2, "priority");
+		max = tableGetInt(L, 2, "maxInstances");
+		cooldown = tableGetInt(L, 2, "cooldownMs");
+		loops = tableGetInt(L, 2, "loops");
+
+		if (tableIsType(L, 2, "group", LUA_TNUMBER))
+			group = tableGetInt(L, 2, "group");
+		if (tableIsType(L, 2, "ticks", LUA_TNUMBER))
+			ticks = tableGetInt(L, 2, "ticks");
+	}
+
+	lua_getfield(L, LUA_REGISTRYINDEX, VOICE_COOLDOWNS);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_createtable(L, 0, 1);
+		lua_pushstring(L, "k");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, VOICE_COOLDOWNS);
+	}
+
+	if (cooldown > 0) {
+		lua_pushvalue(L, 1);
+		lua_rawget(L, -2);
+
+		if (lua_type(L, -1) == LUA_TNUMBER &&
+		    now - (Uint32)lua_tonumber(L, -1) < (Uint32)cooldown)
+			return commonPush(L, "ns", "chunk is cooling down");
+
+		lua_pop(L, 1);
+	}
+
+	/* No Lua call may raise while locked */
+	if (voiceLock() < 0)
+		return commonPushSDLError(L, 1);
+
+	count = Mix_AllocateChannels(-1);
+
+	if (voiceReserve(count) < 0) {
+		voiceUnlock();
+		return commonPushErrno(L, 1);
+	}
+
+	channel = -2;
+	if (max > 0)
+		channel = voiceFindInstance(count, group, c, max, priority);
+	if (channel == -2)
+		channel = voiceFind(count, group, priority);
+	if (channel < 0) {
+		voiceUnlock();
+		return commonPush(L, "ns", "no voice available");
+	}
+
+	if (Mix_PlayChannelTimed(channel, c, loops, ticks) < 0) {
+		voiceUnlock();
+		return commonPushSDLError(L, 1);
+	}
+
+	voices[channel].chunk = c;
+	voices[channel].priority = priority;
+	voices[channel].start = now;
+	voiceUnlock();
+
+	lua_pushvalue(L, 1);
+	lua_pushnumber(L, now);
+	lua_rawset(L, -3);
+
+	return commonPush(L, "i", channel);
+}
+
 /*
  * Chunk:__gc()
  */
@@ -120,6 +426,7 @@ static const luaL_Reg MixMethods[] = {
 	{ "volume",		l_chunk_volume				},
 	{ "playChannel",	l_chunk_playChannel			},
 	{ "fadeInChannel",	l_chunk_fadeInChannel			},
+	{ "play",		l_chunk_play				},
 	{ NULL,			NULL					}
 };
 
@@ -221,173 +528,2111 @@ l_music_fadeIn(lua_State *L)
 static int
 l_music_volume(lua_State *L)
 {
-	return commonPush(L, "i", Mix_VolumeMusic(luaL_checkinteger(L, 1)));
+	return commonPush(L, "i", Mix_VolumeMusic(luaL_checkinteger(L, 1)));
+}
+
+/*
+ * Music:resume()
+ */
+static int
+l_music_resume(lua_State *L)
+{
+	Mix_ResumeMusic();
+
+	(void)L;
+
+	return 0;
+}
+
+/*
+ * Music:rewind()
+ */
+static int
+l_music_rewind(lua_State *L)
+{
+	Mix_RewindMusic();
+
+	(void)L;
+
+	return 0;
+}
+
+/*
+ * Music:setPosition(pos)
+ *
+ * Arguments:
+ *	pos the position
+ *
+ * Returns:
+ *	True on success or nil on failure
+ *	The error message
+ */
+static int
+l_music_setPosition(lua_State *L)
+{
+	if (Mix_SetMusicPosition(luaL_checknumber(L, 1)) < 0)
+		return commonPushSDLError(L, 1);
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * Music:halt()
+ */
+static int
+l_music_halt(lua_State *L)
+{
+	Mix_HaltMusic();
+
+	(void)L;
+
+	return 0;
+}
+
+/*
+ * Music:fadeOut(delay)
+ *
+ * Arguments:
+ *	delay the delay in milliseconds
+ *
+ * Returns:
+ *	True on success or nil on failure
+ *	The error message
+ */
+static int
+l_music_fadeOut(lua_State *L)
+{
+	if (Mix_FadeOutMusic(luaL_checkinteger(L, 1)) < 0)
+		return commonPushSDLError(L, 1);
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * Music:type()
+ *
+ * Returns:
+ *	The music type (mixer.type)
+ */
+static int
+l_music_getType(lua_State *L)
+{
+	return commonPush(L, "i", Mix_GetMusicType(commonGetAs(L, 1, MixMusic, Mix_Music *)));
+}
+
+/*
+ * Music:playing()
+ *
+ * Returns:
+ *	True if playing
+ */
+static int
+l_music_playing(lua_State *L)
+{
+	return commonPush(L, "b", Mix_PlayingMusic());
+}
+
+/*
+ * Music:paused()
+ *
+ * Returns:
+ *	True if paused
+ */
+static int
+l_music_paused(lua_State *L)
+{
+	return commonPush(L, "b", Mix_PausedMusic());
+}
+
+/*
+ * Music:fading()
+ *
+ * Returns:
+ *	The fading status
+ */
+static int
+l_music_fading(lua_State *L)
+{
+	return commonPush(L, "i", Mix_FadingMusic());
+}
+
+/*
+ * Music:__gc()
+ */
+static int
+l_music_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, MixMusic);
+
+	if (udata->mustdelete)
+		Mix_FreeMusic(udata->data);
+
+	return 0;
+}
+
+static const luaL_Reg MusicMethods[] = {
+	{ "play",		l_music_play				},
+	{ "fadeIn",		l_music_fadeIn				},
+	{ "volume",		l_music_volume				},
+	{ "resume",		l_music_resume				},
+	{ "rewind",		l_music_rewind				},
+	{ "setPosition",	l_music_setPosition			},
+	{ "halt",		l_music_halt				},
+	{ "fadeOut",		l_music_fadeOut				},
+	{ "getType",		l_music_getType				},
+	{ "playing",		l_music_playing				},
+	{ "paused",		l_music_paused				},
+	{ "fading",		l_music_fading				},
+	{ NULL,			NULL					}
+};
+
+static const luaL_Reg MusicMetamethods[] = {
+	{ "__gc",		l_music_gc				},
+	{ NULL,			NULL					}
+};
+
+static const CommonObject MixMusicObject = {
+	"Music",
+	MusicMethods,
+	MusicMetamethods
+};
+
+/* ---------------------------------------------------------
+ * Asynchronous Mix_Chunk loading
+ * --------------------------------------------------------- */
+
+#define ChunkLoaderName	ChunkLoaderObject.name
+
+static const CommonObject ChunkLoaderObject;
+
+/*
+ * Registry fields for the decoding threads and for the weak table of chunks
+ * already decoded, indexed by path.
+ */
+#define LOADER_WORKERS	"__SDL_mixer_workers"
+#define LOADER_CACHE	"__SDL_mixer_chunks"
+
+typedef struct chunk_request {
+	struct chunk_loader	*loader;
+	int			 slot;		/* index in the anchor targets */
+	int			 cached;	/* already in the chunk cache */
+	char			*path;		/* file to decode or NULL */
+	SDL_RWops		*ops;		/* RWops to decode or NULL */
+	int			 closeops;	/* close ops once decoded */
+	Mix_Chunk		*chunk;		/* (result) the chunk */
+	char			*error;		/* (result) the error */
+
+	STAILQ_ENTRY(chunk_request) link;
+} ChunkRequest;
+
+typedef STAILQ_HEAD(chunk_requests, chunk_request) ChunkRequests;
+
+/*
+ * The anchor is a registry table which keeps everything the threads may read
+ * alive and stores the results:
+ *
+ * anchor.keep		sources (strings, RWops) and cached chunks
+ * anchor.targets	slot -> { index, ... } for deduplicated paths
+ * anchor.results	index -> chunk or false
+ * anchor.errors	index -> error message
+ * anchor.callback	the function to call or nil
+ */
+typedef struct chunk_loader {
+	SDL_mutex		*mutex;
+	SDL_cond		*cond;		/* signaled on each decode */
+	ChunkRequests		 done;		/* decoded, not delivered */
+	int			 pending;	/* queued or being decoded */
+	int			 cancelled;	/* loader collected */
+	int			 total;		/* number of sources */
+	int			 completed;	/* number of sources delivered */
+	int			 anchor;	/* registry reference */
+} ChunkLoader;
+
+static void
+chunkRequestFree(ChunkRequest *req)
+{
+	if (req->chunk != NULL)
+		Mix_FreeChunk(req->chunk);
+
+	free(req->path);
+	free(req->error);
+	free(req);
+}
+
+/*
+ * Runs on a worker thread, it only reads the request and the C strings or
+ * buffers anchored by the loader.
+ */
+static void
+chunkDecode(ChunkRequest *req)
+{
+	ChunkLoader *loader = req->loader;
+	int cancelled;
+
+	SDL_LockMutex(loader->mutex);
+	cancelled = loader->cancelled;
+	SDL_UnlockMutex(loader->mutex);
+
+	if (!cancelled) {
+		if (req->path != NULL)
+			req->chunk = Mix_LoadWAV(req->path);
+		else
+			req->chunk = Mix_LoadWAV_RW(req->ops, 0);
+
+		if (req->chunk == NULL)
+			req->error = strdup(Mix_GetError());
+	}
+
+	if (req->closeops)
+		SDL_RWclose(req->ops);
+
+	SDL_LockMutex(loader->mutex);
+	STAILQ_INSERT_TAIL(&loader->done, req, link);
+	-- loader->pending;
+
+	/* Still locked, the finalizer may free the loader once it is released */
+	SDL_CondBroadcast(loader->cond);
+	SDL_UnlockMutex(loader->mutex);
+}
+
+/*
+ * Hand one decoded request to Lua: store the chunk in the results, the cache
+ * and call the callback once per source index that requested it. Every index
+ * is delivered even if the callback raises, returns 1 with the first error
+ * pushed in that case.
+ */
+static int
+chunkDeliver(lua_State *L, ChunkLoader *loader, ChunkRequest *req)
+{
+	int anchor, value, indexes, error, i;
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, loader->anchor);
+	anchor = lua_gettop(L);
+
+	if (req->cached) {
+		lua_getfield(L, LUA_REGISTRYINDEX, LOADER_CACHE);
+		lua_getfield(L, -1, req->path);
+		lua_remove(L, -2);
+	} else if (req->chunk != NULL) {
+		commonPushUserdata(L, MixChunk, req->chunk);
+		req->chunk = NULL;
+
+		if (req->path != NULL) {
+			lua_getfield(L, LUA_REGISTRYINDEX, LOADER_CACHE);
+			lua_pushvalue(L, -2);
+			lua_setfield(L, -2, req->path);
+			lua_pop(L, 1);
+		}
+	} else
+		lua_pushboolean(L, 0);
+
+	value = lua_gettop(L);
+
+	lua_getfield(L, anchor, "targets");
+	lua_rawgeti(L, -1, req->slot);
+	indexes = lua_gettop(L);
+
+	lua_pushnil(L);
+	error = lua_gettop(L);
+
+	for (i = 1; ; ++i) {
+		int index;
+
+		lua_rawgeti(L, indexes, i);
+		if (lua_isnil(L, -1))
+			break;
+
+		index = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+
+		lua_getfield(L, anchor, "results");
+		lua_pushvalue(L, value);
+		lua_rawseti(L, -2, index);
+		lua_pop(L, 1);
+
+		if (req->error != NULL) {
+			lua_getfield(L, anchor, "errors");
+			lua_pushstring(L, req->error);
+			lua_rawseti(L, -2, index);
+			lua_pop(L, 1);
+		}
+
+		++ loader->completed;
+
+		lua_getfield(L, anchor, "callback");
+		if (lua_isfunction(L, -1)) {
+			if (lua_toboolean(L, value))
+				lua_pushvalue(L, value);
+			else
+				lua_pushnil(L);
+
+			lua_pushinteger(L, index);
+
+			if (req->error != NULL)
+				lua_pushstring(L, req->error);
+			else
+				lua_pushnil(L);
+
+			if (lua_pcall(L, 3, 0, 0) != 0) {
+				if (lua_isnil(L, error))
+					lua_replace(L, error);
+				else
+					lua_pop(L, 1);
+			}
+		} else
+			lua_pop(L, 1);
+	}
+
+	if (lua_isnil(L, error)) {
+		lua_settop(L, anchor - 1);
+		return 0;
+	}
+
+	lua_pushvalue(L, error);
+	lua_replace(L, anchor);
+	lua_settop(L, anchor);
+
+	return 1;
+}
+
+/*
+ * Deliver every request decoded so far, one at a time so that an error
+ * raised by the callback leaves the others queued.
+ */
+static int
+chunkPoll(lua_State *L, ChunkLoader *loader)
+{
+	ChunkRequest *req;
+	int before = loader->completed;
+
+	for (;;) {
+		SDL_LockMutex(loader->mutex);
+		if ((req = STAILQ_FIRST(&loader->done)) != NULL)
+			STAILQ_REMOVE_HEAD(&loader->done, link);
+		SDL_UnlockMutex(loader->mutex);
+
+		if (req == NULL)
+			break;
+
+		if (chunkDeliver(L, loader, req)) {
+			chunkRequestFree(req);
+			lua_error(L);
+		}
+
+		chunkRequestFree(req);
+	}
+
+	return loader->completed - before;
+}
+
+/*
+ * ChunkLoader:poll()
+ *
+ * Calls the callback for every chunk decoded since the last call.
+ *
+ * Returns:
+ *	The number of sources delivered
+ */
+static int
+l_loader_poll(lua_State *L)
+{
+	ChunkLoader *loader = commonGetAs(L, 1, ChunkLoaderName, ChunkLoader *);
+
+	return commonPush(L, "i", chunkPoll(L, loader));
+}
+
+/*
+ * ChunkLoader:wait()
+ *
+ * Blocks until every source is decoded then deliver them.
+ *
+ * Returns:
+ *	The number of sources delivered
+ */
+static int
+l_loader_wait(lua_State *L)
+{
+	ChunkLoader *loader = commonGetAs(L, 1, ChunkLoaderName, ChunkLoader *);
+
+	SDL_LockMutex(loader->mutex);
+	while (loader->pending > 0)
+		SDL_CondWait(loader->cond, loader->mutex);
+	SDL_UnlockMutex(loader->mutex);
+
+	return commonPush(L, "i", chunkPoll(L, loader));
+}
+
+/*
+ * ChunkLoader:progress()
+ *
+ * Returns:
+ *	The number of sources delivered
+ *	The total number of sources
+ */
+static int
+l_loader_progress(lua_State *L)
+{
+	ChunkLoader *loader = commonGetAs(L, 1, ChunkLoaderName, ChunkLoader *);
+
+	return commonPush(L, "ii", loader->completed, loader->total);
+}
+
+/*
+ * ChunkLoader:isDone()
+ *
+ * Returns:
+ *	True if every source has been delivered
+ */
+static int
+l_loader_isDone(lua_State *L)
+{
+	ChunkLoader *loader = commonGetAs(L, 1, ChunkLoaderName, ChunkLoader *);
+
+	return commonPush(L, "b", loader->completed == loader->total);
+}
+
+/*
+ * ChunkLoader:get(index)
+ *
+ * Arguments:
+ *	index the source index
+ *
+ * Returns:
+ *	The chunk or nil if not delivered or on failure
+ *	The error message
+ */
+static int
+l_loader_get(lua_State *L)
+{
+	ChunkLoader *loader = commonGetAs(L, 1, ChunkLoaderName, ChunkLoader *);
+	int index = luaL_checkinteger(L, 2);
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, loader->anchor);
+	lua_getfield(L, -1, "results");
+	lua_rawgeti(L, -1, index);
+
+	if (!lua_toboolean(L, -1)) {
+		lua_pushnil(L);
+		lua_getfield(L, -4, "errors");
+		lua_rawgeti(L, -1, index);
+		lua_remove(L, -2);
+
+		return 2;
+	}
+
+	return 1;
+}
+
+/*
+ * ChunkLoader:__gc()
+ *
+ * Pending requests are not decoded anymore, the ones already running are
+ * waited for as they may still read the anchored sources.
+ */
+static int
+l_loader_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, ChunkLoaderName);
+	ChunkLoader *loader = udata->data;
+	ChunkRequest *req, *tmp;
+
+	SDL_LockMutex(loader->mutex);
+	loader->cancelled = 1;
+	while (loader->pending > 0)
+		SDL_CondWait(loader->cond, loader->mutex);
+	SDL_UnlockMutex(loader->mutex);
+
+	STAILQ_FOREACH_SAFE(req, &loader->done, link, tmp)
+		chunkRequestFree(req);
+
+	luaL_unref(L, LUA_REGISTRYINDEX, loader->anchor);
+	SDL_DestroyCond(loader->cond);
+	SDL_DestroyMutex(loader->mutex);
+	free(loader);
+
+	return 0;
+}
+
+static const luaL_Reg ChunkLoaderMethods[] = {
+	{ "poll",		l_loader_poll				},
+	{ "wait",		l_loader_wait				},
+	{ "progress",		l_loader_progress			},
+	{ "isDone",		l_loader_isDone				},
+	{ "get",		l_loader_get				},
+	{ NULL,			NULL					}
+};
+
+static const luaL_Reg ChunkLoaderMetamethods[] = {
+	{ "__gc",		l_loader_gc				},
+	{ NULL,			NULL					}
+};
+
+static const CommonObject ChunkLoaderObject = {
+	"ChunkLoader",
+	ChunkLoaderMethods,
+	ChunkLoaderMetamethods
+};
+
+/* ---------------------------------------------------------
+ * Spatial audio scene
+ * --------------------------------------------------------- */
+
+#define SpatialSceneName	SpatialSceneObject.name
+
+static const CommonObject SpatialSceneObject;
+
+/*
+ * Number of floats per emitter in SpatialScene:update()
+ */
+#define SPATIAL_STRIDE		6
+
+/*
+ * Positions are extrapolated with the velocities between two updates, but
+ * never further than this.
+ */
+#define SPATIAL_MAX_EXTRAPOLATE	0.25
+
+/*
+ * Upper bound of the Doppler delay line, in seconds.
+ */
+#define SPATIAL_MAX_DELAY	1.0
+
+typedef struct spatial_emitter {
+	float			 pos[3];
+	float			 vel[3];
+	float			 gain;
+	int			 used;
+} SpatialEmitter;
+
+typedef struct spatial_voice {
+	struct spatial_scene	*scene;
+	int			 emitter;	/* emitter index (0-based) */
+	SDL_atomic_t		 active;	/* cleared by the done callback */
+	float			 gain[2];	/* gains applied at last block */
+	float			 delay;		/* delay applied at last block */
+	int			 started;	/* first block applied */
+	float			*line;		/* delay line, 2 floats per frame */
+	int			 linesize;	/* number of frames in line */
+	int			 write;		/* write position in line */
+} SpatialVoice;
+
+typedef struct spatial_scene {
+	SDL_mutex		*mutex;		/* protects emitters and listener */
+	SpatialEmitter		*emitters;
+	int			 nemitters;
+	float			 listener[3];
+	float			 lvel[3];
+	float			 right[3];	/* listener right vector */
+	float			 minDistance;
+	float			 maxDistance;
+	float			 rolloff;
+	float			 doppler;	/* doppler factor, 0 to disable */
+	float			 speed;		/* speed of sound */
+	Uint32			 stamp;		/* ticks of the last update */
+
+	/* Only accessed from the Lua state */
+	SpatialVoice		**voices;	/* one per channel or NULL */
+	int			 nvoices;
+
+	/* Device format */
+	int			 frequency;
+	Uint16			 format;
+	int			 channels;
+} SpatialScene;
+
+/*
+ * Compute the target gains and delay (in frames) of a voice. Called from the
+ * audio thread.
+ */
+static void
+spatialTarget(SpatialScene *s, SpatialVoice *v, float *gl, float *gr, float *delay)
+{
+	SpatialEmitter *e;
+	float dir[3], dist, gain, pan, angle, dt;
+	int i;
+
+	SDL_LockMutex(s->mutex);
+
+	if (v->emitter >= s->nemitters || !s->emitters[v->emitter].used) {
+		SDL_UnlockMutex(s->mutex);
+		*gl = *gr = 0;
+		*delay = v->delay;
+		return;
+	}
+
+	e = &s->emitters[v->emitter];
+	dt = (SDL_GetTicks() - s->stamp) / 1000.0f;
+	if (dt > SPATIAL_MAX_EXTRAPOLATE)
+		dt = SPATIAL_MAX_EXTRAPOLATE;
+
+	for (i = 0; i < 3; ++i)
+		dir[i] = (e->pos[i] + e->vel[i] * dt) - (s->listener[i] + s->lvel[i] * dt);
+
+	dist = SDL_sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+
+	/* Clamped inverse distance model */
+	gain = dist;
+	if (gain < s->minDistance)
+		gain = s->minDistance;
+	if (gain > s->maxDistance)
+		gain = s->maxDistance;
+
+	gain = s->minDistance / (s->minDistance + s->rolloff * (gain - s->minDistance));
+	gain *= e->gain;
+
+	/* Equal power panning on the listener right axis */
+	pan = 0;
+	if (dist > 0)
+		pan = (dir[0] * s->right[0] + dir[1] * s->right[1] + dir[2] * s->right[2]) / dist;
+
+	angle = (pan + 1) * (float)M_PI / 4;
+	*gl = gain * SDL_cos(angle);
+	*gr = gain * SDL_sin(angle);
+
+	/* Propagation delay, its variation produces the Doppler shift */
+	*delay = s->doppler * dist / s->speed * s->frequency;
+
+	SDL_UnlockMutex(s->mutex);
+
+	if (*delay > v->linesize - 2)
+		*delay = v->linesize - 2;
+	if (*delay < 0)
+		*delay = 0;
+}
+
+/*
+ * Sample access for the supported device formats, AUDIO_S16SYS and
+ * AUDIO_F32SYS.
+ */
+static float
+sampleRead(const void *stream, Uint16 format, int index)
+{
+	if (format == AUDIO_F32SYS)
+		return ((const float *)stream)[index];
+
+	return ((const Sint16 *)stream)[index] / 32768.0f;
+}
+
+static void
+sampleWrite(void *stream, Uint16 format, int index, float value)
+{
+	if (format == AUDIO_F32SYS) {
+		((float *)stream)[index] = value;
+		return;
+	}
+
+	value *= 32768.0f;
+	if (value > 32767.0f)
+		value = 32767.0f;
+	if (value < -32768.0f)
+		value = -32768.0f;
+
+	((Sint16 *)stream)[index] = (Sint16)value;
+}
+
+/*
+ * The effect itself, gains and delay are interpolated over the block to
+ * avoid zipper noise.
+ */
+static void
+spatialEffect(int chan, void *stream, int len, void *udata)
+{
+	SpatialVoice *v = udata;
+	SpatialScene *s = v->scene;
+	float gl, gr, delay, t, l, r, d, in[2], out[2];
+	int frames, i, c, size;
+
+	(void)chan;
+
+	spatialTarget(s, v, &gl, &gr, &delay);
+
+	if (!v->started) {
+		v->gain[0] = gl;
+		v->gain[1] = gr;
+		v->delay = delay;
+		v->started = 1;
+	}
+
+	size = (SDL_AUDIO_BITSIZE(s->format) / 8) * s->channels;
+	frames = len / size;
+
+	for (i = 0; i < frames; ++i) {
+		t = (float)(i + 1) / frames;
+		l = v->gain[0] + (gl - v->gain[0]) * t;
+		r = v->gain[1] + (gr - v->gain[1]) * t;
+
+		in[0] = sampleRead(stream, s->format, i * s->channels);
+		in[1] = (s->channels > 1)
+		    ? sampleRead(stream, s->format, i * s->channels + 1)
+		    : in[0];
+
+		if (v->line != NULL) {
+			float pos, frac;
+			int a, b;
+
+			v->line[v->write * 2] = in[0];
+			v->line[v->write * 2 + 1] = in[1];
+
+			d = v->delay + (delay - v->delay) * t;
+			pos = v->write - d;
+			if (pos < 0)
+				pos += v->linesize;
+
+			a = (int)pos;
+			b = (a + 1) % v->linesize;
+			frac = pos - a;
+
+			for (c = 0; c < 2; ++c)
+				in[c] = v->line[a * 2 + c] * (1 - frac) + v->line[b * 2 + c] * frac;
+
+			v->write = (v->write + 1) % v->linesize;
+		}
+
+		if (s->channels == 1) {
+			sampleWrite(stream, s->format, i, in[0] * (l + r) * 0.5f);
+			continue;
+		}
+
+		out[0] = in[0] * l;
+		out[1] = in[1] * r;
+		sampleWrite(stream, s->format, i * s->channels, out[0]);
+		sampleWrite(stream, s->format, i * s->channels + 1, out[1]);
+
+		/* Extra channels only get the average gain */
+		for (c = 2; c < s->channels; ++c) {
+			int index = i * s->channels + c;
+
+			sampleWrite(stream, s->format, index,
+			    sampleRead(stream, s->format, index) * (l + r) * 0.5f);
+		}
+	}
+
+	v->gain[0] = gl;
+	v->gain[1] = gr;
+	v->delay = delay;
+}
+
+/*
+ * Called when the channel halts or the effect is unregistered, the voice
+ * itself is released from the Lua state.
+ */
+static void
+spatialDone(int chan, void *udata)
+{
+	SpatialVoice *v = udata;
+
+	(void)chan;
+
+	SDL_AtomicSet(&v->active, 0);
+}
+
+static void
+spatialVoiceFree(SpatialVoice *v)
+{
+	free(v->line);
+	free(v);
+}
+
+/*
+ * Detach the voice of a channel, if any.
+ */
+static void
+spatialDetach(SpatialScene *s, int channel)
+{
+	SpatialVoice *v;
+
+	if (channel < 0 || channel >= s->nvoices || (v = s->voices[channel]) == NULL)
+		return;
+
+	if (SDL_AtomicGet(&v->active))
+		Mix_UnregisterEffect(channel, spatialEffect);
+
+	spatialVoiceFree(v);
+	s->voices[channel] = NULL;
+}
+
+/*
+ * Read the emitter or listener fields from a table.
+ */
+static void
+spatialGetVectors(lua_State *L, int idx, float *pos, float *vel)
+{
+	pos[0] = tableGetDouble(L, idx, "x");
+	pos[1] = tableGetDouble(L, idx, "y");
+	pos[2] = tableGetDouble(L, idx, "z");
+	vel[0] = tableGetDouble(L, idx, "vx");
+	vel[1] = tableGetDouble(L, idx, "vy");
+	vel[2] = tableGetDouble(L, idx, "vz");
+}
+
+static int
+spatialCheckEmitter(lua_State *L, SpatialScene *s, int arg)
+{
+	int id = luaL_checkinteger(L, arg);
+
+	if (id < 1 || id > s->nemitters || !s->emitters[id - 1].used)
+		return luaL_argerror(L, arg, "invalid emitter");
+
+	return id - 1;
+}
+
+/*
+ * SpatialScene:setListener(listener)
+ *
+ * Arguments:
+ *	listener the table with x, y, z, vx, vy, vz and the right vector
+ *	    rx, ry, rz (default: 1, 0, 0)
+ */
+static int
+l_scene_setListener(lua_State *L)
+{
+	SpatialScene *s = commonGetAs(L, 1, SpatialSceneName, SpatialScene *);
+	float pos[3], vel[3], right[3] = { 1, 0, 0 };
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+	spatialGetVectors(L, 2, pos, vel);
+
+	if (tableIsType(L, 2, "rx", LUA_TNUMBER) ||
+	    tableIsType(L, 2, "ry", LUA_TNUMBER) ||
+	    tableIsType(L, 2, "rz", LUA_TNUMBER)) {
+		right[0] = tableGetDouble(L, 2, "rx");
+		right[1] = tableGetDouble(L, 2, "ry");
+		right[2] = tableGetDouble(L, 2, "rz");
+	}
+
+	SDL_LockMutex(s->mutex);
+	memcpy(s->listener, pos, sizeof (pos));
+	memcpy(s->lvel, vel, sizeof (vel));
+	memcpy(s->right, right, sizeof (right));
+	s->stamp = SDL_GetTicks();
+	SDL_UnlockMutex(s->mutex);
+
+	return 0;
+}
+
+/*
+ * SpatialScene:addEmitter(emitter)
+ *
+ * Arguments:
+ *	emitter the table with x, y, z, vx, vy, vz and gain (default: 1)
+ *
+ * Returns:
+ *	The emitter id or nil on failure
+ *	The error message
+ */
+static int
+l_scene_addEmitter(lua_State *L)
+{
+	SpatialScene *s = commonGetAs(L, 1, SpatialSceneName, SpatialScene *);
+	SpatialEmitter e, *tmp;
+	int i;
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+	spatialGetVectors(L, 2, e.pos, e.vel);
+	e.gain = tableIsType(L, 2, "gain", LUA_TNUMBER) ? tableGetDouble(L, 2, "gain") : 1;
+	e.used = 1;
+
+	SDL_LockMutex(s->mutex);
+
+	for (i = 0; i < s->nemitters && s->emitters[i].used; ++i)
+		continue;
+
+	if (i == s->nemitters) {
+		tmp = realloc(s->emitters, sizeof (SpatialEmitter) * (s->nemitters * 2 + 16));
+
+		if (tmp == NULL) {
+			SDL_UnlockMutex(s->mutex);
+			return commonPushErrno(L, 1);
+		}
+
+		memset(tmp + s->nemitters, 0, sizeof (SpatialEmitter) * (s->nemitters + 16));
+		s->emitters = tmp;
+		s->nemitters = s->nemitters * 2 + 16;
+	}
+
+	s->emitters[i] = e;
+	SDL_UnlockMutex(s->mutex);
+
+	return commonPush(L, "i", i + 1);
+}
+
+/*
+ * SpatialScene:removeEmitter(id)
+ *
+ * The channels attached to this emitter become silent.
+ *
+ * Arguments:
+ *	id the emitter id
+ */
+static int
+l_scene_removeEmitter(lua_State *L)
+{
+	SpatialScene *s = commonGetAs(L, 1, SpatialSceneName, SpatialScene *);
+	int id = spatialCheckEmitter(L, s, 2);
+
+	SDL_LockMutex(s->mutex);
+	s->emitters[id].used = 0;
+	SDL_UnlockMutex(s->mutex);
+
+	return 0;
+}
+
+/*
+ * SpatialScene:update(data, first)
+ *
+ * Update consecutive emitters at once. The data is a flat sequence of
+ * x, y, z, vx, vy, vz per emitter, either as a table of numbers or as a
+ * string of packed native floats.
+ *
+ * Arguments:
+ *	data the table or the string
+ *	first (optional) the first emitter id, default: 1
+ *
+ * Returns:
+ *	The number of emitters updated
+ */
+static int
+l_scene_update(lua_State *L)
+{
+	SpatialScene *s = commonGetAs(L, 1, SpatialSceneName, SpatialScene *);
+	int first = luaL_optinteger(L, 3, 1) - 1;
+	const float *packed = NULL;
+	float *values;
+	size_t length;
+	int i, count;
+
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		packed = (const float *)lua_tolstring(L, 2, &length);
+		count = length / (sizeof (float) * SPATIAL_STRIDE);
+	} else {
+		luaL_checktype(L, 2, LUA_TTABLE);
+
+		for (length = 0; ; ++length) {
+			lua_rawgeti(L, 2, length + 1);
+			if (lua_isnil(L, -1))
+				break;
+			lua_pop(L, 1);
+		}
+
+		lua_pop(L, 1);
+		count = length / SPATIAL_STRIDE;
+	}
+
+	if (first < 0)
+		return luaL_argerror(L, 3, "invalid emitter");
+	if (first + count > s->nemitters)
+		count = s->nemitters - first;
+	if (count <= 0)
+		return commonPush(L, "i", 0);
+
+	/* Read the table before locking, the audio thread must not wait on Lua */
+	if (packed == NULL) {
+		if ((values = malloc(sizeof (float) * SPATIAL_STRIDE * count)) == NULL)
+			return luaL_error(L, "%s", strerror(errno));
+
+		for (i = 0; i < count * SPATIAL_STRIDE; ++i) {
+			lua_rawgeti(L, 2, i + 1);
+			values[i] = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+	} else
+		values = (float *)packed;
+
+	SDL_LockMutex(s->mutex);
+
+	for (i = 0; i < count; ++i) {
+		SpatialEmitter *e = &s->emitters[first + i];
+
+		memcpy(e->pos, &values[i * SPATIAL_STRIDE], sizeof (e->pos));
+		memcpy(e->vel, &values[i * SPATIAL_STRIDE + 3], sizeof (e->vel));
+	}
+
+	s->stamp = SDL_GetTicks();
+	SDL_UnlockMutex(s->mutex);
+
+	if (packed == NULL)
+		free(values);
+
+	return commonPush(L, "i", count);
+}
+
+/*
+ * SpatialScene:attach(channel, id)
+ *
+ * Position a playing channel on an emitter. The effect is removed by
+ * SDL_mixer when the channel halts, so it must be attached after each play.
+ *
+ * Arguments:
+ *	channel the channel
+ *	id the emitter id
+ *
+ * Returns:
+ *	True on success or nil on failure
+ *	The error message
+ */
+static int
+l_scene_attach(lua_State *L)
+{
+	SpatialScene *s = commonGetAs(L, 1, SpatialSceneName, SpatialScene *);
+	int channel = luaL_checkinteger(L, 2);
+	int id = spatialCheckEmitter(L, s, 3);
+	SpatialVoice *v;
+
+	if (channel < 0)
+		return luaL_argerror(L, 2, "invalid channel");
+
+	if (channel >= s->nvoices) {
+		SpatialVoice **tmp;
+		int n = channel + 1;
+
+		if ((tmp = realloc(s->voices, sizeof (SpatialVoice *) * n)) == NULL)
+			return commonPushErrno(L, 1);
+
+		memset(tmp + s->nvoices, 0, sizeof (SpatialVoice *) * (n - s->nvoices));
+		s->voices = tmp;
+		s->nvoices = n;
+	}
+
+	spatialDetach(s, channel);
+
+	if ((v = calloc(1, sizeof (SpatialVoice))) == NULL)
+		return commonPushErrno(L, 1);
+
+	v->scene = s;
+	v->emitter = id;
+	SDL_AtomicSet(&v->active, 1);
+
+	if (s->doppler > 0) {
+		v->linesize = s->frequency * SPATIAL_MAX_DELAY;
+
+		if ((v->line = calloc(v->linesize, sizeof (float) * 2)) == NULL) {
+			free(v);
+			return commonPushErrno(L, 1);
+		}
+	}
+
+	if (!Mix_RegisterEffect(channel, spatialEffect, spatialDone, v)) {
+		spatialVoiceFree(v);
+		return commonPushSDLError(L, 1);
+	}
+
+	s->voices[channel] = v;
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * SpatialScene:detach(channel)
+ *
+ * Arguments:
+ *	channel the channel
+ */
+static int
+l_scene_detach(lua_State *L)
+{
+	SpatialScene *s = commonGetAs(L, 1, SpatialSceneName, SpatialScene *);
+
+	spatialDetach(s, luaL_checkinteger(L, 2));
+
+	return 0;
+}
+
+/*
+ * SpatialScene:__gc()
+ */
+static int
+l_scene_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, SpatialSceneName);
+	SpatialScene *s = udata->data;
+	int i;
+
+	for (i = 0; i < s->nvoices; ++i)
+		spatialDetach(s, i);
+
+	SDL_DestroyMutex(s->mutex);
+	free(s->voices);
+	free(s->emitters);
+	free(s);
+
+	return 0;
+}
+
+static const luaL_Reg SpatialSceneMethods[] = {
+	{ "setListener",	l_scene_setListener			},
+	{ "addEmitter",		l_scene_addEmitter			},
+	{ "removeEmitter",	l_scene_removeEmitter			},
+	{ "update",		l_scene_update				},
+	{ "attach",		l_scene_attach				},
+	{ "detach",		l_scene_detach				},
+	{ NULL,			NULL					}
+};
+
+static const luaL_Reg SpatialSceneMetamethods[] = {
+	{ "__gc",		l_scene_gc				},
+	{ NULL,			NULL					}
+};
+
+static const CommonObject SpatialSceneObject = {
+	"SpatialScene",
+	SpatialSceneMethods,
+	SpatialSceneMetamethods
+};
+
+/* ---------------------------------------------------------
+ * Playlist object
+ * --------------------------------------------------------- */
+
+#define PlaylistName	PlaylistObject.name
+
+static const CommonObject PlaylistObject;
+
+/*
+ * mixer.crossfade
+ */
+static const CommonEnum PlaylistCurves[] = {
+	{ "Linear",			0				},
+	{ "EqualPower",			1				},
+	{ "SCurve",			2				},
+	{ NULL,				-1				}
+};
+
+#define PLAYLIST_RETIRED	8
+#define PLAYLIST_MAXTRACK	600000	/* default maxTrackMs, 10 minutes */
+
+typedef struct playlist {
+	SDL_mutex		*mutex;		/* protects everything below */
+	SDL_cond		*cond;		/* wakes up the decoder */
+	SDL_Thread		*thread;	/* the decoder */
+	int			 quit;		/* stops the decoder */
+
+	char			**paths;	/* the tracks */
+	int			 npaths;
+
+	int			 playing;	/* the hook is active */
+	int			 current;	/* index of cur or -1 */
+	Mix_Chunk		*cur;		/* track being played */
+	Uint32			 curpos;	/* offset in cur */
+	int			 wanted;	/* index to pre decode or -1 */
+	int			 nextIndex;	/* index of next */
+	Mix_Chunk		*next;		/* pre decoded track */
+	Uint32			 nextpos;	/* offset in next */
+	int			 fading;	/* crossfade in progress */
+	Uint32			 fadepos;	/* bytes of crossfade done */
+	Uint32			 fadelen;	/* bytes of this crossfade */
+	Uint32			 fadebytes;	/* bytes of crossfade setting */
+	Mix_Chunk		*retired[PLAYLIST_RETIRED];
+	int			 nretired;	/* chunks for the decoder to free */
+	char			*error;		/* last decoding error */
+
+	int			 crossfade;	/* crossfade in ms */
+	int			 curve;		/* mixer.crossfade */
+	int			 loop;		/* restart at the end */
+	Uint32			 maxbytes;	/* longest decoded track */
+
+	/* Device format */
+	int			 frequency;
+	Uint16			 format;
+	int			 channels;
+	int			 framesize;
+} Playlist;
+
+/*
+ * Playlist hooked with Mix_HookMusic(), only one can play at a time.
+ */
+static Playlist *playlistHooked;
+
+/*
+ * Index of the track after the given one, or -1 at the end.
+ */
+static int
+playlistAfter(Playlist *p, int index)
+{
+	if (index + 1 < p->npaths)
+		return index + 1;
+
+	return (p->loop && p->npaths > 0) ? 0 : -1;
+}
+
+/*
+ * Give a chunk to the decoder thread so that the audio thread never frees,
+ * returns 0 when the ring is full and the chunk must be kept.
+ */
+static int
+playlistRetire(Playlist *p, Mix_Chunk *chunk)
+{
+	if (chunk == NULL)
+		return 1;
+	if (p->nretired == PLAYLIST_RETIRED)
+		return 0;
+
+	p->retired[p->nretired++] = chunk;
+	SDL_CondSignal(p->cond);
+
+	return 1;
+}
+
+/*
+ * Take both tracks out of the playlist, the caller frees them once the
+ * mutex is released as Mix_FreeChunk() locks the audio device.
+ */
+static void
+playlistTake(Playlist *p, Mix_Chunk **cur, Mix_Chunk **next)
+{
+	*cur = p->cur;
+	*next = p->next;
+	p->cur = p->next = NULL;
+	p->fading = 0;
+}
+
+static int
+playlistDecoder(Playlist *p)
+{
+	Mix_Chunk *chunk;
+	char *path;
+	int index;
+
+	SDL_LockMutex(p->mutex);
+
+	while (!p->quit) {
+		if (p->nretired > 0) {
+			chunk = p->retired[--p->nretired];
+			SDL_UnlockMutex(p->mutex);
+			Mix_FreeChunk(chunk);
+			SDL_LockMutex(p->mutex);
+			continue;
+		}
+
+		if (p->next != NULL || p->wanted < 0) {
+			SDL_CondWait(p->cond, p->mutex);
+			continue;
+		}
+
+		/* The strings are only freed by the finalizer */
+		index = p->wanted;
+		path = p->paths[index];
+		SDL_UnlockMutex(p->mutex);
+
+		chunk = Mix_LoadWAV(path);
+
+		/* Whole tracks stay in memory, skip the ones over the limit */
+		if (chunk != NULL && chunk->alen > p->maxbytes) {
+			Mix_FreeChunk(chunk);
+			chunk = NULL;
+			Mix_SetError("%s: track longer than maxTrackMs", path);
+		}
+
+		SDL_LockMutex(p->mutex);
+
+		if (chunk == NULL) {
+			free(p->error);
+			p->error = strdup(Mix_GetError());
+		}
+
+		if (p->wanted != index) {
+			SDL_UnlockMutex(p->mutex);
+			Mix_FreeChunk(chunk);
+			SDL_LockMutex(p->mutex);
+		} else if (chunk == NULL) {
+			/* Skip it, but don't cycle forever on broken tracks */
+			p->wanted = playlistAfter(p, index);
+
+			if (p->wanted == p->current || (p->current < 0 && p->wanted <= index))
+				p->wanted = -1;
+		} else {
+			p->next = chunk;
+			p->nextIndex = index;
+			p->nextpos = 0;
+			p->wanted = -1;
+		}
+	}
+
+	SDL_UnlockMutex(p->mutex);
+
+	return 0;
+}
+
+static float
+playlistCurve(int curve, float t)
+{
+	switch (curve) {
+	case 1:
+		return SDL_sin(t * (float)M_PI / 2);
+	case 2:
+		return t * t * (3 - 2 * t);
+	default:
+		break;
+	}
+
+	return t;
+}
+
+/*
+ * Make the pre decoded track the current one and ask for the following, the
+ * current one must be retired already.
+ */
+static void
+playlistPromote(Playlist *p)
+{
+	p->cur = p->next;
+	p->curpos = p->nextpos;
+	p->current = p->nextIndex;
+	p->next = NULL;
+	p->fading = 0;
+	p->wanted = playlistAfter(p, p->current);
+
+	SDL_CondSignal(p->cond);
+}
+
+/*
+ * Start a crossfade when the end of the current track is close enough.
+ */
+static void
+playlistCheckFade(Playlist *p)
+{
+	Uint32 remaining;
+
+	if (p->fading || p->cur == NULL || p->next == NULL || p->crossfade <= 0)
+		return;
+
+	remaining = p->cur->alen - p->curpos;
+
+	if (remaining <= p->fadebytes) {
+		p->fading = 1;
+		p->fadepos = 0;
+		p->fadelen = remaining;
+	}
+}
+
+/*
+ * The Mix_HookMusic() callback, the stream contains silence and the channels
+ * are mixed over it afterwards.
+ */
+static void
+playlistMix(void *udata, Uint8 *stream, int len)
+{
+	Playlist *p = udata;
+	int i, c, frames, base;
+	float gin, gout, t, v;
+
+	SDL_LockMutex(p->mutex);
+
+	if (!p->playing) {
+		SDL_UnlockMutex(p->mutex);
+		return;
+	}
+
+	frames = len / p->framesize;
+
+	for (i = 0; i < frames; ++i) {
+		/* Gapless: jump to the next track in the same block */
+		if (p->cur == NULL || p->curpos >= p->cur->alen) {
+			/* Silence until the decoder frees the retired chunks */
+			if (p->next == NULL || !playlistRetire(p, p->cur))
+				break;
+
+			playlistPromote(p);
+		}
+
+		playlistCheckFade(p);
+
+		gout = 1;
+		gin = 0;
+
+		if (p->fading) {
+			t = p->fadelen ? (float)p->fadepos / p->fadelen : 1;
+			gin = playlistCurve(p->curve, t);
+			gout = playlistCurve(p->curve, 1 - t);
+		}
+
+		base = i * p->channels;
+
+		for (c = 0; c < p->channels; ++c) {
+			v = sampleRead(p->cur->abuf + p->curpos, p->format, c) * gout;
+
+			if (p->fading && p->nextpos < p->next->alen)
+				v += sampleRead(p->next->abuf + p->nextpos, p->format, c) * gin;
+
+			sampleWrite(stream, p->format, base + c, sampleRead(stream, p->format, base + c) + v);
+		}
+
+		p->curpos += p->framesize;
+
+		if (p->fading) {
+			p->nextpos += p->framesize;
+			p->fadepos += p->framesize;
+
+			if (p->fadepos >= p->fadelen)
+				p->curpos = p->cur->alen;
+		}
+	}
+
+	SDL_UnlockMutex(p->mutex);
+}
+
+static void
+playlistSetCrossfade(Playlist *p, int ms, int curve)
+{
+	p->crossfade = ms;
+	p->curve = curve;
+	p->fadebytes = (Uint32)((Sint64)ms * p->frequency / 1000) * p->framesize;
+}
+
+/*
+ * Playlist:add(path)
+ *
+ * Arguments:
+ *	path the path to the track
+ *
+ * Returns:
+ *	The track index or nil on failure
+ *	The error message
+ */
+static int
+l_playlist_add(lua_State *L)
+{
+	Playlist *p = commonGetAs(L, 1, PlaylistName, Playlist *);
+	const char *path = luaL_checkstring(L, 2);
+	char **tmp, *copy;
+
+	if ((copy = strdup(path)) == NULL)
+		return commonPushErrno(L, 1);
+
+	SDL_LockMutex(p->mutex);
+
+	if ((tmp = realloc(p->paths, sizeof (char *) * (p->npaths + 1))) == NULL) {
+		SDL_UnlockMutex(p->mutex);
+		free(copy);
+		return commonPushErrno(L, 1);
+	}
+
+	p->paths = tmp;
+	p->paths[p->npaths++] = copy;
+
+	/* Pre decode it if the playlist was waiting for it */
+	if (p->playing && p->next == NULL && p->wanted < 0)
+		p->wanted = playlistAfter(p, p->current);
+
+	SDL_UnlockMutex(p->mutex);
+	SDL_CondSignal(p->cond);
+
+	return commonPush(L, "i", p->npaths);
+}
+
+/*
+ * Playlist:play(index)
+ *
+ * Start or resume the playlist, it replaces the music played by Music:play()
+ * until Playlist:stop() is called. The first track starts as soon as it is
+ * decoded.
+ *
+ * Arguments:
+ *	index (optional) the track to start at, default: resume or 1
+ */
+static int
+l_playlist_play(lua_State *L)
+{
+	Playlist *p = commonGetAs(L, 1, PlaylistName, Playlist *);
+	Mix_Chunk *cur = NULL, *next = NULL;
+	int index = luaL_optinteger(L, 2, 0) - 1;
+
+	if (index >= p->npaths)
+		return luaL_argerror(L, 2, "invalid track");
+
+	SDL_LockMutex(p->mutex);
+
+	if (index >= 0 || p->current < 0) {
+		if (index < 0)
+			index = 0;
+
+		playlistTake(p, &cur, &next);
+		p->current = -1;
+		p->wanted = index;
+	}
+
+	p->playing = 1;
+	SDL_UnlockMutex(p->mutex);
+	SDL_CondSignal(p->cond);
+
+	Mix_FreeChunk(cur);
+	Mix_FreeChunk(next);
+
+	if (playlistHooked != p) {
+		Mix_HookMusic(playlistMix, p);
+		playlistHooked = p;
+	}
+
+	return 0;
+}
+
+/*
+ * Playlist:pause()
+ */
+static int
+l_playlist_pause(lua_State *L)
+{
+	Playlist *p = commonGetAs(L, 1, PlaylistName, Playlist *);
+
+	SDL_LockMutex(p->mutex);
+	p->playing = 0;
+	SDL_UnlockMutex(p->mutex);
+
+	return 0;
+}
+
+/*
+ * Playlist:stop()
+ *
+ * Stop and give the music back to Music:play().
+ */
+static int
+l_playlist_stop(lua_State *L)
+{
+	Playlist *p = commonGetAs(L, 1, PlaylistName, Playlist *);
+	Mix_Chunk *cur, *next;
+
+	if (playlistHooked == p) {
+		Mix_HookMusic(NULL, NULL);
+		playlistHooked = NULL;
+	}
+
+	SDL_LockMutex(p->mutex);
+	p->playing = 0;
+	p->current = -1;
+	p->wanted = -1;
+	playlistTake(p, &cur, &next);
+	SDL_UnlockMutex(p->mutex);
+
+	Mix_FreeChunk(cur);
+	Mix_FreeChunk(next);
+
+	return 0;
+}
+
+/*
+ * Playlist:skip()
+ *
+ * Crossfade now to the next track if it is already decoded.
+ *
+ * Returns:
+ *	True if the transition started
+ */
+static int
+l_playlist_skip(lua_State *L)
+{
+	Playlist *p = commonGetAs(L, 1, PlaylistName, Playlist *);
+	int ret = 0;
+
+	SDL_LockMutex(p->mutex);
+
+	if (p->cur != NULL && p->next != NULL && !p->fading) {
+		if (p->crossfade > 0) {
+			p->fading = 1;
+			p->fadepos = 0;
+			p->fadelen = p->fadebytes;
+
+			if (p->fadelen > p->cur->alen - p->curpos)
+				p->fadelen = p->cur->alen - p->curpos;
+		} else
+			p->curpos = p->cur->alen;
+
+		ret = 1;
+	}
+
+	SDL_UnlockMutex(p->mutex);
+
+	return commonPush(L, "b", ret);
+}
+
+/*
+ * Playlist:setCrossfade(ms, curve)
+ *
+ * Arguments:
+ *	ms the crossfade duration, 0 for gapless transitions
+ *	curve (optional) the curve (mixer.crossfade), default: EqualPower
+ */
+static int
+l_playlist_setCrossfade(lua_State *L)
+{
+	Playlist *p = commonGetAs(L, 1, PlaylistName, Playlist *);
+	int ms = luaL_checkinteger(L, 2);
+	int curve = luaL_optinteger(L, 3, 1);
+
+	SDL_LockMutex(p->mutex);
+	if (!p->fading)
+		playlistSetCrossfade(p, ms, curve);
+	SDL_UnlockMutex(p->mutex);
+
+	return 0;
+}
+
+/*
+ * Playlist:setLoop(loop)
+ *
+ * Arguments:
+ *	loop true to restart at the first track
+ */
+static int
+l_playlist_setLoop(lua_State *L)
+{
+	Playlist *p = commonGetAs(L, 1, PlaylistName, Playlist *);
+
+	SDL_LockMutex(p->mutex);
+	p->loop = lua_toboolean(L, 2);
+	if (p->current >= 0 && p->next == NULL && p->wanted < 0)
+		p->wanted = playlistAfter(p, p->current);
+	SDL_UnlockMutex(p->mutex);
+	SDL_CondSignal(p->cond);
+
+	return 0;
+}
+
+/*
+ * Playlist:position()
+ *
+ * Returns:
+ *	The position in the current track in seconds or nil if none
+ *	The current track index
+ *	The current track duration in seconds
+ */
+static int
+l_playlist_position(lua_State *L)
+{
+	Playlist *p = commonGetAs(L, 1, PlaylistName, Playlist *);
+	double rate = (double)p->frequency * p->framesize;
+	double position, duration;
+	int index;
+
+	SDL_LockMutex(p->mutex);
+
+	if (p->cur == NULL) {
+		SDL_UnlockMutex(p->mutex);
+		return commonPush(L, "n");
+	}
+
+	position = p->curpos / rate;
+	duration = p->cur->alen / rate;
+	index = p->current + 1;
+	SDL_UnlockMutex(p->mutex);
+
+	return commonPush(L, "did", position, index, duration);
+}
+
+/*
+ * Playlist:getError()
+ *
+ * Returns:
+ *	The last decoding error or nil
+ */
+static int
+l_playlist_getError(lua_State *L)
+{
+	Playlist *p = commonGetAs(L, 1, PlaylistName, Playlist *);
+
+	SDL_LockMutex(p->mutex);
+
+	if (p->error != NULL)
+		lua_pushstring(L, p->error);
+	else
+		lua_pushnil(L);
+
+	SDL_UnlockMutex(p->mutex);
+
+	return 1;
+}
+
+/*
+ * Playlist:__gc()
+ */
+static int
+l_playlist_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, PlaylistName);
+	Playlist *p = udata->data;
+	int i;
+
+	if (playlistHooked == p) {
+		Mix_HookMusic(NULL, NULL);
+		playlistHooked = NULL;
+	}
+
+	SDL_LockMutex(p->mutex);
+	p->quit = 1;
+	SDL_UnlockMutex(p->mutex);
+	SDL_CondSignal(p->cond);
+	SDL_WaitThread(p->thread, NULL);
+
+	for (i = 0; i < p->nretired; ++i)
+		Mix_FreeChunk(p->retired[i]);
+	for (i = 0; i < p->npaths; ++i)
+		free(p->paths[i]);
+
+	if (p->cur)
+		Mix_FreeChunk(p->cur);
+	if (p->next)
+		Mix_FreeChunk(p->next);
+
+	SDL_DestroyCond(p->cond);
+	SDL_DestroyMutex(p->mutex);
+	free(p->paths);
+	free(p->error);
+	free(p);
+
+	return 0;
+}
+
+static const luaL_Reg PlaylistMethods[] = {
+	{ "add",		l_playlist_add				},
+	{ "play",		l_playlist_play				},
+	{ "pause",		l_playlist_pause			},
+	{ "stop",		l_playlist_stop				},
+	{ "skip",		l_playlist_skip				},
+	{ "setCrossfade",	l_playlist_setCrossfade			},
+	{ "setLoop",		l_playlist_setLoop			},
+	{ "position",		l_playlist_position			},
+	{ "getError",		l_playlist_getError			},
+	{ NULL,			NULL					}
+};
+
+static const luaL_Reg PlaylistMetamethods[] = {
+	{ "__gc",		l_playlist_gc				},
+	{ NULL,			NULL					}
+};
+
+static const CommonObject PlaylistObject = {
+	"Playlist",
+	PlaylistMethods,
+	PlaylistMetamethods
+};
+
+/* ---------------------------------------------------------
+ * SoundBank object
+ * --------------------------------------------------------- */
+
+#define SoundBankName	SoundBankObject.name
+
+static const CommonObject SoundBankObject;
+
+/*
+ * A sound bank is a file of PCM already converted to the device format:
+ *
+ * header	SoundBankHeader
+ * entries	SoundBankEntry * count
+ * names	the names, not terminated
+ * data		each sound aligned on SOUNDBANK_ALIGN bytes
+ *
+ * Every field is in native byte order, a bank is only valid for the
+ * machine and the audio format it has been built for.
+ */
+#define SOUNDBANK_MAGIC		"LSBK"
+#define SOUNDBANK_VERSION	1
+#define SOUNDBANK_ALIGN		16
+
+typedef struct sound_bank_header {
+	char			 magic[4];
+	Uint32			 version;
+	Uint32			 frequency;
+	Uint16			 format;
+	Uint16			 channels;
+	Uint32			 count;		/* number of entries */
+	Uint32			 names;		/* offset of the names */
+	Uint32			 namesize;	/* size of the names */
+	Uint32			 reserved;
+} SoundBankHeader;
+
+typedef struct sound_bank_entry {
+	Uint32			 offset;	/* offset of the PCM */
+	Uint32			 length;	/* length of the PCM */
+	Uint32			 name;		/* offset in the names */
+	Uint32			 namelen;	/* length of the name */
+} SoundBankEntry;
+
+typedef struct sound_bank {
+	Uint8			*data;		/* the mapping */
+	size_t			 size;		/* its size */
+	const SoundBankHeader	*header;
+	const SoundBankEntry	*entries;
+	const char		*names;
+#if defined(_WIN32)
+	HANDLE			 file;
+	HANDLE			 mapping;
+#endif
+} SoundBank;
+
+static void
+bankUnmap(SoundBank *bank)
+{
+#if defined(_WIN32)
+	if (bank->data)
+		UnmapViewOfFile(bank->data);
+	if (bank->mapping)
+		CloseHandle(bank->mapping);
+	if (bank->file && bank->file != INVALID_HANDLE_VALUE)
+		CloseHandle(bank->file);
+#else
+	if (bank->data)
+		munmap(bank->data, bank->size);
+#endif
 }
 
 /*
- * Music:resume()
+ * Map the whole file read only, the pages are shared with every process
+ * using the same bank.
  */
 static int
-l_music_resume(lua_State *L)
+bankMap(SoundBank *bank, const char *path)
 {
-	Mix_ResumeMusic();
+#if defined(_WIN32)
+	LARGE_INTEGER size;
 
-	(void)L;
+	bank->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+	    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (bank->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(bank->file, &size))
+		goto fail;
+
+	bank->size = (size_t)size.QuadPart;
+	bank->mapping = CreateFileMappingA(bank->file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	if (bank->mapping == NULL)
+		goto fail;
+	if ((bank->data = MapViewOfFile(bank->mapping, FILE_MAP_READ, 0, 0, 0)) == NULL)
+		goto fail;
 
 	return 0;
-}
 
-/*
- * Music:rewind()
- */
-static int
-l_music_rewind(lua_State *L)
-{
-	Mix_RewindMusic();
+fail:
+	SDL_SetError("%s: can't map file (error %lu)", path, GetLastError());
+	bankUnmap(bank);
 
-	(void)L;
+	return -1;
+#else
+	struct stat st;
+	void *data;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		goto fail;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		goto fail;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		goto fail;
+
+	bank->data = data;
+	bank->size = st.st_size;
 
 	return 0;
+
+fail:
+	SDL_SetError("%s: %s", path, strerror(errno));
+
+	return -1;
+#endif
 }
 
 /*
- * Music:setPosition(pos)
- *
- * Arguments:
- *	pos the position
- *
- * Returns:
- *	True on success or nil on failure
- *	The error message
+ * Check that every offset stays in the mapping and that the PCM format is
+ * the one of the device.
  */
 static int
-l_music_setPosition(lua_State *L)
+bankCheck(SoundBank *bank)
 {
-	if (Mix_SetMusicPosition(luaL_checknumber(L, 1)) < 0)
-		return commonPushSDLError(L, 1);
+	const SoundBankHeader *h = (const SoundBankHeader *)bank->data;
+	int frequency, channels;
+	Uint16 format;
+	Uint32 i;
 
-	return commonPush(L, "b", 1);
+	if (bank->size < sizeof (SoundBankHeader) ||
+	    memcmp(h->magic, SOUNDBANK_MAGIC, 4) != 0 ||
+	    h->version != SOUNDBANK_VERSION)
+		return SDL_SetError("not a sound bank");
+
+	if (h->count > (bank->size - sizeof (SoundBankHeader)) / sizeof (SoundBankEntry) ||
+	    h->names > bank->size || h->namesize > bank->size - h->names)
+		return SDL_SetError("corrupted sound bank");
+
+	bank->header = h;
+	bank->entries = (const SoundBankEntry *)(h + 1);
+	bank->names = (const char *)bank->data + h->names;
+
+	for (i = 0; i < h->count; ++i) {
+		const SoundBankEntry *e = &bank->entries[i];
+
+		if (e->offset > bank->size || e->length > bank->size - e->offset ||
+		    e->name > h->namesize || e->namelen > h->namesize - e->name)
+			return SDL_SetError("corrupted sound bank");
+	}
+
+	if (!Mix_QuerySpec(&frequency, &format, &channels))
+		return -1;
+	if (h->frequency != (Uint32)frequency || h->format != format || h->channels != channels)
+		return SDL_SetError("sound bank format does not match the audio device");
+
+	return 0;
 }
 
 /*
- * Music:halt()
+ * The user value of banks and of their chunks, so that chunks keep the
+ * mapping alive and the bank reuses its chunks.
  */
-static int
-l_music_halt(lua_State *L)
+static void
+bankSetAnchor(lua_State *L, int index)
 {
-	Mix_HaltMusic();
-
-	(void)L;
+#if LUA_VERSION_NUM >= 502
+	lua_setuservalue(L, index);
+#else
+	lua_setfenv(L, index);
+#endif
+}
 
-	return 0;
+static void
+bankGetAnchor(lua_State *L, int index)
+{
+#if LUA_VERSION_NUM >= 502
+	lua_getuservalue(L, index);
+#else
+	lua_getfenv(L, index);
+#endif
 }
 
 /*
- * Music:fadeOut(delay)
+ * SoundBank:get(key)
+ *
+ * The chunk is created once and kept by the bank, it references the mapped
+ * memory directly.
  *
  * Arguments:
- *	delay the delay in milliseconds
+ *	key the sound name or index
  *
  * Returns:
- *	True on success or nil on failure
+ *	The chunk or nil on failure
  *	The error message
  */
 static int
-l_music_fadeOut(lua_State *L)
+l_bank_get(lua_State *L)
 {
-	if (Mix_FadeOutMusic(luaL_checkinteger(L, 1)) < 0)
+	SoundBank *bank = commonGetAs(L, 1, SoundBankName, SoundBank *);
+	const SoundBankEntry *e;
+	Mix_Chunk *chunk;
+	int index;
+
+	bankGetAnchor(L, 1);
+
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		lua_getfield(L, -1, "names");
+		lua_pushvalue(L, 2);
+		lua_rawget(L, -2);
+
+		if (lua_isnil(L, -1))
+			return commonPush(L, "ns", "no such sound");
+
+		index = lua_tointeger(L, -1);
+		lua_pop(L, 2);
+	} else
+		index = luaL_checkinteger(L, 2);
+
+	if (index < 1 || (Uint32)index > bank->header->count)
+		return commonPush(L, "ns", "no such sound");
+
+	lua_getfield(L, -1, "chunks");
+	lua_rawgeti(L, -1, index);
+
+	if (!lua_isnil(L, -1))
+		return 1;
+
+	lua_pop(L, 1);
+	e = &bank->entries[index - 1];
+
+	if ((chunk = Mix_QuickLoad_RAW(bank->data + e->offset, e->length)) == NULL)
 		return commonPushSDLError(L, 1);
 
-	return commonPush(L, "b", 1);
-}
+	commonPushUserdata(L, MixChunk, chunk);
 
-/*
- * Music:type()
- *
- * Returns:
- *	The music type (mixer.type)
- */
-static int
-l_music_getType(lua_State *L)
-{
-	return commonPush(L, "i", Mix_GetMusicType(commonGetAs(L, 1, MixMusic, Mix_Music *)));
-}
+	lua_createtable(L, 0, 1);
+	lua_pushvalue(L, 1);
+	lua_setfield(L, -2, "bank");
+	bankSetAnchor(L, -2);
 
-/*
- * Music:playing()
- *
- * Returns:
- *	True if playing
- */
-static int
-l_music_playing(lua_State *L)
-{
-	return commonPush(L, "b", Mix_PlayingMusic());
+	lua_pushvalue(L, -1);
+	lua_rawseti(L, -3, index);
+
+	return 1;
 }
 
 /*
- * Music:paused()
+ * SoundBank:count()
  *
  * Returns:
- *	True if paused
+ *	The number of sounds
  */
 static int
-l_music_paused(lua_State *L)
+l_bank_count(lua_State *L)
 {
-	return commonPush(L, "b", Mix_PausedMusic());
+	SoundBank *bank = commonGetAs(L, 1, SoundBankName, SoundBank *);
+
+	return commonPush(L, "i", bank->header->count);
 }
 
 /*
- * Music:fading()
+ * SoundBank:names()
  *
  * Returns:
- *	The fading status
+ *	The sequence of sound names
  */
 static int
-l_music_fading(lua_State *L)
+l_bank_names(lua_State *L)
 {
-	return commonPush(L, "i", Mix_FadingMusic());
+	SoundBank *bank = commonGetAs(L, 1, SoundBankName, SoundBank *);
+	Uint32 i;
+
+	lua_createtable(L, bank->header->count, 0);
+
+	for (i = 0; i < bank->header->count; ++i) {
+		lua_pushlstring(L, bank->names + bank->entries[i].name, bank->entries[i].namelen);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 1;
 }
 
 /*
- * Music:__gc()
+ * SoundBank:__gc()
  */
 static int
-l_music_gc(lua_State *L)
+l_bank_gc(lua_State *L)
 {
-	CommonUserdata *udata = commonGetUserdata(L, 1, MixMusic);
+	CommonUserdata *udata = commonGetUserdata(L, 1, SoundBankName);
 
-	if (udata->mustdelete)
-		Mix_FreeMusic(udata->data);
+	if (udata->mustdelete) {
+		bankUnmap(udata->data);
+		free(udata->data);
+	}
 
 	return 0;
 }
 
-static const luaL_Reg MusicMethods[] = {
-	{ "play",		l_music_play				},
-	{ "fadeIn",		l_music_fadeIn				},
-	{ "volume",		l_music_volume				},
-	{ "resume",		l_music_resume				},
-	{ "rewind",		l_music_rewind				},
-	{ "setPosition",	l_music_setPosition			},
-	{ "halt",		l_music_halt				},
-	{ "fadeOut",		l_music_fadeOut				},
-	{ "getType",		l_music_getType				},
-	{ "playing",		l_music_playing				},
-	{ "paused",		l_music_paused				},
-	{ "fading",		l_music_fading				},
+static const luaL_Reg SoundBankMethods[] = {
+	{ "get",		l_bank_get				},
+	{ "count",		l_bank_count				},
+	{ "names",		l_bank_names				},
 	{ NULL,			NULL					}
 };
 
-static const luaL_Reg MusicMetamethods[] = {
-	{ "__gc",		l_music_gc				},
+static const luaL_Reg SoundBankMetamethods[] = {
+	{ "__gc",		l_bank_gc				},
 	{ NULL,			NULL					}
 };
 
-static const CommonObject MixMusicObject = {
-	"Music",
-	MusicMethods,
-	MusicMetamethods
+static const CommonObject SoundBankObject = {
+	"SoundBank",
+	SoundBankMethods,
+	SoundBankMetamethods
 };
 
 /* ---------------------------------------------------------
@@ -555,6 +2800,222 @@ l_mixer_loadWAV_RW(lua_State *L)
 	return commonPush(L, "p", MixChunk, c);
 }
 
+/*
+ * mixer.loadWAVAsync(sources, callback)
+ *
+ * Decode the sources on background threads, the chunks are delivered on the
+ * calling state by ChunkLoader:poll() or ChunkLoader:wait(). Each source is
+ * one of:
+ *	a path, identical paths are decoded only once
+ *	a RWops, it must not be closed before being delivered
+ *	a table { data = bytes }, the string is decoded without copy
+ *
+ * Like mixer.loadWAV, the formats are initialized by mixer.init() first,
+ * the decoders must not initialize their library from several threads.
+ *
+ * Arguments:
+ *	sources the source or a sequence of sources
+ *	callback (optional) called as callback(chunk, index, err)
+ *
+ * Returns:
+ *	The loader object or nil on failure
+ *	The error message
+ */
+static int
+l_mixer_loadWAVAsync(lua_State *L)
+{
+	WorkerPool *pool;
+	ChunkLoader *loader;
+	ChunkRequest *req;
+	int anchor, seen, cache, index, nslots = 0, single = 1;
+
+	if (lua_type(L, 1) == LUA_TTABLE) {
+		lua_getfield(L, 1, "data");
+		single = !lua_isnil(L, -1);
+		lua_pop(L, 1);
+	}
+	if (single) {
+		lua_createtable(L, 1, 0);
+		lua_pushvalue(L, 1);
+		lua_rawseti(L, -2, 1);
+		lua_replace(L, 1);
+	}
+	if (!lua_isnoneornil(L, 2))
+		luaL_checktype(L, 2, LUA_TFUNCTION);
+
+	if ((pool = workerShared(L, LOADER_WORKERS, 0)) == NULL)
+		return commonPushSDLError(L, 1);
+
+	/* Chunks already decoded, they are dropped when no longer used */
+	lua_getfield(L, LUA_REGISTRYINDEX, LOADER_CACHE);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_createtable(L, 0, 1);
+		lua_pushstring(L, "v");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, LOADER_CACHE);
+	}
+	cache = lua_gettop(L);
+
+	if ((loader = calloc(1, sizeof (ChunkLoader))) == NULL)
+		return commonPushErrno(L, 1);
+
+	STAILQ_INIT(&loader->done);
+
+	if ((loader->mutex = SDL_CreateMutex()) == NULL ||
+	    (loader->cond = SDL_CreateCond()) == NULL) {
+		if (loader->mutex)
+			SDL_DestroyMutex(loader->mutex);
+		free(loader);
+
+		return commonPushSDLError(L, 1);
+	}
+
+	lua_newtable(L);
+	anchor = lua_gettop(L);
+	lua_newtable(L);
+	lua_setfield(L, anchor, "keep");
+	lua_newtable(L);
+	lua_setfield(L, anchor, "targets");
+	lua_newtable(L);
+	lua_setfield(L, anchor, "results");
+	lua_newtable(L);
+	lua_setfield(L, anchor, "errors");
+	lua_pushvalue(L, 2);
+	lua_setfield(L, anchor, "callback");
+
+	lua_pushvalue(L, anchor);
+	loader->anchor = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	/* From now on, the finalizer cleans up on errors */
+	commonPushUserdata(L, ChunkLoaderName, loader);
+	lua_insert(L, anchor);
+	++ anchor;
+
+	/* Path -> slot for deduplication */
+	lua_newtable(L);
+	seen = lua_gettop(L);
+
+	for (index = 1; ; ++index) {
+		CommonUserdata *udata;
+		int slot, n;
+
+		lua_rawgeti(L, 1, index);
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			break;
+		}
+
+		++ loader->total;
+
+		/* Same path as a previous source, just add the index */
+		if (lua_type(L, -1) == LUA_TSTRING) {
+			lua_pushvalue(L, -1);
+			lua_rawget(L, seen);
+
+			if (!lua_isnil(L, -1)) {
+				slot = lua_tointeger(L, -1);
+				lua_getfield(L, anchor, "targets");
+				lua_rawgeti(L, -1, slot);
+
+				for (n = 1; ; ++n) {
+					lua_rawgeti(L, -1, n);
+					if (lua_isnil(L, -1))
+						break;
+					lua_pop(L, 1);
+				}
+
+				lua_pushinteger(L, index);
+				lua_rawseti(L, -3, n);
+				lua_settop(L, seen);
+				continue;
+			}
+
+			lua_pop(L, 1);
+		}
+
+		if ((req = calloc(1, sizeof (ChunkRequest))) == NULL)
+			return luaL_error(L, "%s", strerror(errno));
+
+		req->loader = loader;
+		req->slot = ++ nslots;
+
+		if (lua_type(L, -1) == LUA_TSTRING) {
+			if ((req->path = strdup(lua_tostring(L, -1))) == NULL) {
+				free(req);
+				return luaL_error(L, "%s", strerror(errno));
+			}
+
+			lua_pushvalue(L, -1);
+			lua_pushinteger(L, req->slot);
+			lua_rawset(L, seen);
+
+			lua_getfield(L, cache, req->path);
+			req->cached = !lua_isnil(L, -1);
+		} else if ((udata = luaL_testudata(L, -1, RWOpsName)) != NULL) {
+			req->ops = udata->data;
+
+			/* Functions backed by Lua can't be called from a thread */
+			if (req->ops->type == SDL_RWOPS_UNKNOWN) {
+				free(req);
+				return luaL_error(L, "source #%d: custom RWops can't be loaded asynchronously", index);
+			}
+		} else if (lua_type(L, -1) == LUA_TTABLE) {
+			const char *data;
+			size_t length;
+
+			lua_getfield(L, -1, "data");
+			if ((data = lua_tolstring(L, -1, &length)) == NULL) {
+				free(req);
+				return luaL_error(L, "source #%d: data must be a string", index);
+			}
+
+			if ((req->ops = SDL_RWFromConstMem(data, length)) == NULL)
+				req->error = strdup(SDL_GetError());
+
+			req->closeops = req->ops != NULL;
+		} else {
+			free(req);
+			return luaL_error(L, "source #%d: expected path, RWops or table", index);
+		}
+
+		/* Keep the source (or the cached chunk) alive */
+		lua_getfield(L, anchor, "keep");
+		lua_pushvalue(L, -2);
+		lua_rawseti(L, -2, req->slot);
+		lua_pop(L, 1);
+
+		lua_getfield(L, anchor, "targets");
+		lua_createtable(L, 1, 0);
+		lua_pushinteger(L, index);
+		lua_rawseti(L, -2, 1);
+		lua_rawseti(L, -2, req->slot);
+
+		SDL_LockMutex(loader->mutex);
+		++ loader->pending;
+		SDL_UnlockMutex(loader->mutex);
+
+		if (req->cached || req->error != NULL || workerPush(pool, (WorkerFunc)chunkDecode, req) < 0) {
+			if (!req->cached && req->error == NULL)
+				req->error = strdup(SDL_GetError());
+
+			SDL_LockMutex(loader->mutex);
+			STAILQ_INSERT_TAIL(&loader->done, req, link);
+			-- loader->pending;
+			SDL_UnlockMutex(loader->mutex);
+		}
+
+		lua_settop(L, seen);
+	}
+
+	lua_pushvalue(L, anchor - 1);
+
+	return 1;
+}
+
 /*
  * mixer.allocateChannels(num)
  *
@@ -568,8 +3029,16 @@ static int
 l_mixer_allocateChannels(lua_State *L)
 {
 	int num = luaL_checkinteger(L, 1);
+	int ret;
+
+	if (voiceLock() < 0)
+		return commonPushSDLError(L, 1);
+
+	ret = Mix_AllocateChannels(num);
+	voiceTruncate(ret);
+	voiceUnlock();
 
-	return commonPush(L, "i", Mix_AllocateChannels(num));
+	return commonPush(L, "i", ret);
 }
 
 /*
@@ -752,8 +3221,17 @@ l_mixer_groupChannel(lua_State *L)
 {
 	int which	= luaL_checkinteger(L, 1);
 	int tag		= luaL_optinteger(L, 2, -1);
+	int ret;
+
+	if (voiceLock() < 0)
+		return commonPushSDLError(L, 1);
+
+	if ((ret = Mix_GroupChannel(which, tag)))
+		voiceSetGroup(which, which, tag);
 
-	return commonPush(L, "b", Mix_GroupChannel(which, tag));
+	voiceUnlock();
+
+	return commonPush(L, "b", ret);
 }
 
 /*
@@ -773,8 +3251,17 @@ l_mixer_groupChannels(lua_State *L)
 	int from	= luaL_checkinteger(L, 1);
 	int to		= luaL_checkinteger(L, 2);
 	int tag		= luaL_optinteger(L, 3, -1);
+	int ret;
+
+	if (voiceLock() < 0)
+		return commonPushSDLError(L, 1);
 
-	return commonPush(L, "i", Mix_GroupChannels(from, to, tag));
+	if ((ret = Mix_GroupChannels(from, to, tag)) > 0)
+		voiceSetGroup(from, from + ret - 1, tag);
+
+	voiceUnlock();
+
+	return commonPush(L, "i", ret);
 }
 
 /*
@@ -922,14 +3409,413 @@ l_mixer_loadMUS(lua_State *L)
 	return commonPush(L, "p", MixMusic, music);
 }
 
+/*
+ * mixer.createSpatialScene(params)
+ *
+ * The audio device must be opened with a signed 16 bits or a float format.
+ *
+ * Arguments:
+ *	params (optional) a table with the optional fields:
+ *	    minDistance the distance of full volume, default: 1
+ *	    maxDistance the distance attenuation stops at, default: 100
+ *	    rolloff the attenuation factor, default: 1
+ *	    doppler the doppler factor, default: 0 (disabled)
+ *	    speedOfSound the speed of sound in units/s, default: 343.3
+ *
+ * Returns:
+ *	The scene object or nil on failure
+ *	The error message
+ */
+static int
+l_mixer_createSpatialScene(lua_State *L)
+{
+	SpatialScene *s;
+	int frequency, channels;
+	Uint16 format;
+
+	if (!Mix_QuerySpec(&frequency, &format, &channels))
+		return commonPushSDLError(L, 1);
+	if (format != AUDIO_S16SYS && format != AUDIO_F32SYS)
+		return commonPush(L, "ns", "unsupported audio format");
+
+	if ((s = calloc(1, sizeof (SpatialScene))) == NULL)
+		return commonPushErrno(L, 1);
+	if ((s->mutex = SDL_CreateMutex()) == NULL) {
+		free(s);
+		return commonPushSDLError(L, 1);
+	}
+
+	s->frequency = frequency;
+	s->format = format;
+	s->channels = channels;
+	s->right[0] = 1;
+	s->minDistance = 1;
+	s->maxDistance = 100;
+	s->rolloff = 1;
+	s->speed = 343.3f;
+	s->stamp = SDL_GetTicks();
+
+	if (lua_type(L, 1) == LUA_TTABLE) {
+		if (tableIsType(L, 1, "minDistance", LUA_TNUMBER))
+			s->minDistance = tableGetDouble(L, 1, "minDistance");
+		if (tableIsType(L, 1, "maxDistance", LUA_TNUMBER))
+			s->maxDistance = tableGetDouble(L, 1, "maxDistance");
+		if (tableIsType(L, 1, "rolloff", LUA_TNUMBER))
+			s->rolloff = tableGetDouble(L, 1, "rolloff");
+		if (tableIsType(L, 1, "speedOfSound", LUA_TNUMBER))
+			s->speed = tableGetDouble(L, 1, "speedOfSound");
+
+		s->doppler = tableGetDouble(L, 1, "doppler");
+	}
+
+	if (s->minDistance <= 0)
+		s->minDistance = 1;
+	if (s->maxDistance < s->minDistance)
+		s->maxDistance = s->minDistance;
+	if (s->speed <= 0)
+		s->speed = 343.3f;
+
+	return commonPush(L, "p", SpatialSceneName, s);
+}
+
+/*
+ * mixer.createPlaylist(params)
+ *
+ * Tracks are fully decoded by a background thread one track ahead, the
+ * device must use a signed 16 bits or a float format.
+ *
+ * The current and the next track are held as PCM in the device format, a
+ * minute of 44.1 kHz stereo takes about 10 MB in 16 bits and 20 MB in
+ * float. Tracks longer than maxTrackMs are skipped with an error. Only the
+ * formats mixer.loadWAV decodes can be played, MOD and MIDI tracks are
+ * skipped with an error and must be played by Music:play().
+ *
+ * Arguments:
+ *	params (optional) a table with the optional fields:
+ *	    crossfade the crossfade in milliseconds, default: 0 (gapless)
+ *	    curve the crossfade curve (mixer.crossfade), default: EqualPower
+ *	    loop true to restart at the first track, default: false
+ *	    maxTrackMs the longest track accepted, default: 600000 (10 min)
+ *
+ * Returns:
+ *	The playlist object or nil on failure
+ *	The error message
+ */
+static int
+l_mixer_createPlaylist(lua_State *L)
+{
+	Playlist *p;
+	int frequency, channels, crossfade = 0, curve = 1;
+	int maxtrack = PLAYLIST_MAXTRACK;
+	Uint64 maxbytes;
+	Uint16 format;
+
+	if (!Mix_QuerySpec(&frequency, &format, &channels))
+		return commonPushSDLError(L, 1);
+	if (format != AUDIO_S16SYS && format != AUDIO_F32SYS)
+		return commonPush(L, "ns", "unsupported audio format");
+
+	if (lua_type(L, 1) == LUA_TTABLE && tableIsType(L, 1, "maxTrackMs", LUA_TNUMBER)) {
+		maxtrack = tableGetInt(L, 1, "maxTrackMs");
+		luaL_argcheck(L, maxtrack > 0, 1, "maxTrackMs must be positive");
+	}
+
+	if ((p = calloc(1, sizeof (Playlist))) == NULL)
+		return commonPushErrno(L, 1);
+
+	p->frequency = frequency;
+	p->format = format;
+	p->channels = channels;
+	p->framesize = (SDL_AUDIO_BITSIZE(format) / 8) * channels;
+	p->current = -1;
+
+	maxbytes = (Uint64)maxtrack * frequency / 1000 * p->framesize;
+	p->maxbytes = (maxbytes > SDL_MAX_UINT32) ? SDL_MAX_UINT32 : (Uint32)maxbytes;
+	p->wanted = -1;
+
+	if (lua_type(L, 1) == LUA_TTABLE) {
+		crossfade = tableGetInt(L, 1, "crossfade");
+		p->loop = tableGetBool(L, 1, "loop");
+
+		if (tableIsType(L, 1, "curve", LUA_TNUMBER))
+			curve = tableGetInt(L, 1, "curve");
+	}
+
+	playlistSetCrossfade(p, crossfade, curve);
+
+	if ((p->mutex = SDL_CreateMutex()) == NULL)
+		goto fail;
+	if ((p->cond = SDL_CreateCond()) == NULL)
+		goto fail;
+	if ((p->thread = SDL_CreateThread((SDL_ThreadFunction)playlistDecoder, "playlist", p)) == NULL)
+		goto fail;
+
+	return commonPush(L, "p", PlaylistName, p);
+
+fail:
+	if (p->cond)
+		SDL_DestroyCond(p->cond);
+	if (p->mutex)
+		SDL_DestroyMutex(p->mutex);
+	free(p);
+
+	return commonPushSDLError(L, 1);
+}
+
+/*
+ * Write a sound bank entry by entry, the entries are rewritten at the end
+ * once the offsets are known.
+ */
+static int
+bankWrite(lua_State *L, FILE *fp, int sources, int count)
+{
+	static const char padding[SOUNDBANK_ALIGN];
+	SoundBankHeader header;
+	SoundBankEntry *entries;
+	Mix_Chunk *chunk;
+	long offset;
+	int frequency, channels, i, ret = -1;
+	Uint16 format;
+
+	if (!Mix_QuerySpec(&frequency, &format, &channels))
+		return -1;
+	if ((entries = calloc(count, sizeof (SoundBankEntry))) == NULL)
+		return SDL_SetError("%s", strerror(errno));
+
+	memset(&header, 0, sizeof (header));
+	memcpy(header.magic, SOUNDBANK_MAGIC, 4);
+	header.version = SOUNDBANK_VERSION;
+	header.frequency = frequency;
+	header.format = format;
+	header.channels = channels;
+	header.count = count;
+	header.names = sizeof (header) + sizeof (SoundBankEntry) * count;
+
+	if (fseek(fp, header.names, SEEK_SET) < 0)
+		goto io;
+
+	/* Names first, they are known already */
+	for (i = 0; i < count; ++i) {
+		const char *name;
+		size_t length;
+
+		lua_rawgeti(L, sources, i + 1);
+		if (lua_type(L, -1) == LUA_TTABLE) {
+			name = tableGetStringl(L, -1, "name", &length);
+			if (name == NULL)
+				name = tableGetStringl(L, -1, "path", &length);
+		} else
+			name = lua_tolstring(L, -1, &length);
+
+		if (length > SDL_MAX_UINT32 - header.namesize) {
+			lua_pop(L, 1);
+			SDL_SetError("sound bank names larger than 4 GiB");
+			goto out;
+		}
+
+		entries[i].name = header.namesize;
+		entries[i].namelen = length;
+		header.namesize += length;
+
+		if (fwrite(name, 1, length, fp) != length) {
+			lua_pop(L, 1);
+			goto io;
+		}
+
+		lua_pop(L, 1);
+	}
+
+	/* Then the PCM converted by SDL_mixer */
+	for (i = 0; i < count; ++i) {
+		const char *path;
+
+		lua_rawgeti(L, sources, i + 1);
+		path = (lua_type(L, -1) == LUA_TTABLE)
+		    ? tableGetString(L, -1, "path")
+		    : lua_tostring(L, -1);
+		lua_pop(L, 1);
+
+		if ((offset = ftell(fp)) < 0)
+			goto io;
+		if (offset % SOUNDBANK_ALIGN != 0) {
+			size_t pad = SOUNDBANK_ALIGN - offset % SOUNDBANK_ALIGN;
+
+			if (fwrite(padding, 1, pad, fp) != pad)
+				goto io;
+
+			offset += pad;
+		}
+
+		if ((chunk = Mix_LoadWAV(path)) == NULL) {
+			SDL_SetError("%s: %s", path, Mix_GetError());
+			goto out;
+		}
+
+		/* Offsets are 32 bits, the whole sound must be addressable */
+		if ((unsigned long)offset > SDL_MAX_UINT32 - chunk->alen) {
+			Mix_FreeChunk(chunk);
+			SDL_SetError("%s: sound bank larger than 4 GiB", path);
+			goto out;
+		}
+
+		entries[i].offset = offset;
+		entries[i].length = chunk->alen;
+
+		if (fwrite(chunk->abuf, 1, chunk->alen, fp) != chunk->alen) {
+			Mix_FreeChunk(chunk);
+			goto io;
+		}
+
+		Mix_FreeChunk(chunk);
+	}
+
+	if (fseek(fp, 0, SEEK_SET) < 0 ||
+	    fwrite(&header, sizeof (header), 1, fp) != 1 ||
+	    fwrite(entries, sizeof (SoundBankEntry), count, fp) != (size_t)count)
+		goto io;
+
+	ret = 0;
+	goto out;
+
+io:
+	SDL_SetError("%s", strerror(errno));
+
+out:
+	free(entries);
+
+	return ret;
+}
+
+/*
+ * mixer.buildSoundBank(output, sources)
+ *
+ * Decode sounds and write them as a bank for mixer.openSoundBank(). The
+ * audio device must be opened with the format the bank will be used with.
+ *
+ * Arguments:
+ *	output the bank path
+ *	sources a sequence of paths or of tables { name = n, path = p }
+ *
+ * Returns:
+ *	True on success or nil on failure
+ *	The error message
+ */
+static int
+l_mixer_buildSoundBank(lua_State *L)
+{
+	const char *output = luaL_checkstring(L, 1);
+	FILE *fp;
+	int count, ok;
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	for (count = 0; ; ++count) {
+		int type;
+
+		lua_rawgeti(L, 2, count + 1);
+		type = lua_type(L, -1);
+
+		if (type == LUA_TTABLE && !tableIsType(L, -1, "path", LUA_TSTRING))
+			return luaL_error(L, "source #%d: missing path", count + 1);
+
+		lua_pop(L, 1);
+
+		if (type == LUA_TNIL)
+			break;
+		if (type != LUA_TSTRING && type != LUA_TTABLE)
+			return luaL_error(L, "source #%d: expected path or table", count + 1);
+	}
+
+	if ((fp = fopen(output, "wb")) == NULL)
+		return commonPushErrno(L, 1);
+
+	ok = bankWrite(L, fp, 2, count) == 0;
+
+	if (fclose(fp) != 0 && ok) {
+		SDL_SetError("%s", strerror(errno));
+		ok = 0;
+	}
+
+	if (!ok) {
+		remove(output);
+		return commonPushSDLError(L, 1);
+	}
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * mixer.openSoundBank(path)
+ *
+ * Map a bank made by mixer.buildSoundBank(), the audio device must have the
+ * same format as when it was built.
+ *
+ * Arguments:
+ *	path the bank path
+ *
+ * Returns:
+ *	The bank object or nil on failure
+ *	The error message
+ */
+static int
+l_mixer_openSoundBank(lua_State *L)
+{
+	const char *path = luaL_checkstring(L, 1);
+	SoundBank *bank;
+	Uint32 i;
+
+	if ((bank = calloc(1, sizeof (SoundBank))) == NULL)
+		return commonPushErrno(L, 1);
+
+	if (bankMap(bank, path) < 0) {
+		free(bank);
+		return commonPushSDLError(L, 1);
+	}
+
+	if (bankCheck(bank) < 0) {
+		bankUnmap(bank);
+		free(bank);
+		return commonPushSDLError(L, 1);
+	}
+
+	commonPushUserdata(L, SoundBankName, bank);
+
+	/* Name to index lookup and the chunks already created */
+	lua_createtable(L, 0, 2);
+	lua_createtable(L, 0, bank->header->count);
+
+	for (i = 0; i < bank->header->count; ++i) {
+		lua_pushlstring(L, bank->names + bank->entries[i].name, bank->entries[i].namelen);
+		lua_pushinteger(L, i + 1);
+		lua_rawset(L, -3);
+	}
+
+	lua_setfield(L, -2, "names");
+	lua_newtable(L);
+	lua_setfield(L, -2, "chunks");
+	bankSetAnchor(L, -2);
+
+	return 1;
+}
+
 /*
  * mixer.closeAudio()
  */
 static int
 l_mixer_closeAudio(lua_State *L)
 {
+	int locked = voiceLock() == 0;
+
 	Mix_CloseAudio();
 
+	/* The channels are gone once the last reference is closed */
+	if (locked) {
+		if (!Mix_QuerySpec(NULL, NULL, NULL))
+			voiceTruncate(0);
+
+		voiceUnlock();
+	}
+
 	(void)L;
 
 	return 0;
@@ -955,6 +3841,7 @@ static const luaL_Reg MixerFunctions[] = {
 	{ "getChunkDecoder",		l_mixer_getChunkDecoder		},
 	{ "loadWAV",			l_mixer_loadWAV			},
 	{ "loadWAV_RW",			l_mixer_loadWAV_RW		},
+	{ "loadWAVAsync",		l_mixer_loadWAVAsync		},
 	{ "allocateChannels",		l_mixer_allocateChannels	},
 	{ "volume",			l_mixer_volume			},
 	{ "pause",			l_mixer_pause			},
@@ -977,6 +3864,10 @@ static const luaL_Reg MixerFunctions[] = {
 	{ "getNumMusicDecoders",	l_mixer_getNumMusicDecoders	},
 	{ "getMusicDecoder",		l_mixer_getMusicDecoder		},
 	{ "loadMUS",			l_mixer_loadMUS			},
+	{ "createSpatialScene",		l_mixer_createSpatialScene	},
+	{ "createPlaylist",		l_mixer_createPlaylist		},
+	{ "buildSoundBank",		l_mixer_buildSoundBank		},
+	{ "openSoundBank",		l_mixer_openSoundBank		},
 	{ "closeAudio",			l_mixer_closeAudio		},
 	{ "quit",			l_mixer_quit			},
 	{ NULL,				NULL				}
@@ -990,6 +3881,7 @@ luaopen_SDL_mixer(lua_State *L)
 	commonBindEnum(L, -1, "flags", MixerFlags);
 	commonBindEnum(L, -1, "fading", MixerFading);
 	commonBindEnum(L, -1, "type", MusicType);
+	commonBindEnum(L, -1, "crossfade", PlaylistCurves);
 
 	/* Mix_Chunk object */
 	commonBindObject(L, &MixChunkObject);
@@ -997,5 +3889,17 @@ luaopen_SDL_mixer(lua_State *L)
 	/* Mix_Music object */
 	commonBindObject(L, &MixMusicObject);
 
+	/* ChunkLoader object */
+	commonBindObject(L, &ChunkLoaderObject);
+
+	/* SpatialScene object */
+	commonBindObject(L, &SpatialSceneObject);
+
+	/* Playlist object */
+	commonBindObject(L, &PlaylistObject);
+
+	/* SoundBank object */
+	commonBindObject(L, &SoundBankObject);
+
 	return 1;
 }
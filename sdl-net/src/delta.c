@@ -0,0 +1,1065 @@
+/*
+ * delta.c -- delta compression of replicated snapshots
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/common.h>
+#include <common/table.h>
+
+#include "delta.h"
+
+/*
+ * A snapshot is a table of entities indexed by integer ids, every entity
+ * has the fields of the schema. Each field is kept as 64 bits:
+ *
+ *	Int, Fixed	signed integer, Fixed is the number times the scale
+ *	Bool		0 or 1
+ *	Float		the bits of the IEEE 754 single
+ *	Double		the bits of the IEEE 754 double
+ *
+ * Packet format:
+ *
+ *	u8	version
+ *	varint	tick
+ *	varint	tick - baseline tick, 0 for a full snapshot
+ *	varint	number of removed entities, then their ids as gaps
+ *	varint	number of changed entities, then for each:
+ *		varint	id gap
+ *		varint	mask of the changed fields
+ *		varint	per changed field, the zigzag difference for Int and
+ *			Fixed, the XOR against the baseline otherwise
+ *
+ * Entities missing from the baseline are compared against zero.
+ */
+#define DELTA_VERSION	1
+#define DELTA_FIELDS	64
+#define DELTA_HISTORY	32
+
+enum field_type {
+	FieldInt,
+	FieldFixed,
+	FieldBool,
+	FieldFloat,
+	FieldDouble
+};
+
+typedef struct delta_field {
+	char		*name;
+	int		 type;
+	double		 scale;
+} Field;
+
+typedef struct delta_snapshot {
+	int		 valid;
+	Uint32		 tick;
+	int		 count;
+	int		 size;		/* allocated entities */
+	Uint32		*ids;		/* sorted */
+	Uint64		*values;	/* count * nfields */
+} Snapshot;
+
+typedef struct delta_history {
+	Snapshot	*ring;
+	int		 length;
+	int		 hasAck;
+	Uint32		 acked;		/* last tick acknowledged */
+} History;
+
+typedef struct delta_codec {
+	Field		 fields[DELTA_FIELDS];
+	int		 nfields;
+	int		 history;
+	Snapshot	 current;	/* scratch for encoding */
+	History		 decoded;	/* decoder baselines */
+	unsigned char	*out;
+	size_t		 outlen;
+	size_t		 outsize;
+} Codec;
+
+/*
+ * Per client history of an encoder, stored in the encoder user value.
+ */
+#define DELTA_CLIENT	"DeltaClient"
+
+/* --------------------------------------------------------
+ * Snapshots
+ * -------------------------------------------------------- */
+
+static void
+snapshotFree(Snapshot *s)
+{
+	free(s->ids);
+	free(s->values);
+	memset(s, 0, sizeof (Snapshot));
+}
+
+static int
+snapshotReserve(Snapshot *s, int count, int nfields)
+{
+	Uint32 *ids;
+	Uint64 *values;
+
+	if (count <= s->size)
+		return 0;
+
+	if ((ids = realloc(s->ids, sizeof (Uint32) * count)) == NULL)
+		return -1;
+
+	s->ids = ids;
+
+	if ((values = realloc(s->values, sizeof (Uint64) * count * nfields)) == NULL)
+		return -1;
+
+	s->values = values;
+	s->size = count;
+
+	return 0;
+}
+
+static int
+snapshotCopy(Snapshot *dst, const Snapshot *src, int nfields)
+{
+	if (snapshotReserve(dst, src->count, nfields) < 0)
+		return -1;
+
+	memcpy(dst->ids, src->ids, sizeof (Uint32) * src->count);
+	memcpy(dst->values, src->values, sizeof (Uint64) * src->count * nfields);
+	dst->count = src->count;
+	dst->tick = src->tick;
+	dst->valid = 1;
+
+	return 0;
+}
+
+static int
+historyInit(History *h, int length)
+{
+	if ((h->ring = calloc(length, sizeof (Snapshot))) == NULL)
+		return -1;
+
+	h->length = length;
+	h->hasAck = 0;
+
+	return 0;
+}
+
+static void
+historyFree(History *h)
+{
+	int i;
+
+	for (i = 0; i < h->length; ++i)
+		snapshotFree(&h->ring[i]);
+
+	free(h->ring);
+	memset(h, 0, sizeof (History));
+}
+
+static Snapshot *
+historyFind(History *h, Uint32 tick)
+{
+	Snapshot *s = &h->ring[tick % h->length];
+
+	return (s->valid && s->tick == tick) ? s : NULL;
+}
+
+static void
+codecFree(Codec *c)
+{
+	int i;
+
+	for (i = 0; i < c->nfields; ++i)
+		free(c->fields[i].name);
+
+	snapshotFree(&c->current);
+	historyFree(&c->decoded);
+	free(c->out);
+	free(c);
+}
+
+/* --------------------------------------------------------
+ * Field conversions
+ * -------------------------------------------------------- */
+
+static Uint64
+fieldGet(lua_State *L, int index, const Field *f)
+{
+	lua_Number n;
+	float single;
+	Uint32 bits32;
+	Uint64 bits;
+
+	switch (f->type) {
+	case FieldBool:
+		return lua_toboolean(L, index) ? 1 : 0;
+	case FieldInt:
+#if LUA_VERSION_NUM >= 503
+		if (lua_isinteger(L, index))
+			return (Uint64)(Sint64)lua_tointeger(L, index);
+#endif
+		return (Uint64)(Sint64)lua_tonumber(L, index);
+	case FieldFixed:
+		return (Uint64)(Sint64)floor(lua_tonumber(L, index) * f->scale + 0.5);
+	case FieldFloat:
+		single = (float)lua_tonumber(L, index);
+		memcpy(&bits32, &single, sizeof (bits32));
+
+		return bits32;
+	default:
+		n = lua_tonumber(L, index);
+		memcpy(&bits, &n, sizeof (bits));
+
+		return bits;
+	}
+}
+
+static void
+fieldPush(lua_State *L, Uint64 value, const Field *f)
+{
+	lua_Number n;
+	float single;
+	Uint32 bits32;
+
+	switch (f->type) {
+	case FieldBool:
+		lua_pushboolean(L, value != 0);
+		break;
+	case FieldInt:
+#if LUA_VERSION_NUM >= 503
+		lua_pushinteger(L, (lua_Integer)(Sint64)value);
+#else
+		lua_pushnumber(L, (lua_Number)(Sint64)value);
+#endif
+		break;
+	case FieldFixed:
+		lua_pushnumber(L, (lua_Number)(Sint64)value / f->scale);
+		break;
+	case FieldFloat:
+		bits32 = (Uint32)value;
+		memcpy(&single, &bits32, sizeof (single));
+		lua_pushnumber(L, single);
+		break;
+	default:
+		memcpy(&n, &value, sizeof (n));
+		lua_pushnumber(L, n);
+		break;
+	}
+}
+
+static Uint64
+fieldDelta(const Field *f, Uint64 base, Uint64 value)
+{
+	if (f->type == FieldInt || f->type == FieldFixed) {
+		Sint64 d = (Sint64)(value - base);
+
+		return ((Uint64)d << 1) ^ (Uint64)(d >> 63);
+	}
+
+	return base ^ value;
+}
+
+static Uint64
+fieldApply(const Field *f, Uint64 base, Uint64 delta)
+{
+	if (f->type == FieldInt || f->type == FieldFixed)
+		return base + ((delta >> 1) ^ (~(delta & 1) + 1));
+
+	return base ^ delta;
+}
+
+/* --------------------------------------------------------
+ * Encoding
+ * -------------------------------------------------------- */
+
+static int
+codecReserve(Codec *c, size_t length)
+{
+	unsigned char *tmp;
+	size_t size;
+
+	if (c->outlen + length <= c->outsize)
+		return 0;
+
+	size = (c->outsize < 256) ? 256 : c->outsize;
+	while (size < c->outlen + length)
+		size *= 2;
+
+	if ((tmp = realloc(c->out, size)) == NULL)
+		return -1;
+
+	c->out = tmp;
+	c->outsize = size;
+
+	return 0;
+}
+
+static int
+codecVarint(Codec *c, Uint64 value)
+{
+	if (codecReserve(c, 10) < 0)
+		return -1;
+
+	while (value >= 0x80) {
+		c->out[c->outlen++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+
+	c->out[c->outlen++] = (unsigned char)value;
+
+	return 0;
+}
+
+static int
+compareIds(const void *a, const void *b)
+{
+	Uint32 x = *(const Uint32 *)a;
+	Uint32 y = *(const Uint32 *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Read the Lua snapshot at index into the scratch snapshot, sorted by id.
+ */
+static int
+codecRead(lua_State *L, int index, Codec *c, Uint32 tick)
+{
+	Snapshot *s = &c->current;
+	int count = 0, i, f;
+
+	luaL_checktype(L, index, LUA_TTABLE);
+
+	lua_pushnil(L);
+	while (lua_next(L, index)) {
+		lua_Number id;
+
+		lua_pop(L, 1);
+
+		if (lua_type(L, -1) != LUA_TNUMBER ||
+		    (id = lua_tonumber(L, -1)) < 0 || id > 4294967295.0 || floor(id) != id) {
+			lua_pop(L, 1);
+			return luaL_argerror(L, index, "entity ids must be positive integers");
+		}
+
+		if (snapshotReserve(s, count + 1, c->nfields) < 0) {
+			lua_pop(L, 1);
+			return -1;
+		}
+
+		s->ids[count++] = (Uint32)id;
+	}
+
+	qsort(s->ids, count, sizeof (Uint32), compareIds);
+
+	for (i = 0; i < count; ++i) {
+		Uint64 *row = &s->values[i * c->nfields];
+
+		lua_pushnumber(L, s->ids[i]);
+		lua_rawget(L, index);
+
+		for (f = 0; f < c->nfields; ++f) {
+			lua_getfield(L, -1, c->fields[f].name);
+			row[f] = fieldGet(L, -1, &c->fields[f]);
+			lua_pop(L, 1);
+		}
+
+		lua_pop(L, 1);
+	}
+
+	s->count = count;
+	s->tick = tick;
+	s->valid = 1;
+
+	return 0;
+}
+
+static Uint64
+rowMask(const Codec *c, const Uint64 *base, const Uint64 *row)
+{
+	Uint64 mask = 0;
+	int f;
+
+	for (f = 0; f < c->nfields; ++f)
+		if (row[f] != (base ? base[f] : 0))
+			mask |= (Uint64)1 << f;
+
+	return mask;
+}
+
+static int
+codecWriteRow(Codec *c, Uint32 gap, Uint64 mask, const Uint64 *base, const Uint64 *row)
+{
+	int f;
+
+	if (codecVarint(c, gap) < 0 || codecVarint(c, mask) < 0)
+		return -1;
+
+	for (f = 0; f < c->nfields; ++f)
+		if (mask & ((Uint64)1 << f))
+			if (codecVarint(c, fieldDelta(&c->fields[f], base ? base[f] : 0, row[f])) < 0)
+				return -1;
+
+	return 0;
+}
+
+/*
+ * Encode the scratch snapshot against the baseline, both are walked in id
+ * order like a merge.
+ */
+static int
+codecEncode(Codec *c, const Snapshot *base)
+{
+	const Snapshot *s = &c->current;
+	int nb = base ? base->count : 0;
+	int i, j, nremoved = 0, nchanged = 0;
+	Uint32 prev;
+	size_t countpos;
+
+	c->outlen = 0;
+
+	if (codecReserve(c, 1) < 0)
+		return -1;
+
+	c->out[c->outlen++] = DELTA_VERSION;
+
+	if (codecVarint(c, s->tick) < 0 || codecVarint(c, base ? s->tick - base->tick : 0) < 0)
+		return -1;
+
+	/* Removed entities */
+	for (i = j = 0; i < nb; ++i) {
+		while (j < s->count && s->ids[j] < base->ids[i])
+			++ j;
+		if (j == s->count || s->ids[j] != base->ids[i])
+			++ nremoved;
+	}
+
+	if (codecVarint(c, nremoved) < 0)
+		return -1;
+
+	for (i = j = 0, prev = 0; i < nb; ++i) {
+		while (j < s->count && s->ids[j] < base->ids[i])
+			++ j;
+		if (j == s->count || s->ids[j] != base->ids[i]) {
+			if (codecVarint(c, base->ids[i] - prev) < 0)
+				return -1;
+
+			prev = base->ids[i];
+		}
+	}
+
+	/* Changed entities, the count is written in a fixed 5 bytes varint */
+	if (codecReserve(c, 5) < 0)
+		return -1;
+
+	countpos = c->outlen;
+	c->outlen += 5;
+
+	for (i = j = 0, prev = 0; j < s->count; ++j) {
+		const Uint64 *row = &s->values[j * c->nfields];
+		const Uint64 *brow = NULL;
+		Uint64 mask;
+
+		while (i < nb && base->ids[i] < s->ids[j])
+			++ i;
+		if (i < nb && base->ids[i] == s->ids[j])
+			brow = &base->values[i * c->nfields];
+
+		mask = rowMask(c, brow, row);
+
+		/* New entities are always sent so that they exist */
+		if (brow != NULL && mask == 0)
+			continue;
+		if (codecWriteRow(c, s->ids[j] - prev, mask, brow, row) < 0)
+			return -1;
+
+		prev = s->ids[j];
+		++ nchanged;
+	}
+
+	for (i = 0; i < 5; ++i)
+		c->out[countpos + i] = ((nchanged >> (7 * i)) & 0x7f) | (i < 4 ? 0x80 : 0);
+
+	return 0;
+}
+
+/* --------------------------------------------------------
+ * Decoding
+ * -------------------------------------------------------- */
+
+typedef struct {
+	const unsigned char	*p;
+	const unsigned char	*end;
+} Reader;
+
+static int
+readVarint(Reader *r, Uint64 *value)
+{
+	int shift;
+
+	*value = 0;
+
+	for (shift = 0; shift < 64; shift += 7) {
+		if (r->p == r->end)
+			return -1;
+
+		*value |= (Uint64)(*r->p & 0x7f) << shift;
+
+		if ((*r->p++ & 0x80) == 0)
+			return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * Apply a packet to its baseline, the result is written to the decoder
+ * history. Returns the snapshot or NULL with an error message.
+ */
+static Snapshot *
+codecDecode(Codec *c, const unsigned char *data, size_t length, const char **error)
+{
+	Reader r = { data, data + length };
+	Snapshot *base = NULL, *s;
+	Uint64 tick, distance, nremoved, nchanged, v;
+	Uint32 *removed = NULL;
+	Uint32 id;
+	int i, j, f, count;
+
+	*error = "invalid delta packet";
+
+	if (length == 0 || *r.p++ != DELTA_VERSION) {
+		*error = "unsupported delta version";
+		return NULL;
+	}
+
+	if (readVarint(&r, &tick) < 0 || readVarint(&r, &distance) < 0)
+		return NULL;
+
+	if (distance != 0 && (base = historyFind(&c->decoded, (Uint32)(tick - distance))) == NULL) {
+		*error = "missing baseline";
+		return NULL;
+	}
+
+	if (readVarint(&r, &nremoved) < 0 || nremoved > (Uint64)(r.end - r.p))
+		return NULL;
+	if (nremoved > 0 && (removed = malloc(sizeof (Uint32) * nremoved)) == NULL) {
+		*error = strerror(errno);
+		return NULL;
+	}
+
+	for (i = 0, id = 0; (Uint64)i < nremoved; ++i) {
+		if (readVarint(&r, &v) < 0)
+			goto fail;
+
+		id += (Uint32)v;
+		removed[i] = id;
+	}
+
+	if (readVarint(&r, &nchanged) < 0 || nchanged > (Uint64)(r.end - r.p))
+		goto fail;
+
+	/* Build in the scratch snapshot, then store in the history */
+	s = &c->current;
+	count = (base ? base->count : 0) + (int)nchanged;
+
+	if (snapshotReserve(s, count > 0 ? count : 1, c->nfields) < 0) {
+		*error = strerror(errno);
+		goto fail;
+	}
+
+	/* Baseline without the removed entities */
+	s->count = 0;
+
+	for (i = j = 0; base != NULL && i < base->count; ++i) {
+		while ((Uint64)j < nremoved && removed[j] < base->ids[i])
+			++ j;
+		if ((Uint64)j < nremoved && removed[j] == base->ids[i])
+			continue;
+
+		s->ids[s->count] = base->ids[i];
+		memcpy(&s->values[s->count * c->nfields], &base->values[i * c->nfields],
+		    sizeof (Uint64) * c->nfields);
+		++ s->count;
+	}
+
+	/* Changes, merged in id order */
+	for (i = 0, j = 0, id = 0; (Uint64)i < nchanged; ++i) {
+		Uint64 mask;
+		Uint64 *row;
+		int k;
+
+		if (readVarint(&r, &v) < 0 || readVarint(&r, &mask) < 0)
+			goto fail;
+
+		id += (Uint32)v;
+
+		while (j < s->count && s->ids[j] < id)
+			++ j;
+
+		if (j == s->count || s->ids[j] != id) {
+			/* New entity, insert it at j */
+			for (k = s->count; k > j; --k) {
+				s->ids[k] = s->ids[k - 1];
+				memcpy(&s->values[k * c->nfields], &s->values[(k - 1) * c->nfields],
+				    sizeof (Uint64) * c->nfields);
+			}
+
+			s->ids[j] = id;
+			memset(&s->values[j * c->nfields], 0, sizeof (Uint64) * c->nfields);
+			++ s->count;
+		}
+
+		row = &s->values[j * c->nfields];
+
+		for (f = 0; f < c->nfields; ++f) {
+			if (!(mask & ((Uint64)1 << f)))
+				continue;
+			if (readVarint(&r, &v) < 0)
+				goto fail;
+
+			row[f] = fieldApply(&c->fields[f], row[f], v);
+		}
+	}
+
+	if (r.p != r.end)
+		goto fail;
+
+	free(removed);
+
+	s->tick = (Uint32)tick;
+	s->valid = 1;
+
+	if (snapshotCopy(&c->decoded.ring[s->tick % c->decoded.length], s, c->nfields) < 0) {
+		*error = strerror(errno);
+		return NULL;
+	}
+
+	return s;
+
+fail:
+	free(removed);
+
+	return NULL;
+}
+
+/* --------------------------------------------------------
+ * Lua helpers
+ * -------------------------------------------------------- */
+
+static int
+l_client_gc(lua_State *L)
+{
+	historyFree(luaL_checkudata(L, 1, DELTA_CLIENT));
+
+	return 0;
+}
+
+static Codec *
+codecGet(lua_State *L, int index, const char *name)
+{
+	CommonUserdata *udata = commonGetUserdata(L, index, name);
+
+	if (!udata->mustdelete)
+		luaL_error(L, "codec closed");
+
+	return udata->data;
+}
+
+static void
+pushUservalue(lua_State *L, int index)
+{
+#if LUA_VERSION_NUM >= 502
+	lua_getuservalue(L, index);
+#else
+	lua_getfenv(L, index);
+#endif
+}
+
+/*
+ * Get the history of a client, created on first use.
+ */
+static History *
+clientGet(lua_State *L, Codec *c, int client)
+{
+	History *h;
+
+	pushUservalue(L, 1);
+	lua_pushvalue(L, client);
+	lua_rawget(L, -2);
+
+	if ((h = lua_touserdata(L, -1)) != NULL) {
+		lua_pop(L, 2);
+		return h;
+	}
+
+	lua_pop(L, 1);
+	lua_pushvalue(L, client);
+	h = lua_newuserdata(L, sizeof (History));
+	memset(h, 0, sizeof (History));
+
+	if (luaL_newmetatable(L, DELTA_CLIENT)) {
+		lua_pushcfunction(L, l_client_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+
+	lua_setmetatable(L, -2);
+
+	if (historyInit(h, c->history) < 0) {
+		lua_pop(L, 3);
+		return NULL;
+	}
+
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+
+	return h;
+}
+
+static void
+schemaParse(lua_State *L, int index, Codec *c)
+{
+	int i;
+
+	luaL_checktype(L, index, LUA_TTABLE);
+
+	for (i = 1; ; ++i) {
+		Field *f;
+		const char *name;
+
+		lua_rawgeti(L, index, i);
+
+		if (lua_type(L, -1) == LUA_TNIL) {
+			lua_pop(L, 1);
+			break;
+		}
+
+		if (lua_type(L, -1) != LUA_TTABLE || c->nfields == DELTA_FIELDS) {
+			lua_pop(L, 1);
+			luaL_argerror(L, index, "expected at most 64 field tables");
+		}
+
+		if ((name = tableGetString(L, -1, "name")) == NULL) {
+			lua_pop(L, 1);
+			luaL_argerror(L, index, "field without name");
+		}
+
+		f = &c->fields[c->nfields];
+		f->type = tableGetInt(L, -1, "type");
+		f->scale = 1;
+
+		if (tableIsType(L, -1, "scale", LUA_TNUMBER))
+			f->scale = tableGetDouble(L, -1, "scale");
+		if (f->type < FieldInt || f->type > FieldDouble || f->scale <= 0) {
+			lua_pop(L, 1);
+			luaL_argerror(L, index, "invalid field type or scale");
+		}
+
+		if ((f->name = strdup(name)) == NULL) {
+			lua_pop(L, 1);
+			luaL_error(L, "%s", strerror(errno));
+		}
+
+		++ c->nfields;
+		lua_pop(L, 1);
+	}
+}
+
+/*
+ * Common part of the constructors, the codec is pushed with an empty
+ * table as user value.
+ */
+static int
+codecCreate(lua_State *L, const char *name, int decoder)
+{
+	int history = luaL_optinteger(L, 2, DELTA_HISTORY);
+	Codec *c;
+
+	if (history <= 0)
+		return luaL_argerror(L, 2, "must be positive");
+	if ((c = calloc(1, sizeof (Codec))) == NULL)
+		return commonPushErrno(L, 1);
+
+	c->history = history;
+
+	/* Owned by Lua before parsing so that errors do not leak */
+	commonPush(L, "p", name, c);
+	lua_createtable(L, 0, 0);
+#if LUA_VERSION_NUM >= 502
+	lua_setuservalue(L, -2);
+#else
+	lua_setfenv(L, -2);
+#endif
+
+	schemaParse(L, 1, c);
+
+	if (decoder && historyInit(&c->decoded, history) < 0)
+		return commonPushErrno(L, 1);
+
+	return 1;
+}
+
+/* --------------------------------------------------------
+ * Delta functions
+ * -------------------------------------------------------- */
+
+/*
+ * SDL.net.createDeltaEncoder(schema, history)
+ *
+ * The schema is a list of fields { name, type, scale } where type is one
+ * of SDL.net.field and scale is used by Fixed only.
+ *
+ * Arguments:
+ *	schema the fields of every entity
+ *	history (optional) the number of snapshots kept per client, default 32
+ *
+ * Returns:
+ *	The encoder or nil
+ *	The error message
+ */
+static int
+l_delta_createEncoder(lua_State *L)
+{
+	return codecCreate(L, DeltaEncoderName, 0);
+}
+
+/*
+ * SDL.net.createDeltaDecoder(schema, history)
+ *
+ * Arguments:
+ *	schema the same schema as the encoder
+ *	history (optional) the number of snapshots kept, default 32
+ *
+ * Returns:
+ *	The decoder or nil
+ *	The error message
+ */
+static int
+l_delta_createDecoder(lua_State *L)
+{
+	return codecCreate(L, DeltaDecoderName, 1);
+}
+
+const luaL_Reg DeltaFunctions[] = {
+	{ "createDeltaEncoder",		l_delta_createEncoder		},
+	{ "createDeltaDecoder",		l_delta_createDecoder		},
+	{ NULL,				NULL				}
+};
+
+/* --------------------------------------------------------
+ * DeltaEncoder object
+ * -------------------------------------------------------- */
+
+/*
+ * DeltaEncoder:encode(client, tick, snapshot)
+ *
+ * The snapshot is encoded against the last one acknowledged by the client
+ * if it is still in the history, fully otherwise.
+ *
+ * Arguments:
+ *	client any value identifying the client
+ *	tick the snapshot tick, increasing
+ *	snapshot the entities indexed by id
+ *
+ * Returns:
+ *	The packet or nil
+ *	The error message
+ */
+static int
+l_encoder_encode(lua_State *L)
+{
+	Codec *c = codecGet(L, 1, DeltaEncoderName);
+	Uint32 tick = (Uint32)luaL_checknumber(L, 3);
+	Snapshot *base = NULL;
+	History *h;
+
+	luaL_checkany(L, 2);
+
+	if ((h = clientGet(L, c, 2)) == NULL)
+		return commonPushErrno(L, 1);
+	if (codecRead(L, 4, c, tick) < 0)
+		return commonPushErrno(L, 1);
+	if (h->hasAck && (Sint32)(tick - h->acked) > 0)
+		base = historyFind(h, h->acked);
+	if (codecEncode(c, base) < 0)
+		return commonPushErrno(L, 1);
+
+	/* Replace the slot only if it is not the baseline */
+	if (base != &h->ring[tick % h->length] &&
+	    snapshotCopy(&h->ring[tick % h->length], &c->current, c->nfields) < 0)
+		return commonPushErrno(L, 1);
+
+	lua_pushlstring(L, (const char *)c->out, c->outlen);
+
+	return 1;
+}
+
+/*
+ * DeltaEncoder:ack(client, tick)
+ *
+ * Arguments:
+ *	client the client
+ *	tick the tick the client decoded
+ */
+static int
+l_encoder_ack(lua_State *L)
+{
+	Codec *c = codecGet(L, 1, DeltaEncoderName);
+	Uint32 tick = (Uint32)luaL_checknumber(L, 3);
+	History *h;
+
+	luaL_checkany(L, 2);
+
+	if ((h = clientGet(L, c, 2)) == NULL)
+		return commonPushErrno(L, 1);
+
+	/* Late acks of older snapshots are ignored */
+	if (!h->hasAck || (Sint32)(tick - h->acked) > 0) {
+		h->acked = tick;
+		h->hasAck = 1;
+	}
+
+	return 0;
+}
+
+/*
+ * DeltaEncoder:remove(client)
+ *
+ * Arguments:
+ *	client the client to forget
+ */
+static int
+l_encoder_remove(lua_State *L)
+{
+	codecGet(L, 1, DeltaEncoderName);
+	luaL_checkany(L, 2);
+
+	pushUservalue(L, 1);
+	lua_pushvalue(L, 2);
+	lua_pushnil(L);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+
+	return 0;
+}
+
+static int
+l_codec_gc(lua_State *L)
+{
+	CommonUserdata *udata = lua_touserdata(L, 1);
+
+	if (udata->mustdelete) {
+		codecFree(udata->data);
+		udata->mustdelete = 0;
+	}
+
+	return 0;
+}
+
+static const luaL_Reg EncoderMethods[] = {
+	{ "encode",			l_encoder_encode		},
+	{ "ack",			l_encoder_ack			},
+	{ "remove",			l_encoder_remove		},
+	{ NULL,				NULL				}
+};
+
+static const luaL_Reg CodecMetamethods[] = {
+	{ "__gc",			l_codec_gc			},
+	{ NULL,				NULL				}
+};
+
+const CommonObject DeltaEncoder = {
+	"DeltaEncoder",
+	EncoderMethods,
+	CodecMetamethods
+};
+
+/* --------------------------------------------------------
+ * DeltaDecoder object
+ * -------------------------------------------------------- */
+
+/*
+ * DeltaDecoder:decode(packet)
+ *
+ * The tick returned should be sent back to the server which then calls
+ * DeltaEncoder:ack.
+ *
+ * Arguments:
+ *	packet the string returned by DeltaEncoder:encode
+ *
+ * Returns:
+ *	The tick or nil
+ *	The snapshot or the error message
+ */
+static int
+l_decoder_decode(lua_State *L)
+{
+	Codec *c = codecGet(L, 1, DeltaDecoderName);
+	size_t length;
+	const char *data = luaL_checklstring(L, 2, &length);
+	const char *error;
+	Snapshot *s;
+	int i, f;
+
+	if ((s = codecDecode(c, (const unsigned char *)data, length, &error)) == NULL)
+		return commonPush(L, "ns", error);
+
+	lua_pushnumber(L, s->tick);
+	lua_createtable(L, 0, s->count);
+
+	for (i = 0; i < s->count; ++i) {
+		const Uint64 *row = &s->values[i * c->nfields];
+
+		lua_pushnumber(L, s->ids[i]);
+		lua_createtable(L, 0, c->nfields);
+
+		for (f = 0; f < c->nfields; ++f) {
+			fieldPush(L, row[f], &c->fields[f]);
+			lua_setfield(L, -2, c->fields[f].name);
+		}
+
+		lua_rawset(L, -3);
+	}
+
+	return 2;
+}
+
+static const luaL_Reg DecoderMethods[] = {
+	{ "decode",			l_decoder_decode		},
+	{ NULL,				NULL				}
+};
+
+const CommonObject DeltaDecoder = {
+	"DeltaDecoder",
+	DecoderMethods,
+	CodecMetamethods
+};
+
+/*
+ * SDL.net.field
+ */
+const CommonEnum DeltaField[] = {
+	{ "Int",			FieldInt			},
+	{ "Fixed",			FieldFixed			},
+	{ "Bool",			FieldBool			},
+	{ "Float",			FieldFloat			},
+	{ "Double",			FieldDouble			},
+	{ NULL,				-1				}
+};
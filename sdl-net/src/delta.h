@@ -0,0 +1,35 @@
+/*
+ * delta.h -- delta compression of replicated snapshots
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _DELTA_H_
+#define _DELTA_H_
+
+#include <common/common.h>
+
+#define DeltaEncoderName	DeltaEncoder.name
+#define DeltaDecoderName	DeltaDecoder.name
+
+extern const CommonObject DeltaEncoder;
+
+extern const CommonObject DeltaDecoder;
+
+extern const CommonEnum DeltaField[];
+
+extern const luaL_Reg DeltaFunctions[];
+
+#endif /* !_DELTA_H_ */
@@ -16,10 +16,534 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/queue.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <config.h>
+
+#if defined(_WIN32)
+#  include <winsock2.h>
+#else
+#  include <sys/types.h>
+#  include <sys/select.h>
+#  include <sys/socket.h>
+#  include <fcntl.h>
+#endif
+
+#if defined(HAVE_SYS_EPOLL_H)
+#  include <sys/epoll.h>
+#  include <unistd.h>
+#endif
+
 #include <SDL_net.h>
 
+#include <common/buffer.h>
 #include <common/common.h>
+#include <common/pack.h>
 #include <common/table.h>
+#include <common/worker.h>
+
+#include "delta.h"
+#include "reliable.h"
+#include "resolve.h"
+
+/*
+ * SDL_net does not expose the descriptor but both TCP and UDP sockets start
+ * with the ready flag followed by the descriptor.
+ */
+struct socket_header {
+	int		 ready;
+#if defined(_WIN32)
+	SOCKET		 channel;
+#else
+	int		 channel;
+#endif
+};
+
+#define socketChannel(s)	(((struct socket_header *)(s))->channel)
+
+/*
+ * select() sets hold at most FD_SETSIZE sockets on Windows and descriptors
+ * below FD_SETSIZE elsewhere, FD_SET() past that overflows the set.
+ */
+#if defined(_WIN32)
+#  define socketSelectable(set, fd)	((set)->fd_count < FD_SETSIZE)
+#else
+#  define socketSelectable(set, fd)	((fd) >= 0 && (fd) < FD_SETSIZE)
+#endif
+
+/* ---------------------------------------------------------
+ * Message framing
+ * --------------------------------------------------------- */
+
+/*
+ * Framing state of TCP sockets, indexed by the socket pointer. It is not
+ * stored as the socket user value because closeSocket() uses it.
+ */
+#define FRAMING		"__SDL_net_framing"
+#define FRAMING_META	"Framing"
+
+#define FRAMING_MIN	4096
+#define FRAMING_MAX	(16 * 1024 * 1024)
+
+typedef struct framing {
+	int		 prefix;	/* 2, 4 or 0 for delimiter */
+	int		 big;		/* prefix is big endian */
+	char		 delimiter[16];
+	size_t		 delimlen;
+	size_t		 max;		/* maximum message length */
+	char		*in;		/* received data */
+	size_t		 start;		/* first byte not consumed */
+	size_t		 length;	/* end of received data */
+	size_t		 scan;		/* delimiter search position */
+	size_t		 skip;		/* bytes of a refused message to drop */
+	size_t		 size;		/* allocated */
+	char		*out;		/* message being sent */
+	size_t		 outsize;	/* allocated */
+	SDLNet_SocketSet set;		/* to poll without blocking */
+} Framing;
+
+static void
+framingInit(Framing *f)
+{
+	memset(f, 0, sizeof (Framing));
+
+	f->prefix = 4;
+	f->big = 1;
+	f->max = FRAMING_MAX;
+}
+
+static void
+framingFree(Framing *f)
+{
+	if (f->set)
+		SDLNet_FreeSocketSet(f->set);
+
+	free(f->in);
+	free(f->out);
+}
+
+static size_t
+framingReadPrefix(const Framing *f, const unsigned char *p)
+{
+	size_t value = 0;
+	int i;
+
+	for (i = 0; i < f->prefix; ++i) {
+		if (f->big)
+			value = (value << 8) | p[i];
+		else
+			value |= (size_t)p[i] << (8 * i);
+	}
+
+	return value;
+}
+
+static void
+framingWritePrefix(const Framing *f, unsigned char *p, size_t value)
+{
+	int i;
+
+	for (i = 0; i < f->prefix; ++i) {
+		if (f->big)
+			p[f->prefix - i - 1] = (value >> (8 * i)) & 0xff;
+		else
+			p[i] = (value >> (8 * i)) & 0xff;
+	}
+}
+
+static void
+framingConsume(Framing *f, size_t consumed)
+{
+	f->start += consumed;
+
+	if (f->start == f->length)
+		f->start = f->length = f->scan = 0;
+}
+
+/*
+ * Drop what has been received of a message refused as too large, up to its
+ * length or up to its delimiter. Returns 1 once it is gone.
+ */
+static int
+framingSkip(Framing *f)
+{
+	size_t avail = f->length - f->start;
+
+	if (f->prefix > 0) {
+		size_t n = (avail < f->skip) ? avail : f->skip;
+
+		framingConsume(f, n);
+		f->skip -= n;
+
+		return f->skip == 0;
+	}
+
+	if (f->scan < f->start)
+		f->scan = f->start;
+
+	for (; f->scan + f->delimlen <= f->length; ++f->scan) {
+		if (memcmp(f->in + f->scan, f->delimiter, f->delimlen) == 0) {
+			framingConsume(f, f->scan + f->delimlen - f->start);
+			f->skip = 0;
+
+			return 1;
+		}
+	}
+
+	/* Keep what may be the beginning of the delimiter */
+	framingConsume(f, f->scan - f->start);
+
+	return 0;
+}
+
+/*
+ * Find a complete message in the buffer. Returns 1 and sets msg, len and
+ * consumed if there is one, 0 if more data is needed or -1 if the message
+ * is larger than allowed, it is then skipped so the next one can be read.
+ */
+static int
+framingExtract(Framing *f, const char **msg, size_t *len, size_t *consumed)
+{
+	const char *data;
+	size_t avail;
+
+	if (f->skip > 0 && !framingSkip(f))
+		return 0;
+
+	data = f->in + f->start;
+	avail = f->length - f->start;
+
+	if (f->prefix > 0) {
+		size_t size;
+
+		if (avail < (size_t)f->prefix)
+			return 0;
+		if ((size = framingReadPrefix(f, (const unsigned char *)data)) > f->max) {
+			framingConsume(f, f->prefix);
+			f->skip = size;
+			return -1;
+		}
+		if (avail - f->prefix < size)
+			return 0;
+
+		*msg = data + f->prefix;
+		*len = size;
+		*consumed = f->prefix + size;
+
+		return 1;
+	}
+
+	/* Resume the search where the previous one stopped */
+	if (f->scan < f->start)
+		f->scan = f->start;
+
+	for (; f->scan + f->delimlen <= f->length; ++f->scan) {
+		if (memcmp(f->in + f->scan, f->delimiter, f->delimlen) == 0) {
+			*msg = data;
+			*len = f->scan - f->start;
+			*consumed = *len + f->delimlen;
+			f->scan += f->delimlen;
+
+			return 1;
+		}
+	}
+
+	if (avail > f->max + f->delimlen) {
+		f->skip = 1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Make room for at least one byte at the end of the receive buffer, the
+ * buffer grows geometrically.
+ */
+static int
+framingReserve(Framing *f)
+{
+	size_t size;
+	char *tmp;
+
+	if (f->length < f->size)
+		return 0;
+
+	if (f->start > 0) {
+		memmove(f->in, f->in + f->start, f->length - f->start);
+		f->length -= f->start;
+		f->scan = (f->scan >= f->start) ? f->scan - f->start : 0;
+		f->start = 0;
+
+		if (f->length < f->size)
+			return 0;
+	}
+
+	size = (f->size == 0) ? FRAMING_MIN : f->size * 2;
+	if ((tmp = realloc(f->in, size)) == NULL)
+		return -1;
+
+	f->in = tmp;
+	f->size = size;
+
+	return 0;
+}
+
+/*
+ * Build the framed message in the output buffer, returns its length or 0
+ * with the SDL error set.
+ */
+static size_t
+framingPack(Framing *f, const char *data, size_t length)
+{
+	size_t total;
+
+	if (length > f->max || (f->prefix == 2 && length > 0xffff)) {
+		SDL_SetError("message too large");
+		return 0;
+	}
+
+	total = f->prefix + length + f->delimlen;
+
+	if (total > f->outsize) {
+		char *tmp;
+
+		if ((tmp = realloc(f->out, total)) == NULL) {
+			SDL_SetError("%s", strerror(errno));
+			return 0;
+		}
+
+		f->out = tmp;
+		f->outsize = total;
+	}
+
+	framingWritePrefix(f, (unsigned char *)f->out, length);
+	memcpy(f->out + f->prefix, data, length);
+	memcpy(f->out + f->prefix + length, f->delimiter, f->delimlen);
+
+	return total;
+}
+
+/*
+ * Apply the settings of a table { prefix, endian, delimiter, maxSize }, the
+ * table is checked before anything is changed.
+ */
+static void
+framingConfigure(lua_State *L, int idx, Framing *f)
+{
+	const char *delimiter, *endian;
+	size_t delimlen = 0;
+	int prefix, max = FRAMING_MAX;
+
+	luaL_checktype(L, idx, LUA_TTABLE);
+
+	prefix = tableGetInt(L, idx, "prefix");
+	delimiter = tableGetStringl(L, idx, "delimiter", &delimlen);
+	endian = tableGetString(L, idx, "endian");
+
+	if (delimiter != NULL && (delimlen == 0 || delimlen > sizeof (f->delimiter)))
+		luaL_argerror(L, idx, "invalid delimiter");
+	if (delimiter == NULL && prefix == 0)
+		prefix = 32;
+	if (prefix != 0 && prefix != 16 && prefix != 32)
+		luaL_argerror(L, idx, "prefix must be 16 or 32");
+	if (prefix != 0 && delimiter != NULL)
+		luaL_argerror(L, idx, "prefix and delimiter are exclusive");
+	if (tableIsType(L, idx, "maxSize", LUA_TNUMBER) &&
+	    (max = tableGetInt(L, idx, "maxSize")) < 0)
+		luaL_argerror(L, idx, "maxSize must not be negative");
+
+	f->prefix = prefix / 8;
+	f->big = endian == NULL || strcmp(endian, "little") != 0;
+	f->delimlen = delimlen;
+	f->max = max;
+	f->skip = 0;
+
+	if (delimiter != NULL)
+		memcpy(f->delimiter, delimiter, delimlen);
+}
+
+static int
+l_framing_gc(lua_State *L)
+{
+	framingFree(luaL_checkudata(L, 1, FRAMING_META));
+
+	return 0;
+}
+
+/*
+ * Get the framing of a socket, created with the defaults on first use.
+ */
+static Framing *
+framingGet(lua_State *L, void *socket)
+{
+	Framing *f;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, FRAMING);
+	lua_pushlightuserdata(L, socket);
+	lua_rawget(L, -2);
+
+	if ((f = lua_touserdata(L, -1)) != NULL) {
+		lua_pop(L, 2);
+		return f;
+	}
+
+	lua_pop(L, 1);
+	lua_pushlightuserdata(L, socket);
+	f = lua_newuserdata(L, sizeof (Framing));
+	framingInit(f);
+
+	if (luaL_newmetatable(L, FRAMING_META)) {
+		lua_pushcfunction(L, l_framing_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+
+	lua_setmetatable(L, -2);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+
+	return f;
+}
+
+/*
+ * Drop the state stored for a socket in one of the registry tables.
+ */
+static void
+removeState(lua_State *L, const char *field, void *socket)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, field);
+	lua_pushlightuserdata(L, socket);
+	lua_pushnil(L);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+}
+
+/* ---------------------------------------------------------
+ * UDP batching
+ * --------------------------------------------------------- */
+
+/*
+ * Packet vectors of UDP sockets, indexed by the socket pointer and reused
+ * by every recvMany() and sendMany() call.
+ */
+#define BATCH		"__SDL_net_batch"
+#define BATCH_META	"UdpBatch"
+
+#define BATCH_PACKET	1500
+
+typedef struct udp_batch {
+	UDPpacket	**recv;		/* received packets, NULL terminated */
+	int		 nrecv;		/* number of packets */
+	int		 size;		/* size of each packet */
+	UDPpacket	*send;		/* packets to send */
+	UDPpacket	**sendp;	/* pointers to send */
+	int		 nsend;		/* number of packets */
+	unsigned char	*value;		/* packed by sendValue() */
+	size_t		 valuesize;	/* allocated */
+} UdpBatch;
+
+static int
+l_batch_gc(lua_State *L)
+{
+	UdpBatch *b = luaL_checkudata(L, 1, BATCH_META);
+
+	if (b->recv)
+		SDLNet_FreePacketV(b->recv);
+
+	free(b->send);
+	free(b->sendp);
+	free(b->value);
+
+	return 0;
+}
+
+static UdpBatch *
+batchGet(lua_State *L, void *socket)
+{
+	UdpBatch *b;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, BATCH);
+	lua_pushlightuserdata(L, socket);
+	lua_rawget(L, -2);
+
+	if ((b = lua_touserdata(L, -1)) != NULL) {
+		lua_pop(L, 2);
+		return b;
+	}
+
+	lua_pop(L, 1);
+	lua_pushlightuserdata(L, socket);
+	b = lua_newuserdata(L, sizeof (UdpBatch));
+	memset(b, 0, sizeof (UdpBatch));
+
+	if (luaL_newmetatable(L, BATCH_META)) {
+		lua_pushcfunction(L, l_batch_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+
+	lua_setmetatable(L, -2);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+
+	return b;
+}
+
+/*
+ * The receive vector is only reallocated when it must grow.
+ */
+static int
+batchReserveRecv(UdpBatch *b, int count, int size)
+{
+	UDPpacket **v;
+
+	if (b->recv != NULL && count <= b->nrecv && size <= b->size)
+		return 0;
+
+	if (count < b->nrecv)
+		count = b->nrecv;
+	if (size < b->size)
+		size = b->size;
+	if ((v = SDLNet_AllocPacketV(count, size)) == NULL)
+		return -1;
+	if (b->recv)
+		SDLNet_FreePacketV(b->recv);
+
+	b->recv = v;
+	b->nrecv = count;
+	b->size = size;
+
+	return 0;
+}
+
+static int
+batchReserveSend(UdpBatch *b, int count)
+{
+	UDPpacket *v;
+	UDPpacket **p;
+	int i;
+
+	if (count <= b->nsend)
+		return 0;
+	if ((v = realloc(b->send, sizeof (UDPpacket) * count)) == NULL)
+		return -1;
+
+	b->send = v;
+
+	if ((p = realloc(b->sendp, sizeof (UDPpacket *) * count)) == NULL)
+		return -1;
+
+	b->sendp = p;
+	b->nsend = count;
+
+	for (i = 0; i < count; ++i)
+		b->sendp[i] = &b->send[i];
+
+	return 0;
+}
 
 /* ---------------------------------------------------------
  * Common helpers
@@ -56,8 +580,8 @@ checkAddress(lua_State *L, int index, IPaddress *addr)
 	addr->port = tableGetInt(L, index, "port");
 }
 
-static void
-assertNotClosed(lua_State *L, int index)
+static int
+isClosed(lua_State *L, int index)
 {
 	int type;
 
@@ -72,7 +596,13 @@ assertNotClosed(lua_State *L, int index)
 	lua_pop(L, 2);
 #endif
 
-	if (type != LUA_TNIL)
+	return type != LUA_TNIL;
+}
+
+static void
+assertNotClosed(lua_State *L, int index)
+{
+	if (isClosed(L, index))
 		luaL_error(L, "attempt operation on closed socket");
 }
 
@@ -81,10 +611,13 @@ closeSocket(lua_State *L, enum SocketType type, const char *name)
 {
 	CommonUserdata *udata = commonGetUserdata(L, 1, name);
 
-	if (type == Tcp)
+	if (type == Tcp) {
+		removeState(L, FRAMING, udata->data);
 		SDLNet_TCP_Close(udata->data);
-	else if (type == Udp)
+	} else if (type == Udp) {
+		removeState(L, BATCH, udata->data);
 		SDLNet_UDP_Close(udata->data);
+	}
 
 	udata->mustdelete = 0;
 
@@ -109,10 +642,14 @@ collectSocket(lua_State *L, enum SocketType type, const char *name)
 	CommonUserdata *udata = commonGetUserdata(L, 1, name);
 
 	if (udata->mustdelete) {
-		if (type == Tcp)
+		if (type == Tcp) {
+			removeState(L, FRAMING, udata->data);
 			SDLNet_TCP_Close(udata->data);
-		else if (type == Udp)
+		}
+		else if (type == Udp) {
+			removeState(L, BATCH, udata->data);
 			SDLNet_UDP_Close(udata->data);
+		}
 	}
 
 	return 0;
@@ -183,7 +720,7 @@ l_tcp_send(lua_State *L)
 	TCPsocket s = commonGetAs(L, 1, TcpName, TCPsocket);
 	size_t length;
 	int sent, ret = 1;
-	const char *data = luaL_checklstring(L, 2, &length);
+	const char *data = bufferCheckData(L, 2, 3, &length);
 
 	assertNotClosed(L, 1);
 
@@ -203,11 +740,26 @@ l_tcp_recv(lua_State *L)
 {
 	TCPsocket s = commonGetAs(L, 1, TcpName, TCPsocket);
 	int count = luaL_checkinteger(L, 2);
+	Buffer *b = bufferTest(L, 3);
 	char *data;
 	int nread, ret;
 
 	assertNotClosed(L, 1);
 
+	/* Read after the bytes used in the buffer */
+	if (b != NULL) {
+		if (bufferReserve(b, count) < 0)
+			return commonPushSDLError(L, 2);
+		if ((nread = SDLNet_TCP_Recv(s, b->data + b->length, count)) <= 0)
+			return commonPushSDLError(L, 2);
+
+		b->length += nread;
+		lua_pushvalue(L, 3);
+		lua_pushinteger(L, nread);
+
+		return 2;
+	}
+
 	if ((data = malloc(count + 1)) == NULL)
 		return commonPushErrno(L, 2);
 
@@ -229,45 +781,220 @@ l_tcp_recv(lua_State *L)
 }
 
 static int
-l_tcp_ready(lua_State *L)
+l_tcp_setFraming(lua_State *L)
 {
+	TCPsocket s = commonGetAs(L, 1, TcpName, TCPsocket);
+
 	assertNotClosed(L, 1);
+	framingConfigure(L, 2, framingGet(L, s));
 
-	return ready(L, 1, Tcp, TcpName);
+	return commonPush(L, "b", 1);
 }
 
 static int
-l_tcp_gc(lua_State *L)
+l_tcp_sendMessage(lua_State *L)
 {
-	return collectSocket(L, Tcp, TcpName);
-}
-
-static const luaL_Reg TcpMethods[] = {
-	{ "close",			l_tcp_close			},
-	{ "accept",			l_tcp_accept			},
-	{ "getPeerAddress",		l_tcp_getPeerAddress		},
-	{ "send",			l_tcp_send			},
-	{ "recv",			l_tcp_recv			},
-	{ "ready",			l_tcp_ready			},
-	{ NULL,				NULL				}
-};
+	TCPsocket s = commonGetAs(L, 1, TcpName, TCPsocket);
+	size_t length, total;
+	const char *data = bufferCheckData(L, 2, 3, &length);
+	Framing *f;
 
-static const luaL_Reg TcpMetamethods[] = {
-	{ "__gc",			l_tcp_gc			},
-	{ NULL,				NULL				}
-};
+	assertNotClosed(L, 1);
 
-static const CommonObject TcpSocket = {
-	"TcpSocket",
-	TcpMethods,
-	TcpMetamethods
-};
+	f = framingGet(L, s);
 
-/* ---------------------------------------------------------
- * UDPsocket object
- * --------------------------------------------------------- */
+	if ((total = framingPack(f, data, length)) == 0)
+		return commonPushSDLError(L, 1);
+	if (SDLNet_TCP_Send(s, f->out, total) < (int)total)
+		return commonPushSDLError(L, 1);
 
-#define UdpName	UdpSocket.name
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * Read until a complete message is buffered. Returns 1 with the message,
+ * 0 if none is available without blocking or -1 with the SDL error set.
+ */
+static int
+tcpReceive(TCPsocket s, Framing *f, int wait, const char **msg, size_t *length, size_t *consumed)
+{
+	int ret, nread;
+
+	for (;;) {
+		if ((ret = framingExtract(f, msg, length, consumed)) > 0)
+			return 1;
+
+		if (ret < 0) {
+			SDL_SetError("message too large");
+			return -1;
+		}
+
+		if (!wait) {
+			if (f->set == NULL) {
+				if ((f->set = SDLNet_AllocSocketSet(1)) == NULL)
+					return -1;
+
+				SDLNet_AddSocket(f->set, (SDLNet_GenericSocket)s);
+			}
+
+			if (SDLNet_CheckSockets(f->set, 0) <= 0)
+				return 0;
+		}
+
+		if (framingReserve(f) < 0)
+			return SDL_OutOfMemory();
+
+		nread = SDLNet_TCP_Recv(s, f->in + f->length, f->size - f->length);
+
+		if (nread == 0) {
+			SDL_SetError("connection closed");
+			return -1;
+		}
+		if (nread < 0)
+			return -1;
+
+		f->length += nread;
+	}
+}
+
+static int
+l_tcp_recvMessage(lua_State *L)
+{
+	TCPsocket s = commonGetAs(L, 1, TcpName, TCPsocket);
+	int wait = lua_isnoneornil(L, 2) || lua_toboolean(L, 2);
+	const char *msg;
+	size_t length, consumed;
+	Framing *f;
+	int ret;
+
+	assertNotClosed(L, 1);
+
+	f = framingGet(L, s);
+
+	if ((ret = tcpReceive(s, f, wait, &msg, &length, &consumed)) < 0)
+		return commonPushSDLError(L, 1);
+	if (ret == 0)
+		return commonPush(L, "n");
+
+	lua_pushlstring(L, msg, length);
+	framingConsume(f, consumed);
+
+	return 1;
+}
+
+static int
+l_tcp_sendValue(lua_State *L)
+{
+	TCPsocket s = commonGetAs(L, 1, TcpName, TCPsocket);
+	PackBuffer b;
+	size_t length;
+	Framing *f;
+	int ret;
+
+	luaL_checkany(L, 2);
+	assertNotClosed(L, 1);
+
+	f = framingGet(L, s);
+
+	if (f->prefix == 0)
+		return commonPush(L, "ns", "values need a length prefix framing");
+
+	/* Pack directly after the prefix, the buffer is kept for next time */
+	packInit(&b, f->out, f->outsize, f->prefix);
+	ret = packValue(L, 2, &b);
+	f->out = (char *)b.data;
+	f->outsize = b.size;
+
+	if (ret < 0)
+		return commonPushSDLError(L, 1);
+
+	length = b.length - b.head;
+
+	if (length > f->max || (f->prefix == 2 && length > 0xffff))
+		return commonPush(L, "ns", "message too large");
+
+	framingWritePrefix(f, b.data, length);
+
+	if (SDLNet_TCP_Send(s, b.data, b.length) < (int)b.length)
+		return commonPushSDLError(L, 1);
+
+	return commonPush(L, "b", 1);
+}
+
+static int
+l_tcp_recvValue(lua_State *L)
+{
+	TCPsocket s = commonGetAs(L, 1, TcpName, TCPsocket);
+	int wait = lua_isnoneornil(L, 2) || lua_toboolean(L, 2);
+	const char *msg;
+	size_t length, consumed;
+	Framing *f;
+	int ret;
+
+	assertNotClosed(L, 1);
+
+	f = framingGet(L, s);
+
+	if ((ret = tcpReceive(s, f, wait, &msg, &length, &consumed)) < 0)
+		return commonPushSDLError(L, 1);
+	if (ret == 0)
+		return commonPush(L, "n");
+
+	/* Decoded from the receive buffer, a bad message is dropped */
+	ret = unpackValue(L, msg, length);
+	framingConsume(f, consumed);
+
+	if (ret < 0)
+		return commonPushSDLError(L, 1);
+
+	return 1;
+}
+
+static int
+l_tcp_ready(lua_State *L)
+{
+	assertNotClosed(L, 1);
+
+	return ready(L, 1, Tcp, TcpName);
+}
+
+static int
+l_tcp_gc(lua_State *L)
+{
+	return collectSocket(L, Tcp, TcpName);
+}
+
+static const luaL_Reg TcpMethods[] = {
+	{ "close",			l_tcp_close			},
+	{ "accept",			l_tcp_accept			},
+	{ "getPeerAddress",		l_tcp_getPeerAddress		},
+	{ "send",			l_tcp_send			},
+	{ "recv",			l_tcp_recv			},
+	{ "setFraming",			l_tcp_setFraming		},
+	{ "sendMessage",		l_tcp_sendMessage		},
+	{ "recvMessage",		l_tcp_recvMessage		},
+	{ "sendValue",			l_tcp_sendValue			},
+	{ "recvValue",			l_tcp_recvValue			},
+	{ "ready",			l_tcp_ready			},
+	{ NULL,				NULL				}
+};
+
+static const luaL_Reg TcpMetamethods[] = {
+	{ "__gc",			l_tcp_gc			},
+	{ NULL,				NULL				}
+};
+
+static const CommonObject TcpSocket = {
+	"TcpSocket",
+	TcpMethods,
+	TcpMetamethods
+};
+
+/* ---------------------------------------------------------
+ * UDPsocket object
+ * --------------------------------------------------------- */
+
+#define UdpName	UdpSocket.name
 
 static const CommonObject UdpSocket;
 
@@ -327,10 +1054,12 @@ l_udp_send(lua_State *L)
 {
 	UDPsocket s = commonGetAs(L, 1, UdpName, UDPsocket);
 	UDPpacket p;
+	size_t length;
 	int ret;
 
 	assertNotClosed(L, 1);
-	p.data = (Uint8 *)luaL_checklstring(L, 2, (size_t *)&p.len);
+	p.data = (Uint8 *)bufferCheckData(L, 2, 4, &length);
+	p.len = p.maxlen = length;
 
 	/*
 	 * If next argument is a table, we parse the address fields, otherwise
@@ -355,26 +1084,286 @@ l_udp_recv(lua_State *L)
 {
 	UDPsocket s = commonGetAs(L, 1, UdpName, UDPsocket);
 	int count = luaL_checkinteger(L, 2);
+	Buffer *b = bufferTest(L, 3);
 	int ret;
 	UDPpacket *p;
 
 	assertNotClosed(L, 1);
 
+	/* Receive in place after the bytes used in the buffer */
+	if (b != NULL) {
+		UDPpacket inplace;
+
+		if (bufferReserve(b, count) < 0)
+			return commonPushSDLError(L, 2);
+
+		memset(&inplace, 0, sizeof (inplace));
+		inplace.data = b->data + b->length;
+		inplace.maxlen = count;
+
+		if ((ret = SDLNet_UDP_Recv(s, &inplace)) < 0)
+			return commonPushSDLError(L, 2);
+		if (ret == 0)
+			return commonPush(L, "nn");
+
+		b->length += inplace.len;
+		lua_pushvalue(L, 3);
+		lua_pushinteger(L, inplace.len);
+
+		return 2 + pushAddress(L, &inplace.address);
+	}
+
 	if ((p = SDLNet_AllocPacket(count)) == NULL)
 		return commonPushSDLError(L, 2);
 
 	ret = SDLNet_UDP_Recv(s, p);
-	if (ret <= 0) {
-		lua_pushnil(L);
-		lua_pushnil(L);
-	} else {
+	if (ret < 0)
+		ret = commonPushSDLError(L, 2);
+	else if (ret == 0)
+		ret = commonPush(L, "nn");
+	else {
 		lua_pushlstring(L, (const char *)p->data, p->len);
 		lua_pushinteger(L, ret);
+		ret = 2;
 	}
 
 	SDLNet_FreePacket(p);
 
-	return 2;
+	return ret;
+}
+
+static int
+l_udp_recvMany(lua_State *L)
+{
+	UDPsocket s	= commonGetAs(L, 1, UdpName, UDPsocket);
+	int max		= luaL_checkinteger(L, 2);
+	int size	= luaL_optinteger(L, 5, BATCH_PACKET);
+	UDPpacket *saved = NULL;
+	UdpBatch *b;
+	int i, count;
+
+	assertNotClosed(L, 1);
+
+	if (max <= 0)
+		return luaL_argerror(L, 2, "must be positive");
+
+	/* Tables to fill, reused from the previous call if given */
+	if (lua_isnoneornil(L, 3))
+		lua_createtable(L, max, 0);
+	else {
+		luaL_checktype(L, 3, LUA_TTABLE);
+		lua_pushvalue(L, 3);
+	}
+
+	if (lua_isnoneornil(L, 4))
+		lua_createtable(L, max, 0);
+	else {
+		luaL_checktype(L, 4, LUA_TTABLE);
+		lua_pushvalue(L, 4);
+	}
+
+	b = batchGet(L, s);
+
+	if (batchReserveRecv(b, max, size) < 0)
+		return commonPushSDLError(L, 1);
+
+	/* Terminate the vector early to receive at most max packets */
+	if (max < b->nrecv) {
+		saved = b->recv[max];
+		b->recv[max] = NULL;
+	}
+
+	count = SDLNet_UDP_RecvV(s, b->recv);
+
+	if (saved != NULL)
+		b->recv[max] = saved;
+	if (count < 0)
+		return commonPushSDLError(L, 1);
+
+	for (i = 0; i < count; ++i) {
+		UDPpacket *p = b->recv[i];
+
+		lua_pushlstring(L, (const char *)p->data, p->len);
+		lua_rawseti(L, -3, i + 1);
+
+		lua_rawgeti(L, -1, i + 1);
+		if (lua_type(L, -1) != LUA_TTABLE) {
+			lua_pop(L, 1);
+			lua_createtable(L, 0, 3);
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, -3, i + 1);
+		}
+
+		tableSetInt(L, -1, "host", p->address.host);
+		tableSetInt(L, -1, "port", p->address.port);
+		tableSetInt(L, -1, "channel", p->channel);
+		lua_pop(L, 1);
+	}
+
+	/* Stop ipairs on what was received now */
+	lua_pushnil(L);
+	lua_rawseti(L, -3, count + 1);
+
+	lua_pushinteger(L, count);
+	lua_insert(L, -3);
+
+	return 3;
+}
+
+static int
+l_udp_sendMany(lua_State *L)
+{
+	UDPsocket s = commonGetAs(L, 1, UdpName, UDPsocket);
+	int perpacket, count, i, ret;
+	UDPpacket common;
+	UdpBatch *b;
+
+	assertNotClosed(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	/*
+	 * The destination is either one channel or address for every packet
+	 * or a sequence with one per packet.
+	 */
+	memset(&common, 0, sizeof (common));
+	perpacket = 0;
+
+	if (lua_type(L, 3) == LUA_TNUMBER)
+		common.channel = lua_tointeger(L, 3);
+	else if (lua_type(L, 3) == LUA_TTABLE) {
+		lua_rawgeti(L, 3, 1);
+		perpacket = !lua_isnil(L, -1);
+		lua_pop(L, 1);
+
+		if (!perpacket) {
+			checkAddress(L, 3, &common.address);
+			common.channel = -1;
+		}
+	} else
+		return luaL_error(L, "expected address, channel or sequence");
+
+	for (count = 0; ; ++count) {
+		lua_rawgeti(L, 2, count + 1);
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			break;
+		}
+		lua_pop(L, 1);
+	}
+
+	if (count == 0)
+		return commonPush(L, "i", 0);
+
+	b = batchGet(L, s);
+
+	if (batchReserveSend(b, count) < 0)
+		return commonPushErrno(L, 1);
+
+	/* The strings and buffers stay on the arguments, no copy is needed */
+	for (i = 0; i < count; ++i) {
+		UDPpacket *p = &b->send[i];
+		Buffer *buffer;
+		size_t length;
+
+		*p = common;
+
+		lua_rawgeti(L, 2, i + 1);
+		if ((buffer = bufferTest(L, -1)) != NULL) {
+			p->data = buffer->data;
+			length = buffer->length;
+		} else
+			p->data = (Uint8 *)luaL_checklstring(L, -1, &length);
+
+		p->len = p->maxlen = length;
+		lua_pop(L, 1);
+
+		if (perpacket) {
+			lua_rawgeti(L, 3, i + 1);
+
+			if (lua_type(L, -1) == LUA_TNUMBER)
+				p->channel = lua_tointeger(L, -1);
+			else {
+				checkAddress(L, -1, &p->address);
+				p->channel = -1;
+			}
+
+			lua_pop(L, 1);
+		}
+	}
+
+	if ((ret = SDLNet_UDP_SendV(s, b->sendp, count)) == 0)
+		return commonPushSDLError(L, 1);
+
+	return commonPush(L, "i", ret);
+}
+
+static int
+l_udp_sendValue(lua_State *L)
+{
+	UDPsocket s = commonGetAs(L, 1, UdpName, UDPsocket);
+	PackBuffer pb;
+	UDPpacket p;
+	UdpBatch *b;
+	int ret;
+
+	luaL_checkany(L, 2);
+	assertNotClosed(L, 1);
+
+	memset(&p, 0, sizeof (p));
+
+	if (lua_type(L, 3) == LUA_TTABLE) {
+		checkAddress(L, 3, &p.address);
+		p.channel = -1;
+	} else if (lua_type(L, 3) == LUA_TNUMBER) {
+		p.channel = luaL_checkinteger(L, 3);
+	} else
+		return luaL_error(L, "expected address or channel");
+
+	b = batchGet(L, s);
+
+	packInit(&pb, b->value, b->valuesize, 0);
+	ret = packValue(L, 2, &pb);
+	b->value = pb.data;
+	b->valuesize = pb.size;
+
+	if (ret < 0)
+		return commonPushSDLError(L, 1);
+
+	p.data = pb.data;
+	p.len = p.maxlen = pb.length;
+
+	if ((ret = SDLNet_UDP_Send(s, p.channel, &p)) == 0)
+		return commonPushSDLError(L, 1);
+
+	return commonPush(L, "i", ret);
+}
+
+static int
+l_udp_recvValue(lua_State *L)
+{
+	UDPsocket s	= commonGetAs(L, 1, UdpName, UDPsocket);
+	int size	= luaL_optinteger(L, 2, BATCH_PACKET);
+	UDPpacket *p;
+	UdpBatch *b;
+	int ret;
+
+	assertNotClosed(L, 1);
+
+	b = batchGet(L, s);
+
+	if (batchReserveRecv(b, 1, size) < 0)
+		return commonPushSDLError(L, 1);
+
+	p = b->recv[0];
+
+	if ((ret = SDLNet_UDP_Recv(s, p)) < 0)
+		return commonPushSDLError(L, 1);
+	if (ret == 0)
+		return commonPush(L, "n");
+	if (unpackValue(L, p->data, p->len) < 0)
+		return commonPushSDLError(L, 1);
+
+	return 1 + pushAddress(L, &p->address);
 }
 
 static int
@@ -398,6 +1387,10 @@ static const luaL_Reg UdpMethods[] = {
 	{ "getPeerAddress",		l_udp_getPeerAddress		},
 	{ "send",			l_udp_send			},
 	{ "recv",			l_udp_recv			},
+	{ "recvMany",			l_udp_recvMany			},
+	{ "sendMany",			l_udp_sendMany			},
+	{ "sendValue",			l_udp_sendValue			},
+	{ "recvValue",			l_udp_recvValue			},
 	{ "ready",			l_udp_ready			},
 	{ NULL,				NULL				}
 };
@@ -524,43 +1517,1085 @@ static const CommonObject SocketSet = {
 };
 
 /* ---------------------------------------------------------
- * SDL_net functions
+ * Poller object (epoll)
  * --------------------------------------------------------- */
 
-static int
-l_init(lua_State *L)
-{
-	if (SDLNet_Init() < 0)
-		return commonPushSDLError(L, 1);
+#if defined(HAVE_SYS_EPOLL_H)
 
-	return commonPush(L, "b", 1);
-}
+#define PollerName	Poller.name
 
-static int
-l_resolveHost(lua_State *L)
-{
-	const char *host	= NULL;
-	int port		= luaL_checkinteger(L, 2);
-	IPaddress addr;
+static const CommonObject Poller;
 
-	if (lua_type(L, 1) == LUA_TSTRING)
-		host = luaL_checkstring(L, 1);
+typedef struct poller {
+	int			 fd;		/* the epoll descriptor */
+	struct epoll_event	*events;	/* returned by epoll_wait */
+	int			 nevents;	/* allocated events */
+	int			 count;		/* registered sockets */
+	int			 sockets;	/* registry ref, fd -> socket */
+} EPoller;
 
-	if (SDLNet_ResolveHost(&addr, host, port) < 0)
-		return commonPushSDLError(L, 1);
+/*
+ * The header of a closed socket is freed, check isClosed() first.
+ */
+static struct socket_header *
+checkPolled(lua_State *L, int index)
+{
+	if (!luaL_testudata(L, index, TcpName) && !luaL_testudata(L, index, UdpName))
+		luaL_error(L, "TcpSocket or UdpSocket expected");
 
-	return pushAddress(L, &addr);
+	return ((CommonUserdata *)lua_touserdata(L, index))->data;
+}
+
+/*
+ * Closing a socket removes it from the epoll set but not from the registry,
+ * such entries are dropped when found.
+ */
+static void
+pollerDrop(lua_State *L, EPoller *p, int registry, int fd)
+{
+	lua_pushnil(L);
+	lua_rawseti(L, registry, fd);
+	-- p->count;
 }
 
 static int
-l_resolveIp(lua_State *L)
+l_poller_add(lua_State *L)
 {
-	IPaddress address;
-	const char *host;
+	EPoller *p = commonGetAs(L, 1, PollerName, EPoller *);
+	struct socket_header *s = checkPolled(L, 2);
+	struct epoll_event ev;
 
-	checkAddress(L, 1, &address);
-	if ((host = SDLNet_ResolveIP(&address)) == NULL)
-		return commonPushSDLError(L, 1);
+	assertNotClosed(L, 2);
+
+	if (p->count == p->nevents) {
+		struct epoll_event *tmp;
+		int n = (p->nevents == 0) ? 64 : p->nevents * 2;
+
+		if ((tmp = realloc(p->events, sizeof (struct epoll_event) * n)) == NULL)
+			return commonPushErrno(L, 1);
+
+		p->events = tmp;
+		p->nevents = n;
+	}
+
+	memset(&ev, 0, sizeof (ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = s->channel;
+
+	if (epoll_ctl(p->fd, EPOLL_CTL_ADD, s->channel, &ev) < 0)
+		return commonPushErrno(L, 1);
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, p->sockets);
+
+	/* The descriptor of a socket closed while registered was reused */
+	lua_rawgeti(L, -1, s->channel);
+	if (!lua_isnil(L, -1))
+		pollerDrop(L, p, lua_gettop(L) - 1, s->channel);
+	lua_pop(L, 1);
+
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, s->channel);
+	lua_pop(L, 1);
+
+	return commonPush(L, "i", ++p->count);
+}
+
+static int
+l_poller_del(lua_State *L)
+{
+	EPoller *p = commonGetAs(L, 1, PollerName, EPoller *);
+	struct socket_header *s = checkPolled(L, 2);
+	struct epoll_event ev;
+	int registry, found = 0;
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, p->sockets);
+	registry = lua_gettop(L);
+
+	if (!isClosed(L, 2)) {
+		if (epoll_ctl(p->fd, EPOLL_CTL_DEL, s->channel, &ev) < 0)
+			return commonPushErrno(L, 1);
+
+		pollerDrop(L, p, registry, s->channel);
+
+		return commonPush(L, "i", p->count);
+	}
+
+	/* Already out of the epoll set, find the descriptor it had */
+	lua_pushnil(L);
+	while (!found && lua_next(L, registry)) {
+		if ((found = lua_rawequal(L, -1, 2)))
+			pollerDrop(L, p, registry, lua_tointeger(L, -2));
+
+		lua_pop(L, 1);
+	}
+
+	if (!found)
+		return commonPush(L, "ns", "socket not registered");
+
+	return commonPush(L, "i", p->count);
+}
+
+static int
+l_poller_wait(lua_State *L)
+{
+	EPoller *p = commonGetAs(L, 1, PollerName, EPoller *);
+	int timeout = luaL_optinteger(L, 2, -1);
+	int i, n, count = 0;
+
+	if (lua_isnoneornil(L, 3))
+		lua_createtable(L, 16, 0);
+	else {
+		luaL_checktype(L, 3, LUA_TTABLE);
+		lua_pushvalue(L, 3);
+	}
+
+	if (p->nevents == 0)
+		n = 0;
+	else if ((n = epoll_wait(p->fd, p->events, p->nevents, timeout)) < 0) {
+		if (errno != EINTR)
+			return commonPushErrno(L, 1);
+
+		n = 0;
+	}
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, p->sockets);
+
+	for (i = 0; i < n; ++i) {
+		CommonUserdata *udata;
+
+		lua_rawgeti(L, -1, p->events[i].data.fd);
+
+		/* Unknown or closed while still registered */
+		if ((udata = lua_touserdata(L, -1)) == NULL || isClosed(L, -1)) {
+			lua_pop(L, 1);
+			continue;
+		}
+
+		/* Keep SDLNet_SocketReady() meaningful */
+		((struct socket_header *)udata->data)->ready = 1;
+		lua_rawseti(L, -3, ++count);
+	}
+
+	lua_pop(L, 1);
+	lua_pushnil(L);
+	lua_rawseti(L, -2, count + 1);
+	lua_pushinteger(L, count);
+
+	return 2;
+}
+
+static int
+l_poller_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, PollerName);
+	EPoller *p = udata->data;
+
+	if (udata->mustdelete) {
+		luaL_unref(L, LUA_REGISTRYINDEX, p->sockets);
+		close(p->fd);
+		free(p->events);
+		free(p);
+	}
+
+	return 0;
+}
+
+static const luaL_Reg PollerMethods[] = {
+	{ "add",			l_poller_add			},
+	{ "del",			l_poller_del			},
+	{ "wait",			l_poller_wait			},
+	{ NULL,				NULL				}
+};
+
+static const luaL_Reg PollerMetamethods[] = {
+	{ "__gc",			l_poller_gc			},
+	{ NULL,				NULL				}
+};
+
+static const CommonObject Poller = {
+	"Poller",
+	PollerMethods,
+	PollerMetamethods
+};
+
+#endif /* HAVE_SYS_EPOLL_H */
+
+/* ---------------------------------------------------------
+ * NetService object
+ * --------------------------------------------------------- */
+
+#define ServiceName	NetServiceObject.name
+
+static const CommonObject NetServiceObject;
+
+enum ServiceCommandType {
+	ServiceListen,
+	ServiceConnect,
+	ServiceOpened,
+	ServiceSend,
+	ServiceClose
+};
+
+enum ServiceEventType {
+	ServiceAccept,
+	ServiceConnected,
+	ServiceMessage,
+	ServiceClosed,
+	ServiceError
+};
+
+static const char *ServiceEventNames[] = {
+	"accept",
+	"connect",
+	"message",
+	"close",
+	"error"
+};
+
+typedef struct service_command {
+	enum ServiceCommandType	 type;
+	int			 id;
+	TCPsocket		 sock;		/* ServiceListen, ServiceOpened */
+	IPaddress		 address;	/* ServiceConnect */
+	struct service		*svc;		/* ServiceConnect */
+	char			*data;		/* ServiceSend or open error */
+	size_t			 length;
+
+	STAILQ_ENTRY(service_command) link;
+} ServiceCommand;
+
+typedef struct service_event {
+	enum ServiceEventType	 type;
+	int			 id;
+	int			 listener;	/* ServiceAccept */
+	IPaddress		 address;	/* ServiceAccept */
+	char			*data;		/* message or error */
+	size_t			 length;
+
+	STAILQ_ENTRY(service_event) link;
+} ServiceEvent;
+
+typedef STAILQ_HEAD(service_commands, service_command) ServiceCommands;
+typedef STAILQ_HEAD(service_events, service_event) ServiceEvents;
+
+/*
+ * Only the I/O thread accesses the connections. The socket is NULL while
+ * connecting, messages sent meanwhile are queued.
+ */
+typedef struct service_conn {
+	int			 id;
+	TCPsocket		 sock;
+	int			 listener;
+	Framing			 framing;
+	char			*queue;		/* bytes not sent yet */
+	size_t			 qstart;	/* first byte not sent */
+	size_t			 qlength;	/* end of queued bytes */
+	size_t			 qsize;		/* allocated */
+} ServiceConn;
+
+typedef struct service {
+	SDL_Thread		*thread;
+	SDL_mutex		*mutex;		/* protects the queues */
+	ServiceCommands		 commands;
+	ServiceEvents		 events;
+	SDL_atomic_t		 ids;		/* last connection id */
+
+	/* Wake up the I/O thread by sending a datagram to itself */
+	UDPsocket		 wake;
+	IPaddress		 wakeaddr;
+	SDL_atomic_t		 woken;
+
+	/* SDLNet_TCP_Open() blocks, connections are opened there */
+	WorkerPool		 connector;
+	SDL_atomic_t		 quit;		/* stop the I/O thread and opens */
+
+	/* I/O thread only */
+	ServiceConn		**conns;
+	int			 nconns;
+	Framing			 framing;	/* settings of new connections */
+} Service;
+
+/*
+ * Sockets are switched to non blocking once connected so that a slow peer
+ * only grows its queue.
+ */
+static int
+socketNonBlocking(TCPsocket sock)
+{
+#if defined(_WIN32)
+	u_long on = 1;
+
+	if (ioctlsocket(socketChannel(sock), FIONBIO, &on) != 0)
+		return SDL_SetError("ioctlsocket failed: %d", WSAGetLastError());
+#else
+	int flags;
+
+	if ((flags = fcntl(socketChannel(sock), F_GETFL)) < 0 ||
+	    fcntl(socketChannel(sock), F_SETFL, flags | O_NONBLOCK) < 0)
+		return SDL_SetError("%s", strerror(errno));
+#endif
+
+	return 0;
+}
+
+static int
+socketWouldBlock(void)
+{
+#if defined(_WIN32)
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+/*
+ * Send what the socket accepts without blocking, returns the number of
+ * bytes sent (maybe 0) or -1 with the SDL error set.
+ */
+static int
+socketSend(TCPsocket sock, const char *data, size_t length)
+{
+	int n;
+
+#if defined(_WIN32)
+	if ((n = send(socketChannel(sock), data, (int)length, 0)) == SOCKET_ERROR) {
+		if (socketWouldBlock())
+			return 0;
+
+		return SDL_SetError("send failed: %d", WSAGetLastError());
+	}
+#else
+#  if defined(MSG_NOSIGNAL)
+	const int flags = MSG_NOSIGNAL;
+#  else
+	const int flags = 0;
+#  endif
+
+	do {
+		n = send(socketChannel(sock), data, length, flags);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0) {
+		if (socketWouldBlock())
+			return 0;
+
+		return SDL_SetError("%s", strerror(errno));
+	}
+#endif
+
+	return n;
+}
+
+static void
+serviceWake(Service *svc)
+{
+	UDPpacket p;
+	Uint8 byte = 0;
+
+	if (!SDL_AtomicCAS(&svc->woken, 0, 1))
+		return;
+
+	memset(&p, 0, sizeof (p));
+	p.data = &byte;
+	p.len = p.maxlen = 1;
+	p.address = svc->wakeaddr;
+	p.channel = -1;
+
+	SDLNet_UDP_Send(svc->wake, -1, &p);
+}
+
+static int
+serviceCommand(Service *svc, ServiceCommand *cmd)
+{
+	SDL_LockMutex(svc->mutex);
+	STAILQ_INSERT_TAIL(&svc->commands, cmd, link);
+	SDL_UnlockMutex(svc->mutex);
+	serviceWake(svc);
+
+	return 0;
+}
+
+static void
+serviceEvent(Service *svc, enum ServiceEventType type, int id, const char *data, size_t length)
+{
+	ServiceEvent *ev;
+
+	if ((ev = calloc(1, sizeof (ServiceEvent))) == NULL)
+		return;
+
+	ev->type = type;
+	ev->id = id;
+
+	if (data != NULL && (ev->data = malloc(length)) != NULL) {
+		memcpy(ev->data, data, length);
+		ev->length = length;
+	}
+
+	SDL_LockMutex(svc->mutex);
+	STAILQ_INSERT_TAIL(&svc->events, ev, link);
+	SDL_UnlockMutex(svc->mutex);
+}
+
+static void
+serviceError(Service *svc, int id)
+{
+	const char *error = SDLNet_GetError();
+
+	serviceEvent(svc, ServiceError, id, error, strlen(error));
+}
+
+static ServiceConn *
+serviceAdd(Service *svc, int id, TCPsocket sock, int listener)
+{
+	ServiceConn *c, **tmp;
+
+	if ((c = calloc(1, sizeof (ServiceConn))) == NULL)
+		return NULL;
+	if ((tmp = realloc(svc->conns, sizeof (ServiceConn *) * (svc->nconns + 1))) == NULL) {
+		free(c);
+		return NULL;
+	}
+
+	c->id = id;
+	c->sock = sock;
+	c->listener = listener;
+	c->framing = svc->framing;
+	c->framing.in = c->framing.out = NULL;
+	c->framing.set = NULL;
+
+	svc->conns = tmp;
+	svc->conns[svc->nconns++] = c;
+
+	return c;
+}
+
+static ServiceConn *
+serviceFind(Service *svc, int id)
+{
+	int i;
+
+	for (i = 0; i < svc->nconns; ++i)
+		if (svc->conns[i]->id == id)
+			return svc->conns[i];
+
+	return NULL;
+}
+
+static void
+serviceRemove(Service *svc, ServiceConn *c, int notify)
+{
+	int i;
+
+	for (i = 0; i < svc->nconns && svc->conns[i] != c; ++i)
+		continue;
+
+	memmove(&svc->conns[i], &svc->conns[i + 1], sizeof (ServiceConn *) * (svc->nconns - i - 1));
+	-- svc->nconns;
+
+	if (notify)
+		serviceEvent(svc, ServiceClosed, c->id, NULL, 0);
+
+	if (c->sock != NULL)
+		SDLNet_TCP_Close(c->sock);
+
+	framingFree(&c->framing);
+	free(c->queue);
+	free(c);
+}
+
+/*
+ * Append bytes to the queue of a connection, the bytes already sent are
+ * dropped first.
+ */
+static int
+serviceQueue(ServiceConn *c, const char *data, size_t length)
+{
+	if (c->qstart > 0) {
+		memmove(c->queue, c->queue + c->qstart, c->qlength - c->qstart);
+		c->qlength -= c->qstart;
+		c->qstart = 0;
+	}
+
+	if (c->qlength + length > c->qsize) {
+		size_t size = (c->qsize == 0) ? FRAMING_MIN : c->qsize;
+		char *tmp;
+
+		while (size < c->qlength + length)
+			size *= 2;
+
+		if ((tmp = realloc(c->queue, size)) == NULL)
+			return SDL_SetError("%s", strerror(errno));
+
+		c->queue = tmp;
+		c->qsize = size;
+	}
+
+	memcpy(c->queue + c->qlength, data, length);
+	c->qlength += length;
+
+	return 0;
+}
+
+/*
+ * Send as much of the queue as possible, the rest waits for the socket to
+ * be writable.
+ */
+static int
+serviceFlush(ServiceConn *c)
+{
+	int n;
+
+	while (c->qstart < c->qlength) {
+		if ((n = socketSend(c->sock, c->queue + c->qstart, c->qlength - c->qstart)) < 0)
+			return -1;
+		if (n == 0)
+			return 0;
+
+		c->qstart += n;
+	}
+
+	c->qstart = c->qlength = 0;
+
+	return 0;
+}
+
+/*
+ * Runs on a connector thread, the result goes back to the I/O thread as a
+ * ServiceOpened command.
+ */
+static void
+serviceOpen(ServiceCommand *cmd)
+{
+	Service *svc = cmd->svc;
+	const char *error = "service stopped";
+
+	if (!SDL_AtomicGet(&svc->quit) &&
+	    (cmd->sock = SDLNet_TCP_Open(&cmd->address)) == NULL)
+		error = SDLNet_GetError();
+
+	if (cmd->sock == NULL && (cmd->data = strdup(error)) != NULL)
+		cmd->length = strlen(error);
+
+	cmd->type = ServiceOpened;
+	serviceCommand(svc, cmd);
+}
+
+/*
+ * Run the commands queued by the Lua state.
+ */
+static void
+serviceRunCommands(Service *svc)
+{
+	ServiceCommands commands;
+	ServiceCommand *cmd, *tmp;
+	ServiceConn *c;
+	size_t total;
+
+	SDL_AtomicSet(&svc->woken, 0);
+
+	SDL_LockMutex(svc->mutex);
+	STAILQ_INIT(&commands);
+	STAILQ_CONCAT(&commands, &svc->commands);
+	SDL_UnlockMutex(svc->mutex);
+
+	STAILQ_FOREACH_SAFE(cmd, &commands, link, tmp) {
+		switch (cmd->type) {
+		case ServiceListen:
+			if (serviceAdd(svc, cmd->id, cmd->sock, 1) == NULL)
+				SDLNet_TCP_Close(cmd->sock);
+			break;
+		case ServiceConnect:
+			if ((c = serviceAdd(svc, cmd->id, NULL, 0)) == NULL)
+				break;
+
+			/* The command now belongs to the connector */
+			cmd->svc = svc;
+			if (workerPush(&svc->connector, (WorkerFunc)serviceOpen, cmd) == 0)
+				continue;
+
+			serviceError(svc, cmd->id);
+			serviceRemove(svc, c, 0);
+			break;
+		case ServiceOpened:
+			/* Closed while connecting */
+			if ((c = serviceFind(svc, cmd->id)) == NULL || c->sock != NULL)
+				break;
+
+			if (cmd->sock == NULL) {
+				serviceEvent(svc, ServiceError, c->id, cmd->data, cmd->length);
+				serviceRemove(svc, c, 0);
+				break;
+			}
+
+			c->sock = cmd->sock;
+			cmd->sock = NULL;
+
+			if (socketNonBlocking(c->sock) < 0 || serviceFlush(c) < 0) {
+				serviceError(svc, c->id);
+				serviceRemove(svc, c, 0);
+			} else
+				serviceEvent(svc, ServiceConnected, c->id, NULL, 0);
+			break;
+		case ServiceSend:
+			if ((c = serviceFind(svc, cmd->id)) == NULL || c->listener)
+				break;
+
+			total = framingPack(&c->framing, cmd->data, cmd->length);
+
+			if (total == 0 || serviceQueue(c, c->framing.out, total) < 0 ||
+			    (c->sock != NULL && serviceFlush(c) < 0)) {
+				serviceError(svc, c->id);
+				serviceRemove(svc, c, 1);
+			}
+			break;
+		case ServiceClose:
+			if ((c = serviceFind(svc, cmd->id)) != NULL)
+				serviceRemove(svc, c, 1);
+			break;
+		default:
+			break;
+		}
+
+		if (cmd->sock != NULL && cmd->type == ServiceOpened)
+			SDLNet_TCP_Close(cmd->sock);
+
+		free(cmd->data);
+		free(cmd);
+	}
+}
+
+static void
+serviceRead(Service *svc, ServiceConn *c)
+{
+	const char *msg;
+	size_t length, consumed;
+	int nread, ret;
+
+	if (c->listener) {
+		TCPsocket client;
+		ServiceEvent *ev;
+		IPaddress *addr;
+		int id;
+
+		if ((client = SDLNet_TCP_Accept(c->sock)) == NULL)
+			return;
+
+		id = SDL_AtomicAdd(&svc->ids, 1) + 1;
+
+		if (socketNonBlocking(client) < 0 || serviceAdd(svc, id, client, 0) == NULL) {
+			SDLNet_TCP_Close(client);
+			return;
+		}
+		if ((ev = calloc(1, sizeof (ServiceEvent))) == NULL)
+			return;
+
+		ev->type = ServiceAccept;
+		ev->id = id;
+		ev->listener = c->id;
+
+		if ((addr = SDLNet_TCP_GetPeerAddress(client)) != NULL)
+			ev->address = *addr;
+
+		SDL_LockMutex(svc->mutex);
+		STAILQ_INSERT_TAIL(&svc->events, ev, link);
+		SDL_UnlockMutex(svc->mutex);
+
+		return;
+	}
+
+	if (framingReserve(&c->framing) < 0) {
+		serviceRemove(svc, c, 1);
+		return;
+	}
+
+	nread = SDLNet_TCP_Recv(c->sock, c->framing.in + c->framing.length,
+	    c->framing.size - c->framing.length);
+
+	/* Readiness is only a hint for non blocking sockets */
+	if (nread < 0 && socketWouldBlock())
+		return;
+	if (nread <= 0) {
+		serviceRemove(svc, c, 1);
+		return;
+	}
+
+	c->framing.length += nread;
+
+	while ((ret = framingExtract(&c->framing, &msg, &length, &consumed)) > 0) {
+		serviceEvent(svc, ServiceMessage, c->id, msg, length);
+		framingConsume(&c->framing, consumed);
+	}
+
+	if (ret < 0) {
+		msg = "message too large";
+		serviceEvent(svc, ServiceError, c->id, msg, strlen(msg));
+		serviceRemove(svc, c, 1);
+	}
+}
+
+/*
+ * Wait for the wake up socket, readable connections and connections with
+ * queued bytes becoming writable. SDLNet_CheckSockets() only checks for
+ * reading so select() is used directly.
+ *
+ * Connections select() can not watch are closed with an error. Returns the
+ * number of ready sockets, 0 if interrupted or -1 with the SDL error set.
+ */
+static int
+serviceSelect(Service *svc, fd_set *rset, fd_set *wset)
+{
+	static const char *toomany = "too many sockets for select()";
+	ServiceConn *c;
+	int i, n, max;
+
+	FD_ZERO(rset);
+	FD_ZERO(wset);
+
+	if (!socketSelectable(rset, socketChannel(svc->wake)))
+		return SDL_SetError("%s", toomany);
+
+	FD_SET(socketChannel(svc->wake), rset);
+	max = (int)socketChannel(svc->wake);
+
+	for (i = svc->nconns - 1; i >= 0; --i) {
+		if ((c = svc->conns[i])->sock == NULL)
+			continue;
+
+		if (!socketSelectable(rset, socketChannel(c->sock))) {
+			serviceEvent(svc, ServiceError, c->id, toomany, strlen(toomany));
+			serviceRemove(svc, c, 1);
+			continue;
+		}
+
+		FD_SET(socketChannel(c->sock), rset);
+
+		if (c->qstart < c->qlength)
+			FD_SET(socketChannel(c->sock), wset);
+		if ((int)socketChannel(c->sock) > max)
+			max = (int)socketChannel(c->sock);
+	}
+
+#if defined(_WIN32)
+	if ((n = select(max + 1, rset, wset, NULL, NULL)) == SOCKET_ERROR) {
+		if (WSAGetLastError() == WSAEINTR)
+			return 0;
+
+		return SDL_SetError("select failed: %d", WSAGetLastError());
+	}
+#else
+	if ((n = select(max + 1, rset, wset, NULL, NULL)) < 0) {
+		if (errno == EINTR)
+			return 0;
+
+		return SDL_SetError("%s", strerror(errno));
+	}
+#endif
+
+	return n;
+}
+
+static int
+serviceMain(Service *svc)
+{
+	UDPpacket *p;
+	ServiceConn *c;
+	fd_set rset, wset;
+	const char *error;
+	int i, n;
+
+	if ((p = SDLNet_AllocPacket(16)) == NULL)
+		return -1;
+
+	for (;;) {
+		serviceRunCommands(svc);
+
+		if (SDL_AtomicGet(&svc->quit))
+			break;
+		if ((n = serviceSelect(svc, &rset, &wset)) == 0)
+			continue;
+
+		/* Retrying would spin, stop and report it as an error of id 0 */
+		if (n < 0) {
+			error = SDL_GetError();
+			serviceEvent(svc, ServiceError, 0, error, strlen(error));
+			SDL_AtomicSet(&svc->quit, 1);
+			break;
+		}
+
+		if (FD_ISSET(socketChannel(svc->wake), &rset))
+			while (SDLNet_UDP_Recv(svc->wake, p) > 0)
+				continue;
+
+		/*
+		 * Walk backwards as connections may be removed, the accepted
+		 * ones are appended and wait for the next round.
+		 */
+		for (i = svc->nconns - 1; i >= 0; --i) {
+			if (i >= svc->nconns || (c = svc->conns[i])->sock == NULL)
+				continue;
+
+			if (FD_ISSET(socketChannel(c->sock), &wset) && serviceFlush(c) < 0) {
+				serviceError(svc, c->id);
+				serviceRemove(svc, c, 1);
+				continue;
+			}
+			if (FD_ISSET(socketChannel(c->sock), &rset))
+				serviceRead(svc, c);
+		}
+	}
+
+	while (svc->nconns > 0)
+		serviceRemove(svc, svc->conns[svc->nconns - 1], 0);
+
+	SDLNet_FreePacket(p);
+
+	return 0;
+}
+
+static Service *
+checkService(lua_State *L)
+{
+	Service *svc = commonGetAs(L, 1, ServiceName, Service *);
+
+	if (svc == NULL)
+		luaL_error(L, "attempt operation on stopped service");
+
+	return svc;
+}
+
+static ServiceCommand *
+newCommand(lua_State *L, enum ServiceCommandType type, int id)
+{
+	ServiceCommand *cmd;
+
+	if ((cmd = calloc(1, sizeof (ServiceCommand))) == NULL)
+		luaL_error(L, "%s", strerror(errno));
+
+	cmd->type = type;
+	cmd->id = id;
+
+	return cmd;
+}
+
+static int
+l_service_listen(lua_State *L)
+{
+	Service *svc = checkService(L);
+	IPaddress addr;
+	ServiceCommand *cmd;
+	TCPsocket s;
+	int id;
+
+	if (lua_type(L, 2) == LUA_TNUMBER) {
+		addr.host = INADDR_ANY;
+		SDLNet_Write16(lua_tointeger(L, 2), &addr.port);
+	} else
+		checkAddress(L, 2, &addr);
+
+	if ((s = SDLNet_TCP_Open(&addr)) == NULL)
+		return commonPushSDLError(L, 1);
+
+	id = SDL_AtomicAdd(&svc->ids, 1) + 1;
+	cmd = newCommand(L, ServiceListen, id);
+	cmd->sock = s;
+	serviceCommand(svc, cmd);
+
+	return commonPush(L, "i", id);
+}
+
+static int
+l_service_connect(lua_State *L)
+{
+	Service *svc = checkService(L);
+	ServiceCommand *cmd;
+	IPaddress addr;
+	int id;
+
+	checkAddress(L, 2, &addr);
+
+	id = SDL_AtomicAdd(&svc->ids, 1) + 1;
+	cmd = newCommand(L, ServiceConnect, id);
+	cmd->address = addr;
+	serviceCommand(svc, cmd);
+
+	return commonPush(L, "i", id);
+}
+
+static int
+l_service_send(lua_State *L)
+{
+	Service *svc = checkService(L);
+	int id = luaL_checkinteger(L, 2);
+	size_t length;
+	const char *data = luaL_checklstring(L, 3, &length);
+	ServiceCommand *cmd;
+
+	cmd = newCommand(L, ServiceSend, id);
+
+	if ((cmd->data = malloc(length)) == NULL) {
+		free(cmd);
+		return commonPushErrno(L, 1);
+	}
+
+	memcpy(cmd->data, data, length);
+	cmd->length = length;
+	serviceCommand(svc, cmd);
+
+	return commonPush(L, "b", 1);
+}
+
+static int
+l_service_close(lua_State *L)
+{
+	Service *svc = checkService(L);
+
+	serviceCommand(svc, newCommand(L, ServiceClose, luaL_checkinteger(L, 2)));
+
+	return 0;
+}
+
+static int
+l_service_poll(lua_State *L)
+{
+	Service *svc = checkService(L);
+	ServiceEvents events;
+	ServiceEvent *ev, *tmp;
+	int n = 0;
+
+	SDL_LockMutex(svc->mutex);
+	STAILQ_INIT(&events);
+	STAILQ_CONCAT(&events, &svc->events);
+	SDL_UnlockMutex(svc->mutex);
+
+	lua_createtable(L, 0, 0);
+
+	STAILQ_FOREACH_SAFE(ev, &events, link, tmp) {
+		lua_createtable(L, 0, 4);
+		tableSetString(L, -1, "type", ServiceEventNames[ev->type]);
+		tableSetInt(L, -1, "id", ev->id);
+
+		if (ev->type == ServiceAccept) {
+			tableSetInt(L, -1, "listener", ev->listener);
+			pushAddress(L, &ev->address);
+			lua_setfield(L, -2, "address");
+		} else if (ev->type == ServiceMessage && ev->data != NULL) {
+			lua_pushlstring(L, ev->data, ev->length);
+			lua_setfield(L, -2, "data");
+		} else if (ev->type == ServiceError && ev->data != NULL) {
+			lua_pushlstring(L, ev->data, ev->length);
+			lua_setfield(L, -2, "message");
+		}
+
+		lua_rawseti(L, -2, ++n);
+
+		free(ev->data);
+		free(ev);
+	}
+
+	return 1;
+}
+
+static int
+l_service_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, ServiceName);
+	Service *svc = udata->data;
+	ServiceCommand *cmd, *ctmp;
+	ServiceEvent *ev, *etmp;
+
+	if (svc == NULL)
+		return 0;
+
+	/*
+	 * Stops the I/O thread once woken up, opens still queued fail at once
+	 * and the running ones are waited for.
+	 */
+	SDL_AtomicSet(&svc->quit, 1);
+	serviceWake(svc);
+	SDL_WaitThread(svc->thread, NULL);
+	workerFree(&svc->connector);
+
+	STAILQ_FOREACH_SAFE(cmd, &svc->commands, link, ctmp) {
+		if (cmd->sock != NULL)
+			SDLNet_TCP_Close(cmd->sock);
+
+		free(cmd->data);
+		free(cmd);
+	}
+
+	STAILQ_FOREACH_SAFE(ev, &svc->events, link, etmp) {
+		free(ev->data);
+		free(ev);
+	}
+
+	SDLNet_UDP_Close(svc->wake);
+	SDL_DestroyMutex(svc->mutex);
+	free(svc->conns);
+	free(svc);
+
+	udata->data = NULL;
+
+	return 0;
+}
+
+static const luaL_Reg ServiceMethods[] = {
+	{ "listen",			l_service_listen		},
+	{ "connect",			l_service_connect		},
+	{ "send",			l_service_send			},
+	{ "close",			l_service_close			},
+	{ "poll",			l_service_poll			},
+	{ NULL,				NULL				}
+};
+
+static const luaL_Reg ServiceMetamethods[] = {
+	{ "__gc",			l_service_gc			},
+	{ NULL,				NULL				}
+};
+
+static const CommonObject NetServiceObject = {
+	"NetService",
+	ServiceMethods,
+	ServiceMetamethods
+};
+
+/* ---------------------------------------------------------
+ * SDL_net functions
+ * --------------------------------------------------------- */
+
+static int
+l_init(lua_State *L)
+{
+	if (SDLNet_Init() < 0)
+		return commonPushSDLError(L, 1);
+
+	return commonPush(L, "b", 1);
+}
+
+static int
+l_resolveHost(lua_State *L)
+{
+	const char *host	= NULL;
+	int port		= luaL_checkinteger(L, 2);
+	IPaddress addr;
+
+	if (lua_type(L, 1) == LUA_TSTRING)
+		host = luaL_checkstring(L, 1);
+
+	if (resolveHost(&addr, host, port) < 0)
+		return commonPushSDLError(L, 1);
+
+	return pushAddress(L, &addr);
+}
+
+static int
+l_resolveIp(lua_State *L)
+{
+	IPaddress address;
+	char host[256];
+
+	checkAddress(L, 1, &address);
+	if (resolveIp(&address, host, sizeof (host)) < 0)
+		return commonPushSDLError(L, 1);
 
 	return commonPush(L, "s", host);
 }
@@ -603,6 +2638,79 @@ l_openUdp(lua_State *L)
 	return commonPush(L, "p", UdpName, s);
 }
 
+static int
+l_createPoller(lua_State *L)
+{
+#if defined(HAVE_SYS_EPOLL_H)
+	EPoller *p;
+
+	if ((p = calloc(1, sizeof (EPoller))) == NULL)
+		return commonPushErrno(L, 1);
+
+	if ((p->fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		free(p);
+		return commonPushErrno(L, 1);
+	}
+
+	lua_newtable(L);
+	p->sockets = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	return commonPush(L, "p", PollerName, p);
+#else
+	return commonPush(L, "ns", "poller not available, use SocketSet");
+#endif
+}
+
+static int
+l_createService(lua_State *L)
+{
+	Service *svc;
+	IPaddress *local;
+	Framing framing;
+
+	framingInit(&framing);
+	if (!lua_isnoneornil(L, 1))
+		framingConfigure(L, 1, &framing);
+
+	if ((svc = calloc(1, sizeof (Service))) == NULL)
+		return commonPushErrno(L, 1);
+
+	svc->framing = framing;
+
+	STAILQ_INIT(&svc->commands);
+	STAILQ_INIT(&svc->events);
+
+	if ((svc->mutex = SDL_CreateMutex()) == NULL)
+		goto fail;
+	if (workerInit(&svc->connector, 2, "net connect") < 0)
+		goto fail;
+	if ((svc->wake = SDLNet_UDP_Open(0)) == NULL)
+		goto fail;
+	if ((local = SDLNet_UDP_GetPeerAddress(svc->wake, -1)) == NULL)
+		goto fail;
+
+	svc->wakeaddr.port = local->port;
+	SDLNet_Write32(INADDR_LOOPBACK, &svc->wakeaddr.host);
+
+	if ((svc->thread = SDL_CreateThread((SDL_ThreadFunction)serviceMain, "net", svc)) == NULL)
+		goto fail;
+
+	return commonPush(L, "p", ServiceName, svc);
+
+fail:
+	commonPushSDLError(L, 1);
+
+	workerFree(&svc->connector);
+	if (svc->wake)
+		SDLNet_UDP_Close(svc->wake);
+	if (svc->mutex)
+		SDL_DestroyMutex(svc->mutex);
+
+	free(svc);
+
+	return 2;
+}
+
 static int
 l_quit(lua_State *L)
 {
@@ -620,6 +2728,8 @@ static const luaL_Reg functions[] = {
 	{ "set",				l_set			},
 	{ "openTcp",				l_openTcp		},
 	{ "openUdp",				l_openUdp		},
+	{ "createPoller",			l_createPoller		},
+	{ "createService",			l_createService		},
 	{ "quit",				l_quit			},
 	{ NULL,					NULL			}
 };
@@ -628,11 +2738,24 @@ int EXPORT
 luaopen_SDL_net(lua_State *L)
 {
 	commonNewLibrary(L, functions);
+	commonBindLibrary(L, DeltaFunctions);
+	commonBindLibrary(L, ReliableFunctions);
+	commonBindLibrary(L, ResolveFunctions);
+	commonBindEnum(L, -1, "field", DeltaField);
+	commonBindEnum(L, -1, "lane", ReliableLane);
 
 	/* Prepare the table for socket set reference */
 	lua_createtable(L, 0, 0);
 	lua_setfield(L, LUA_REGISTRYINDEX, REGISTRY);
 
+	/* Framing of TCP sockets */
+	lua_createtable(L, 0, 0);
+	lua_setfield(L, LUA_REGISTRYINDEX, FRAMING);
+
+	/* Packet vectors of UDP sockets */
+	lua_createtable(L, 0, 0);
+	lua_setfield(L, LUA_REGISTRYINDEX, BATCH);
+
 	/* TCPsocket */
 	commonBindObject(L, &TcpSocket);
 
@@ -642,5 +2765,23 @@ luaopen_SDL_net(lua_State *L)
 	/* SDLNet_SocketSet */
 	commonBindObject(L, &SocketSet);
 
+#if defined(HAVE_SYS_EPOLL_H)
+	/* Poller */
+	commonBindObject(L, &Poller);
+#endif
+
+	/* NetService */
+	commonBindObject(L, &NetServiceObject);
+
+	/* Reliable */
+	commonBindObject(L, &ReliableObject);
+
+	/* Delta snapshots */
+	commonBindObject(L, &DeltaEncoder);
+	commonBindObject(L, &DeltaDecoder);
+
+	/* Background host resolution */
+	commonBindObject(L, &ResolutionObject);
+
 	return 1;
 }
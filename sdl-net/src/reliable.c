@@ -0,0 +1,1251 @@
+/*
+ * reliable.c -- reliable channels over UDP
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/queue.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL_net.h>
+
+#include <common/common.h>
+#include <common/table.h>
+
+#include "reliable.h"
+
+/*
+ * Every datagram starts with a header:
+ *
+ *	u16	protocol identifier
+ *	u8	flags, bit 0 set when the ack fields are valid
+ *	u16	packet sequence
+ *	u16	latest sequence received from the peer
+ *	u32	bit n set if sequence (ack - n - 1) was received too
+ *
+ * followed by fragments:
+ *
+ *	u8	lane
+ *	u16	message id in that lane
+ *	u8	fragment index
+ *	u8	fragment count
+ *	u16	fragment length
+ *
+ * Everything is in network byte order. Acks are per packet, each packet
+ * remembers the reliable fragments it carried so they are acknowledged
+ * together.
+ */
+#define RELIABLE_PROTOCOL	0x5244
+#define RELIABLE_HASACK		0x01
+
+#define RELIABLE_HEADER		11
+#define RELIABLE_FRAGHEADER	7
+
+#define RELIABLE_MTU		1200
+#define RELIABLE_MINMTU		64
+#define RELIABLE_MAXMTU		65507
+#define RELIABLE_MAXFRAGS	255
+
+#define RELIABLE_WINDOW		256	/* messages in flight per lane */
+#define RELIABLE_SENT		256	/* packets remembered for acks */
+#define RELIABLE_REFS		64	/* reliable fragments per packet */
+#define RELIABLE_UNRELIABLE	16	/* unreliable reassembly slots */
+
+#define RELIABLE_MINRTO		20
+#define RELIABLE_MAXRTO		2000
+#define RELIABLE_TIMEOUT	10000
+#define RELIABLE_KEEPALIVE	250
+
+enum lane {
+	LaneUnreliable,
+	LaneReliable,
+	LaneOrdered,
+	LaneCount
+};
+
+enum slot_state {
+	SlotEmpty,
+	SlotPartial,
+	SlotComplete,
+	SlotDelivered
+};
+
+typedef struct out_fragment {
+	Uint32		 time;		/* last transmission */
+	Uint8		 sent;
+	Uint8		 acked;
+} OutFragment;
+
+typedef struct out_message {
+	Uint16		 id;
+	char		*data;
+	size_t		 length;
+	int		 count;		/* fragments */
+	int		 nacked;
+	OutFragment	*frags;
+
+	STAILQ_ENTRY(out_message) link;
+} OutMessage;
+
+typedef STAILQ_HEAD(out_messages, out_message) OutMessages;
+
+typedef struct in_slot {
+	int		 state;
+	Uint16		 id;
+	int		 count;
+	int		 received;
+	char		**pieces;
+	Uint16		*lengths;
+} InSlot;
+
+typedef struct sent_packet {
+	int		 valid;
+	Uint16		 seq;
+	Uint32		 time;
+	int		 nrefs;
+
+	struct {
+		Uint8	 lane;
+		Uint8	 index;
+		Uint16	 id;
+	} refs[RELIABLE_REFS];
+} SentPacket;
+
+typedef struct connection {
+	IPaddress	 address;
+	Uint16		 seq;		/* next packet sequence */
+	Uint16		 remote;	/* latest sequence received */
+	Uint32		 ackbits;
+	int		 hasRemote;
+	int		 needAck;	/* fragments received since last send */
+	Uint32		 lastRecv;
+	Uint32		 lastSend;
+	double		 srtt;
+	double		 rttvar;
+	int		 hasRtt;
+
+	Uint16		 nextId[LaneCount];
+	Uint16		 base[LaneCount - 1];	/* next id to deliver */
+	OutMessages	 out[LaneCount];
+	InSlot		 slots[LaneCount - 1][RELIABLE_WINDOW];
+	InSlot		 unreliable[RELIABLE_UNRELIABLE];
+	SentPacket	 sent[RELIABLE_SENT];
+
+	/* Statistics */
+	Uint32		 packetsSent;
+	Uint32		 packetsReceived;
+	Uint32		 resent;
+	Uint32		 duplicates;
+
+	STAILQ_ENTRY(connection) link;
+} Connection;
+
+typedef STAILQ_HEAD(connections, connection) Connections;
+
+typedef struct delivered {
+	int		 lane;
+	IPaddress	 address;
+	char		*data;
+	size_t		 length;
+
+	STAILQ_ENTRY(delivered) link;
+} Delivered;
+
+typedef STAILQ_HEAD(delivered_queue, delivered) DeliveredQueue;
+
+/*
+ * Datagram held back by the latency simulation.
+ */
+typedef struct delayed {
+	Uint32		 due;
+	IPaddress	 address;
+	size_t		 length;
+	unsigned char	*data;
+
+	STAILQ_ENTRY(delayed) link;
+} Delayed;
+
+typedef STAILQ_HEAD(delayed_queue, delayed) DelayedQueue;
+
+typedef struct reliable {
+	int		 mtu;
+	Uint32		 timeout;
+	UDPpacket	*packet;	/* receive buffer */
+	unsigned char	*out;		/* packet being built */
+	size_t		 outlen;
+	Connections	 connections;
+	DeliveredQueue	 delivered;
+
+	/* Network simulation */
+	double		 loss;
+	double		 duplicate;
+	Uint32		 latency;
+	Uint32		 jitter;
+	Uint32		 rng;
+	DelayedQueue	 delayed;
+} Reliable;
+
+/* --------------------------------------------------------
+ * Helpers
+ * -------------------------------------------------------- */
+
+static Uint32
+reliableRandom(Reliable *r)
+{
+	/* xorshift32, good enough to drop packets */
+	r->rng ^= r->rng << 13;
+	r->rng ^= r->rng >> 17;
+	r->rng ^= r->rng << 5;
+
+	return r->rng;
+}
+
+static int
+reliableChance(Reliable *r, double probability)
+{
+	if (probability <= 0)
+		return 0;
+
+	return (reliableRandom(r) >> 8) / 16777216.0 < probability;
+}
+
+static size_t
+reliableFragSize(const Reliable *r)
+{
+	return r->mtu - RELIABLE_HEADER - RELIABLE_FRAGHEADER;
+}
+
+static void
+slotReset(InSlot *slot)
+{
+	int i;
+
+	if (slot->pieces != NULL)
+		for (i = 0; i < slot->count; ++i)
+			free(slot->pieces[i]);
+
+	free(slot->pieces);
+	free(slot->lengths);
+	memset(slot, 0, sizeof (InSlot));
+}
+
+static int
+slotInit(InSlot *slot, Uint16 id, int count)
+{
+	slot->pieces = calloc(count, sizeof (char *));
+	slot->lengths = calloc(count, sizeof (Uint16));
+
+	if (slot->pieces == NULL || slot->lengths == NULL) {
+		slotReset(slot);
+		return -1;
+	}
+
+	slot->state = SlotPartial;
+	slot->id = id;
+	slot->count = count;
+	slot->received = 0;
+
+	return 0;
+}
+
+static void
+messageFree(OutMessage *m)
+{
+	free(m->data);
+	free(m->frags);
+	free(m);
+}
+
+static Connection *
+connectionFind(Reliable *r, const IPaddress *address)
+{
+	Connection *c;
+
+	STAILQ_FOREACH(c, &r->connections, link)
+		if (c->address.host == address->host &&
+		    c->address.port == address->port)
+			return c;
+
+	return NULL;
+}
+
+static Connection *
+connectionGet(Reliable *r, const IPaddress *address)
+{
+	Connection *c;
+	int i;
+
+	if ((c = connectionFind(r, address)) != NULL)
+		return c;
+	if ((c = calloc(1, sizeof (Connection))) == NULL)
+		return NULL;
+
+	c->address = *address;
+	c->lastRecv = c->lastSend = SDL_GetTicks();
+	c->srtt = 100;
+	c->rttvar = 50;
+
+	for (i = 0; i < LaneCount; ++i)
+		STAILQ_INIT(&c->out[i]);
+
+	STAILQ_INSERT_TAIL(&r->connections, c, link);
+
+	return c;
+}
+
+static void
+connectionFree(Reliable *r, Connection *c)
+{
+	OutMessage *m, *tmp;
+	int i, j;
+
+	STAILQ_REMOVE(&r->connections, c, connection, link);
+
+	for (i = 0; i < LaneCount; ++i)
+		STAILQ_FOREACH_SAFE(m, &c->out[i], link, tmp)
+			messageFree(m);
+
+	for (i = 0; i < LaneCount - 1; ++i)
+		for (j = 0; j < RELIABLE_WINDOW; ++j)
+			slotReset(&c->slots[i][j]);
+
+	for (i = 0; i < RELIABLE_UNRELIABLE; ++i)
+		slotReset(&c->unreliable[i]);
+
+	free(c);
+}
+
+static Uint32
+connectionRto(const Connection *c)
+{
+	double rto = c->srtt + 4 * c->rttvar;
+
+	if (rto < RELIABLE_MINRTO)
+		return RELIABLE_MINRTO;
+	if (rto > RELIABLE_MAXRTO)
+		return RELIABLE_MAXRTO;
+
+	return (Uint32)rto;
+}
+
+static void
+reliableFree(Reliable *r)
+{
+	Delivered *d, *dtmp;
+	Delayed *p, *ptmp;
+
+	while (!STAILQ_EMPTY(&r->connections))
+		connectionFree(r, STAILQ_FIRST(&r->connections));
+
+	STAILQ_FOREACH_SAFE(d, &r->delivered, link, dtmp) {
+		free(d->data);
+		free(d);
+	}
+
+	STAILQ_FOREACH_SAFE(p, &r->delayed, link, ptmp)
+		free(p);
+
+	if (r->packet)
+		SDLNet_FreePacket(r->packet);
+
+	free(r->out);
+	free(r);
+}
+
+/* --------------------------------------------------------
+ * Transmission
+ * -------------------------------------------------------- */
+
+static void
+datagramSend(UDPsocket s, const IPaddress *address, unsigned char *data, size_t length)
+{
+	UDPpacket p;
+
+	p.channel = -1;
+	p.data = data;
+	p.len = p.maxlen = (int)length;
+	p.address = *address;
+
+	SDLNet_UDP_Send(s, -1, &p);
+}
+
+/*
+ * Send a datagram through the simulation, it may be dropped, duplicated
+ * or delayed until a later update.
+ */
+static void
+datagramTransmit(Reliable *r, UDPsocket s, const IPaddress *address, unsigned char *data, size_t length)
+{
+	Uint32 delay;
+	Delayed *d;
+	int copies;
+
+	if (reliableChance(r, r->loss))
+		return;
+
+	copies = reliableChance(r, r->duplicate) ? 2 : 1;
+
+	while (copies-- > 0) {
+		delay = r->latency;
+
+		if (r->jitter > 0)
+			delay += reliableRandom(r) % (r->jitter + 1);
+		if (delay == 0) {
+			datagramSend(s, address, data, length);
+			continue;
+		}
+
+		if ((d = malloc(sizeof (Delayed) + length)) == NULL)
+			continue;
+
+		d->due = SDL_GetTicks() + delay;
+		d->address = *address;
+		d->length = length;
+		d->data = (unsigned char *)(d + 1);
+		memcpy(d->data, data, length);
+
+		STAILQ_INSERT_TAIL(&r->delayed, d, link);
+	}
+}
+
+static void
+datagramFlushDelayed(Reliable *r, UDPsocket s, Uint32 now)
+{
+	Delayed *d, *tmp;
+
+	STAILQ_FOREACH_SAFE(d, &r->delayed, link, tmp) {
+		if ((Sint32)(now - d->due) < 0)
+			continue;
+
+		datagramSend(s, &d->address, d->data, d->length);
+		STAILQ_REMOVE(&r->delayed, d, delayed, link);
+		free(d);
+	}
+}
+
+static SentPacket *
+packetBegin(Reliable *r, Connection *c, Uint32 now)
+{
+	SentPacket *sp;
+	Uint16 seq = c->seq++;
+
+	SDLNet_Write16(RELIABLE_PROTOCOL, r->out);
+	r->out[2] = c->hasRemote ? RELIABLE_HASACK : 0;
+	SDLNet_Write16(seq, r->out + 3);
+	SDLNet_Write16(c->remote, r->out + 5);
+	SDLNet_Write32(c->ackbits, r->out + 7);
+	r->outlen = RELIABLE_HEADER;
+
+	sp = &c->sent[seq % RELIABLE_SENT];
+	sp->valid = 1;
+	sp->seq = seq;
+	sp->time = now;
+	sp->nrefs = 0;
+
+	return sp;
+}
+
+static void
+packetFlush(Reliable *r, UDPsocket s, Connection *c, Uint32 now)
+{
+	datagramTransmit(r, s, &c->address, r->out, r->outlen);
+
+	c->lastSend = now;
+	c->needAck = 0;
+	c->packetsSent++;
+}
+
+typedef struct {
+	SentPacket	*sp;		/* NULL if no packet is open */
+} Builder;
+
+static void
+packetAdd(Reliable *r, UDPsocket s, Connection *c, Builder *b, Uint32 now,
+	  int lane, const OutMessage *m, int index)
+{
+	size_t fragsize = reliableFragSize(r);
+	size_t offset = index * fragsize;
+	size_t length = m->length - offset;
+
+	if (length > fragsize)
+		length = fragsize;
+
+	if (b->sp != NULL && (r->outlen + RELIABLE_FRAGHEADER + length > (size_t)r->mtu ||
+	    (lane != LaneUnreliable && b->sp->nrefs == RELIABLE_REFS))) {
+		packetFlush(r, s, c, now);
+		b->sp = NULL;
+	}
+
+	if (b->sp == NULL)
+		b->sp = packetBegin(r, c, now);
+
+	r->out[r->outlen] = lane;
+	SDLNet_Write16(m->id, r->out + r->outlen + 1);
+	r->out[r->outlen + 3] = index;
+	r->out[r->outlen + 4] = m->count;
+	SDLNet_Write16((Uint16)length, r->out + r->outlen + 5);
+	memcpy(r->out + r->outlen + RELIABLE_FRAGHEADER, m->data + offset, length);
+	r->outlen += RELIABLE_FRAGHEADER + length;
+
+	if (lane != LaneUnreliable) {
+		int n = b->sp->nrefs++;
+
+		b->sp->refs[n].lane = lane;
+		b->sp->refs[n].index = index;
+		b->sp->refs[n].id = m->id;
+	}
+}
+
+/*
+ * Send the unreliable messages, the reliable fragments never sent or not
+ * acknowledged within the RTO, then an ack or a keep alive if nothing else
+ * was sent.
+ */
+static void
+connectionSend(Reliable *r, UDPsocket s, Connection *c, Uint32 now)
+{
+	Builder b = { NULL };
+	OutMessage *m;
+	Uint32 rto = connectionRto(c);
+	int lane, i;
+
+	while ((m = STAILQ_FIRST(&c->out[LaneUnreliable])) != NULL) {
+		for (i = 0; i < m->count; ++i)
+			packetAdd(r, s, c, &b, now, LaneUnreliable, m, i);
+
+		STAILQ_REMOVE_HEAD(&c->out[LaneUnreliable], link);
+		messageFree(m);
+	}
+
+	for (lane = LaneReliable; lane < LaneCount; ++lane) {
+		Uint16 oldest;
+
+		if ((m = STAILQ_FIRST(&c->out[lane])) == NULL)
+			continue;
+
+		oldest = m->id;
+
+		STAILQ_FOREACH(m, &c->out[lane], link) {
+			/* The receiver only accepts ids within its window */
+			if ((Uint16)(m->id - oldest) >= RELIABLE_WINDOW)
+				break;
+
+			for (i = 0; i < m->count; ++i) {
+				OutFragment *f = &m->frags[i];
+
+				if (f->acked || (f->sent && now - f->time < rto))
+					continue;
+				if (f->sent)
+					c->resent++;
+
+				f->sent = 1;
+				f->time = now;
+				packetAdd(r, s, c, &b, now, lane, m, i);
+			}
+		}
+	}
+
+	if (b.sp == NULL && (c->needAck || now - c->lastSend >= RELIABLE_KEEPALIVE)) {
+		b.sp = packetBegin(r, c, now);
+	}
+
+	if (b.sp != NULL)
+		packetFlush(r, s, c, now);
+}
+
+/* --------------------------------------------------------
+ * Reception
+ * -------------------------------------------------------- */
+
+static void
+fragmentAcked(Connection *c, int lane, Uint16 id, int index)
+{
+	OutMessage *m;
+
+	STAILQ_FOREACH(m, &c->out[lane], link) {
+		if (m->id != id)
+			continue;
+		if (index >= m->count || m->frags[index].acked)
+			return;
+
+		m->frags[index].acked = 1;
+
+		if (++ m->nacked == m->count) {
+			STAILQ_REMOVE(&c->out[lane], m, out_message, link);
+			messageFree(m);
+		}
+
+		return;
+	}
+}
+
+static void
+packetAcked(Connection *c, Uint16 seq, Uint32 now)
+{
+	SentPacket *sp = &c->sent[seq % RELIABLE_SENT];
+	double sample;
+	int i;
+
+	if (!sp->valid || sp->seq != seq)
+		return;
+
+	sp->valid = 0;
+	sample = now - sp->time;
+
+	/* RFC 6298 estimator */
+	if (!c->hasRtt) {
+		c->srtt = sample;
+		c->rttvar = sample / 2;
+		c->hasRtt = 1;
+	} else {
+		double delta = c->srtt - sample;
+
+		c->rttvar = 0.75 * c->rttvar + 0.25 * (delta < 0 ? -delta : delta);
+		c->srtt = 0.875 * c->srtt + 0.125 * sample;
+	}
+
+	for (i = 0; i < sp->nrefs; ++i)
+		fragmentAcked(c, sp->refs[i].lane, sp->refs[i].id, sp->refs[i].index);
+}
+
+/*
+ * Record a received sequence, returns 0 if the packet was already seen.
+ */
+static int
+sequenceTrack(Connection *c, Uint16 seq)
+{
+	Uint16 d;
+
+	if (!c->hasRemote) {
+		c->hasRemote = 1;
+		c->remote = seq;
+		c->ackbits = 0;
+		return 1;
+	}
+
+	if ((d = seq - c->remote) == 0)
+		return 0;
+
+	if (d < 0x8000) {
+		if (d < 32)
+			c->ackbits = (c->ackbits << d) | (1U << (d - 1));
+		else if (d == 32)
+			c->ackbits = 1U << 31;
+		else
+			c->ackbits = 0;
+
+		c->remote = seq;
+
+		return 1;
+	}
+
+	if ((d = c->remote - seq) <= 32) {
+		if (c->ackbits & (1U << (d - 1)))
+			return 0;
+
+		c->ackbits |= 1U << (d - 1);
+	}
+
+	return 1;
+}
+
+static void
+slotDeliver(Reliable *r, Connection *c, int lane, InSlot *slot)
+{
+	Delivered *d;
+	size_t length = 0;
+	int i;
+
+	for (i = 0; i < slot->count; ++i)
+		length += slot->lengths[i];
+
+	if ((d = malloc(sizeof (Delivered))) == NULL)
+		return;
+	if ((d->data = malloc(length + 1)) == NULL) {
+		free(d);
+		return;
+	}
+
+	d->lane = lane;
+	d->address = c->address;
+	d->length = 0;
+
+	for (i = 0; i < slot->count; ++i) {
+		memcpy(d->data + d->length, slot->pieces[i], slot->lengths[i]);
+		d->length += slot->lengths[i];
+	}
+
+	STAILQ_INSERT_TAIL(&r->delivered, d, link);
+}
+
+/*
+ * Move the window of a reliable lane over the messages already delivered,
+ * the ordered lane delivers its completed messages on the way.
+ */
+static void
+laneAdvance(Reliable *r, Connection *c, int lane)
+{
+	int l = lane - 1;
+	InSlot *slot;
+
+	for (;;) {
+		slot = &c->slots[l][c->base[l] % RELIABLE_WINDOW];
+
+		if (slot->id != c->base[l] || slot->state < SlotComplete)
+			break;
+		if (slot->state == SlotComplete)
+			slotDeliver(r, c, lane, slot);
+
+		slotReset(slot);
+		c->base[l]++;
+	}
+}
+
+static void
+fragmentReceived(Reliable *r, Connection *c, int lane, Uint16 id, int index,
+		 int count, const unsigned char *data, Uint16 length)
+{
+	InSlot *slot;
+
+	if (lane == LaneUnreliable) {
+		slot = &c->unreliable[id % RELIABLE_UNRELIABLE];
+
+		/* Older incomplete messages are dropped */
+		if (slot->state != SlotEmpty && slot->id != id)
+			slotReset(slot);
+	} else {
+		if ((Uint16)(id - c->base[lane - 1]) >= RELIABLE_WINDOW) {
+			c->duplicates++;
+			return;
+		}
+
+		slot = &c->slots[lane - 1][id % RELIABLE_WINDOW];
+
+		if (slot->state >= SlotComplete) {
+			c->duplicates++;
+			return;
+		}
+	}
+
+	if (slot->state == SlotEmpty && slotInit(slot, id, count) < 0)
+		return;
+	if (slot->count != count || slot->pieces[index] != NULL)
+		return;
+	if ((slot->pieces[index] = malloc(length + 1)) == NULL)
+		return;
+
+	memcpy(slot->pieces[index], data, length);
+	slot->lengths[index] = length;
+
+	if (++ slot->received < slot->count)
+		return;
+
+	switch (lane) {
+	case LaneUnreliable:
+		slotDeliver(r, c, lane, slot);
+		slotReset(slot);
+		break;
+	case LaneReliable:
+		slotDeliver(r, c, lane, slot);
+		slotReset(slot);
+		slot->id = id;
+		slot->state = SlotDelivered;
+		laneAdvance(r, c, lane);
+		break;
+	default:
+		slot->state = SlotComplete;
+		laneAdvance(r, c, lane);
+		break;
+	}
+}
+
+static void
+packetReceived(Reliable *r, const UDPpacket *p, Uint32 now)
+{
+	const unsigned char *data = p->data;
+	size_t length = p->len, offset;
+	Uint16 seq, ack;
+	Uint32 ackbits;
+	Connection *c;
+	int i, flags;
+
+	if (length < RELIABLE_HEADER || SDLNet_Read16(data) != RELIABLE_PROTOCOL)
+		return;
+	if ((c = connectionGet(r, &p->address)) == NULL)
+		return;
+
+	flags = data[2];
+	seq = SDLNet_Read16(data + 3);
+	ack = SDLNet_Read16(data + 5);
+	ackbits = SDLNet_Read32(data + 7);
+
+	c->lastRecv = now;
+	c->packetsReceived++;
+
+	if (!sequenceTrack(c, seq)) {
+		c->duplicates++;
+		return;
+	}
+
+	if (flags & RELIABLE_HASACK) {
+		packetAcked(c, ack, now);
+
+		for (i = 0; i < 32; ++i)
+			if (ackbits & (1U << i))
+				packetAcked(c, (Uint16)(ack - i - 1), now);
+	}
+
+	for (offset = RELIABLE_HEADER; offset + RELIABLE_FRAGHEADER <= length; ) {
+		const unsigned char *f = data + offset;
+		int lane = f[0], index = f[3], count = f[4];
+		Uint16 flen = SDLNet_Read16(f + 5);
+
+		if (offset + RELIABLE_FRAGHEADER + flen > length)
+			break;
+		if (lane >= LaneCount || count == 0 || index >= count)
+			break;
+
+		fragmentReceived(r, c, lane, SDLNet_Read16(f + 1), index, count,
+		    f + RELIABLE_FRAGHEADER, flen);
+
+		offset += RELIABLE_FRAGHEADER + flen;
+		c->needAck = 1;
+	}
+}
+
+/* --------------------------------------------------------
+ * Lua helpers
+ * -------------------------------------------------------- */
+
+static Reliable *
+reliableGet(lua_State *L, int index)
+{
+	CommonUserdata *udata = commonGetUserdata(L, index, ReliableName);
+
+	if (!udata->mustdelete)
+		luaL_error(L, "endpoint closed");
+
+	return udata->data;
+}
+
+/*
+ * Get the UDP socket kept in the user value.
+ */
+static UDPsocket
+reliableSocket(lua_State *L, int index)
+{
+	CommonUserdata *udata;
+
+#if LUA_VERSION_NUM >= 502
+	lua_getuservalue(L, index);
+#else
+	lua_getfenv(L, index);
+#endif
+	lua_getfield(L, -1, "socket");
+	udata = commonGetUserdata(L, -1, "UdpSocket");
+	lua_pop(L, 2);
+
+	if (!udata->mustdelete)
+		luaL_error(L, "socket closed");
+
+	return udata->data;
+}
+
+static void
+reliableCheckAddress(lua_State *L, int index, IPaddress *address)
+{
+	luaL_checktype(L, index, LUA_TTABLE);
+
+	address->host = tableGetInt(L, index, "host");
+	address->port = tableGetInt(L, index, "port");
+}
+
+static void
+reliablePushAddress(lua_State *L, const IPaddress *address)
+{
+	lua_createtable(L, 0, 2);
+	tableSetInt(L, -1, "host", address->host);
+	tableSetInt(L, -1, "port", address->port);
+}
+
+static void
+reliableSimulation(lua_State *L, int index, Reliable *r)
+{
+	if (tableIsType(L, index, "loss", LUA_TNUMBER))
+		r->loss = tableGetDouble(L, index, "loss");
+	if (tableIsType(L, index, "duplicate", LUA_TNUMBER))
+		r->duplicate = tableGetDouble(L, index, "duplicate");
+	if (tableIsType(L, index, "latency", LUA_TNUMBER))
+		r->latency = tableGetInt(L, index, "latency");
+	if (tableIsType(L, index, "jitter", LUA_TNUMBER))
+		r->jitter = tableGetInt(L, index, "jitter");
+	if (tableIsType(L, index, "seed", LUA_TNUMBER))
+		r->rng = tableGetInt(L, index, "seed");
+	if (r->rng == 0)
+		r->rng = 0x2545f491;
+}
+
+/* --------------------------------------------------------
+ * Reliable functions
+ * -------------------------------------------------------- */
+
+/*
+ * SDL.net.createReliable(socket, params)
+ *
+ * Params:
+ *	mtu (optional) the maximum datagram size, default 1200
+ *	timeout (optional) ms without packets before a peer is dropped
+ *	loss, duplicate (optional) simulated probabilities from 0 to 1
+ *	latency, jitter (optional) simulated delays in ms
+ *	seed (optional) for the simulation
+ *
+ * Arguments:
+ *	socket the UDP socket, it must not be read by anything else
+ *	params (optional) the parameters
+ *
+ * Returns:
+ *	The endpoint or nil
+ *	The error message
+ */
+static int
+l_reliable_create(lua_State *L)
+{
+	Reliable *r;
+	int mtu = RELIABLE_MTU;
+	Uint32 timeout = RELIABLE_TIMEOUT;
+
+	commonGetUserdata(L, 1, "UdpSocket");
+
+	if (!lua_isnoneornil(L, 2)) {
+		luaL_checktype(L, 2, LUA_TTABLE);
+
+		if (tableIsType(L, 2, "mtu", LUA_TNUMBER))
+			mtu = tableGetInt(L, 2, "mtu");
+		if (tableIsType(L, 2, "timeout", LUA_TNUMBER))
+			timeout = tableGetInt(L, 2, "timeout");
+		if (mtu < RELIABLE_MINMTU || mtu > RELIABLE_MAXMTU)
+			return luaL_argerror(L, 2, "invalid mtu");
+	}
+
+	if ((r = calloc(1, sizeof (Reliable))) == NULL)
+		return commonPushErrno(L, 1);
+
+	r->mtu = mtu;
+	r->timeout = timeout;
+
+	STAILQ_INIT(&r->connections);
+	STAILQ_INIT(&r->delivered);
+	STAILQ_INIT(&r->delayed);
+
+	if (!lua_isnoneornil(L, 2))
+		reliableSimulation(L, 2, r);
+	else
+		r->rng = 0x2545f491;
+
+	if ((r->out = malloc(mtu)) == NULL) {
+		reliableFree(r);
+		return commonPushErrno(L, 1);
+	}
+
+	if ((r->packet = SDLNet_AllocPacket(RELIABLE_MAXMTU)) == NULL) {
+		reliableFree(r);
+		return commonPushSDLError(L, 1);
+	}
+
+	commonPush(L, "p", ReliableName, r);
+
+	/* Keep the socket alive with the endpoint */
+	lua_createtable(L, 0, 1);
+	lua_pushvalue(L, 1);
+	lua_setfield(L, -2, "socket");
+#if LUA_VERSION_NUM >= 502
+	lua_setuservalue(L, -2);
+#else
+	lua_setfenv(L, -2);
+#endif
+
+	return 1;
+}
+
+const luaL_Reg ReliableFunctions[] = {
+	{ "createReliable",		l_reliable_create		},
+	{ NULL,				NULL				}
+};
+
+/* --------------------------------------------------------
+ * Reliable object
+ * -------------------------------------------------------- */
+
+/*
+ * Reliable:send(address, data, lane)
+ *
+ * Arguments:
+ *	address the peer address
+ *	data the message, split in fragments if larger than the mtu
+ *	lane (optional) see SDL.net.lane, default Ordered
+ *
+ * Returns:
+ *	True on success or nil
+ *	The error message
+ */
+static int
+l_reliable_send(lua_State *L)
+{
+	Reliable *r = reliableGet(L, 1);
+	size_t length, fragsize = reliableFragSize(r);
+	const char *data;
+	int lane, count;
+	IPaddress address;
+	OutMessage *m;
+	Connection *c;
+
+	reliableCheckAddress(L, 2, &address);
+	data = luaL_checklstring(L, 3, &length);
+	lane = luaL_optinteger(L, 4, LaneOrdered);
+
+	if (lane < 0 || lane >= LaneCount)
+		return luaL_argerror(L, 4, "invalid lane");
+
+	count = (length == 0) ? 1 : (int)((length + fragsize - 1) / fragsize);
+
+	if (count > RELIABLE_MAXFRAGS)
+		return commonPush(L, "ns", "message too large");
+	if ((c = connectionGet(r, &address)) == NULL)
+		return commonPushErrno(L, 1);
+	if ((m = calloc(1, sizeof (OutMessage))) == NULL)
+		return commonPushErrno(L, 1);
+
+	m->data = malloc(length + 1);
+	m->frags = calloc(count, sizeof (OutFragment));
+
+	if (m->data == NULL || m->frags == NULL) {
+		messageFree(m);
+		return commonPushErrno(L, 1);
+	}
+
+	memcpy(m->data, data, length);
+	m->length = length;
+	m->count = count;
+	m->id = c->nextId[lane]++;
+
+	STAILQ_INSERT_TAIL(&c->out[lane], m, link);
+
+	return commonPush(L, "b", 1);
+}
+
+/*
+ * Reliable:update()
+ *
+ * Reads the datagrams received, acknowledges them and sends what is
+ * pending. It should be called at a regular rate.
+ *
+ * Returns:
+ *	A table of the addresses that timed out, or nil
+ */
+static int
+l_reliable_update(lua_State *L)
+{
+	Reliable *r = reliableGet(L, 1);
+	UDPsocket s = reliableSocket(L, 1);
+	Uint32 now = SDL_GetTicks();
+	Connection *c, *tmp;
+	int ret, ntimeout = 0;
+
+	datagramFlushDelayed(r, s, now);
+
+	while ((ret = SDLNet_UDP_Recv(s, r->packet)) > 0)
+		packetReceived(r, r->packet, now);
+
+	if (ret < 0)
+		return commonPushSDLError(L, 1);
+
+	STAILQ_FOREACH_SAFE(c, &r->connections, link, tmp) {
+		if (now - c->lastRecv >= r->timeout) {
+			if (ntimeout++ == 0)
+				lua_createtable(L, 1, 0);
+
+			reliablePushAddress(L, &c->address);
+			lua_rawseti(L, -2, ntimeout);
+			connectionFree(r, c);
+			continue;
+		}
+
+		connectionSend(r, s, c, now);
+	}
+
+	return ntimeout > 0 ? 1 : 0;
+}
+
+/*
+ * Reliable:receive()
+ *
+ * Returns:
+ *	The message or nil if there is none
+ *	The sender address
+ *	The lane
+ */
+static int
+l_reliable_receive(lua_State *L)
+{
+	Reliable *r = reliableGet(L, 1);
+	Delivered *d;
+
+	if ((d = STAILQ_FIRST(&r->delivered)) == NULL)
+		return commonPush(L, "n");
+
+	STAILQ_REMOVE_HEAD(&r->delivered, link);
+
+	lua_pushlstring(L, d->data, d->length);
+	reliablePushAddress(L, &d->address);
+	lua_pushinteger(L, d->lane);
+
+	free(d->data);
+	free(d);
+
+	return 3;
+}
+
+/*
+ * Reliable:stats(address)
+ *
+ * Arguments:
+ *	address the peer address
+ *
+ * Returns:
+ *	A table { rtt, rto, sent, received, resent, duplicates, pending } or
+ *	nil if the peer is unknown
+ */
+static int
+l_reliable_stats(lua_State *L)
+{
+	Reliable *r = reliableGet(L, 1);
+	IPaddress address;
+	OutMessage *m;
+	Connection *c;
+	int lane, pending = 0;
+
+	reliableCheckAddress(L, 2, &address);
+
+	if ((c = connectionFind(r, &address)) == NULL)
+		return commonPush(L, "n");
+
+	for (lane = LaneReliable; lane < LaneCount; ++lane)
+		STAILQ_FOREACH(m, &c->out[lane], link)
+			++ pending;
+
+	lua_createtable(L, 0, 7);
+
+	lua_pushnumber(L, c->srtt);
+	lua_setfield(L, -2, "rtt");
+	tableSetInt(L, -1, "rto", connectionRto(c));
+	tableSetInt(L, -1, "sent", c->packetsSent);
+	tableSetInt(L, -1, "received", c->packetsReceived);
+	tableSetInt(L, -1, "resent", c->resent);
+	tableSetInt(L, -1, "duplicates", c->duplicates);
+	tableSetInt(L, -1, "pending", pending);
+
+	return 1;
+}
+
+/*
+ * Reliable:setSimulation(params)
+ *
+ * Arguments:
+ *	params a table { loss, duplicate, latency, jitter, seed }
+ */
+static int
+l_reliable_setSimulation(lua_State *L)
+{
+	Reliable *r = reliableGet(L, 1);
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+	reliableSimulation(L, 2, r);
+
+	return 0;
+}
+
+/*
+ * Reliable:disconnect(address)
+ *
+ * Forget the peer, its pending messages are discarded.
+ *
+ * Arguments:
+ *	address the peer address
+ */
+static int
+l_reliable_disconnect(lua_State *L)
+{
+	Reliable *r = reliableGet(L, 1);
+	IPaddress address;
+	Connection *c;
+
+	reliableCheckAddress(L, 2, &address);
+
+	if ((c = connectionFind(r, &address)) != NULL)
+		connectionFree(r, c);
+
+	return 0;
+}
+
+/*
+ * Reliable:close()
+ */
+static int
+l_reliable_close(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, ReliableName);
+
+	if (udata->mustdelete) {
+		reliableFree(udata->data);
+		udata->mustdelete = 0;
+	}
+
+	return 0;
+}
+
+static const luaL_Reg methods[] = {
+	{ "send",			l_reliable_send			},
+	{ "update",			l_reliable_update		},
+	{ "receive",			l_reliable_receive		},
+	{ "stats",			l_reliable_stats		},
+	{ "setSimulation",		l_reliable_setSimulation	},
+	{ "disconnect",			l_reliable_disconnect		},
+	{ "close",			l_reliable_close		},
+	{ NULL,				NULL				}
+};
+
+static const luaL_Reg metamethods[] = {
+	{ "__gc",			l_reliable_close		},
+	{ NULL,				NULL				}
+};
+
+const CommonObject ReliableObject = {
+	"Reliable",
+	methods,
+	metamethods
+};
+
+/*
+ * SDL.net.lane
+ */
+const CommonEnum ReliableLane[] = {
+	{ "Unreliable",			LaneUnreliable			},
+	{ "Reliable",			LaneReliable			},
+	{ "Ordered",			LaneOrdered			},
+	{ NULL,				-1				}
+};
@@ -0,0 +1,488 @@
+/*
+ * resolve.c -- asynchronous host resolution
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/table.h>
+#include <common/worker.h>
+
+#include "resolve.h"
+
+/*
+ * SDLNet_ResolveHost uses gethostbyname which is not reentrant, a single
+ * thread runs the lookups so the main thread never waits for them.
+ */
+#define RESOLVE_POOL		"__SDL_net_resolver"
+#define RESOLVE_THREADS		1
+
+#define RESOLVE_NAMELEN		256
+#define RESOLVE_ERRLEN		128
+
+#define RESOLVE_CACHE		64	/* cached names */
+#define RESOLVE_TTL		60000	/* default time to live in ms */
+
+enum status {
+	StatusPending,
+	StatusDone,
+	StatusFailed
+};
+
+typedef struct cache_entry {
+	char		 name[RESOLVE_NAMELEN];
+	Uint32		 host;			/* network byte order */
+	Uint32		 expires;
+} CacheEntry;
+
+/*
+ * The cache is shared by every state of the process, the critical sections
+ * are a few string compares so a spin lock is enough.
+ */
+static CacheEntry	 cache[RESOLVE_CACHE];
+static Uint32		 cacheTtl = RESOLVE_TTL;
+static SDL_SpinLock	 cacheLock;
+
+typedef struct resolution {
+	SDL_mutex	*mutex;
+	SDL_cond	*cond;
+	SDL_atomic_t	 ref;			/* the handle and the job */
+
+	char		 name[RESOLVE_NAMELEN];
+	Uint16		 port;
+	Uint32		 event;			/* pushed when done, 0 for none */
+
+	/* Protected by mutex */
+	enum status	 status;
+	IPaddress	 address;
+	char		 error[RESOLVE_ERRLEN];
+} Resolution;
+
+/* --------------------------------------------------------
+ * Cache
+ * -------------------------------------------------------- */
+
+static int
+cacheFind(const char *name, Uint32 *host)
+{
+	Uint32 now = SDL_GetTicks();
+	int i, found = 0;
+
+	SDL_AtomicLock(&cacheLock);
+
+	for (i = 0; i < RESOLVE_CACHE && !found; ++i) {
+		if (cache[i].name[0] == '\0' || strcmp(cache[i].name, name) != 0)
+			continue;
+
+		if (SDL_TICKS_PASSED(now, cache[i].expires))
+			cache[i].name[0] = '\0';
+		else {
+			*host = cache[i].host;
+			found = 1;
+		}
+	}
+
+	SDL_AtomicUnlock(&cacheLock);
+
+	return found;
+}
+
+static void
+cacheStore(const char *name, Uint32 host)
+{
+	Uint32 now = SDL_GetTicks();
+	CacheEntry *slot = NULL, *oldest = NULL;
+	int i;
+
+	if (strlen(name) >= RESOLVE_NAMELEN)
+		return;
+
+	SDL_AtomicLock(&cacheLock);
+
+	if (cacheTtl == 0)
+		goto out;
+
+	/* Same name, then a free or expired slot, then the oldest */
+	for (i = 0; i < RESOLVE_CACHE; ++i) {
+		if (strcmp(cache[i].name, name) == 0) {
+			slot = &cache[i];
+			break;
+		}
+
+		if (cache[i].name[0] == '\0' || SDL_TICKS_PASSED(now, cache[i].expires)) {
+			if (slot == NULL)
+				slot = &cache[i];
+		} else if (oldest == NULL || SDL_TICKS_PASSED(oldest->expires, cache[i].expires))
+			oldest = &cache[i];
+	}
+
+	if (slot == NULL)
+		slot = oldest;
+
+	strcpy(slot->name, name);
+	slot->host = host;
+	slot->expires = now + cacheTtl;
+
+out:
+	SDL_AtomicUnlock(&cacheLock);
+}
+
+static SDL_mutex *
+resolverMutex(void)
+{
+	static SDL_SpinLock lock;
+	static SDL_mutex *mutex;
+
+	SDL_AtomicLock(&lock);
+	if (mutex == NULL)
+		mutex = SDL_CreateMutex();
+	SDL_AtomicUnlock(&lock);
+
+	return mutex;
+}
+
+int
+resolveHost(IPaddress *address, const char *name, Uint16 port)
+{
+	SDL_mutex *mutex = resolverMutex();
+	Uint32 host;
+	int ret;
+
+	if (name != NULL && cacheFind(name, &host)) {
+		address->host = host;
+		SDLNet_Write16(port, &address->port);
+
+		return 0;
+	}
+
+	SDL_LockMutex(mutex);
+	ret = SDLNet_ResolveHost(address, name, port);
+	SDL_UnlockMutex(mutex);
+
+	if (ret == 0 && name != NULL && address->host != INADDR_NONE)
+		cacheStore(name, address->host);
+
+	return ret;
+}
+
+int
+resolveIp(const IPaddress *address, char *name, size_t size)
+{
+	SDL_mutex *mutex = resolverMutex();
+	const char *host;
+	int ret = 0;
+
+	/* The result points to the resolver storage, copy it while locked */
+	SDL_LockMutex(mutex);
+	if ((host = SDLNet_ResolveIP(address)) == NULL)
+		ret = -1;
+	else
+		SDL_strlcpy(name, host, size);
+	SDL_UnlockMutex(mutex);
+
+	return ret;
+}
+
+/* --------------------------------------------------------
+ * Background lookups
+ * -------------------------------------------------------- */
+
+static void
+resolutionRelease(Resolution *r)
+{
+	if (!SDL_AtomicDecRef(&r->ref))
+		return;
+
+	if (r->cond)
+		SDL_DestroyCond(r->cond);
+	if (r->mutex)
+		SDL_DestroyMutex(r->mutex);
+
+	free(r);
+}
+
+static void
+resolutionFinish(Resolution *r, enum status status, const IPaddress *address)
+{
+	SDL_LockMutex(r->mutex);
+	r->status = status;
+
+	if (status == StatusDone)
+		r->address = *address;
+	else
+		SDL_strlcpy(r->error, SDL_GetError(), sizeof (r->error));
+
+	SDL_UnlockMutex(r->mutex);
+	SDL_CondBroadcast(r->cond);
+}
+
+static void
+resolutionRun(Resolution *r)
+{
+	IPaddress address;
+	Uint32 event = r->event;
+
+	if (resolveHost(&address, r->name, r->port) < 0)
+		resolutionFinish(r, StatusFailed, NULL);
+	else
+		resolutionFinish(r, StatusDone, &address);
+
+	resolutionRelease(r);
+
+	if (event != 0) {
+		SDL_Event ev;
+
+		SDL_zero(ev);
+		ev.type = event;
+		ev.user.timestamp = SDL_GetTicks();
+		SDL_PushEvent(&ev);
+	}
+}
+
+static int
+resolutionPush(lua_State *L, Resolution *r)
+{
+	enum status status;
+	IPaddress address;
+	char error[RESOLVE_ERRLEN];
+
+	SDL_LockMutex(r->mutex);
+	status = r->status;
+	address = r->address;
+	memcpy(error, r->error, sizeof (error));
+	SDL_UnlockMutex(r->mutex);
+
+	if (status == StatusPending)
+		return commonPush(L, "ns", "resolution pending");
+	if (status == StatusFailed)
+		return commonPush(L, "ns", error);
+
+	lua_createtable(L, 0, 2);
+	tableSetInt(L, -1, "host", address.host);
+	tableSetInt(L, -1, "port", address.port);
+
+	return 1;
+}
+
+/* --------------------------------------------------------
+ * Resolve functions
+ * -------------------------------------------------------- */
+
+/*
+ * SDL.net.resolveHostAsync(name, port, event)
+ *
+ * Cached names complete immediately, otherwise the lookup runs in a
+ * background thread.
+ *
+ * Arguments:
+ *	name the host name
+ *	port the port
+ *	event (optional) a type from SDL.registerEvents pushed when done
+ *
+ * Returns:
+ *	The resolution or nil
+ *	The error message
+ */
+static int
+l_resolve_hostAsync(lua_State *L)
+{
+	size_t length;
+	const char *name = luaL_checklstring(L, 1, &length);
+	int port = luaL_checkinteger(L, 2);
+	Uint32 event = luaL_optinteger(L, 3, 0);
+	Uint32 host;
+	WorkerPool *pool;
+	Resolution *r;
+
+	if (length >= RESOLVE_NAMELEN)
+		return luaL_argerror(L, 1, "name too long");
+	if ((r = calloc(1, sizeof (Resolution))) == NULL)
+		return commonPushErrno(L, 1);
+
+	memcpy(r->name, name, length + 1);
+	r->port = port;
+	r->event = event;
+	SDL_AtomicSet(&r->ref, 1);
+
+	if ((r->mutex = SDL_CreateMutex()) == NULL ||
+	    (r->cond = SDL_CreateCond()) == NULL)
+		goto fail;
+
+	if (cacheFind(name, &host)) {
+		r->status = StatusDone;
+		r->address.host = host;
+		SDLNet_Write16(r->port, &r->address.port);
+
+		return commonPush(L, "p", ResolutionName, r);
+	}
+
+	if ((pool = workerShared(L, RESOLVE_POOL, RESOLVE_THREADS)) == NULL)
+		goto fail;
+
+	SDL_AtomicIncRef(&r->ref);
+
+	if (workerPush(pool, (WorkerFunc)resolutionRun, r) < 0) {
+		SDL_AtomicSet(&r->ref, 1);
+		goto fail;
+	}
+
+	return commonPush(L, "p", ResolutionName, r);
+
+fail:
+	commonPushSDLError(L, 1);
+	resolutionRelease(r);
+
+	return 2;
+}
+
+/*
+ * SDL.net.setResolveCache(ttl)
+ *
+ * Set how long resolved names are remembered, by resolveHost too. The
+ * current entries are dropped.
+ *
+ * Arguments:
+ *	ttl the time to live in ms, 0 disables the cache
+ */
+static int
+l_resolve_setCache(lua_State *L)
+{
+	lua_Integer ttl = luaL_checkinteger(L, 1);
+
+	if (ttl < 0)
+		return luaL_argerror(L, 1, "must be positive");
+
+	SDL_AtomicLock(&cacheLock);
+	cacheTtl = ttl;
+	memset(cache, 0, sizeof (cache));
+	SDL_AtomicUnlock(&cacheLock);
+
+	return 0;
+}
+
+const luaL_Reg ResolveFunctions[] = {
+	{ "resolveHostAsync",		l_resolve_hostAsync		},
+	{ "setResolveCache",		l_resolve_setCache		},
+	{ NULL,				NULL				}
+};
+
+/* --------------------------------------------------------
+ * Resolution object
+ * -------------------------------------------------------- */
+
+/*
+ * Resolution:isDone()
+ *
+ * Returns:
+ *	True if the lookup has finished, successfully or not
+ */
+static int
+l_resolution_isDone(lua_State *L)
+{
+	Resolution *r = commonGetAs(L, 1, ResolutionName, Resolution *);
+	int done;
+
+	SDL_LockMutex(r->mutex);
+	done = r->status != StatusPending;
+	SDL_UnlockMutex(r->mutex);
+
+	return commonPush(L, "b", done);
+}
+
+/*
+ * Resolution:get()
+ *
+ * Returns:
+ *	The address table or nil
+ *	The error message, "resolution pending" if not done
+ */
+static int
+l_resolution_get(lua_State *L)
+{
+	return resolutionPush(L, commonGetAs(L, 1, ResolutionName, Resolution *));
+}
+
+/*
+ * Resolution:wait(timeout)
+ *
+ * Arguments:
+ *	timeout (optional) the maximum time in ms, default forever
+ *
+ * Returns:
+ *	Like Resolution:get()
+ */
+static int
+l_resolution_wait(lua_State *L)
+{
+	Resolution *r = commonGetAs(L, 1, ResolutionName, Resolution *);
+	lua_Integer timeout = luaL_optinteger(L, 2, -1);
+	Uint32 deadline = SDL_GetTicks() + (Uint32)timeout;
+	Uint32 now;
+
+	SDL_LockMutex(r->mutex);
+
+	while (r->status == StatusPending) {
+		if (timeout < 0) {
+			SDL_CondWait(r->cond, r->mutex);
+			continue;
+		}
+
+		if (SDL_TICKS_PASSED(now = SDL_GetTicks(), deadline))
+			break;
+
+		SDL_CondWaitTimeout(r->cond, r->mutex, deadline - now);
+	}
+
+	SDL_UnlockMutex(r->mutex);
+
+	return resolutionPush(L, r);
+}
+
+/*
+ * Resolution:__gc()
+ */
+static int
+l_resolution_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, ResolutionName);
+
+	/* A running lookup keeps its own reference */
+	if (udata->mustdelete) {
+		resolutionRelease(udata->data);
+		udata->mustdelete = 0;
+	}
+
+	return 0;
+}
+
+static const luaL_Reg methods[] = {
+	{ "isDone",			l_resolution_isDone		},
+	{ "get",			l_resolution_get		},
+	{ "wait",			l_resolution_wait		},
+	{ NULL,				NULL				}
+};
+
+static const luaL_Reg metamethods[] = {
+	{ "__gc",			l_resolution_gc			},
+	{ NULL,				NULL				}
+};
+
+const CommonObject ResolutionObject = {
+	"Resolution",
+	methods,
+	metamethods
+};
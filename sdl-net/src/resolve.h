@@ -0,0 +1,56 @@
+/*
+ * resolve.h -- asynchronous host resolution
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _RESOLVE_H_
+#define _RESOLVE_H_
+
+#include <SDL_net.h>
+
+#include <common/common.h>
+
+#define ResolutionName	ResolutionObject.name
+
+extern const CommonObject ResolutionObject;
+
+extern const luaL_Reg ResolveFunctions[];
+
+/**
+ * Resolve a host like SDLNet_ResolveHost, using the cache first. The
+ * resolver is not reentrant so calls are serialized.
+ *
+ * @param address the result
+ * @param name the host name or NULL for INADDR_ANY
+ * @param port the port in host byte order
+ * @return 0 on success or -1 with the SDL error set
+ */
+int
+resolveHost(IPaddress *address, const char *name, Uint16 port);
+
+/**
+ * Reverse lookup like SDLNet_ResolveIP, serialized with resolveHost as
+ * both share the resolver static storage.
+ *
+ * @param address the address
+ * @param name the result
+ * @param size the size of name
+ * @return 0 on success or -1 with the SDL error set
+ */
+int
+resolveIp(const IPaddress *address, char *name, size_t size);
+
+#endif /* !_RESOLVE_H_ */
@@ -23,12 +23,15 @@
 
 #include <config.h>
 
+#include <common/buffer.h>
+#include <common/pack.h>
 #include <common/rwops.h>
 #include <common/surface.h>
 #include <common/video.h>
 #include <common/table.h>
 
 #include "audio.h"
+#include "capture.h"
 #include "channel.h"
 #include "clipboard.h"
 #include "cpu.h"
@@ -329,6 +332,8 @@ static const struct {
 	{ PlatformFunctions				},
 	{ PowerFunctions				},
 	{ RWOpsFunctions				},
+	{ PackFunctions					},
+	{ BufferFunctions				},
 
 	/* Thread and mutexes */
 	{ ThreadFunctions				},
@@ -345,6 +350,7 @@ static const struct {
 	{ HapticFunctions				},
 
 	/* Video */
+	{ CaptureFunctions				},
 	{ ClipboardFunctions				},
 	{ DisplayFunctions				},
 	{ RectangleFunctions				},
@@ -425,6 +431,7 @@ static const struct {
 	/* Video */
 	{ "pixelFormat",	PixelFormat			},
 	{ "blendMode",		BlendMode			},
+	{ "resizeFilter",	ResizeFilter			},
 
 	/* Renderer */
 	{ "rendererFlags",	RendererFlags			},
@@ -453,9 +460,13 @@ static const struct {
 	{ &Joystick						},
 	{ &Renderer						},
 	{ &Surface						},
+	{ &PixelView						},
+	{ &SurfacePool						},
+	{ &FrameCapture						},
 	{ &Texture						},
 	{ &Window						},
 	{ &RWOps						},
+	{ &BufferObject					},
 	{ &Thread						},
 	{ &ChannelObject					},
 	{ &AudioObject						},
@@ -0,0 +1,472 @@
+/*
+ * capture.c -- frame capture to QOI files in background threads
+ *
+ * Copyright (c) 2026 LuaSDL2 contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/pixels.h>
+#include <common/qoi.h>
+#include <common/surface.h>
+#include <common/table.h>
+#include <common/worker.h>
+
+#include "capture.h"
+#include "renderer.h"
+
+/*
+ * Encoding is CPU bound, the pool has one thread per CPU.
+ */
+#define CAPTURE_POOL		"__SDL_capture_workers"
+#define CAPTURE_PENDING		4
+#define CAPTURE_ERRLEN		128
+
+typedef struct capture {
+	SDL_mutex	*mutex;
+	SDL_cond	*cond;
+	SDL_atomic_t	 ref;			/* the handle and the frames */
+
+	char		*pattern;
+	int		 next;			/* index of the next frame */
+	int		 maxpending;
+	Uint32		 frames;		/* accepted */
+	Uint32		 dropped;
+
+	/* Protected by mutex */
+	int		 pending;
+	Uint32		 written;
+	Uint32		 failed;
+	char		 error[CAPTURE_ERRLEN];
+} Capture;
+
+/*
+ * A copy of the pixels, the source can change as soon as push returns.
+ */
+typedef struct frame {
+	Capture		*capture;
+	char		*path;
+	Uint32		*pixels;		/* w * 4 bytes per row */
+	int		 w;
+	int		 h;
+	PixelLayout	 layout;
+} Frame;
+
+/* --------------------------------------------------------
+ * Background encoding
+ * -------------------------------------------------------- */
+
+static void
+captureRelease(Capture *c)
+{
+	if (!SDL_AtomicDecRef(&c->ref))
+		return;
+
+	if (c->cond)
+		SDL_DestroyCond(c->cond);
+	if (c->mutex)
+		SDL_DestroyMutex(c->mutex);
+
+	free(c->pattern);
+	free(c);
+}
+
+static void
+frameFree(Frame *f)
+{
+	free(f->path);
+	free(f->pixels);
+	free(f);
+}
+
+static void
+frameRun(Frame *f)
+{
+	Capture *c = f->capture;
+	SDL_RWops *ops;
+	Uint8 *data;
+	size_t length;
+	int ok = 0;
+
+	data = qoiEncode(f->pixels, f->w, f->h, f->w * 4, &f->layout, &length);
+
+	if (data != NULL && (ops = SDL_RWFromFile(f->path, "wb")) != NULL) {
+		ok = SDL_RWwrite(ops, data, 1, length) == length;
+
+		if (SDL_RWclose(ops) < 0)
+			ok = 0;
+	}
+
+	free(data);
+
+	SDL_LockMutex(c->mutex);
+	c->pending --;
+
+	if (ok)
+		c->written ++;
+	else {
+		c->failed ++;
+		SDL_snprintf(c->error, sizeof (c->error), "%s: %s", f->path, SDL_GetError());
+	}
+
+	SDL_CondBroadcast(c->cond);
+	SDL_UnlockMutex(c->mutex);
+
+	frameFree(f);
+	captureRelease(c);
+}
+
+/*
+ * Copy a surface, 32-bit formats with 8-bit channels are copied as is and
+ * the others converted to ARGB8888.
+ */
+static int
+frameFromSurface(Frame *f, SDL_Surface *surf)
+{
+	const Uint8 *row;
+	int y, ret = 0;
+
+	f->w = surf->w;
+	f->h = surf->h;
+
+	if ((f->pixels = malloc((size_t)f->w * f->h * 4)) == NULL)
+		return SDL_OutOfMemory();
+	if (SDL_LockSurface(surf) < 0)
+		return -1;
+
+	if (pixelsLayout(surf->format, &f->layout) == 0) {
+		for (y = 0; y < f->h; ++y) {
+			row = (const Uint8 *)surf->pixels + (size_t)y * surf->pitch;
+			memcpy(f->pixels + (size_t)y * f->w, row, (size_t)f->w * 4);
+		}
+	} else {
+		ret = SDL_ConvertPixels(f->w, f->h, surf->format->format,
+		    surf->pixels, surf->pitch, SDL_PIXELFORMAT_ARGB8888,
+		    f->pixels, f->w * 4);
+
+		f->layout.r = 16;
+		f->layout.g = 8;
+		f->layout.b = 0;
+		f->layout.a = 24;
+		f->layout.hasalpha = surf->format->Amask != 0;
+	}
+
+	SDL_UnlockSurface(surf);
+
+	return ret;
+}
+
+/*
+ * Read the current rendering target, without alpha. The buffer is sized from
+ * the target itself, which may be a texture larger than the window, and the
+ * same rectangle is given to SDL so it never writes past it.
+ */
+static int
+frameFromRenderer(Frame *f, SDL_Renderer *rd)
+{
+	SDL_Texture *target;
+	SDL_Rect rect;
+
+	if ((target = SDL_GetRenderTarget(rd)) != NULL) {
+		if (SDL_QueryTexture(target, NULL, NULL, &f->w, &f->h) < 0)
+			return -1;
+	} else if (SDL_GetRendererOutputSize(rd, &f->w, &f->h) < 0)
+		return -1;
+
+	if (f->w <= 0 || f->h <= 0)
+		return SDL_SetError("empty rendering target");
+
+	/* Pixels outside the viewport are not read, keep them black */
+	if ((f->pixels = calloc((size_t)f->w * f->h, 4)) == NULL)
+		return SDL_OutOfMemory();
+
+	f->layout.r = 16;
+	f->layout.g = 8;
+	f->layout.b = 0;
+	f->layout.a = 24;
+	f->layout.hasalpha = 0;
+
+	rect.x = 0;
+	rect.y = 0;
+	rect.w = f->w;
+	rect.h = f->h;
+
+	return SDL_RenderReadPixels(rd, &rect, SDL_PIXELFORMAT_ARGB8888,
+	    f->pixels, f->w * 4);
+}
+
+/*
+ * The pattern is given to SDL_snprintf so it must have exactly one integer
+ * conversion like %d or %05d, %% is allowed.
+ */
+static int
+capturePatternValid(const char *pattern)
+{
+	const char *p;
+	int count = 0;
+
+	for (p = pattern; *p != '\0'; ++p) {
+		if (*p != '%')
+			continue;
+		if (*++p == '%')
+			continue;
+
+		while (*p >= '0' && *p <= '9')
+			++p;
+
+		if (*p != 'd')
+			return 0;
+
+		++ count;
+	}
+
+	return count == 1;
+}
+
+static int
+capturePushStats(lua_State *L, Capture *c)
+{
+	lua_createtable(L, 0, 6);
+	tableSetInt(L, -1, "frames", c->frames);
+	tableSetInt(L, -1, "dropped", c->dropped);
+
+	SDL_LockMutex(c->mutex);
+	tableSetInt(L, -1, "pending", c->pending);
+	tableSetInt(L, -1, "written", c->written);
+	tableSetInt(L, -1, "failed", c->failed);
+
+	if (c->failed > 0)
+		tableSetString(L, -1, "error", c->error);
+
+	SDL_UnlockMutex(c->mutex);
+
+	return 1;
+}
+
+/* --------------------------------------------------------
+ * Capture functions
+ * -------------------------------------------------------- */
+
+/*
+ * SDL.createFrameCapture(pattern, options)
+ *
+ * Write frames to numbered QOI files, encoded in background threads so the
+ * frame loop only pays for a copy of the pixels. Options are:
+ *
+ *	first the number of the first frame, default 0
+ *	maxPending the frames being encoded before new ones are dropped,
+ *	default 4
+ *
+ * Arguments:
+ *	pattern the file names with one integer conversion, e.g. "shot%05d.qoi"
+ *	options (optional) the options table
+ *
+ * Returns:
+ *	The capture or nil
+ *	The error message
+ */
+static int
+l_capture_create(lua_State *L)
+{
+	const char *pattern = luaL_checkstring(L, 1);
+	Capture *c;
+
+	luaL_argcheck(L, capturePatternValid(pattern), 1, "pattern needs one %d conversion");
+
+	if ((c = calloc(1, sizeof (Capture))) == NULL)
+		return commonPushErrno(L, 1);
+
+	SDL_AtomicSet(&c->ref, 1);
+	c->maxpending = CAPTURE_PENDING;
+
+	if (lua_type(L, 2) == LUA_TTABLE) {
+		c->next = tableGetInt(L, 2, "first");
+
+		if (tableIsType(L, 2, "maxPending", LUA_TNUMBER))
+			c->maxpending = tableGetInt(L, 2, "maxPending");
+		if (c->maxpending < 1)
+			c->maxpending = 1;
+	}
+
+	if ((c->pattern = malloc(strlen(pattern) + 1)) == NULL) {
+		captureRelease(c);
+		return commonPushErrno(L, 1);
+	}
+
+	strcpy(c->pattern, pattern);
+
+	if ((c->mutex = SDL_CreateMutex()) == NULL || (c->cond = SDL_CreateCond()) == NULL) {
+		commonPushSDLError(L, 1);
+		captureRelease(c);
+		return 2;
+	}
+
+	return commonPush(L, "p", FrameCaptureName, c);
+}
+
+const luaL_Reg CaptureFunctions[] = {
+	{ "createFrameCapture",		l_capture_create		},
+	{ NULL,				NULL				}
+};
+
+/* --------------------------------------------------------
+ * FrameCapture object
+ * -------------------------------------------------------- */
+
+/*
+ * FrameCapture:push(source)
+ *
+ * Copy the pixels of a surface or of the current target of a renderer and
+ * queue the frame. The frame is dropped when too many are pending, it
+ * never blocks on encoding.
+ *
+ * Arguments:
+ *	source the surface or renderer
+ *
+ * Returns:
+ *	The frame number or nil
+ *	The error message
+ */
+static int
+l_capture_push(lua_State *L)
+{
+	Capture *c = commonGetAs(L, 1, FrameCaptureName, Capture *);
+	WorkerPool *pool;
+	Frame *f;
+	size_t length;
+	int pending, ret;
+
+	SDL_LockMutex(c->mutex);
+	pending = c->pending;
+	SDL_UnlockMutex(c->mutex);
+
+	if (pending >= c->maxpending) {
+		c->dropped ++;
+		return commonPush(L, "ns", "too many pending frames");
+	}
+
+	if ((pool = workerShared(L, CAPTURE_POOL, 0)) == NULL)
+		return commonPushSDLError(L, 1);
+	if ((f = calloc(1, sizeof (Frame))) == NULL)
+		return commonPushErrno(L, 1);
+
+	if (luaL_testudata(L, 2, RendererName) != NULL)
+		ret = frameFromRenderer(f, commonGetAs(L, 2, RendererName, SDL_Renderer *));
+	else
+		ret = frameFromSurface(f, commonGetAs(L, 2, SurfaceName, SDL_Surface *));
+
+	length = strlen(c->pattern) + 32;
+
+	if (ret == 0 && (f->path = malloc(length)) == NULL)
+		ret = SDL_OutOfMemory();
+	if (ret < 0) {
+		frameFree(f);
+		return commonPushSDLError(L, 1);
+	}
+
+	SDL_snprintf(f->path, length, c->pattern, c->next);
+	f->capture = c;
+
+	SDL_LockMutex(c->mutex);
+	c->pending ++;
+	SDL_UnlockMutex(c->mutex);
+	SDL_AtomicIncRef(&c->ref);
+
+	if (workerPush(pool, (WorkerFunc)frameRun, f) < 0) {
+		SDL_LockMutex(c->mutex);
+		c->pending --;
+		SDL_UnlockMutex(c->mutex);
+		captureRelease(c);
+		frameFree(f);
+
+		return commonPushSDLError(L, 1);
+	}
+
+	c->frames ++;
+
+	return commonPush(L, "i", c->next ++);
+}
+
+/*
+ * FrameCapture:wait()
+ *
+ * Block until every pending frame is written.
+ *
+ * Returns:
+ *	Like FrameCapture:getStats()
+ */
+static int
+l_capture_wait(lua_State *L)
+{
+	Capture *c = commonGetAs(L, 1, FrameCaptureName, Capture *);
+
+	SDL_LockMutex(c->mutex);
+
+	while (c->pending > 0)
+		SDL_CondWait(c->cond, c->mutex);
+
+	SDL_UnlockMutex(c->mutex);
+
+	return capturePushStats(L, c);
+}
+
+/*
+ * FrameCapture:getStats()
+ *
+ * Returns:
+ *	A table with frames, dropped, pending, written, failed and error, the
+ *	last error message if any
+ */
+static int
+l_capture_getStats(lua_State *L)
+{
+	return capturePushStats(L, commonGetAs(L, 1, FrameCaptureName, Capture *));
+}
+
+/*
+ * FrameCapture:__gc()
+ */
+static int
+l_capture_gc(lua_State *L)
+{
+	CommonUserdata *udata = commonGetUserdata(L, 1, FrameCaptureName);
+
+	/* Pending frames keep their own reference and are still written */
+	if (udata->mustdelete) {
+		captureRelease(udata->data);
+		udata->mustdelete = 0;
+	}
+
+	return 0;
+}
+
+static const luaL_Reg methods[] = {
+	{ "push",			l_capture_push			},
+	{ "wait",			l_capture_wait			},
+	{ "getStats",			l_capture_getStats		},
+	{ NULL,				NULL				}
+};
+
+static const luaL_Reg metamethods[] = {
+	{ "__gc",			l_capture_gc			},
+	{ NULL,				NULL				}
+};
+
+const CommonObject FrameCapture = {
+	"FrameCapture",
+	methods,
+	metamethods
+};